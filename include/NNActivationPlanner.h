@@ -0,0 +1,59 @@
+#pragma once
+
+#include "NNAllocator.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Static memory plan for the per-batch buffers of a network (activations, dz, scratch). Each
+// buffer is registered with its size per sample and the schedule steps it is live on; plan()
+// then packs them into one workspace so that buffers with disjoint lifetimes share memory.
+// Offsets are expressed per sample, so a single plan serves every batch size: buffer data for
+// a batch of B starts at offset * stride(B) floats, with stride(B) = B rounded up to a cache
+// line.
+class NNActivationPlanner {
+  public:
+    static constexpr size_t ALIGNMENT = NNAllocator::ALIGNMENT;
+
+    NNActivationPlanner() = default;
+    NNActivationPlanner(const NNActivationPlanner&) = delete;
+    NNActivationPlanner& operator=(const NNActivationPlanner&) = delete;
+    NNActivationPlanner(NNActivationPlanner&&) = default;
+    NNActivationPlanner& operator=(NNActivationPlanner&&) = default;
+
+    // Drops all buffers (and the plan) so the schedule can be described again.
+    void clear();
+    // Registers a buffer of rows floats per sample that is live on steps [firstStep, lastStep]
+    // and returns its id.
+    int add(int rows, int firstStep, int lastStep);
+    // Assigns offsets, largest buffers first, each at the lowest offset not used by any buffer
+    // whose lifetime overlaps.
+    void plan();
+    bool isPlanned() const { return planned_; }
+    // Grows the workspace to hold batch samples, existing contents are not preserved.
+    void reserve(int batch);
+    // Start of buffer id for a batch of batch samples, after reserve(batch).
+    float* data(int id, int batch);
+
+    static size_t stride(int batch);
+    // Workspace bytes needed for a batch, i.e. the peak of simultaneously live buffers after
+    // reuse, and the bytes the same buffers would take without any reuse.
+    size_t peakBytes(int batch) const { return peakRows_ * stride(batch) * sizeof(float); }
+    size_t unplannedBytes(int batch) const { return totalRows_ * stride(batch) * sizeof(float); }
+
+  private:
+    struct Buffer {
+        size_t rows = 0;
+        int firstStep = 0;
+        int lastStep = 0;
+        size_t offset = 0;
+    };
+
+    std::vector<Buffer> buffers_;
+    NNAllocator::Buffer workspace_;
+    size_t peakRows_ = 0;
+    size_t totalRows_ = 0;
+    size_t workspaceSize_ = 0;
+    bool planned_ = false;
+};
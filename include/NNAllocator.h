@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Float buffers for matrices, parameter arenas, activation workspaces and datasets. Every buffer
+// is 64-byte aligned, so rows handed to SIMD loops start on a cache line. Buffers of at least
+// hugeThreshold bytes are mapped on their own and 2 MB aligned, then either backed by explicit
+// huge pages (MAP_HUGETLB, which needs pages reserved in /proc/sys/vm/nr_hugepages) or advised
+// to transparent huge pages (MADV_HUGEPAGE). Explicit pages fall back to transparent ones when
+// none are free. Without Linux every buffer is a plain aligned allocation.
+class NNAllocator {
+  private:
+    static const std::string TAG;
+
+  public:
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t HUGE_PAGE = 2 << 20;
+
+    enum class HugePages { Off, Transparent, Explicit };
+    struct Policy {
+        HugePages hugePages = HugePages::Transparent;
+        // Smaller buffers use the heap. Never below HUGE_PAGE.
+        size_t hugeThreshold = HUGE_PAGE;
+    };
+    // Applies to later allocations; existing buffers keep their backing.
+    static void setPolicy(const Policy& policy);
+    static Policy getPolicy();
+
+    // count floats, uninitialized. Never returns nullptr, a count of 0 still gets a buffer.
+    static float* allocate(size_t count);
+    // count must be the count passed to allocate.
+    static void deallocate(float* ptr, size_t count);
+
+    struct Deleter {
+        size_t count = 0;
+        void operator()(float* ptr) const { deallocate(ptr, count); }
+    };
+    using Buffer = std::unique_ptr<float[], Deleter>;
+    // count zeroed floats.
+    static Buffer allocateBuffer(size_t count);
+    // Same, shared, e.g. one block holding every sample of a dataset.
+    static std::shared_ptr<float> allocateShared(size_t count);
+
+    struct Stats {
+        // Bytes of every live buffer.
+        size_t liveBytes = 0;
+        // Of those, bytes in buffers mapped on their own (at or above the threshold).
+        size_t mappedBytes = 0;
+        // Mapped bytes on explicit huge pages, and mapped bytes advised to transparent ones.
+        size_t explicitHugeBytes = 0;
+        size_t advisedBytes = 0;
+        // Mapped bytes actually resident on huge pages: explicit pages plus the AnonHugePages
+        // of the advised mappings in /proc/self/smaps.
+        size_t hugeBackedBytes = 0;
+    };
+    static Stats getStats();
+    static void logStats();
+};
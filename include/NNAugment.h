@@ -0,0 +1,64 @@
+#pragma once
+
+#include "NNMatrix.h"
+#include "NNRandom.h"
+
+#include <cstdint>
+#include <vector>
+
+// Random augmentation of small grayscale images (28x28 MNIST digits by default): an affine
+// shift/rotation/scale, an optional smooth elastic distortion and optional pixel noise. Each
+// image is resampled bilinearly in a few passes over plain float arrays (coordinates, sampling,
+// blending) so the loops auto-vectorize; only the four-tap gather is scalar.
+//
+// Image i of a call uses the random stream of sample firstSample + i, so the output depends on
+// the seed and the sample number only, not on how images are batched or split over threads.
+class NNAugmenter {
+  public:
+    struct Options {
+        // Uniform in [-maxShift, maxShift] pixels along each axis.
+        float maxShift = 2.0f;
+        // Uniform in [-maxRotation, maxRotation] degrees.
+        float maxRotation = 10.0f;
+        float minScale = 0.9f;
+        float maxScale = 1.1f;
+        // Elastic distortion: random displacements of up to elasticAlpha pixels on a coarse grid
+        // of elasticGrid x elasticGrid cells, interpolated bilinearly in between. 0 disables it.
+        float elasticAlpha = 0.0f;
+        int elasticGrid = 4;
+        // Standard deviation of additive noise relative to the pixel range. 0 disables it.
+        float noiseStddev = 0.0f;
+    };
+
+    explicit NNAugmenter(Options options, int width = 28, int height = 28,
+                         uint64_t seed = NNRandom::globalSeed());
+
+    int getImageSize() const { return width_ * height_; }
+    // Augments count images stored back to back, pixels in [0, 1]. in and out may not overlap.
+    void apply(const float* in, float* out, int count, uint64_t firstSample,
+               int threads = 1) const;
+    // Same for 8-bit pixels in [0, 255].
+    void apply(const uint8_t* in, uint8_t* out, int count, uint64_t firstSample,
+               int threads = 1) const;
+    // Augments a packed (pixels x batch) matrix in place, one sample per column.
+    void applyColumns(NNMatrix& batch, uint64_t firstSample, int threads = 1) const;
+
+  private:
+    struct Scratch;
+    // One image with pixels in [0, maxValue].
+    void augment(const float* in, float* out, uint64_t sample, float maxValue,
+                 Scratch& scratch) const;
+    template <typename Pixel>
+    void applyRange(const Pixel* in, Pixel* out, int count, uint64_t firstSample,
+                    float maxValue) const;
+
+    Options options_;
+    int width_;
+    int height_;
+    uint64_t seed_;
+    // Elastic grid cell of every column and row and the position inside it.
+    std::vector<int> columnCell_;
+    std::vector<float> columnFrac_;
+    std::vector<int> rowCell_;
+    std::vector<float> rowFrac_;
+};
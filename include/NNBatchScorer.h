@@ -0,0 +1,73 @@
+#pragma once
+
+#include "NNNuma.h"
+#include "NeuralNetwork.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Streams images from an IDX image file (magic 2051) or from a packed file of raw imageSize-byte
+// images, a chunk at a time. Throws std::runtime_error when the file cannot be opened or read.
+class NNImageStream {
+  public:
+    // packedImageSize 0 reads an IDX file, otherwise the file is raw images of that many bytes.
+    explicit NNImageStream(const std::string& path, int packedImageSize = 0);
+    ~NNImageStream();
+    NNImageStream(const NNImageStream&) = delete;
+    NNImageStream& operator=(const NNImageStream&) = delete;
+
+    int getImageSize() const { return imageSize_; }
+    // Images in the file, from the IDX header or the packed file's size.
+    int64_t getCount() const { return count_; }
+    // Reads up to maxImages images into out, returns how many were read (0 at the end).
+    int read(uint8_t* out, int maxImages);
+
+  private:
+    int fd_ = -1;
+    int imageSize_ = 0;
+    int64_t count_ = 0;
+    int64_t remaining_ = 0;
+};
+
+// Offline scoring of an image stream. A reader thread fills chunks of images, worker threads
+// each run batched forward passes on their own replica of the network and format the results,
+// and the calling thread writes finished chunks in input order. A fixed pool of chunks bounds
+// memory and keeps reading, compute and writing overlapped.
+class NNBatchScorer {
+  private:
+    const std::string TAG = "NNBatchScorer";
+
+  public:
+    struct Options {
+        // 0 uses one worker per hardware thread.
+        int threads = 0;
+        int batchSize = 256;
+        int chunkImages = 4096;
+        int topK = 1;
+        // CSV lines "index,class1,prob1,...,classK,probK" instead of binary records of topK
+        // (int32 class, float probability) pairs in native byte order.
+        bool csv = false;
+        // Pins the workers; each one's activation workspace is then allocated on its node.
+        NNPinPolicy pin = NNPinPolicy::None;
+    };
+
+    // Workers copy network's parameters, so it is not used after construction.
+    NNBatchScorer(const NeuralNetwork& network, Options options);
+    ~NNBatchScorer();
+
+    // Scores every remaining image of input and writes the results to outputPath ("-" for
+    // stdout). Returns the number of images scored. Throws std::runtime_error on I/O errors.
+    int64_t score(NNImageStream& input, const std::string& outputPath);
+
+  private:
+    struct Chunk;
+    struct Pipeline;
+    void scoreChunk(NeuralNetwork& network, Chunk& chunk) const;
+
+    Options options_;
+    int inputSize_;
+    int classes_;
+    std::vector<std::unique_ptr<NeuralNetwork>> workers_;
+};
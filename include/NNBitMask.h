@@ -0,0 +1,34 @@
+#pragma once
+
+#include "NNMatrix.h"
+#include "NNRandom.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One bit per element of a row-major matrix, packed 32 to a word. Used to remember which ReLU
+// units fired so backward can gate dz without keeping (or re-deriving from) float activations,
+// and for dropout masks.
+class NNBitMask {
+  public:
+    static constexpr size_t WORD_BITS = 32;
+
+    void resize(size_t bits);
+    size_t size() const { return bits_; }
+    size_t byteSize() const { return words_.size() * sizeof(uint32_t); }
+    bool test(size_t bit) const { return (words_[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1u; }
+    // Bit i is bit i % WORD_BITS of word i / WORD_BITS.
+    const uint32_t* words() const { return words_.data(); }
+    // Sets each bit to whether the matching element of m is positive.
+    void record(const NNMatrix& m);
+    // Sets bit i with probability keepProbability, from element offset + i of random's stream,
+    // so the same offset always gives the same mask.
+    void sample(const NNRandom& random, uint64_t offset, size_t bits, float keepProbability);
+    // Zeroes the elements of m whose bit is clear and multiplies the others by scale.
+    void apply(NNMatrix& m, float scale = 1.0f) const;
+
+  private:
+    std::vector<uint32_t> words_;
+    size_t bits_ = 0;
+};
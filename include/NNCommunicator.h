@@ -0,0 +1,132 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Point-to-point link of one rank in a ring: it only ever sends to the next rank and receives
+// from the previous one. Transfers are non-blocking so a rank can push and pull at the same
+// time without deadlocking on full buffers.
+class NNTransport {
+  public:
+    virtual ~NNTransport() = default;
+    int getRank() const { return rank_; }
+    int getWorldSize() const { return worldSize_; }
+    // Sends sendBytes to the next rank while receiving recvBytes from the previous rank.
+    void sendRecv(const void* sendBuf, size_t sendBytes, void* recvBuf, size_t recvBytes);
+
+  protected:
+    NNTransport(int rank, int worldSize) : rank_(rank), worldSize_(worldSize) {}
+    // Each returns the number of bytes moved, 0 when the call would block.
+    virtual size_t trySend(const void* buf, size_t bytes) = 0;
+    virtual size_t tryRecv(void* buf, size_t bytes) = 0;
+    // Blocks (briefly) until trySend or tryRecv may make progress.
+    virtual void waitForProgress(bool wantSend, bool wantRecv) = 0;
+
+    int rank_;
+    int worldSize_;
+};
+
+// TCP ring, rank r listens on basePort + r. Over loopback this stands in for multi-node runs.
+class NNTcpTransport : public NNTransport {
+  public:
+    NNTcpTransport(int rank, int worldSize, const std::string& host = "127.0.0.1",
+                   int basePort = 29500, int timeoutMs = 30000);
+    ~NNTcpTransport() override;
+
+  protected:
+    size_t trySend(const void* buf, size_t bytes) override;
+    size_t tryRecv(void* buf, size_t bytes) override;
+    void waitForProgress(bool wantSend, bool wantRecv) override;
+
+  private:
+    int nextFd_ = -1;
+    int prevFd_ = -1;
+};
+
+// Single-host ring over a POSIX shared memory segment holding one SPSC byte queue per rank.
+// Rank 0 creates (and later unlinks) the segment, the other ranks attach to it by name.
+class NNShmTransport : public NNTransport {
+  public:
+    NNShmTransport(int rank, int worldSize, const std::string& name, int timeoutMs = 30000);
+    ~NNShmTransport() override;
+
+  protected:
+    size_t trySend(const void* buf, size_t bytes) override;
+    size_t tryRecv(void* buf, size_t bytes) override;
+    void waitForProgress(bool wantSend, bool wantRecv) override;
+
+  private:
+    struct Channel;
+    struct Header;
+    std::string name_;
+    void* mem_ = nullptr;
+    size_t memSize_ = 0;
+    Channel* inbox_ = nullptr;
+    Channel* outbox_ = nullptr;
+};
+
+// Collectives over a ring transport. allReduceAsync queues work for a background thread so
+// gradient communication overlaps with the rest of the backward pass.
+class NNCommunicator {
+  public:
+    NNCommunicator(std::unique_ptr<NNTransport> transport);
+    ~NNCommunicator();
+    NNCommunicator(const NNCommunicator&) = delete;
+    NNCommunicator& operator=(const NNCommunicator&) = delete;
+
+    int getRank() const { return transport_->getRank(); }
+    int getWorldSize() const { return transport_->getWorldSize(); }
+    // Ring all-reduce (reduce-scatter + all-gather), sums or averages in place across ranks.
+    void allReduce(float* data, size_t count, bool average = true);
+    void broadcast(float* data, size_t count, int root = 0);
+    void allReduceAsync(float* data, size_t count, bool average = true);
+    // Waits for every queued allReduceAsync to finish.
+    void wait();
+
+  private:
+    struct Job {
+        float* data;
+        size_t count;
+        bool average;
+    };
+    void ringAllReduce(float* data, size_t count, bool average);
+    void run();
+
+    std::unique_ptr<NNTransport> transport_;
+    std::vector<float> recvChunk_;
+    std::deque<Job> jobs_;
+    int pending_ = 0;
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable jobCv_;
+    std::condition_variable doneCv_;
+    std::thread worker_;
+};
+
+using NNCommunicatorPtr = std::shared_ptr<NNCommunicator>;
+
+// Coalesces gradient ranges into buckets of about bucketBytes before handing them to the
+// communicator. Backward finishes layers last to first while the arena stores them first to
+// last, so consecutive ready ranges are adjacent and grow the bucket downwards.
+class NNGradientBucketer {
+  public:
+    NNGradientBucketer(NNCommunicator& communicator, size_t bucketBytes = 1 << 20);
+    void add(float* data, size_t count);
+    // Flushes the open bucket and waits for all reductions.
+    void finish();
+
+  private:
+    void flush();
+
+    NNCommunicator& communicator_;
+    size_t bucketFloats_;
+    float* start_ = nullptr;
+    size_t count_ = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "NNGraph.h"
+#include "NNMatrix.h"
+#include "NNRandom.h"
+
+// One convolution stage of a NeuralNetwork: outChannels kernel x kernel filters, then ReLU and,
+// when pool is above 1, a pool x pool max pool with stride pool.
+struct NNConvSpec {
+    int outChannels = 1;
+    int kernel = 3;
+    int stride = 1;
+    int padding = 0;
+    int pool = 1;
+};
+
+// A convolution stage over samples of channels x height x width. It only runs inside an
+// NNGraph, which lowers the convolution to im2col and one GEMM per batch.
+class NNConvLayer {
+  public:
+    // Xavier-uniform filters and biases drawn from random, elements
+    // [0, outChannels * channels * kernel^2) of the stream for the filters and the next
+    // outChannels for the biases.
+    NNConvLayer(int channels, int height, int width, const NNConvSpec& spec,
+                const NNRandom& random = NNRandom());
+    // Adds the stage to graph, with gradients going to this layer's dWeight and dBias. Call
+    // after bindParameters, the graph keeps pointers to the current storage.
+    NNGraph::Value addToGraph(NNGraph& graph, NNGraph::Value input);
+    // Moves weight, bias and their gradients into externally owned (arena) storage.
+    void bindParameters(float* weightMem, float* biasMem, float* dWeightMem, float* dBiasMem);
+    // (outChannels x channels * kernel^2), one filter per row.
+    const NNMatrix& getWeight() const { return weight; }
+    const NNMatrix& getBias() const { return bias; }
+    int getInputSize() const { return window.channels * window.height * window.width; }
+    // Shape of the output, after pooling.
+    int getOutChannels() const { return weight.getRowSize(); }
+    int getOutHeight() const;
+    int getOutWidth() const;
+    int getOutputSize() const { return getOutChannels() * getOutHeight() * getOutWidth(); }
+
+  private:
+    NNGraph::Window poolWindow() const;
+
+    NNGraph::Window window;
+    int pool = 1;
+    NNMatrix weight;
+    NNMatrix bias;
+    NNMatrix dWeight;
+    NNMatrix dBias;
+};
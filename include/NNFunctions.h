@@ -1,8 +1,10 @@
 #pragma once
 
+#include "NNBitMask.h"
 #include "NNMatrix.h"
 
 #include <string>
+#include <vector>
 
 class NNFunctions {
   private:
@@ -14,4 +16,16 @@ class NNFunctions {
     static MatrixFunc ReLUFunc;
     static MatrixFunc ReLUDrevative;
     static NNMatrix softmax(const NNMatrix& matrix);
-};
\ No newline at end of file
+    // ReLU in place, optionally recording which elements stayed active for the backward pass.
+    // With a dropout keep mask, elements whose bit is clear are zeroed and the others scaled by
+    // keepScale in the same pass, so the recorded mask gates dz for both.
+    static void relu(NNMatrix& z, NNBitMask* mask = nullptr, const NNBitMask* keep = nullptr,
+                     float keepScale = 1.0f);
+
+    // Fused softmax + cross-entropy over a batch. logits is (classes x batch) with one sample
+    // per column, labels holds the class index of each sample. Fills dlogits with the gradient
+    // of the mean loss w.r.t. the logits, predictions with the per-sample argmax, and returns
+    // the mean loss. Uses a max-shifted log-sum-exp, so no probability is ever clipped.
+    static float softmaxCrossEntropy(const NNMatrix& logits, const std::vector<int>& labels,
+                                     NNMatrix& dlogits, std::vector<int>& predictions);
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "NNActivationPlanner.h"
+#include "NNBitMask.h"
+#include "NNMatrix.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A small computation graph over batched values. Every value is (rows x batch) with one sample
+// per column, except parameters, which are (rows x cols) matrices in external storage such as
+// a parameter arena. Layers add their operations, then compile():
+//  - fuses softmax + cross-entropy into one kernel, and every run of a bias add and unary
+//    element-wise ops (bias + activation, scale + tanh...) into a single pass,
+//  - schedules the nodes the loss and outputs depend on, in topological order,
+//  - differentiates the loss in reverse mode, walking the schedule backwards, and
+//  - plans every activation, gradient and scratch buffer into one workspace with
+//    NNActivationPlanner, so buffers with disjoint lifetimes share memory.
+// forward(), loss() and backward() then run the schedule without allocating.
+class NNGraph {
+  private:
+    static const std::string TAG;
+
+  public:
+    using Value = int;
+
+    // Batch norm: weight of each batch in the running statistics, and the variance offset.
+    static constexpr float BATCH_NORM_MOMENTUM = 0.1f;
+    static constexpr float BATCH_NORM_EPSILON = 1e-5f;
+
+    // Geometry of a convolution or pooling window over samples of channels x height x width,
+    // stored channel by channel, row by row in each column.
+    struct Window {
+        int channels = 1;
+        int height = 1;
+        int width = 1;
+        int kernel = 1;
+        int stride = 1;
+        // Zeros around the input for convolutions; pooling ignores the padded positions.
+        int padding = 0;
+        int outHeight() const { return (height + 2 * padding - kernel) / stride + 1; }
+        int outWidth() const { return (width + 2 * padding - kernel) / stride + 1; }
+    };
+
+    NNGraph() = default;
+    NNGraph(const NNGraph&) = delete;
+    NNGraph& operator=(const NNGraph&) = delete;
+    NNGraph(NNGraph&&) = default;
+    NNGraph& operator=(NNGraph&&) = default;
+
+    // Batched input of rows per sample, written through value() before forward().
+    Value input(int rows);
+    // (rows x cols) parameter at param. backward() adds its gradient to grad, and a nullptr
+    // grad makes it a constant.
+    Value parameter(int rows, int cols, float* param, float* grad);
+    // weight, a parameter, times x.
+    Value matmul(Value weight, Value x);
+    // x plus a (biasRows x 1) bias parameter in every column. With fewer bias rows than x has,
+    // each entry covers rows / biasRows consecutive rows, e.g. all positions of a channel.
+    Value addBias(Value x, Value bias);
+    // Convolution of x with weight, an (outChannels x channels * kernel * kernel) parameter,
+    // giving outChannels x outHeight x outWidth per sample. Lowered to im2col and one GEMM over
+    // the whole batch.
+    Value conv2d(Value weight, Value x, const Window& window);
+    // Max of every kernel x kernel window of each channel.
+    Value maxPool(Value x, const Window& window);
+    // Normalizes every row of x to zero mean and unit variance over the batch, then scales it by
+    // gamma and shifts it by beta, (rows x 1) parameters. Training batches use their own
+    // statistics and fold them into runningMean and runningVar (rows floats each); otherwise
+    // those are used instead. One pass per row for forward and one for backward.
+    Value batchNorm(Value x, Value gamma, Value beta, float* runningMean, float* runningVar);
+    Value relu(Value x);
+    Value sigmoid(Value x);
+    Value tanh(Value x);
+    Value scale(Value x, float factor);
+    // Inverted dropout: on training batches, x with the elements whose bit in mask is clear
+    // zeroed and the others multiplied by keepScale; otherwise x. mask covers the (rows x batch)
+    // value row by row, and the caller redraws it before each training forward().
+    Value dropout(Value x, const NNBitMask* mask, float keepScale);
+    Value add(Value a, Value b);
+    Value mul(Value a, Value b);
+    // Softmax of every column.
+    Value softmax(Value x);
+    // Mean cross-entropy of per-column probabilities against the labels passed to loss().
+    Value crossEntropy(Value probabilities);
+
+    // Prepares the graph to evaluate outputs and, unless loss is negative, to differentiate the
+    // loss (a crossEntropy value) w.r.t. every parameter with a gradient. fuse = false keeps
+    // one kernel per node. Nothing can be added afterwards.
+    void compile(Value loss, const std::vector<Value>& outputs = {}, bool fuse = true);
+    bool isCompiled() const { return compiled_; }
+
+    // Points every buffer at the workspace for batch samples, dropping earlier contents.
+    void setBatch(int batch);
+    // Whether forward() runs training batches (the default). Only batch norm and dropout care,
+    // and backward() needs a training forward.
+    void setTraining(bool training) { training_ = training; }
+    // (rows x batch) buffer of v for the current batch. Inputs are written and outputs read
+    // through it; any other value only holds data while it is live in the schedule.
+    NNMatrix& value(Value v) { return nodes_[v].out; }
+    // Runs every scheduled node but the loss.
+    void forward();
+    // Mean loss for labels (one class index per sample), after forward().
+    float loss(const std::vector<int>& labels);
+    // Per-sample argmax of the loss input, filled by loss().
+    const std::vector<int>& getPredictions() const { return predictions_; }
+    // Adds scale times the gradient of the loss to every parameter gradient, after loss().
+    void backward(float scale = 1.0f);
+
+    // Nodes run per batch, and nodes folded into others by fusion.
+    int getScheduleSize() const { return static_cast<int>(schedule_.size()); }
+    int getFusedCount() const { return fusedCount_; }
+    size_t peakBytes(int batch) const { return workspace_.peakBytes(batch); }
+    size_t unplannedBytes(int batch) const { return workspace_.unplannedBytes(batch); }
+    // The schedule, one node per line, e.g. "5 elementwise(bias,relu) 128 <- 4 3".
+    std::string describe() const;
+
+  private:
+    enum class Op : uint8_t {
+        Input,
+        Parameter,
+        MatMul,
+        AddBias,
+        Relu,
+        Sigmoid,
+        Tanh,
+        Scale,
+        Dropout,
+        Add,
+        Mul,
+        Conv2D,
+        MaxPool,
+        BatchNorm,
+        Softmax,
+        CrossEntropy,
+        // Produced by fusion.
+        Elementwise,
+        SoftmaxCrossEntropy,
+    };
+    // One unary op of an Elementwise chain.
+    struct ChainOp {
+        Op op;
+        float factor;
+    };
+    static constexpr int MAX_CHAIN = 8;
+
+    struct Node {
+        Op op = Op::Input;
+        int rows = 0;
+        // Columns of a parameter.
+        int cols = 0;
+        std::vector<Value> inputs;
+        float factor = 1.0f;
+        // Storage of a parameter and its gradient.
+        float* param = nullptr;
+        float* grad = nullptr;
+        // Elementwise: unary ops applied in order after adding the optional bias inputs[1].
+        std::vector<ChainOp> chain;
+        // Keep mask of a Dropout, or of the one Dropout in an Elementwise chain.
+        const NNBitMask* mask = nullptr;
+        // Conv2D and MaxPool geometry.
+        Window window;
+        // BatchNorm running statistics, and the mean and inverse deviation of each row in the
+        // last training batch.
+        float* runningMean = nullptr;
+        float* runningVar = nullptr;
+        std::vector<float> batchStats;
+        bool removed = false;
+        // Depends on a parameter with a gradient, and back-propagated because it also lies on
+        // a path to the loss.
+        bool needsGrad = false;
+        bool differentiate = false;
+        int step = 0;
+        int buffer = -1;
+        int gradBuffer = -1;
+        int scratchBuffer = -1;
+        int forwardScratchBuffer = -1;
+        // Value and gradient (views into the workspace, or into a parameter's storage). The
+        // backward scratch holds the transposed input of a MatMul, or the columns of a Conv2D;
+        // the forward scratch holds the columns of a Conv2D.
+        NNMatrix out{1, 1};
+        NNMatrix dOut{1, 1};
+        NNMatrix scratch{1, 1};
+        NNMatrix forwardScratch{1, 1};
+    };
+
+    Value addNode(Op op, int rows, std::vector<Value> inputs, float factor = 1.0f);
+    std::vector<int> countUses(const std::vector<Value>& roots) const;
+    void fuse(const std::vector<Value>& roots);
+    void planBuffers(const std::vector<Value>& outputs);
+    // Whether the backward of node reads the values of its inputs, or its own value.
+    bool readsInputs(const Node& node) const;
+    bool readsOutput(const Node& node) const;
+    void runForward(Node& node);
+    void runBackward(Node& node, float scale);
+    // Gradient of v for the next contribution: the first one of a pass overwrites it (add is
+    // false), later ones add to it.
+    float* gradFor(Value v, bool& add);
+    // Conv2D lowering: columns (channels * kernel^2 x outHeight * outWidth * batch) of x, and
+    // the scatter-add of column gradients back into dx.
+    void im2col(const Window& window, const float* x, float* columns) const;
+    void col2im(const Window& window, const float* columns, float* dx) const;
+    static void applyUnary(Op op, float factor, const float* in, float* out, int count);
+    // Derivative of a unary op from its output y.
+    static float derivative(Op op, float factor, float y);
+    // op of node's chain over count elements starting at element offset of the value, which
+    // only matters to a Dropout, and its gradient: g times the derivative at outputs y.
+    void applyChainOp(const Node& node, const ChainOp& op, size_t offset, const float* in,
+                      float* out, int count) const;
+    void chainGradient(const Node& node, const ChainOp& op, size_t offset, const float* y,
+                       float* g, int count) const;
+    static const char* opName(Op op);
+
+    std::vector<Node> nodes_;
+    // Nodes in execution order, the loss (if any) last.
+    std::vector<Value> schedule_;
+    Value loss_ = -1;
+    bool compiled_ = false;
+    int fusedCount_ = 0;
+    NNActivationPlanner workspace_;
+    int batch_ = 0;
+    bool training_ = true;
+    std::vector<char> gradWritten_;
+    // Per-sample scratch for softmax and the chain values recomputed by Elementwise backward.
+    std::vector<float> colMax_;
+    std::vector<float> colSum_;
+    std::vector<float> chainValues_;
+    // Per-sample input row of the maximum, for MaxPool backward.
+    std::vector<int> argMax_;
+    // Loss gradient when nothing upstream of the loss is trained.
+    NNMatrix lossGrad_{1, 1};
+    std::vector<int> labels_;
+    std::vector<int> predictions_;
+};
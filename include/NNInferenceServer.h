@@ -0,0 +1,105 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Latency and throughput of the requests answered since the server started (or since the last
+// resetStats). Latencies run from the moment a request's last byte was read to its reply.
+struct NNServeStats {
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    double seconds = 0.0;
+    double requestsPerSecond = 0.0;
+    double meanBatch = 0.0;
+    float p50Us = 0.0f;
+    float p99Us = 0.0f;
+    float p999Us = 0.0f;
+};
+
+// Serves a network over a Unix domain socket or loopback TCP. A client writes raw images of
+// inputSize bytes (pixels 0-255) back to back and reads one REPLY_BYTES reply per image, in
+// order: the predicted class as int32 and its softmax probability as float, native byte order.
+// Requests from all connections are coalesced into batches of up to maxBatch, waiting at most
+// maxDelayUs after the oldest queued request before running a partial batch.
+class NNInferenceServer {
+  private:
+    const std::string TAG = "NNInferenceServer";
+
+  public:
+    struct Options {
+        // Listens on this Unix socket when set, otherwise on 127.0.0.1:port (0 picks a port).
+        std::string socketPath;
+        int port = 0;
+        int maxBatch = 64;
+        int maxDelayUs = 500;
+    };
+    static constexpr size_t REPLY_BYTES = 8;
+
+    NNInferenceServer(NeuralNetwork& network, int inputSize, Options options);
+    ~NNInferenceServer();
+    NNInferenceServer(const NNInferenceServer&) = delete;
+    NNInferenceServer& operator=(const NNInferenceServer&) = delete;
+
+    // Binds the socket and starts the I/O and batching threads. Throws std::runtime_error when
+    // the socket cannot be set up. The network must not be used elsewhere until stop().
+    void start();
+    // Closes the socket and every connection, queued requests are dropped.
+    void stop();
+    // The bound TCP port, useful with Options::port 0.
+    int getPort() const { return port_; }
+    NNServeStats getStats() const;
+    void resetStats();
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    struct Connection;
+    struct Request {
+        std::shared_ptr<Connection> connection;
+        std::vector<uint8_t> pixels;
+        Clock::time_point arrival;
+    };
+
+    void runIo();
+    void runBatches();
+    void acceptConnections();
+    // Reads what is available on connection, returns false once it is closed.
+    bool readRequests(const std::shared_ptr<Connection>& connection);
+    void runBatch(std::vector<Request>& batch);
+
+    NeuralNetwork& network_;
+    int inputSize_;
+    Options options_;
+    int listenFd_ = -1;
+    int port_ = 0;
+    // Written by stop() to wake the I/O thread out of poll.
+    int wakeFds_[2] = {-1, -1};
+    std::atomic<bool> stop_{false};
+    // Open connections, only touched by the I/O thread.
+    std::vector<std::shared_ptr<Connection>> connections_;
+
+    std::deque<Request> queue_;
+    std::mutex queueMutex_;
+    std::condition_variable queueCv_;
+
+    mutable std::mutex statsMutex_;
+    Clock::time_point statsStart_;
+    uint64_t batches_ = 0;
+    uint64_t requests_ = 0;
+    // Latest latencies in microseconds, a ring of at most MAX_LATENCY_SAMPLES.
+    std::vector<float> latencies_;
+    size_t latencyNext_ = 0;
+    static constexpr size_t MAX_LATENCY_SAMPLES = 1 << 20;
+
+    std::thread ioThread_;
+    std::thread batchThread_;
+};
@@ -1,27 +1,53 @@
 #pragma once
 
 #include "NNFunctions.h"
+#include "NNGraph.h"
 #include "NNMatrix.h"
+#include "NNRandom.h"
 #include "NNUtils.h"
 
 class NNLayer {
   public:
-    NNLayer(int inputSize = 1, int outputSize = 1);
+    // Xavier-uniform weights and biases drawn from random, elements [0, in * out) of the stream
+    // for the weights and the next outputSize for the biases.
+    NNLayer(int inputSize = 1, int outputSize = 1, const NNRandom& random = NNRandom());
     NNMatrix forward(const NNMatrix& input, MatrixFunc derivateFunc = NNFunctions::SigmoidDrevative,
                      bool debug = false);
+    // Batched, allocation-free variants writing into preallocated (e.g. workspace view) outputs:
+    // out (outputSize x batch) = weight * input + bias, without activation.
+    void forward(const NNMatrix& input, NNMatrix& out);
+    // Sparse (inputSize x batch) input, touching only its non-zeros.
+    void forward(const NNSparseColumns& input, NNMatrix& out);
     NNMatrix calculatePrevLayerDA(const NNMatrix& dz);
+    // da (inputSize x batch) = weight^T * dz.
+    void calculatePrevLayerDA(const NNMatrix& dz, NNMatrix& da);
     NNMatrix setDz(NNMatrix&& other);
-    void update(const NNMatrix& dw, const NNMatrix& db, float alpha, float momentum);
+    // Batched: input is (inputSize x batch), dz is (outputSize x batch). Adds dz * input^T to the
+    // weight gradient and the row sums of dz to the bias gradient.
+    void accumulateGradients(const NNMatrix& input, const NNMatrix& dz);
+    // Same, with caller-provided (batch x inputSize) scratch for the transposed input.
+    void accumulateGradients(const NNMatrix& input, const NNMatrix& dz, NNMatrix& inputT);
+    void accumulateGradients(const NNSparseColumns& input, const NNMatrix& dz);
+    // Adds weight * input + bias to graph, with gradients going to this layer's dWeight and
+    // dBias. Call after bindParameters, the graph keeps pointers to the current storage.
+    // withBias = false leaves the bias out, for a following batch norm whose shift replaces it.
+    NNGraph::Value addToGraph(NNGraph& graph, NNGraph::Value input, bool withBias = true);
+    // Moves weight, bias and their gradients into externally owned (arena) storage.
+    void bindParameters(float* weightMem, float* biasMem, float* dWeightMem, float* dBiasMem);
+    const NNMatrix& getWeight() const { return weight; }
+    const NNMatrix& getBias() const { return bias; }
     int getInputSize() const { return weight.getColSize(); }
     int getOutputSize() const { return weight.getRowSize(); }
     void dump();
 
   private:
+    void accumulateBiasGradient(const NNMatrix& dz);
+
     const std::string TAG = "NNLayer";
     NNMatrix weight;
-    NNMatrix vWeight;
     NNMatrix bias;
-    NNMatrix vBias;
+    NNMatrix dWeight;
+    NNMatrix dBias;
     NNMatrix dz_;
     int batchSize = 1;
 };
\ No newline at end of file
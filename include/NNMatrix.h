@@ -9,10 +9,24 @@
 using NNVector = std::vector<float>;
 using MatrixFunc = std::function<float(float)>;
 
+// Column-compressed sparse matrix: column j holds index/value[colStart[j], colStart[j + 1]).
+// Used for batches of sparse input samples, one sample per column.
+struct NNSparseColumns {
+    int rows = 0;
+    std::vector<int> colStart{0};
+    std::vector<int> index;
+    std::vector<float> value;
+    int getColSize() const { return static_cast<int>(colStart.size()) - 1; }
+    float density() const;
+};
+
 class NNMatrix : public std::enable_shared_from_this<NNMatrix> {
   public:
     NNMatrix(int row, int col, float defaultValue = 0.0f);
     NNMatrix(const NNMatrix& other);
+    // (row x col) view of mem, which lies inside storage. The matrix keeps storage alive, so
+    // many samples can share one large block (e.g. a dataset on huge pages).
+    NNMatrix(std::shared_ptr<float> storage, float* mem, int row, int col);
     // NNMatrix(NNMatrix &&other);
     virtual ~NNMatrix();
     int getColSize() const { return col_; }
@@ -21,6 +35,19 @@ class NNMatrix : public std::enable_shared_from_this<NNMatrix> {
     NNVector getCol(int col) const;
     void set(int i, int j, float elemValue);
     float get(int i, int j) const;
+    float* data() {
+        dropNonZeroIndex();
+        return mem_;
+    }
+    const float* data() const { return mem_; }
+    // Copies the contents into mem (row x col floats owned by someone else, e.g. a parameter
+    // arena) and turns this matrix into a view of it. Assigning to a view writes through.
+    void rebind(float* mem);
+    // Turns this matrix into a (row x col) view of mem without copying, e.g. a slice of an
+    // activation workspace. The previous contents are discarded.
+    void setView(float* mem, int row, int col);
+    bool isView() const { return !owned_; }
+    void fill(float value);
     NNMatrix operator-(const NNMatrix& other);
     NNMatrix& operator-=(const NNMatrix& other);
     NNMatrix& operator+=(const NNMatrix& other);
@@ -29,19 +56,51 @@ class NNMatrix : public std::enable_shared_from_this<NNMatrix> {
     NNMatrix& operator=(const NNMatrix& other);
     NNMatrix& operator=(NNMatrix&& other) noexcept;
     NNMatrix dotProduct(const NNMatrix& other);
+    // this += op(a) * b where op(a) is a or, with transposeA, a^T. No allocation.
+    void addDotProduct(const NNMatrix& a, const NNMatrix& b, bool transposeA = false);
+    // this += a * b^T, e.g. a weight gradient from (out x positions) and (in x positions).
+    void addDotProductTransposed(const NNMatrix& a, const NNMatrix& b);
+    // this += a * b and this += a * b^T for a sparse b. Cost scales with b's non-zeros.
+    void addDotProduct(const NNMatrix& a, const NNSparseColumns& b);
+    void addDotProductTransposed(const NNMatrix& a, const NNSparseColumns& b);
+    NNMatrix transpose() const;
+    // Writes the transpose into out, which must already be (col x row).
+    void transposeInto(NNMatrix& out) const;
+    // Adds a (row x 1) column vector to every column, e.g. a bias to a batch of outputs.
+    NNMatrix& addToColumns(const NNMatrix& column);
     NNMatrix elementProduct(const NNMatrix& other);
     NNMatrix applyFunction(const MatrixFunc& func);
     int getIndexOfColMax(int col) const;
     float getColMax(int col) const;
     void dump(bool showFullLine = false, int lineSize = -1, bool dumpToFile = false) const;
     void toOneHot();
+    // Records the positions of the non-zero elements of a column vector so sparse inputs can
+    // skip zeros. Built once (e.g. at load time) and dropped by any non-const access.
+    void buildNonZeroIndex();
+    const std::vector<int>* getNonZeroIndex() const {
+        return hasNonZeroIndex_ ? &nonZero_ : nullptr;
+    }
 
   private:
+    // Frees owned memory and forgets shared storage, leaving mem_ dangling for the caller.
+    void release();
+    void dropNonZeroIndex() {
+        if (hasNonZeroIndex_) {
+            nonZero_.clear();
+            hasNonZeroIndex_ = false;
+        }
+    }
+
     const std::string TAG = "NNMatrix";
     const int MAX_DUMP_LINE_SIZE = 28;
     float* mem_ = nullptr;
     int row_ = 0;
     int col_ = 0;
+    bool owned_ = true;
+    // Block a view lies in, when the view shares its ownership.
+    std::shared_ptr<float> storage_;
+    bool hasNonZeroIndex_ = false;
+    std::vector<int> nonZero_;
 };
 
 using NNMatrixPtr = std::shared_ptr<NNMatrix>;
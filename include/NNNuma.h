@@ -0,0 +1,73 @@
+#pragma once
+
+#include "NNMatrix.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// How worker threads or processes are spread over the CPUs: not at all, filling one node's CPUs
+// before the next (compact), or alternating between nodes (scatter).
+enum class NNPinPolicy { None, Compact, Scatter };
+
+// NUMA topology and placement. On Linux the node layout comes from /sys/devices/system/node and
+// placement uses sched_setaffinity and set_mempolicy directly, without libnuma. Elsewhere, or
+// when sysfs is missing, the host is one node holding every CPU and placement does nothing.
+//
+// Pages land on the node of the thread that first touches them, so a worker that is pinned
+// before it allocates (or copies) its buffers gets them on its own node.
+class NNNuma {
+  private:
+    const std::string TAG = "NNNuma";
+
+  public:
+    // nodeCpus[n] lists the CPUs of node n; nodes without CPUs may be empty.
+    explicit NNNuma(std::vector<std::vector<int>> nodeCpus);
+    // Topology of this host, read once.
+    static const NNNuma& system();
+
+    int getNodeCount() const { return static_cast<int>(nodeCpus_.size()); }
+    const std::vector<int>& getCpus(int node) const { return nodeCpus_[node]; }
+    // Node of cpu, 0 when unknown.
+    int nodeOfCpu(int cpu) const;
+    // CPU for worker under policy, -1 for NNPinPolicy::None.
+    int cpuFor(int worker, NNPinPolicy policy) const;
+    // Pins the calling thread to cpuFor(worker, policy) and makes its new pages prefer that
+    // CPU's node. Returns the node, or -1 when the thread is left unpinned.
+    int placeWorker(int worker, NNPinPolicy policy) const;
+    // Spreads the calling thread's new pages round-robin over every node, e.g. while loading a
+    // dataset that all nodes read. resetMemoryPolicy() goes back to first-touch placement.
+    bool interleaveMemory() const;
+
+    static bool pinThread(int cpu);
+    static bool preferNode(int node);
+    static bool resetMemoryPolicy();
+    // Deep copy of samples (values and non-zero indices) into one block written by the calling
+    // thread, so a pinned worker gets a replica of read-only data on its own node.
+    static std::vector<NNMatrixPtr> localCopy(const std::vector<NNMatrixPtr>& samples);
+
+    // Page allocation counters of one node from its numastat. local/otherNode count pages
+    // allocated by processes running on this node, on this node or elsewhere.
+    struct NodeStats {
+        uint64_t numaHit = 0;
+        uint64_t numaMiss = 0;
+        uint64_t interleaveHit = 0;
+        uint64_t localNode = 0;
+        uint64_t otherNode = 0;
+    };
+    std::vector<NodeStats> readNodeStats() const;
+    // Logs, per node, the local and remote allocation rates between two readNodeStats() calls.
+    void logNodeStats(const std::vector<NodeStats>& before, const std::vector<NodeStats>& after,
+                      double seconds) const;
+    // Resident pages of this process on each node, from /proc/self/numa_maps.
+    static std::map<int, uint64_t> residentPages();
+
+    // "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}, the sysfs cpulist format.
+    static std::vector<int> parseCpuList(const std::string& list);
+    // "none", "compact" or "scatter". Returns false for anything else.
+    static bool parsePinPolicy(const std::string& name, NNPinPolicy& policy);
+
+  private:
+    std::vector<std::vector<int>> nodeCpus_;
+};
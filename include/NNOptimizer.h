@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Optimizers update one parameter buffer at a time in a single fused pass over the parameter,
+// its gradient and its per-element state buffers (momentum, second moment...). The buffers are
+// plain contiguous floats so the loops vectorize.
+class NNOptimizer {
+  public:
+    static constexpr int MAX_STATE_SIZE = 2;
+
+    virtual ~NNOptimizer() = default;
+    virtual std::string name() const = 0;
+    // Number of per-element state buffers update() expects.
+    virtual int stateSize() const = 0;
+    // Applies one step to n parameters. state holds stateSize() buffers of n floats each.
+    // decay selects whether weight decay applies to this buffer (weights yes, biases no).
+    virtual void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                        bool decay) = 0;
+    // Layer-wise optimizers (LARS, LAMB) scale each tensor's step by its own trust ratio, so
+    // they must be called once per layer tensor instead of once per arena sweep.
+    virtual bool isLayerwise() const { return false; }
+    // Advances the step counter, call once per optimizer step before the update() calls.
+    void nextStep() { step_++; }
+    int getStep() const { return step_; }
+    // Restores the step counter, e.g. when resuming from a snapshot.
+    void setStep(int step) { step_ = step; }
+
+  protected:
+    int step_ = 0;
+};
+
+// v = momentum * v + lr * g; w -= v (or the Nesterov look-ahead form).
+class NNSGDOptimizer : public NNOptimizer {
+  public:
+    NNSGDOptimizer(float momentum = 0.9f, bool nesterov = false, float weightDecay = 0.0f);
+    std::string name() const override { return nesterov_ ? "nesterov" : "sgd"; }
+    int stateSize() const override { return momentum_ != 0.0f ? 1 : 0; }
+    void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                bool decay) override;
+
+  private:
+    float momentum_;
+    bool nesterov_;
+    float weightDecay_;
+};
+
+// Adam with bias correction. decoupled=true gives AdamW (decay applied to the weight directly
+// instead of being folded into the gradient).
+class NNAdamOptimizer : public NNOptimizer {
+  public:
+    NNAdamOptimizer(float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-8f,
+                    float weightDecay = 0.0f, bool decoupled = false);
+    std::string name() const override { return decoupled_ ? "adamw" : "adam"; }
+    int stateSize() const override { return 2; }
+    void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                bool decay) override;
+
+  private:
+    float beta1_;
+    float beta2_;
+    float epsilon_;
+    float weightDecay_;
+    bool decoupled_;
+};
+
+class NNRMSPropOptimizer : public NNOptimizer {
+  public:
+    NNRMSPropOptimizer(float rho = 0.9f, float epsilon = 1e-8f, float weightDecay = 0.0f);
+    std::string name() const override { return "rmsprop"; }
+    int stateSize() const override { return 1; }
+    void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                bool decay) override;
+
+  private:
+    float rho_;
+    float epsilon_;
+    float weightDecay_;
+};
+
+// LARS: SGD-momentum whose per-layer rate is scaled by
+// trust * ||w|| / (||g|| + weightDecay * ||w||). Tensors without decay (biases) are not scaled.
+class NNLARSOptimizer : public NNOptimizer {
+  public:
+    NNLARSOptimizer(float momentum = 0.9f, float weightDecay = 0.0f, float trust = 0.001f);
+    std::string name() const override { return "lars"; }
+    int stateSize() const override { return 1; }
+    bool isLayerwise() const override { return true; }
+    void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                bool decay) override;
+
+  private:
+    float momentum_;
+    float weightDecay_;
+    float trust_;
+};
+
+// LAMB: the AdamW update u is rescaled per layer by ||w|| / ||u|| so very large batches can
+// use large learning rates. Tensors without decay (biases) take the plain AdamW step.
+class NNLAMBOptimizer : public NNOptimizer {
+  public:
+    NNLAMBOptimizer(float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-6f,
+                    float weightDecay = 0.0f);
+    std::string name() const override { return "lamb"; }
+    int stateSize() const override { return 2; }
+    bool isLayerwise() const override { return true; }
+    void update(float* param, const float* grad, float* const* state, size_t n, float lr,
+                bool decay) override;
+
+  private:
+    float beta1_;
+    float beta2_;
+    float epsilon_;
+    float weightDecay_;
+};
+
+using NNOptimizerPtr = std::shared_ptr<NNOptimizer>;
+
+// Learning rate as a function of the 0-based optimizer step.
+class NNLearningRateSchedule {
+  public:
+    virtual ~NNLearningRateSchedule() = default;
+    virtual float rate(int step) const = 0;
+};
+
+class NNConstantSchedule : public NNLearningRateSchedule {
+  public:
+    NNConstantSchedule(float lr) : lr_(lr) {}
+    float rate(int step) const override { return lr_; }
+
+  private:
+    float lr_;
+};
+
+// lr * gamma^(step / stepSize)
+class NNStepSchedule : public NNLearningRateSchedule {
+  public:
+    NNStepSchedule(float lr, int stepSize, float gamma);
+    float rate(int step) const override;
+
+  private:
+    float lr_;
+    int stepSize_;
+    float gamma_;
+};
+
+// Cosine annealing from lr down to minLr over totalSteps, then flat at minLr.
+class NNCosineSchedule : public NNLearningRateSchedule {
+  public:
+    NNCosineSchedule(float lr, int totalSteps, float minLr = 0.0f);
+    float rate(int step) const override;
+
+  private:
+    float lr_;
+    int totalSteps_;
+    float minLr_;
+};
+
+// Linear ramp from after->rate(0) / warmupSteps to after->rate(0) over warmupSteps, then hands
+// over to after.
+class NNWarmupSchedule : public NNLearningRateSchedule {
+  public:
+    NNWarmupSchedule(int warmupSteps, std::shared_ptr<NNLearningRateSchedule> after);
+    float rate(int step) const override;
+
+  private:
+    int warmupSteps_;
+    std::shared_ptr<NNLearningRateSchedule> after_;
+};
+
+using NNLearningRateSchedulePtr = std::shared_ptr<NNLearningRateSchedule>;
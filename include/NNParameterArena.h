@@ -0,0 +1,71 @@
+#pragma once
+
+#include "NNAllocator.h"
+#include "NNOptimizer.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Owns every trainable parameter of a network together with its gradient and optimizer state,
+// each in one contiguous 64-byte aligned buffer. Layers reserve segments, the arena lays them
+// out (weight-decayed segments first), and layers then bind views onto them. Zeroing gradients,
+// the optimizer step, gradient reduction and checkpointing are each one linear sweep.
+class NNParameterArena {
+  public:
+    static constexpr size_t ALIGNMENT = NNAllocator::ALIGNMENT;
+
+    NNParameterArena() = default;
+    NNParameterArena(const NNParameterArena&) = delete;
+    NNParameterArena& operator=(const NNParameterArena&) = delete;
+    NNParameterArena(NNParameterArena&&) = default;
+    NNParameterArena& operator=(NNParameterArena&&) = default;
+
+    // Registers a segment of count floats and returns its id. decay selects whether the
+    // optimizer applies weight decay to it.
+    int reserve(size_t count, bool decay);
+    // Lays out and zero-allocates parameter and gradient buffers for all reserved segments.
+    void allocate();
+
+    float* param(int segment) { return params_.get() + segments_[segment].offset; }
+    float* grad(int segment) { return grads_.get() + segments_[segment].offset; }
+    const float* param(int segment) const { return params_.get() + segments_[segment].offset; }
+    float* params() { return params_.get(); }
+    const float* params() const { return params_.get(); }
+    float* grads() { return grads_.get(); }
+    const float* grads() const { return grads_.get(); }
+    // Optimizer state slot (same layout as params), empty until the first step.
+    float* state(int slot) { return state_.get() + static_cast<size_t>(slot) * size_; }
+    int stateSize() const { return stateSize_; }
+    // Zero-allocates stateSize optimizer state slots unless that many already exist.
+    void reserveState(int stateSize);
+    // Total floats per buffer including alignment padding.
+    size_t size() const { return size_; }
+    size_t segmentSize(int segment) const { return segments_[segment].count; }
+    // Floats from the segment start to the next segment (size plus alignment padding).
+    size_t segmentSpan(int segment) const;
+    // The weight-decayed segments occupy [0, decaySize()) of every buffer.
+    size_t decaySize() const { return decaySize_; }
+
+    void zeroGrad();
+    // One optimizer step over the whole arena: a decayed sweep then an undecayed sweep, or one
+    // sweep per segment for layer-wise optimizers.
+    void step(NNOptimizer& optimizer, float learningRate);
+
+  private:
+    using AlignedBuffer = NNAllocator::Buffer;
+
+    struct Segment {
+        size_t count = 0;
+        size_t offset = 0;
+        bool decay = false;
+    };
+
+    std::vector<Segment> segments_;
+    AlignedBuffer params_;
+    AlignedBuffer grads_;
+    AlignedBuffer state_;
+    size_t size_ = 0;
+    size_t decaySize_ = 0;
+    int stateSize_ = 0;
+};
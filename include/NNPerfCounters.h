@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Opt-in hardware counters (Linux perf_event_open) around named regions: kernels (gemm, relu,
+// loss, optimizer...) and per-layer forward/backward. Counters are per thread and only count the
+// thread that activated them. Without perf access (other OS, perf_event_paranoid, no PMU in a
+// VM) regions still get wall time and GFLOP/s.
+//
+// Regions nest and are inclusive: a layer's forward also contains its gemm.
+class NNPerfCounters {
+  private:
+    const std::string TAG = "NNPerfCounters";
+
+  public:
+    enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, COUNTER_COUNT };
+
+    NNPerfCounters();
+    ~NNPerfCounters();
+    NNPerfCounters(const NNPerfCounters&) = delete;
+    NNPerfCounters& operator=(const NNPerfCounters&) = delete;
+
+    bool isAvailable(Counter counter) const { return slot_[counter] >= 0; }
+    // Peak GFLOP/s of one core for percent-of-peak columns. Measured with a short
+    // multiply-add loop built with this binary's flags unless set explicitly.
+    double getPeakGflops();
+    void setPeakGflops(double gflops) { peakGflops_ = gflops; }
+
+    // Starts region name on this thread, flops is the work it does. Returns its id for end().
+    int begin(const char* name, double flops = 0.0);
+    void end(int id);
+    // Totals of region name since the last report or reset, 0 for unknown regions.
+    uint64_t getCalls(const std::string& name) const;
+    double getFlops(const std::string& name) const;
+    // Logs one table row per region, then clears the totals.
+    void report(const std::string& title);
+    void reset();
+
+    // The counters regions on this thread go to, nullptr when none are active.
+    static NNPerfCounters* current();
+    // Makes counters current on this thread for the lifetime of the guard.
+    class Activation {
+      public:
+        explicit Activation(NNPerfCounters* counters);
+        ~Activation();
+        Activation(const Activation&) = delete;
+        Activation& operator=(const Activation&) = delete;
+
+      private:
+        NNPerfCounters* previous_;
+    };
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    using Values = std::array<uint64_t, COUNTER_COUNT>;
+    struct Region {
+        std::string name;
+        uint64_t calls = 0;
+        double seconds = 0.0;
+        double flops = 0.0;
+        Values counts{};
+    };
+    struct Open {
+        int id;
+        double flops;
+        Clock::time_point start;
+        Values counts;
+    };
+    Values read() const;
+
+    int leaderFd_ = -1;
+    std::vector<int> fds_;
+    // Position of each counter in the group read, -1 when unavailable.
+    std::array<int, COUNTER_COUNT> slot_;
+    double peakGflops_ = 0.0;
+    std::map<std::string, int> ids_;
+    std::vector<Region> regions_;
+    std::vector<Open> stack_;
+};
+
+// Counts the enclosing block as region name of the current thread's counters, if any.
+class NNPerfScope {
+  public:
+    explicit NNPerfScope(const char* name, double flops = 0.0)
+        : counters_(NNPerfCounters::current()) {
+        if (counters_) {
+            id_ = counters_->begin(name, flops);
+        }
+    }
+    ~NNPerfScope() {
+        if (counters_) {
+            counters_->end(id_);
+        }
+    }
+    NNPerfScope(const NNPerfScope&) = delete;
+    NNPerfScope& operator=(const NNPerfScope&) = delete;
+
+  private:
+    NNPerfCounters* counters_;
+    int id_ = -1;
+};
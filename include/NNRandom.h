@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Counter-based random numbers (Philox4x32-10). Element i of the stream (seed, stream) is a pure
+// function of (seed, stream, i), so bulk fills can be split across any number of threads and
+// still produce the same bits as a single thread, and independent streams (one per layer, per
+// epoch, ...) need no shared state.
+class NNRandom {
+  public:
+    static constexpr uint64_t DEFAULT_SEED = 0x5eed5eed2024ull;
+
+    explicit NNRandom(uint64_t seed = globalSeed(), uint64_t stream = 0)
+        : seed_(seed), stream_(stream) {}
+
+    // Seed used by default-constructed generators (and so by NeuralNetwork and NNUtils).
+    static void setGlobalSeed(uint64_t seed);
+    static uint64_t globalSeed();
+
+    uint64_t getSeed() const { return seed_; }
+    uint64_t getStream() const { return stream_; }
+    // An independent generator with the same seed.
+    NNRandom substream(uint64_t stream) const { return NNRandom(seed_, stream); }
+
+    // Random access into the stream.
+    uint32_t bitsAt(uint64_t index) const;
+    float uniformAt(uint64_t index) const { return toUnitFloat(bitsAt(index)); }
+
+    // Sequential draws, advancing an internal position in the stream.
+    uint32_t next() { return bitsAt(position_++); }
+    float uniform(float a, float b) { return a + (b - a) * toUnitFloat(next()); }
+
+    // out[i] = element offset + i of the stream. Work is split over threads (0 = hardware
+    // concurrency), the result does not depend on the split.
+    void fillBits(uint32_t* out, size_t count, uint64_t offset = 0, int threads = 0) const;
+    // out[i] uniform in [a, b), from element offset + i.
+    void fillUniform(float* out, size_t count, float a, float b, uint64_t offset = 0,
+                     int threads = 0) const;
+    // Uniformly random permutation of [0, n): bulk random draws, then a Fisher-Yates pass.
+    std::vector<uint32_t> permutation(size_t n, int threads = 0) const;
+
+    // One Philox4x32-10 block: four 32-bit outputs for a 128-bit counter and 64-bit key.
+    static std::array<uint32_t, 4> philox(std::array<uint32_t, 4> counter,
+                                          std::array<uint32_t, 2> key);
+    // 24 high bits to a float in [0, 1).
+    static float toUnitFloat(uint32_t bits) { return static_cast<float>(bits >> 8) * 0x1p-24f; }
+
+  private:
+    // Fills blocks [firstBlock, firstBlock + blockCount) into out (4 words per block).
+    void fillBlocks(uint32_t* out, uint64_t firstBlock, size_t blockCount) const;
+
+    uint64_t seed_;
+    uint64_t stream_;
+    uint64_t position_ = 0;
+};
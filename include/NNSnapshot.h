@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Everything needed to continue an interrupted training run: parameters, optimizer state and
+// where in the schedule the run was (epoch, next batch, shuffles drawn so far).
+struct NNSnapshot {
+    std::vector<int> config;
+    // The rest of the architecture: input shape {channels, height, width} and the outChannels,
+    // kernel, stride, padding and pool of every conv stage (both empty for an MLP), and whether
+    // hidden layers are batch-normalized. Version 1 files have none of it.
+    std::vector<int> inputShape;
+    std::vector<int> convSpecs;
+    int batchNorm = 0;
+    uint64_t seed = 0;
+    uint64_t shuffleCount = 0;
+    int epoch = 0;
+    int nextBatch = 0;
+    int optimizerStep = 0;
+    float epochLoss = 0.0f;
+    int stateSize = 0;
+    std::vector<float> params;
+    // stateSize slots of params.size() floats each.
+    std::vector<float> state;
+
+    // Writes to path + ".tmp", fsyncs it and renames it over path, so path always holds a
+    // complete snapshot. Throws std::runtime_error on I/O errors.
+    void write(const std::string& path) const;
+    // Returns false when path is missing, truncated or fails its checksum.
+    static bool read(const std::string& path, NNSnapshot& out);
+};
+
+// Writes snapshots on a background thread. Two snapshot buffers are recycled, so taking a
+// snapshot is a copy into preallocated memory and memory stays bounded: when both buffers are
+// still being written the new snapshot is skipped rather than queued.
+class NNSnapshotWriter {
+  public:
+    explicit NNSnapshotWriter(std::string path);
+    ~NNSnapshotWriter();
+    NNSnapshotWriter(const NNSnapshotWriter&) = delete;
+    NNSnapshotWriter& operator=(const NNSnapshotWriter&) = delete;
+
+    const std::string& getPath() const { return path_; }
+    // A free buffer to fill, or nullptr when both are busy.
+    NNSnapshot* acquire();
+    // Queues a buffer returned by acquire() for writing.
+    void submit(NNSnapshot* snapshot);
+    // Waits until every submitted snapshot is on disk.
+    void flush();
+    int getWritten() const;
+    int getSkipped() const;
+
+  private:
+    static constexpr int BUFFER_COUNT = 2;
+    void run();
+
+    const std::string TAG = "NNSnapshotWriter";
+    std::string path_;
+    NNSnapshot buffers_[BUFFER_COUNT];
+    std::vector<NNSnapshot*> free_;
+    std::deque<NNSnapshot*> queue_;
+    int writing_ = 0;
+    int written_ = 0;
+    int skipped_ = 0;
+    bool stop_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable queueCv_;
+    std::condition_variable doneCv_;
+    std::thread worker_;
+};
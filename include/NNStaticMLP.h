@@ -0,0 +1,143 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace NNStaticDetail {
+
+template <int In, int Out>
+struct Layer {
+    // Stored transposed (In x Out): each input scales one contiguous row of weights, which
+    // vectorizes without reassociating a reduction and lets zero inputs be skipped.
+    alignas(64) std::array<float, static_cast<size_t>(In) * Out> weightT;
+    alignas(64) std::array<float, Out> bias;
+
+    void load(const NNLayer& layer) {
+        if (layer.getInputSize() != In || layer.getOutputSize() != Out) {
+            throw std::runtime_error("Layer size mismatch, expected " + std::to_string(In) + "x" +
+                                     std::to_string(Out));
+        }
+        const float* w = layer.getWeight().data();
+        for (int i = 0; i < Out; i++) {
+            for (int k = 0; k < In; k++) {
+                weightT[static_cast<size_t>(k) * Out + i] = w[static_cast<size_t>(i) * In + k];
+            }
+        }
+        std::copy_n(layer.getBias().data(), Out, bias.data());
+    }
+
+    template <bool Relu>
+    void forward(const float* __restrict in, float* __restrict out) const {
+        std::copy_n(bias.data(), Out, out);
+        for (int k = 0; k < In; k++) {
+            const float x = in[k];
+            // Post-ReLU activations and image backgrounds are mostly zeros.
+            if (x == 0.0f) {
+                continue;
+            }
+            const float* w = weightT.data() + static_cast<size_t>(k) * Out;
+            for (int i = 0; i < Out; i++) {
+                out[i] += x * w[i];
+            }
+        }
+        if (Relu) {
+            for (int i = 0; i < Out; i++) {
+                out[i] = std::max(out[i], 0.0f);
+            }
+        }
+    }
+};
+
+template <int... Sizes>
+struct Layers;
+
+template <int In, int Out>
+struct Layers<In, Out> {
+    static constexpr int OUTPUT = Out;
+    Layer<In, Out> head;
+
+    void load(const NeuralNetwork& network, size_t l) { head.load(network.layers[l]); }
+    void forward(const float* in, float* out) const { head.template forward<false>(in, out); }
+};
+
+template <int In, int Out, int... Rest>
+struct Layers<In, Out, Rest...> {
+    static constexpr int OUTPUT = Layers<Out, Rest...>::OUTPUT;
+    Layer<In, Out> head;
+    Layers<Out, Rest...> tail;
+
+    void load(const NeuralNetwork& network, size_t l) {
+        head.load(network.layers[l]);
+        tail.load(network, l + 1);
+    }
+    void forward(const float* in, float* out) const {
+        alignas(64) float hidden[Out];
+        head.template forward<true>(in, hidden);
+        tail.forward(hidden, out);
+    }
+};
+
+template <int First, int... Rest>
+constexpr int first() {
+    return First;
+}
+
+} // namespace NNStaticDetail
+
+// Inference-only MLP whose topology is fixed at compile time, e.g. NNStaticMLP<784, 128, 64, 10>.
+// Weights sit in cache-line aligned std::arrays and every loop bound is a constant, so each
+// layer compiles to fully unrolled vector code and forward() never allocates. Hidden layers use
+// ReLU and forward() returns the raw logits, matching NeuralNetwork. The object holds every
+// weight inline (about 400 KB for 784-128-64-10), so allocate it on the heap.
+template <int... Sizes>
+class NNStaticMLP {
+    static_assert(sizeof...(Sizes) >= 2, "NNStaticMLP needs at least an input and an output size");
+
+  public:
+    static constexpr int LAYER_COUNT = sizeof...(Sizes) - 1;
+    static constexpr int INPUT_SIZE = NNStaticDetail::first<Sizes...>();
+    static constexpr int OUTPUT_SIZE = NNStaticDetail::Layers<Sizes...>::OUTPUT;
+    using Output = std::array<float, OUTPUT_SIZE>;
+
+    // Copies the weights of a trained network, throws std::runtime_error if its topology
+    // differs from Sizes or it has conv stages. Batch norms are folded into the dense layers
+    // first.
+    explicit NNStaticMLP(const NeuralNetwork& network) {
+        if (!network.getConvSpecs().empty()) {
+            throw std::runtime_error("NNStaticMLP cannot run conv stages");
+        }
+        if (network.hasBatchNorm()) {
+            load(network.foldBatchNorm());
+        } else {
+            load(network);
+        }
+    }
+
+    // input holds INPUT_SIZE floats (e.g. a normalized image), logits receives OUTPUT_SIZE.
+    void forward(const float* input, float* logits) const { layers_.forward(input, logits); }
+    Output forward(const float* input) const {
+        Output logits;
+        forward(input, logits.data());
+        return logits;
+    }
+    int predict(const float* input) const {
+        const Output logits = forward(input);
+        return static_cast<int>(std::max_element(logits.begin(), logits.end()) - logits.begin());
+    }
+
+  private:
+    void load(const NeuralNetwork& network) {
+        if (network.layers.size() != LAYER_COUNT) {
+            throw std::runtime_error("Expected " + std::to_string(LAYER_COUNT) + " layers, got " +
+                                     std::to_string(network.layers.size()));
+        }
+        layers_.load(network, 0);
+    }
+
+    NNStaticDetail::Layers<Sizes...> layers_;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "NNMatrix.h"
+#include "NNNuma.h"
+#include "NeuralNetwork.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One point of a hyperparameter sweep.
+struct NNTrialConfig {
+    std::vector<int> hidden;
+    float learningRate = 0.005f;
+    float momentum = 0.9f;
+    int batchSize = 16;
+
+    std::string describe() const;
+};
+
+struct NNTrialResult {
+    NNTrialConfig config;
+    uint64_t seed = 0;
+    // Epochs trained before the trial finished or was stopped.
+    int epochs = 0;
+    float loss = 0.0f;
+    float accuracy = 0.0f;
+    // The trial survived every rung and trained the full budget.
+    bool finished = false;
+};
+
+// Trains many networks on one dataset with successive halving. Every rung trains the surviving
+// trials concurrently on a pool of threads, then keeps the best 1/eta by validation accuracy and
+// grows the epoch budget by eta, until one trial is left or the budget reaches maxEpochs.
+// The samples are shared read-only by every trial, each trial only owns its own sample order.
+class NNSweep {
+  private:
+    const std::string TAG = "NNSweep";
+
+  public:
+    struct Options {
+        // 0 uses one thread per hardware thread.
+        int threads = 0;
+        // Epoch budget of the first rung.
+        int minEpochs = 1;
+        int maxEpochs = 8;
+        int eta = 2;
+        // Trial t trains from its own seed drawn from stream t of this seed.
+        uint64_t seed = NNRandom::DEFAULT_SEED;
+        // Lower the log level to warnings while trials train.
+        bool quietTrials = true;
+        // Pins the trial threads. A trial's network is built by the thread that first trains
+        // it, so its buffers sit on that thread's node.
+        NNPinPolicy pin = NNPinPolicy::None;
+    };
+
+    NNSweep(std::vector<NNMatrixPtr> X, std::vector<NNMatrixPtr> Y,
+            std::vector<NNMatrixPtr> validationX, std::vector<NNMatrixPtr> validationY,
+            Options options);
+    ~NNSweep();
+
+    // Runs the sweep and returns one result per trial, best first.
+    std::vector<NNTrialResult> run(const std::vector<NNTrialConfig>& trials);
+    // The network of the best trial of the last run().
+    NeuralNetwork* getBest() { return best_.get(); }
+
+    // Every combination of the given values.
+    static std::vector<NNTrialConfig> grid(const std::vector<std::vector<int>>& hidden,
+                                           const std::vector<float>& learningRates,
+                                           const std::vector<float>& momenta,
+                                           const std::vector<int>& batchSizes);
+
+  private:
+    struct Trial;
+    // Builds the trial's network, optimizer and sample order on the calling thread.
+    void buildTrial(Trial& trial) const;
+    // Trains every trial up to its target epochs, on up to options_.threads threads.
+    void trainRung(std::vector<Trial*>& trials, int targetEpochs);
+
+    std::vector<NNMatrixPtr> X_;
+    std::vector<NNMatrixPtr> Y_;
+    std::vector<NNMatrixPtr> validationX_;
+    std::vector<NNMatrixPtr> validationY_;
+    Options options_;
+    std::unique_ptr<NeuralNetwork> best_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "NNMatrix.h"
+#include "NNRandom.h"
 #include "nnlog/nnlog.h"
 
 #include <cstdint>
@@ -22,10 +23,30 @@ class NNUtils {
     static std::vector<NNMatrixPtr> read_mnist_data(const std::string& filePath);
     static std::vector<NNMatrixPtr> read_mnist_labels(const std::string& filePath);
     static void shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label);
-    static std::vector<NNMatrixPtr> getBatch(std::vector<NNMatrixPtr>& input, int batchNo,
+    // Same permutation of input and label for a given random stream.
+    static void shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label,
+                        const NNRandom& random);
+    // Same, also permuting the class index of every label.
+    static void shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label,
+                        std::vector<int>& labelIndices, const NNRandom& random);
+    static std::vector<NNMatrixPtr> getBatch(const std::vector<NNMatrixPtr>& input, int batchNo,
                                              int batchSize);
+    // Every worldSize-th sample starting at rank, truncated so all ranks get the same count.
+    static std::vector<NNMatrixPtr> shard(const std::vector<NNMatrixPtr>& input, int rank,
+                                          int worldSize);
+    // Draws from a per-thread stream of the global seed.
     static float random(float a, float b);
     static float xavierInit(int inputSize, int outputSize);
+    // Xavier/Glorot uniform initialization draws from [-limit, limit].
+    static float xavierLimit(int inputSize, int outputSize);
     static void normalizeMnistData(std::vector<NNMatrixPtr>& data);
     static void normalizeMnistLabel(std::vector<NNMatrixPtr>& labels);
+    static std::vector<int> toLabelIndices(const std::vector<NNMatrixPtr>& labels);
+    // Packs (size x 1) samples into out as a (size x batch) matrix, one sample per column.
+    static void packColumns(const std::vector<NNMatrixPtr>& samples, NNMatrix& out);
+    // Sparse counterpart of packColumns built from the samples' non-zero indices. Returns false
+    // when a sample has no index (out is then incomplete).
+    static bool packSparseColumns(const std::vector<NNMatrixPtr>& samples, NNSparseColumns& out);
+    // Nearest-rank q-quantile (q in [0, 1]) of values, 0 when empty. Reorders values.
+    static float percentile(std::vector<float>& values, double q);
 };
\ No newline at end of file
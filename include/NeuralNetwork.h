@@ -1,10 +1,22 @@
 #pragma once
 
+#include "NNActivationPlanner.h"
+#include "NNAugment.h"
+#include "NNCommunicator.h"
+#include "NNConvLayer.h"
 #include "NNLayer.h"
+#include "NNOptimizer.h"
+#include "NNParameterArena.h"
+#include "NNPerfCounters.h"
+#include "NNRandom.h"
+#include "NNSnapshot.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 class NeuralNetwork {
@@ -12,7 +24,26 @@ class NeuralNetwork {
     const std::string TAG = "NeuralNetwork";
 
   public:
-    NeuralNetwork(const std::vector<int>& config);
+    // Layer l is initialized from stream l of seed and epoch shuffles use their own streams,
+    // so a run is reproducible from the seed alone.
+    NeuralNetwork(const std::vector<int>& config, uint64_t seed = NNRandom::globalSeed());
+    // Convolutional network over inputs of inputShape {channels, height, width}: the convs
+    // stages in order, then dense layers from their flattened output through config[1..]. config[0]
+    // is the input size, channels * height * width. Conv stage s is initialized from stream
+    // CONV_STREAM + s. Conv networks always run through an NNGraph (see setGraphExecution).
+    // batchNorm puts a batch norm between every hidden dense layer and its ReLU, which also
+    // makes the network run through an NNGraph; the shift of the batch norm takes the place of
+    // the layer's bias. Either may be used without the other (empty inputShape and convs).
+    NeuralNetwork(const std::vector<int>& inputShape, const std::vector<NNConvSpec>& convs,
+                  const std::vector<int>& config, uint64_t seed = NNRandom::globalSeed(),
+                  bool batchNorm = false);
+    // A network of the architecture stored in snapshot (dense sizes, input shape, conv stages
+    // and batch norm), ready for resumeFromSnapshot.
+    static NeuralNetwork fromSnapshot(const NNSnapshot& snapshot);
+    // Layers hold views into the parameter arena, so networks move but do not copy.
+    NeuralNetwork(const NeuralNetwork&) = delete;
+    NeuralNetwork& operator=(const NeuralNetwork&) = delete;
+    NeuralNetwork(NeuralNetwork&&) = default;
     using TrainCallback =
         std::function<void(int epoch, int totalEpochs, float loss, float accuracy)>;
     using BatchCallback =
@@ -30,22 +61,238 @@ class NeuralNetwork {
                LayerCallback layerCallback = nullptr, BatchCallback batchCallback = nullptr,
                StopCallback stopCallback = nullptr,
                BatchStatsCallback batchStatsCallback = nullptr);
+    // Replaces the default SGD-momentum optimizer built from train()'s momentum argument.
+    void setOptimizer(NNOptimizerPtr optimizer) { optimizer_ = std::move(optimizer); }
+    // Replaces the constant learning rate passed to train().
+    void setLearningRateSchedule(NNLearningRateSchedulePtr schedule) {
+        schedule_ = std::move(schedule);
+    }
+    NNParameterArena& getParameters() { return parameters_; }
+    const NNParameterArena& getParameters() const { return parameters_; }
+    // Layer sizes from input to output, as passed to the constructor.
+    const std::vector<int>& getConfig() const { return config_; }
+    // Input shape and conv stages as passed to the constructor, empty for an MLP.
+    const std::vector<int>& getInputShape() const { return inputShape_; }
+    const std::vector<NNConvSpec>& getConvSpecs() const { return convSpecs_; }
+    bool hasBatchNorm() const { return batchNorm_; }
+    // The same network without batch norms: each one's running statistics, scale and shift are
+    // folded into the weight rows and bias of the dense layer before it, so inference runs the
+    // plain layers at no extra cost.
+    NeuralNetwork foldBatchNorm() const;
+    // Writes the parameters and architecture, with batch norms folded, as a snapshot that
+    // nn_score and nn_serve load like any other. Throws std::runtime_error on I/O errors.
+    void exportModel(const std::string& path) const;
+    // Data-parallel training: parameters are broadcast from rank 0 when train() starts and
+    // gradients are averaged across ranks in buckets while backward is still running. Batch
+    // norm running statistics are averaged after every epoch. Each rank passes its own shard of
+    // the training data to train().
+    void setCommunicator(NNCommunicatorPtr communicator, size_t bucketBytes = 1 << 20);
+    // Large-batch mode: gradients of microBatches consecutive batches of train()'s batchSize are
+    // accumulated before one optimizer step, so the effective batch is microBatches * batchSize.
+    // Pair with NNLARSOptimizer or NNLAMBOptimizer to keep very large batches stable.
+    void setGradientAccumulation(int microBatches) {
+        accumulationSteps_ = std::max(1, microBatches);
+    }
+    // Batches whose non-zero fraction is below threshold run the first layer's forward and
+    // weight gradient on the non-zeros only. Inputs need a non-zero index (built by
+    // NNUtils::normalizeMnistData). 0 always uses the dense path.
+    void setSparseInputThreshold(float threshold) { sparseInputThreshold_ = threshold; }
+    // Record hidden-layer ReLU masks as bitsets during forward so backward gates dz with them
+    // instead of re-deriving the derivative from the saved activations (on by default).
+    void setReluMasks(bool enabled);
+    // Inverted dropout: every hidden unit of a training batch is zeroed with probability rate
+    // and the others are scaled by 1 / (1 - rate), so evaluation and inference run unchanged.
+    // The keep mask is a bitset drawn per batch from the seed and the batch's sample number, and
+    // is applied inside the ReLU kernel; the ReLU mask then gates dz for both. Graph batches
+    // (graph execution, conv and batch norm networks) draw the same masks and apply them in the
+    // fused bias + ReLU pass, so the graph is rebuilt on next use. 0 disables it.
+    void setDropout(float rate) {
+        dropoutRate_ = std::clamp(rate, 0.0f, 0.95f);
+        graph_.reset();
+    }
+    // Bytes of the activation workspace for a batch: the peak of simultaneously live
+    // activations, dz and scratch buffers under the static plan. Use it to pick a batch size
+    // whose working set stays in L2/L3.
+    size_t getPeakActivationBytes(int batchSize);
+    // Snapshots parameters, optimizer state and the training position every everySteps
+    // optimizer steps. The copy is taken at the step boundary and written to path on a
+    // background thread. An empty path or everySteps <= 0 disables snapshots.
+    void setSnapshots(const std::string& path, int everySteps);
+    // Loads a snapshot written by setSnapshots or exportModel. The next train() call then
+    // continues from the snapshot's epoch and batch, given the same training data in the same
+    // initial order. Returns false when there is no usable snapshot for this network (same
+    // architecture) at path.
+    bool resumeFromSnapshot(const std::string& path);
+    // Gradient checkpointing: only the outputs of the listed hidden layers (plus the input and
+    // the logits) are kept from forward until backward. Every run of hidden layers in between is
+    // recomputed from the kept output below it when backward reaches it, so each segment trades
+    // one extra forward pass for its activations. Empty keeps every output (the default).
+    void setCheckpoints(const std::vector<int>& hiddenLayers);
+    // Checkpoints every interval-th hidden layer; about sqrt(layers) balances memory against
+    // recomputation. 1 or less keeps every output.
+    void setCheckpointInterval(int interval);
+    // Augments every training batch (not evaluation batches) after it is packed. Sample i of
+    // epoch shuffle k gets its own random stream, so augmented runs stay reproducible and
+    // resumable. Augmented batches always take the dense input path. nullptr disables it.
+    void setAugmentation(std::shared_ptr<const NNAugmenter> augmenter, int threads = 1) {
+        augmenter_ = std::move(augmenter);
+        augmentThreads_ = threads;
+    }
+    // Batched inference: fill the (inputSize x batch) matrix returned by beginInference with one
+    // sample per column, then runInference returns the logits (outputSize x batch). Both use the
+    // training workspace, so inference must not overlap with train() or another inference.
+    NNMatrix& beginInference(int batch);
+    const NNMatrix& runInference();
+    // Trains, evaluates and runs inference through an NNGraph compiled from the layers, which
+    // fuses bias + ReLU and softmax + cross-entropy and plans its own workspace, instead of the
+    // hand-written forward and backward. Graph batches always run dense with every activation
+    // kept, so the sparse input path, checkpoints and layer callbacks do not apply to them.
+    void setGraphExecution(bool enabled) { useGraph_ = enabled; }
+    // Counts the kernels and every layer's forward and backward on the training thread and
+    // reports them at the end of each epoch, evaluation included. nullptr disables it.
+    void setPerfCounters(std::shared_ptr<NNPerfCounters> counters) {
+        perf_ = std::move(counters);
+    }
 
   private:
-    NNMatrix forward(int epic, int batchNo, const std::vector<NNMatrixPtr>& X,
-                     LayerCallback layerCallback);
-    void backward(const std::vector<NNMatrixPtr>& X, const std::vector<NNMatrixPtr>& Y,
-                  float learningRate, float momentum, int epic, int batchNo,
+    // augmentSample is the sample number of the batch's first column for the augmenter, or -1
+    // for batches that are not augmented.
+    const NNMatrix& forward(int epic, int batchNo, const std::vector<NNMatrixPtr>& X,
+                            LayerCallback layerCallback, bool training,
+                            int64_t augmentSample = -1);
+    // Whether batches run through graph_: when asked to, and always for conv and batch norm
+    // networks.
+    bool graphMode() const { return useGraph_ || !convLayers.empty() || batchNorm_; }
+    // Compiles graph_ from the conv stages and layers on first use.
+    void ensureGraph();
+    // Forward through graph_; augmentSample as for forward(). Batch norms use the batch's
+    // statistics when training and their running ones otherwise.
+    const NNMatrix& forwardGraph(const std::vector<NNMatrixPtr>& X, int64_t augmentSample,
+                                 bool training);
+    void backward(float gradScale, bool reduceGradients, int epic, int batchNo,
                   LayerCallback layerCallback);
-    float loss(std::vector<NNMatrixPtr>& Y);
-    float calculateCrossEntropyLoss(const NNMatrix& actual, const NNMatrix& expect);
-    NNMatrix calculateDW(const NNMatrix& input, const NNMatrix& dz);
+    // The hand-written backward of every layer, reducing each gradient once it is final.
+    void backwardLayers(float gradScale, bool reduce, int epic, int batchNo,
+                        LayerCallback layerCallback);
+    void reduceLayerGradient(int layerIndex);
+    // Averages the batch norm running statistics over the data-parallel ranks, which only
+    // gradients keep in sync: each rank's come from its own shard. Called after every epoch.
+    void averageBatchNormStatistics();
+    void takeSnapshot(const NNOptimizer& optimizer, int epoch, int nextBatch, float epochLoss);
+    // Fills the architecture fields of snapshot (config, input shape, conv stages, batch norm).
+    void describeArchitecture(NNSnapshot& snapshot) const;
+    // Runs layer l on the current batch (or its kept/recomputed input) into layerOutputs[l].
+    // ReLU masks are only recorded, and dropout only applied, when training.
+    void forwardLayer(int l, bool training = true);
+    // Recomputes the run of dropped hidden outputs just below layer top, before its backward.
+    void recomputeSegment(int top);
+    // Describes every per-batch buffer's lifetime to the planner and plans the workspace.
+    void planActivations();
+    // Points the batch buffers below at the workspace, shaped for batch samples.
+    void bindActivations(int batch);
+    // Mean loss of the current batch against batchLabels_.
+    float loss();
+    // Share of x_test whose prediction matches labels, one class index per sample.
     float accuracy(int epic, const std::vector<NNMatrixPtr>& x_test,
-                   const std::vector<NNMatrixPtr>& y_test);
+                   const std::vector<int>& labels);
     NNMatrix predict(int epic, NNMatrixPtr x);
     int argmax(const NNMatrix& x);
 
+    static constexpr int EVAL_BATCH_SIZE = 256;
+    // First random stream used for epoch shuffles, below it are the layer initializers.
+    static constexpr uint64_t SHUFFLE_STREAM = 1ull << 32;
+    // First random stream of the conv stage initializers.
+    static constexpr uint64_t CONV_STREAM = 1ull << 31;
+    // First random stream of the per-layer dropout masks.
+    static constexpr uint64_t DROPOUT_STREAM = 1ull << 30;
+
+    // Current batch packed one sample per column (inputSize x batch), its class indices, and
+    // the fused loss results for the output-layer logits in layerOutputs.back(). The loss
+    // gradient goes to dzs_.back().
+    NNMatrix batchInput_{1, 1};
+    std::vector<int> batchLabels_;
+    std::vector<int> batchPredictions_;
+    // Sparse copy of the current batch, used by the first layer when useSparseInput_ is set.
+    NNSparseColumns batchSparse_;
+    bool useSparseInput_ = false;
+    float sparseInputThreshold_ = 0.5f;
+
+    NNParameterArena parameters_;
+    std::vector<int> weightSegments_;
+    std::vector<int> biasSegments_;
+    std::vector<int> convWeightSegments_;
+    std::vector<int> convBiasSegments_;
+    // Per hidden layer with a batch norm: gamma, beta, running mean and running variance, one
+    // outputSize run each. The running statistics never get a gradient, so the optimizers leave
+    // them alone, while snapshots and NNBatchScorer replicas still carry them.
+    std::vector<int> normSegments_;
+    bool batchNorm_ = false;
+    NNCommunicatorPtr communicator_;
+    std::unique_ptr<NNGradientBucketer> bucketer_;
+    // Per-layer dz of the batch being back-propagated (outputSize x batch) and per-layer
+    // scratch for the transposed layer input (batch x inputSize).
+    std::vector<NNMatrix> dzs_;
+    std::vector<NNMatrix> inputTs_;
+    // batchInput_, layerOutputs, dzs_ and inputTs_ are views into this workspace.
+    NNActivationPlanner activations_;
+    int inputBuffer_ = -1;
+    std::vector<int> outputBuffers_;
+    std::vector<int> dzBuffers_;
+    std::vector<int> inputTBuffers_;
+    // Buffers for recomputed outputs of the layers whose output is not kept, -1 otherwise.
+    std::vector<int> recomputeBuffers_;
+    std::vector<bool> keepOutput_;
+    int batch_ = 0;
+    // Per hidden layer, which units of layerOutputs were active (one bit per element).
+    std::vector<NNBitMask> reluMasks_;
+    bool useReluMasks_ = true;
+    float dropoutRate_ = 0.0f;
+    // Keep mask of the layer being run; the ReLU masks carry it on to backward.
+    NNBitMask dropoutMask_;
+    // Sample number of the current training batch's first column across all epochs, which
+    // places its dropout draws in each layer's stream.
+    int64_t batchSample_ = 0;
+    int accumulationSteps_ = 1;
+    uint64_t seed_;
+    // Epochs shuffled so far, across train() calls.
+    uint64_t shuffleCount_ = 0;
+    std::shared_ptr<const NNAugmenter> augmenter_;
+    int augmentThreads_ = 1;
+    std::vector<int> config_;
+    std::vector<int> inputShape_;
+    std::vector<NNConvSpec> convSpecs_;
+    std::unique_ptr<NNSnapshotWriter> snapshotWriter_;
+    int snapshotEvery_ = 0;
+    // Position restored by resumeFromSnapshot for the next train() call.
+    struct ResumePoint {
+        bool pending = false;
+        uint64_t shuffleCount = 0;
+        int epoch = 0;
+        int nextBatch = 0;
+        int optimizerStep = 0;
+        int stateSize = 0;
+        float epochLoss = 0.0f;
+    };
+    ResumePoint resume_;
+    NNOptimizerPtr optimizer_;
+    NNLearningRateSchedulePtr schedule_;
+    std::shared_ptr<NNPerfCounters> perf_;
+    bool useGraph_ = false;
+    std::unique_ptr<NNGraph> graph_;
+    NNGraph::Value graphInput_ = -1;
+    NNGraph::Value graphLogits_ = -1;
+    // Per hidden layer, the keep mask of the current graph batch when dropout is on.
+    std::vector<NNBitMask> graphDropoutMasks_;
+    // Region names of each layer for the perf counters.
+    std::vector<std::string> perfForwardNames_;
+    std::vector<std::string> perfBackwardNames_;
+
   public:
+    // Conv stages from the input, empty for an MLP.
+    std::vector<NNConvLayer> convLayers;
+    // Dense layers, after the conv stages.
     std::vector<NNLayer> layers;
-    std::vector<std::vector<NNMatrix>> layerOutputs;
+    // Per-layer activations of the current batch, one sample per column. Views into the
+    // activation workspace, valid until the next forward.
+    std::vector<NNMatrix> layerOutputs;
 };
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "NNActivationPlanner.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace {
+constexpr size_t FLOATS_PER_LINE = NNActivationPlanner::ALIGNMENT / sizeof(float);
+} // namespace
+
+void NNActivationPlanner::clear() {
+    buffers_.clear();
+    peakRows_ = 0;
+    totalRows_ = 0;
+    planned_ = false;
+}
+
+int NNActivationPlanner::add(int rows, int firstStep, int lastStep) {
+    assert(rows > 0 && firstStep <= lastStep);
+    Buffer buffer;
+    buffer.rows = static_cast<size_t>(rows);
+    buffer.firstStep = firstStep;
+    buffer.lastStep = lastStep;
+    buffers_.push_back(buffer);
+    planned_ = false;
+    return static_cast<int>(buffers_.size()) - 1;
+}
+
+void NNActivationPlanner::plan() {
+    std::vector<int> order(buffers_.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = static_cast<int>(i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [this](int a, int b) { return buffers_[a].rows > buffers_[b].rows; });
+
+    peakRows_ = 0;
+    totalRows_ = 0;
+    std::vector<int> placed;
+    std::vector<std::pair<size_t, size_t>> taken;
+    for (int id : order) {
+        Buffer& buffer = buffers_[id];
+        // Memory ranges of already placed buffers that are live at the same time as this one.
+        taken.clear();
+        for (int other : placed) {
+            const Buffer& o = buffers_[other];
+            if (o.firstStep <= buffer.lastStep && buffer.firstStep <= o.lastStep) {
+                taken.emplace_back(o.offset, o.offset + o.rows);
+            }
+        }
+        std::sort(taken.begin(), taken.end());
+        size_t offset = 0;
+        for (const auto& range : taken) {
+            if (offset + buffer.rows <= range.first) {
+                break;
+            }
+            offset = std::max(offset, range.second);
+        }
+        buffer.offset = offset;
+        placed.push_back(id);
+        peakRows_ = std::max(peakRows_, offset + buffer.rows);
+        totalRows_ += buffer.rows;
+    }
+    planned_ = true;
+}
+
+void NNActivationPlanner::reserve(int batch) {
+    assert(planned_);
+    const size_t count = peakRows_ * stride(batch);
+    if (count <= workspaceSize_ && workspace_) {
+        return;
+    }
+    workspace_ = NNAllocator::allocateBuffer(count);
+    workspaceSize_ = count;
+}
+
+float* NNActivationPlanner::data(int id, int batch) {
+    assert(planned_ && (buffers_[id].offset + buffers_[id].rows) * stride(batch) <= workspaceSize_);
+    return workspace_.get() + buffers_[id].offset * stride(batch);
+}
+
+size_t NNActivationPlanner::stride(int batch) {
+    return (static_cast<size_t>(batch) + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+}
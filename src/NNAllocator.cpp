@@ -0,0 +1,220 @@
+#include "NNAllocator.h"
+
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+const std::string NNAllocator::TAG = "NNAllocator";
+
+namespace {
+struct Mapping {
+    // Length of the whole mapping, the part of it the buffer uses, and whether it is on
+    // explicit huge pages.
+    size_t mapBytes = 0;
+    size_t bytes = 0;
+    bool explicitHuge = false;
+};
+
+struct State {
+    std::mutex mutex;
+    NNAllocator::Policy policy;
+    // Mapped buffers by address. Buffers below HUGE_PAGE are never mapped and skip the lookup.
+    std::map<uintptr_t, Mapping> mappings;
+    size_t mappedBytes = 0;
+    size_t explicitHugeBytes = 0;
+    std::atomic<size_t> liveBytes{0};
+};
+
+// Never destroyed, so buffers of static objects can still be freed at exit.
+State& state() {
+    static State* instance = new State();
+    return *instance;
+}
+
+size_t roundUp(size_t bytes, size_t unit) { return (bytes + unit - 1) / unit * unit; }
+
+float* heapAllocate(size_t bytes) {
+    return static_cast<float*>(
+        ::operator new[](std::max<size_t>(bytes, 1), std::align_val_t(NNAllocator::ALIGNMENT)));
+}
+
+#ifdef __linux__
+// A HUGE_PAGE-aligned anonymous mapping of bytes (a multiple of HUGE_PAGE), nullptr on failure.
+void* mapHuge(size_t bytes, bool explicitHuge) {
+    if (explicitHuge) {
+        void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        return mem == MAP_FAILED ? nullptr : mem;
+    }
+    // Over-map by one huge page and trim, so the kernel can back the range with whole pages.
+    const size_t padded = bytes + NNAllocator::HUGE_PAGE;
+    void* mem = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(mem);
+    const uintptr_t aligned = roundUp(start, NNAllocator::HUGE_PAGE);
+    if (aligned > start) {
+        munmap(mem, aligned - start);
+    }
+    const size_t tail = start + padded - (aligned + bytes);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+    }
+    madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+    return reinterpret_cast<void*>(aligned);
+}
+
+// Bytes of the advised buffers in [start, end).
+size_t advisedOverlap(const std::map<uintptr_t, Mapping>& ranges, uintptr_t start,
+                      uintptr_t end) {
+    size_t overlap = 0;
+    auto it = ranges.upper_bound(start);
+    if (it != ranges.begin()) {
+        --it;
+    }
+    for (; it != ranges.end() && it->first < end; ++it) {
+        const uintptr_t first = std::max(start, it->first);
+        const uintptr_t last = std::min(end, it->first + it->second.bytes);
+        if (!it->second.explicitHuge && first < last) {
+            overlap += last - first;
+        }
+    }
+    return overlap;
+}
+
+// AnonHugePages of the smaps entries holding advised buffers. The kernel may merge adjacent
+// mappings into one entry, so each entry counts at most the bytes it shares with them.
+size_t residentHugeBytes(const std::map<uintptr_t, Mapping>& ranges) {
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    size_t overlap = 0;
+    size_t total = 0;
+    while (std::getline(smaps, line)) {
+        uintptr_t start = 0;
+        uintptr_t end = 0;
+        unsigned long kb = 0;
+        if (std::sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            overlap = advisedOverlap(ranges, start, end);
+        } else if (overlap > 0 && std::sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) == 1) {
+            total += std::min(overlap, static_cast<size_t>(kb) * 1024);
+        }
+    }
+    return total;
+}
+#endif
+} // namespace
+
+void NNAllocator::setPolicy(const Policy& policy) {
+    State& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    st.policy = policy;
+    st.policy.hugeThreshold = std::max(st.policy.hugeThreshold, HUGE_PAGE);
+}
+
+NNAllocator::Policy NNAllocator::getPolicy() {
+    State& st = state();
+    std::lock_guard<std::mutex> lock(st.mutex);
+    return st.policy;
+}
+
+float* NNAllocator::allocate(size_t count) {
+    State& st = state();
+    const size_t bytes = count * sizeof(float);
+    st.liveBytes += bytes;
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE) {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        if (st.policy.hugePages != HugePages::Off && bytes >= st.policy.hugeThreshold) {
+            const size_t mapBytes = roundUp(bytes, HUGE_PAGE);
+            bool explicitHuge = st.policy.hugePages == HugePages::Explicit;
+            void* mem = mapHuge(mapBytes, explicitHuge);
+            if (mem == nullptr && explicitHuge) {
+                explicitHuge = false;
+                mem = mapHuge(mapBytes, false);
+            }
+            if (mem != nullptr) {
+                st.mappings[reinterpret_cast<uintptr_t>(mem)] = {mapBytes, bytes, explicitHuge};
+                st.mappedBytes += bytes;
+                st.explicitHugeBytes += explicitHuge ? bytes : 0;
+                return static_cast<float*>(mem);
+            }
+        }
+    }
+#endif
+    return heapAllocate(bytes);
+}
+
+void NNAllocator::deallocate(float* ptr, size_t count) {
+    if (ptr == nullptr) {
+        return;
+    }
+    State& st = state();
+    const size_t bytes = count * sizeof(float);
+    st.liveBytes -= bytes;
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE) {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        auto it = st.mappings.find(reinterpret_cast<uintptr_t>(ptr));
+        if (it != st.mappings.end()) {
+            munmap(ptr, it->second.mapBytes);
+            st.mappedBytes -= bytes;
+            st.explicitHugeBytes -= it->second.explicitHuge ? bytes : 0;
+            st.mappings.erase(it);
+            return;
+        }
+    }
+#endif
+    ::operator delete[](ptr, std::align_val_t(ALIGNMENT));
+}
+
+NNAllocator::Buffer NNAllocator::allocateBuffer(size_t count) {
+    float* mem = allocate(count);
+    std::fill_n(mem, count, 0.0f);
+    return Buffer(mem, Deleter{count});
+}
+
+std::shared_ptr<float> NNAllocator::allocateShared(size_t count) {
+    float* mem = allocate(count);
+    std::fill_n(mem, count, 0.0f);
+    return std::shared_ptr<float>(mem, Deleter{count});
+}
+
+NNAllocator::Stats NNAllocator::getStats() {
+    State& st = state();
+    Stats stats;
+    stats.liveBytes = st.liveBytes;
+    std::map<uintptr_t, Mapping> ranges;
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        stats.mappedBytes = st.mappedBytes;
+        stats.explicitHugeBytes = st.explicitHugeBytes;
+        stats.advisedBytes = st.mappedBytes - st.explicitHugeBytes;
+        ranges = st.mappings;
+    }
+    stats.hugeBackedBytes = stats.explicitHugeBytes;
+#ifdef __linux__
+    stats.hugeBackedBytes += residentHugeBytes(ranges);
+#endif
+    return stats;
+}
+
+void NNAllocator::logStats() {
+    const Stats stats = getStats();
+    const double mb = 1024.0 * 1024.0;
+    LOG << "Buffers " << stats.liveBytes / mb << " MB, " << stats.mappedBytes / mb
+        << " MB in large mappings (" << stats.explicitHugeBytes / mb << " MB explicit huge pages, "
+        << stats.advisedBytes / mb << " MB advised), " << stats.hugeBackedBytes / mb
+        << " MB huge-page backed" << std::endl;
+}
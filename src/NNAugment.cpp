@@ -0,0 +1,242 @@
+#include "NNAugment.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace {
+// Sample s draws from stream AUGMENT_STREAM + s, clear of the layer and shuffle streams.
+constexpr uint64_t AUGMENT_STREAM = 1ull << 48;
+// Stream elements: 0-3 the affine parameters, 4.. the elastic grid, NOISE_OFFSET.. the noise.
+constexpr uint64_t ELASTIC_OFFSET = 4;
+constexpr uint64_t NOISE_OFFSET = 1 << 20;
+// Zero border around the source so every bilinear tap is in bounds without branches.
+constexpr int PAD = 2;
+
+void cellsOf(int pixels, int grid, std::vector<int>& cell, std::vector<float>& frac) {
+    cell.resize(pixels);
+    frac.resize(pixels);
+    for (int i = 0; i < pixels; i++) {
+        const float g = pixels > 1 ? static_cast<float>(i) * grid / (pixels - 1) : 0.0f;
+        cell[i] = std::min(static_cast<int>(g), grid - 1);
+        frac[i] = g - cell[i];
+    }
+}
+} // namespace
+
+struct NNAugmenter::Scratch {
+    Scratch(int width, int height, int grid)
+        : padded(static_cast<size_t>(width + 2 * PAD) * (height + 2 * PAD), 0.0f),
+          sx(width * height), sy(width * height), noise(2 * width * height),
+          controlX((grid + 1) * (grid + 1)), controlY((grid + 1) * (grid + 1)), rowX(grid + 1),
+          rowY(grid + 1), in(width * height), out(width * height) {}
+    std::vector<float> padded;
+    // Source coordinates of every output pixel.
+    std::vector<float> sx;
+    std::vector<float> sy;
+    std::vector<uint32_t> noise;
+    std::vector<float> controlX;
+    std::vector<float> controlY;
+    std::vector<float> rowX;
+    std::vector<float> rowY;
+    // Float copies of 8-bit images.
+    std::vector<float> in;
+    std::vector<float> out;
+};
+
+NNAugmenter::NNAugmenter(Options options, int width, int height, uint64_t seed)
+    : options_(options), width_(width), height_(height), seed_(seed) {
+    options_.elasticGrid = std::max(1, options_.elasticGrid);
+    cellsOf(width_, options_.elasticGrid, columnCell_, columnFrac_);
+    cellsOf(height_, options_.elasticGrid, rowCell_, rowFrac_);
+}
+
+void NNAugmenter::augment(const float* in, float* out, uint64_t sample, float maxValue,
+                          Scratch& scratch) const {
+    const int w = width_;
+    const int h = height_;
+    const int n = w * h;
+    const int stride = w + 2 * PAD;
+    const NNRandom random(seed_, AUGMENT_STREAM + sample);
+
+    float* padded = scratch.padded.data();
+    for (int y = 0; y < h; y++) {
+        std::memcpy(padded + static_cast<size_t>(y + PAD) * stride + PAD, in + y * w,
+                    w * sizeof(float));
+    }
+
+    // Output pixel p samples the source at c + R(-angle) (p - c - shift) / scale.
+    const float shiftX = (2.0f * random.uniformAt(0) - 1.0f) * options_.maxShift;
+    const float shiftY = (2.0f * random.uniformAt(1) - 1.0f) * options_.maxShift;
+    const float angle = (2.0f * random.uniformAt(2) - 1.0f) * options_.maxRotation *
+                        static_cast<float>(M_PI / 180.0);
+    const float scale =
+        options_.minScale + (options_.maxScale - options_.minScale) * random.uniformAt(3);
+    const float a = std::cos(angle) / scale;
+    const float b = std::sin(angle) / scale;
+    const float cx = 0.5f * (w - 1);
+    const float cy = 0.5f * (h - 1);
+    float* sx = scratch.sx.data();
+    float* sy = scratch.sy.data();
+    for (int y = 0; y < h; y++) {
+        const float v = y - cy - shiftY;
+        float* rowX = sx + y * w;
+        float* rowY = sy + y * w;
+        for (int x = 0; x < w; x++) {
+            const float u = x - cx - shiftX;
+            rowX[x] = cx + a * u + b * v;
+            rowY[x] = cy - b * u + a * v;
+        }
+    }
+
+    if (options_.elasticAlpha > 0.0f) {
+        const int points = options_.elasticGrid + 1;
+        float* controlX = scratch.controlX.data();
+        float* controlY = scratch.controlY.data();
+        for (int k = 0; k < points * points; k++) {
+            controlX[k] = (2.0f * random.uniformAt(ELASTIC_OFFSET + 2 * k) - 1.0f) *
+                          options_.elasticAlpha;
+            controlY[k] = (2.0f * random.uniformAt(ELASTIC_OFFSET + 2 * k + 1) - 1.0f) *
+                          options_.elasticAlpha;
+        }
+        float* gridX = scratch.rowX.data();
+        float* gridY = scratch.rowY.data();
+        const int* column = columnCell_.data();
+        const float* columnFrac = columnFrac_.data();
+        for (int y = 0; y < h; y++) {
+            // Interpolate the control rows around y, then along every column.
+            const float fy = rowFrac_[y];
+            const float* top = controlX + rowCell_[y] * points;
+            const float* topY = controlY + rowCell_[y] * points;
+            for (int j = 0; j < points; j++) {
+                gridX[j] = top[j] + fy * (top[j + points] - top[j]);
+                gridY[j] = topY[j] + fy * (topY[j + points] - topY[j]);
+            }
+            float* rowX = sx + y * w;
+            float* rowY = sy + y * w;
+            for (int x = 0; x < w; x++) {
+                const int c = column[x];
+                const float fx = columnFrac[x];
+                rowX[x] += gridX[c] + fx * (gridX[c + 1] - gridX[c]);
+                rowY[x] += gridY[c] + fx * (gridY[c + 1] - gridY[c]);
+            }
+        }
+    }
+
+    // Clamp into the zero border, so taps outside the image read zeros.
+    const float maxX = static_cast<float>(w);
+    const float maxY = static_cast<float>(h);
+    for (int i = 0; i < n; i++) {
+        sx[i] = std::min(std::max(sx[i], -1.0f), maxX);
+        sy[i] = std::min(std::max(sy[i], -1.0f), maxY);
+    }
+    for (int i = 0; i < n; i++) {
+        // Coordinates are >= -1, so truncating x + PAD floors it into padded coordinates.
+        const int ix = static_cast<int>(sx[i] + PAD);
+        const int iy = static_cast<int>(sy[i] + PAD);
+        const float fx = sx[i] + PAD - ix;
+        const float fy = sy[i] + PAD - iy;
+        const float* p = padded + static_cast<size_t>(iy) * stride + ix;
+        const float top = p[0] + fx * (p[1] - p[0]);
+        const float bottom = p[stride] + fx * (p[stride + 1] - p[stride]);
+        out[i] = top + fy * (bottom - top);
+    }
+
+    if (options_.noiseStddev > 0.0f) {
+        // Sum of four 16-bit uniforms (Irwin-Hall), rescaled to zero mean and unit variance.
+        uint32_t* bits = scratch.noise.data();
+        random.fillBits(bits, 2 * static_cast<size_t>(n), NOISE_OFFSET, 1);
+        const float amplitude = std::sqrt(3.0f) * options_.noiseStddev * maxValue;
+        for (int i = 0; i < n; i++) {
+            const uint32_t b0 = bits[2 * i];
+            const uint32_t b1 = bits[2 * i + 1];
+            const float sum = static_cast<float>((b0 & 0xffff) + (b0 >> 16) + (b1 & 0xffff) +
+                                                 (b1 >> 16));
+            out[i] += (sum * (1.0f / 65536.0f) - 2.0f) * amplitude;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = std::min(std::max(out[i], 0.0f), maxValue);
+    }
+}
+
+template <typename Pixel>
+void NNAugmenter::applyRange(const Pixel* in, Pixel* out, int count, uint64_t firstSample,
+                             float maxValue) const {
+    const int n = getImageSize();
+    Scratch scratch(width_, height_, options_.elasticGrid);
+    for (int i = 0; i < count; i++) {
+        const Pixel* src = in + static_cast<size_t>(i) * n;
+        Pixel* dst = out + static_cast<size_t>(i) * n;
+        if constexpr (std::is_same_v<Pixel, float>) {
+            augment(src, dst, firstSample + i, maxValue, scratch);
+        } else {
+            std::copy(src, src + n, scratch.in.begin());
+            augment(scratch.in.data(), scratch.out.data(), firstSample + i, maxValue, scratch);
+            for (int k = 0; k < n; k++) {
+                dst[k] = static_cast<Pixel>(scratch.out[k] + 0.5f);
+            }
+        }
+    }
+}
+
+namespace {
+// Splits count images into contiguous ranges, one per thread.
+template <typename Fn> void splitImages(int count, int threads, Fn fn) {
+    threads = std::max(1, std::min(threads, count));
+    std::vector<std::thread> workers;
+    const int per = (count + threads - 1) / threads;
+    for (int t = 1; t < threads; t++) {
+        const int begin = t * per;
+        const int end = std::min(count, begin + per);
+        if (begin < end) {
+            workers.emplace_back(fn, begin, end);
+        }
+    }
+    fn(0, std::min(count, per));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+} // namespace
+
+void NNAugmenter::apply(const float* in, float* out, int count, uint64_t firstSample,
+                        int threads) const {
+    splitImages(count, threads, [&](int begin, int end) {
+        const size_t offset = static_cast<size_t>(begin) * getImageSize();
+        applyRange(in + offset, out + offset, end - begin, firstSample + begin, 1.0f);
+    });
+}
+
+void NNAugmenter::apply(const uint8_t* in, uint8_t* out, int count, uint64_t firstSample,
+                        int threads) const {
+    splitImages(count, threads, [&](int begin, int end) {
+        const size_t offset = static_cast<size_t>(begin) * getImageSize();
+        applyRange(in + offset, out + offset, end - begin, firstSample + begin, 255.0f);
+    });
+}
+
+void NNAugmenter::applyColumns(NNMatrix& batch, uint64_t firstSample, int threads) const {
+    const int n = getImageSize();
+    const int count = batch.getColSize();
+    if (batch.getRowSize() != n || count == 0) {
+        return;
+    }
+    // Images are columns of the batch, augment them as contiguous rows of its transpose.
+    std::vector<float> images(static_cast<size_t>(count) * n);
+    std::vector<float> augmented(images.size());
+    float* data = batch.data();
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < count; j++) {
+            images[static_cast<size_t>(j) * n + i] = data[static_cast<size_t>(i) * count + j];
+        }
+    }
+    apply(images.data(), augmented.data(), count, firstSample, threads);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < count; j++) {
+            data[static_cast<size_t>(i) * count + j] = augmented[static_cast<size_t>(j) * n + i];
+        }
+    }
+}
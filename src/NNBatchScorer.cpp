@@ -0,0 +1,334 @@
+#include "NNBatchScorer.h"
+
+#include "NNUtils.h"
+#include "NNVectorMath.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+constexpr uint32_t IDX_IMAGE_MAGIC = 2051;
+
+uint32_t readBigEndian(const uint8_t* bytes) {
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) |
+           uint32_t(bytes[3]);
+}
+
+// Reads exactly bytes unless the file ends first, returns the bytes read.
+size_t readFully(int fd, uint8_t* out, size_t bytes) {
+    size_t done = 0;
+    while (done < bytes) {
+        const ssize_t got = ::read(fd, out + done, bytes - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            throw std::runtime_error(std::string("Read failed: ") + std::strerror(errno));
+        }
+        if (got == 0) {
+            break;
+        }
+        done += static_cast<size_t>(got);
+    }
+    return done;
+}
+
+void writeFully(int fd, const char* data, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t put = ::write(fd, data, bytes);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+        }
+        data += put;
+        bytes -= static_cast<size_t>(put);
+    }
+}
+} // namespace
+
+NNImageStream::NNImageStream(const std::string& path, int packedImageSize) {
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw std::runtime_error("Unable to open " + path);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (packedImageSize > 0) {
+        struct stat st {};
+        fstat(fd_, &st);
+        imageSize_ = packedImageSize;
+        count_ = st.st_size / packedImageSize;
+    } else {
+        uint8_t header[16];
+        if (readFully(fd_, header, sizeof(header)) != sizeof(header) ||
+            readBigEndian(header) != IDX_IMAGE_MAGIC) {
+            close(fd_);
+            throw std::runtime_error("Invalid mnist image file!");
+        }
+        count_ = readBigEndian(header + 4);
+        imageSize_ = static_cast<int>(readBigEndian(header + 8) * readBigEndian(header + 12));
+    }
+    remaining_ = count_;
+}
+
+NNImageStream::~NNImageStream() { close(fd_); }
+
+int NNImageStream::read(uint8_t* out, int maxImages) {
+    const int wanted = static_cast<int>(std::min<int64_t>(maxImages, remaining_));
+    if (wanted <= 0) {
+        return 0;
+    }
+    const size_t got = readFully(fd_, out, static_cast<size_t>(wanted) * imageSize_);
+    const int images = static_cast<int>(got / imageSize_);
+    // A truncated file ends at its last complete image.
+    remaining_ = images < wanted ? 0 : remaining_ - images;
+    return images;
+}
+
+struct NNBatchScorer::Chunk {
+    int64_t seq = 0;
+    int64_t firstIndex = 0;
+    int count = 0;
+    std::vector<uint8_t> pixels;
+    std::string out;
+};
+
+// Chunks move free -> ready (read) -> done (scored) -> free (written).
+struct NNBatchScorer::Pipeline {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Chunk*> free;
+    std::deque<Chunk*> ready;
+    std::map<int64_t, Chunk*> done;
+    bool readerDone = false;
+    int64_t chunksRead = 0;
+    bool abort = false;
+    std::string error;
+
+    void fail(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!abort) {
+            error = message;
+            abort = true;
+        }
+        changed.notify_all();
+    }
+};
+
+NNBatchScorer::NNBatchScorer(const NeuralNetwork& network, Options options)
+    : options_(options), inputSize_(network.getConfig().front()),
+      classes_(network.getConfig().back()) {
+    if (options_.threads <= 0) {
+        options_.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    options_.batchSize = std::max(1, options_.batchSize);
+    options_.chunkImages = std::max(options_.batchSize, options_.chunkImages);
+    options_.topK = std::clamp(options_.topK, 1, classes_);
+
+    const NNParameterArena& params = network.getParameters();
+    for (int t = 0; t < options_.threads; t++) {
+        workers_.push_back(std::make_unique<NeuralNetwork>(
+            network.getInputShape(), network.getConvSpecs(), network.getConfig(),
+            NNRandom::globalSeed(), network.hasBatchNorm()));
+        std::copy_n(params.params(), params.size(), workers_.back()->getParameters().params());
+    }
+}
+
+NNBatchScorer::~NNBatchScorer() = default;
+
+int64_t NNBatchScorer::score(NNImageStream& input, const std::string& outputPath) {
+    if (input.getImageSize() != inputSize_) {
+        throw std::runtime_error("Images have " + std::to_string(input.getImageSize()) +
+                                 " pixels, the network expects " + std::to_string(inputSize_));
+    }
+    const bool toStdout = outputPath == "-";
+    const int outFd =
+        toStdout ? STDOUT_FILENO : open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) {
+        throw std::runtime_error("Unable to open " + outputPath);
+    }
+
+    // Two spare chunks let reading and writing proceed while every worker is busy.
+    std::vector<Chunk> chunks(workers_.size() + 2);
+    Pipeline pipeline;
+    for (Chunk& chunk : chunks) {
+        chunk.pixels.resize(static_cast<size_t>(options_.chunkImages) * inputSize_);
+        pipeline.free.push_back(&chunk);
+    }
+
+    std::thread reader([&] {
+        int64_t seq = 0;
+        int64_t index = 0;
+        while (true) {
+            Chunk* chunk = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(pipeline.mutex);
+                pipeline.changed.wait(lock,
+                                      [&] { return pipeline.abort || !pipeline.free.empty(); });
+                if (pipeline.abort) {
+                    break;
+                }
+                chunk = pipeline.free.front();
+                pipeline.free.pop_front();
+            }
+            try {
+                chunk->count = input.read(chunk->pixels.data(), options_.chunkImages);
+            } catch (const std::exception& e) {
+                pipeline.fail(e.what());
+                break;
+            }
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            if (chunk->count == 0) {
+                pipeline.free.push_back(chunk);
+                break;
+            }
+            chunk->seq = seq++;
+            chunk->firstIndex = index;
+            index += chunk->count;
+            pipeline.ready.push_back(chunk);
+            pipeline.changed.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.readerDone = true;
+        pipeline.chunksRead = seq;
+        pipeline.changed.notify_all();
+    });
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < workers_.size(); w++) {
+        workers.emplace_back([&, w, net = workers_[w].get()] {
+            NNNuma::system().placeWorker(static_cast<int>(w), options_.pin);
+            while (true) {
+                Chunk* chunk = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(pipeline.mutex);
+                    pipeline.changed.wait(lock, [&] {
+                        return pipeline.abort || !pipeline.ready.empty() || pipeline.readerDone;
+                    });
+                    if (pipeline.abort || pipeline.ready.empty()) {
+                        return;
+                    }
+                    chunk = pipeline.ready.front();
+                    pipeline.ready.pop_front();
+                }
+                scoreChunk(*net, *chunk);
+                std::lock_guard<std::mutex> lock(pipeline.mutex);
+                pipeline.done[chunk->seq] = chunk;
+                pipeline.changed.notify_all();
+            }
+        });
+    }
+
+    // Write finished chunks in input order on this thread.
+    int64_t scored = 0;
+    for (int64_t next = 0;; next++) {
+        Chunk* chunk = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&] {
+                return pipeline.abort || pipeline.done.count(next) > 0 ||
+                       (pipeline.readerDone && next == pipeline.chunksRead);
+            });
+            if (pipeline.abort || pipeline.done.count(next) == 0) {
+                break;
+            }
+            chunk = pipeline.done[next];
+            pipeline.done.erase(next);
+        }
+        try {
+            writeFully(outFd, chunk->out.data(), chunk->out.size());
+        } catch (const std::exception& e) {
+            pipeline.fail(e.what());
+            break;
+        }
+        scored += chunk->count;
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.free.push_back(chunk);
+        pipeline.changed.notify_all();
+    }
+
+    reader.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (!toStdout && close(outFd) != 0 && pipeline.error.empty()) {
+        pipeline.error = std::string("Write failed: ") + std::strerror(errno);
+    }
+    if (!pipeline.error.empty()) {
+        throw std::runtime_error(pipeline.error);
+    }
+    LOG << "Scored " << scored << " images into " << outputPath << std::endl;
+    return scored;
+}
+
+void NNBatchScorer::scoreChunk(NeuralNetwork& network, Chunk& chunk) const {
+    const int topK = options_.topK;
+    chunk.out.clear();
+    std::vector<int> order(classes_);
+    std::vector<float> probabilities(classes_);
+    char line[32];
+
+    for (int b0 = 0; b0 < chunk.count; b0 += options_.batchSize) {
+        const int n = std::min(options_.batchSize, chunk.count - b0);
+        NNMatrix& input = network.beginInference(n);
+        float* x = input.data();
+        const uint8_t* pixels = chunk.pixels.data() + static_cast<size_t>(b0) * inputSize_;
+        for (int j = 0; j < n; j++) {
+            const uint8_t* image = pixels + static_cast<size_t>(j) * inputSize_;
+            for (int i = 0; i < inputSize_; i++) {
+                x[static_cast<size_t>(i) * n + j] = image[i] / 255.0f;
+            }
+        }
+        const float* z = network.runInference().data();
+
+        for (int j = 0; j < n; j++) {
+            float zMax = z[j];
+            for (int k = 1; k < classes_; k++) {
+                zMax = std::max(zMax, z[static_cast<size_t>(k) * n + j]);
+            }
+            float sum = 0.0f;
+            for (int k = 0; k < classes_; k++) {
+                probabilities[k] = NNVectorMath::exp(z[static_cast<size_t>(k) * n + j] - zMax);
+                sum += probabilities[k];
+            }
+            std::iota(order.begin(), order.end(), 0);
+            std::partial_sort(order.begin(), order.begin() + topK, order.end(),
+                              [&](int a, int c) { return probabilities[a] > probabilities[c]; });
+
+            if (options_.csv) {
+                std::snprintf(line, sizeof(line), "%lld",
+                              static_cast<long long>(chunk.firstIndex + b0 + j));
+                chunk.out += line;
+                for (int k = 0; k < topK; k++) {
+                    std::snprintf(line, sizeof(line), ",%d,%.6f", order[k],
+                                  probabilities[order[k]] / sum);
+                    chunk.out += line;
+                }
+                chunk.out += '\n';
+            } else {
+                for (int k = 0; k < topK; k++) {
+                    const int32_t label = order[k];
+                    const float probability = probabilities[order[k]] / sum;
+                    chunk.out.append(reinterpret_cast<const char*>(&label), sizeof(label));
+                    chunk.out.append(reinterpret_cast<const char*>(&probability),
+                                     sizeof(probability));
+                }
+            }
+        }
+    }
+}
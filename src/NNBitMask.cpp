@@ -0,0 +1,77 @@
+#include "NNBitMask.h"
+
+#include <algorithm>
+#include <cassert>
+
+void NNBitMask::resize(size_t bits) {
+    bits_ = bits;
+    words_.assign((bits + WORD_BITS - 1) / WORD_BITS, 0u);
+}
+
+void NNBitMask::record(const NNMatrix& m) {
+    const size_t count = static_cast<size_t>(m.getRowSize()) * m.getColSize();
+    if (count != bits_) {
+        resize(count);
+    }
+    const float* src = m.data();
+    const size_t fullWords = count / WORD_BITS;
+    for (size_t w = 0; w < fullWords; w++) {
+        const float* block = src + w * WORD_BITS;
+        uint32_t word = 0;
+        for (size_t b = 0; b < WORD_BITS; b++) {
+            word |= static_cast<uint32_t>(block[b] > 0.0f) << b;
+        }
+        words_[w] = word;
+    }
+    if (fullWords < words_.size()) {
+        uint32_t word = 0;
+        for (size_t b = 0; fullWords * WORD_BITS + b < count; b++) {
+            word |= static_cast<uint32_t>(src[fullWords * WORD_BITS + b] > 0.0f) << b;
+        }
+        words_[fullWords] = word;
+    }
+}
+
+void NNBitMask::sample(const NNRandom& random, uint64_t offset, size_t bits,
+                       float keepProbability) {
+    if (bits != bits_) {
+        resize(bits);
+    }
+    // A unit is kept when its 32-bit draw falls below keepProbability * 2^32.
+    const uint64_t threshold = static_cast<uint64_t>(
+        std::clamp(static_cast<double>(keepProbability), 0.0, 1.0) * 4294967296.0);
+    // Draws go through a stack buffer in chunks of whole words.
+    constexpr size_t CHUNK = 32 * WORD_BITS;
+    uint32_t draws[CHUNK];
+    for (size_t start = 0; start < bits; start += CHUNK) {
+        const size_t count = std::min(CHUNK, bits - start);
+        random.fillBits(draws, count, offset + start, 1);
+        for (size_t w = 0; w * WORD_BITS < count; w++) {
+            const size_t wordBits = std::min(WORD_BITS, count - w * WORD_BITS);
+            const uint32_t* block = draws + w * WORD_BITS;
+            uint32_t word = 0;
+            for (size_t b = 0; b < wordBits; b++) {
+                word |= static_cast<uint32_t>(block[b] < threshold) << b;
+            }
+            words_[start / WORD_BITS + w] = word;
+        }
+    }
+}
+
+void NNBitMask::apply(NNMatrix& m, float scale) const {
+    const size_t count = static_cast<size_t>(m.getRowSize()) * m.getColSize();
+    assert(count == bits_);
+    float* dst = m.data();
+    const size_t fullWords = count / WORD_BITS;
+    // Written as a select rather than a branch so it vectorizes into a blend.
+    for (size_t w = 0; w < fullWords; w++) {
+        const uint32_t word = words_[w];
+        float* block = dst + w * WORD_BITS;
+        for (size_t b = 0; b < WORD_BITS; b++) {
+            block[b] = ((word >> b) & 1u) ? block[b] * scale : 0.0f;
+        }
+    }
+    for (size_t i = fullWords * WORD_BITS; i < count; i++) {
+        dst[i] = test(i) ? dst[i] * scale : 0.0f;
+    }
+}
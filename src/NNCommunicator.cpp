@@ -0,0 +1,446 @@
+#include "NNCommunicator.h"
+
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const std::string TAG = "NNCommunicator";
+
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+void setSocketOptions(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+sockaddr_in resolve(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr) {
+        throw std::runtime_error("Unable to resolve " + host);
+    }
+    sockaddr_in addr = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    freeaddrinfo(result);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return addr;
+}
+} // namespace
+
+void NNTransport::sendRecv(const void* sendBuf, size_t sendBytes, void* recvBuf,
+                           size_t recvBytes) {
+    const auto* src = static_cast<const char*>(sendBuf);
+    auto* dst = static_cast<char*>(recvBuf);
+    size_t sent = 0;
+    size_t received = 0;
+    while (sent < sendBytes || received < recvBytes) {
+        bool progress = false;
+        if (sent < sendBytes) {
+            size_t n = trySend(src + sent, sendBytes - sent);
+            sent += n;
+            progress = progress || n > 0;
+        }
+        if (received < recvBytes) {
+            size_t n = tryRecv(dst + received, recvBytes - received);
+            received += n;
+            progress = progress || n > 0;
+        }
+        if (!progress) {
+            waitForProgress(sent < sendBytes, received < recvBytes);
+        }
+    }
+}
+
+NNTcpTransport::NNTcpTransport(int rank, int worldSize, const std::string& host, int basePort,
+                               int timeoutMs)
+    : NNTransport(rank, worldSize) {
+    if (worldSize <= 1) {
+        return;
+    }
+
+    const int next = (rank + 1) % worldSize;
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in listenAddr = resolve(host, basePort + rank);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&listenAddr), sizeof(listenAddr)) != 0 ||
+        listen(listenFd, 1) != 0) {
+        close(listenFd);
+        throw std::runtime_error("Unable to listen on port " + std::to_string(basePort + rank));
+    }
+
+    // Every rank listens first, then connects to its successor, then accepts its predecessor,
+    // so the ring forms regardless of start-up order.
+    const auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    sockaddr_in nextAddr = resolve(host, basePort + next);
+    while (true) {
+        nextFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(nextFd_, reinterpret_cast<sockaddr*>(&nextAddr), sizeof(nextAddr)) == 0) {
+            break;
+        }
+        close(nextFd_);
+        nextFd_ = -1;
+        if (Clock::now() > deadline) {
+            close(listenFd);
+            throw std::runtime_error("Timed out connecting to rank " + std::to_string(next));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    pollfd pfd{listenFd, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0 || (prevFd_ = accept(listenFd, nullptr, nullptr)) < 0) {
+        close(listenFd);
+        throw std::runtime_error("Timed out waiting for the previous rank");
+    }
+    close(listenFd);
+
+    setSocketOptions(nextFd_);
+    setSocketOptions(prevFd_);
+    LOG << "Rank " << rank << "/" << worldSize << " joined tcp ring on " << host << ":"
+        << basePort;
+}
+
+NNTcpTransport::~NNTcpTransport() {
+    if (nextFd_ >= 0) {
+        close(nextFd_);
+    }
+    if (prevFd_ >= 0) {
+        close(prevFd_);
+    }
+}
+
+size_t NNTcpTransport::trySend(const void* buf, size_t bytes) {
+    ssize_t n = send(nextFd_, buf, bytes, SEND_FLAGS);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+    }
+    return static_cast<size_t>(n);
+}
+
+size_t NNTcpTransport::tryRecv(void* buf, size_t bytes) {
+    ssize_t n = recv(prevFd_, buf, bytes, 0);
+    if (n == 0) {
+        throw std::runtime_error("Previous rank closed the connection");
+    }
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        throw std::runtime_error(std::string("recv failed: ") + std::strerror(errno));
+    }
+    return static_cast<size_t>(n);
+}
+
+void NNTcpTransport::waitForProgress(bool wantSend, bool wantRecv) {
+    pollfd fds[2];
+    int count = 0;
+    if (wantSend) {
+        fds[count++] = {nextFd_, POLLOUT, 0};
+    }
+    if (wantRecv) {
+        fds[count++] = {prevFd_, POLLIN, 0};
+    }
+    poll(fds, count, 100);
+}
+
+// Byte queue with one producer (previous rank) and one consumer (owning rank). head and tail
+// are running byte counts, each written by one side only.
+struct NNShmTransport::Channel {
+    static constexpr size_t CAPACITY = 1 << 20;
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) unsigned char data[CAPACITY];
+};
+
+struct NNShmTransport::Header {
+    alignas(64) std::atomic<uint32_t> ready{0};
+    uint32_t worldSize = 0;
+};
+
+NNShmTransport::NNShmTransport(int rank, int worldSize, const std::string& name, int timeoutMs)
+    : NNTransport(rank, worldSize), name_(name) {
+    if (worldSize <= 1) {
+        return;
+    }
+
+    memSize_ = sizeof(Header) + sizeof(Channel) * static_cast<size_t>(worldSize);
+    const auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    int fd = -1;
+    if (rank == 0) {
+        shm_unlink(name_.c_str());
+        fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(memSize_)) != 0) {
+            throw std::runtime_error("Unable to create shared memory " + name_);
+        }
+    } else {
+        struct stat st{};
+        while ((fd = shm_open(name_.c_str(), O_RDWR, 0600)) < 0 || fstat(fd, &st) != 0 ||
+               static_cast<size_t>(st.st_size) < memSize_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (Clock::now() > deadline) {
+                throw std::runtime_error("Timed out attaching shared memory " + name_);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    mem_ = mmap(nullptr, memSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem_ == MAP_FAILED) {
+        mem_ = nullptr;
+        throw std::runtime_error("Unable to map shared memory " + name_);
+    }
+
+    auto* header = static_cast<Header*>(mem_);
+    auto* channels = reinterpret_cast<Channel*>(static_cast<char*>(mem_) + sizeof(Header));
+    if (rank == 0) {
+        new (header) Header();
+        header->worldSize = static_cast<uint32_t>(worldSize);
+        for (int r = 0; r < worldSize; r++) {
+            new (&channels[r].head) std::atomic<uint64_t>(0);
+            new (&channels[r].tail) std::atomic<uint64_t>(0);
+        }
+        header->ready.store(1, std::memory_order_release);
+    } else {
+        while (header->ready.load(std::memory_order_acquire) == 0) {
+            if (Clock::now() > deadline) {
+                throw std::runtime_error("Timed out waiting for shared memory " + name_);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    inbox_ = &channels[rank];
+    outbox_ = &channels[(rank + 1) % worldSize];
+    LOG << "Rank " << rank << "/" << worldSize << " joined shm ring " << name_;
+}
+
+NNShmTransport::~NNShmTransport() {
+    if (mem_ != nullptr) {
+        munmap(mem_, memSize_);
+    }
+    if (rank_ == 0 && worldSize_ > 1) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+size_t NNShmTransport::trySend(const void* buf, size_t bytes) {
+    const uint64_t head = outbox_->head.load(std::memory_order_relaxed);
+    const uint64_t tail = outbox_->tail.load(std::memory_order_acquire);
+    const size_t n = std::min<size_t>(bytes, Channel::CAPACITY - (head - tail));
+    if (n == 0) {
+        return 0;
+    }
+
+    const size_t pos = head % Channel::CAPACITY;
+    const size_t first = std::min(n, Channel::CAPACITY - pos);
+    std::memcpy(outbox_->data + pos, buf, first);
+    std::memcpy(outbox_->data, static_cast<const char*>(buf) + first, n - first);
+    outbox_->head.store(head + n, std::memory_order_release);
+    return n;
+}
+
+size_t NNShmTransport::tryRecv(void* buf, size_t bytes) {
+    const uint64_t tail = inbox_->tail.load(std::memory_order_relaxed);
+    const uint64_t head = inbox_->head.load(std::memory_order_acquire);
+    const size_t n = std::min<size_t>(bytes, head - tail);
+    if (n == 0) {
+        return 0;
+    }
+
+    const size_t pos = tail % Channel::CAPACITY;
+    const size_t first = std::min(n, Channel::CAPACITY - pos);
+    std::memcpy(buf, inbox_->data + pos, first);
+    std::memcpy(static_cast<char*>(buf) + first, inbox_->data, n - first);
+    inbox_->tail.store(tail + n, std::memory_order_release);
+    return n;
+}
+
+void NNShmTransport::waitForProgress(bool wantSend, bool wantRecv) { std::this_thread::yield(); }
+
+NNCommunicator::NNCommunicator(std::unique_ptr<NNTransport> transport)
+    : transport_(std::move(transport)) {
+    if (getWorldSize() > 1) {
+        worker_ = std::thread(&NNCommunicator::run, this);
+    }
+}
+
+NNCommunicator::~NNCommunicator() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    jobCv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void NNCommunicator::allReduce(float* data, size_t count, bool average) {
+    wait();
+    ringAllReduce(data, count, average);
+}
+
+void NNCommunicator::broadcast(float* data, size_t count, int root) {
+    const int worldSize = getWorldSize();
+    if (worldSize <= 1 || count == 0) {
+        return;
+    }
+    wait();
+
+    // Pass the buffer along the ring: everyone but the root receives, everyone but the root's
+    // predecessor forwards.
+    const int rank = getRank();
+    const size_t bytes = count * sizeof(float);
+    if (rank != root) {
+        transport_->sendRecv(nullptr, 0, data, bytes);
+    }
+    if ((rank + 1) % worldSize != root) {
+        transport_->sendRecv(data, bytes, nullptr, 0);
+    }
+}
+
+void NNCommunicator::allReduceAsync(float* data, size_t count, bool average) {
+    if (getWorldSize() <= 1 || count == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back({data, count, average});
+        pending_++;
+    }
+    jobCv_.notify_one();
+}
+
+void NNCommunicator::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void NNCommunicator::run() {
+    while (true) {
+        Job job{};
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobCv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        ringAllReduce(job.data, job.count, job.average);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+        }
+        doneCv_.notify_all();
+    }
+}
+
+void NNCommunicator::ringAllReduce(float* data, size_t count, bool average) {
+    const int worldSize = getWorldSize();
+    if (worldSize <= 1 || count == 0) {
+        return;
+    }
+
+    const int rank = getRank();
+    auto chunkBegin = [&](int chunk) { return count * static_cast<size_t>(chunk) / worldSize; };
+    auto chunkSize = [&](int chunk) { return chunkBegin(chunk + 1) - chunkBegin(chunk); };
+    recvChunk_.resize(chunkSize(worldSize - 1) + 1);
+
+    // Reduce-scatter: after worldSize - 1 steps rank r holds the full sum of chunk r + 1.
+    for (int step = 0; step < worldSize - 1; step++) {
+        const int sendChunk = (rank - step + worldSize) % worldSize;
+        const int recvChunk = (rank - step - 1 + worldSize) % worldSize;
+        const size_t recvCount = chunkSize(recvChunk);
+        transport_->sendRecv(data + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(float),
+                             recvChunk_.data(), recvCount * sizeof(float));
+        float* dst = data + chunkBegin(recvChunk);
+        const float* src = recvChunk_.data();
+        for (size_t i = 0; i < recvCount; i++) {
+            dst[i] += src[i];
+        }
+    }
+
+    const int ownedChunk = (rank + 1) % worldSize;
+    if (average) {
+        const float scale = 1.0f / static_cast<float>(worldSize);
+        float* owned = data + chunkBegin(ownedChunk);
+        const size_t ownedCount = chunkSize(ownedChunk);
+        for (size_t i = 0; i < ownedCount; i++) {
+            owned[i] *= scale;
+        }
+    }
+
+    // All-gather: circulate the reduced chunks.
+    for (int step = 0; step < worldSize - 1; step++) {
+        const int sendChunk = (ownedChunk - step + worldSize) % worldSize;
+        const int recvChunk = (ownedChunk - step - 1 + worldSize) % worldSize;
+        transport_->sendRecv(data + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(float),
+                             data + chunkBegin(recvChunk), chunkSize(recvChunk) * sizeof(float));
+    }
+}
+
+NNGradientBucketer::NNGradientBucketer(NNCommunicator& communicator, size_t bucketBytes)
+    : communicator_(communicator), bucketFloats_(std::max<size_t>(bucketBytes / sizeof(float), 1)) {
+}
+
+void NNGradientBucketer::add(float* data, size_t count) {
+    if (count_ > 0 && data + count != start_) {
+        flush();
+    }
+    start_ = data;
+    count_ += count;
+    if (count_ >= bucketFloats_) {
+        flush();
+    }
+}
+
+void NNGradientBucketer::flush() {
+    if (count_ > 0) {
+        communicator_.allReduceAsync(start_, count_);
+    }
+    start_ = nullptr;
+    count_ = 0;
+}
+
+void NNGradientBucketer::finish() {
+    flush();
+    communicator_.wait();
+}
@@ -0,0 +1,50 @@
+#include "NNConvLayer.h"
+
+#include "NNUtils.h"
+
+#include <algorithm>
+
+NNConvLayer::NNConvLayer(int channels, int height, int width, const NNConvSpec& spec,
+                         const NNRandom& random)
+    : window{channels, height, width, spec.kernel, spec.stride, spec.padding},
+      pool(std::max(spec.pool, 1)), weight(spec.outChannels, channels * spec.kernel * spec.kernel),
+      bias(spec.outChannels, 1), dWeight(spec.outChannels, channels * spec.kernel * spec.kernel),
+      dBias(spec.outChannels, 1) {
+    const int area = spec.kernel * spec.kernel;
+    const float limit = NNUtils::xavierLimit(channels * area, spec.outChannels * area);
+    const size_t weightCount = static_cast<size_t>(weight.getRowSize()) * weight.getColSize();
+    random.fillUniform(weight.data(), weightCount, -limit, limit);
+    random.fillUniform(bias.data(), spec.outChannels, -limit, limit, weightCount);
+}
+
+NNGraph::Window NNConvLayer::poolWindow() const {
+    return {getOutChannels(), window.outHeight(), window.outWidth(), pool, pool, 0};
+}
+
+int NNConvLayer::getOutHeight() const {
+    return pool > 1 ? poolWindow().outHeight() : window.outHeight();
+}
+
+int NNConvLayer::getOutWidth() const {
+    return pool > 1 ? poolWindow().outWidth() : window.outWidth();
+}
+
+NNGraph::Value NNConvLayer::addToGraph(NNGraph& graph, NNGraph::Value input) {
+    const NNGraph::Value w = graph.parameter(weight.getRowSize(), weight.getColSize(),
+                                             weight.data(), dWeight.data());
+    const NNGraph::Value b = graph.parameter(bias.getRowSize(), 1, bias.data(), dBias.data());
+    // One bias per channel, so the bias add fuses with the ReLU.
+    NNGraph::Value x = graph.relu(graph.addBias(graph.conv2d(w, input, window), b));
+    if (pool > 1) {
+        x = graph.maxPool(x, poolWindow());
+    }
+    return x;
+}
+
+void NNConvLayer::bindParameters(float* weightMem, float* biasMem, float* dWeightMem,
+                                 float* dBiasMem) {
+    weight.rebind(weightMem);
+    bias.rebind(biasMem);
+    dWeight.rebind(dWeightMem);
+    dBias.rebind(dBiasMem);
+}
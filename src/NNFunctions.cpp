@@ -1,16 +1,14 @@
 #include "NNFunctions.h"
 
+#include "NNPerfCounters.h"
 #include "NNUtils.h"
+#include "NNVectorMath.h"
+
+#include <algorithm>
+#include <cassert>
 
 const std::string NNFunctions::TAG = "NNFunctions";
-MatrixFunc NNFunctions::SigmoidFunc = [](float x) {
-    if (x < -700)
-        return 0.0f;
-    else if (x > 700)
-        return 1.0f;
-    else
-        return 1.0f / (1.0f + std::exp(-x));
-};
+MatrixFunc NNFunctions::SigmoidFunc = [](float x) { return NNVectorMath::sigmoid(x); };
 
 MatrixFunc NNFunctions::SigmoidDrevative = [](float y) { return y * (1 - y); };
 
@@ -29,7 +27,7 @@ NNMatrix NNFunctions::softmax(const NNMatrix& input) {
     float colMax = input.getColMax(0);
     float sum = 0.0f;
     for (int i = 0; i < rows; i++) {
-        float val = std::expf(input.get(i, 0) - colMax);
+        float val = NNVectorMath::exp(input.get(i, 0) - colMax);
         sum += val;
         ret.set(i, 0, val);
     }
@@ -37,4 +35,111 @@ NNMatrix NNFunctions::softmax(const NNMatrix& input) {
     sum = std::max(sum, 1e-5f);
     ret /= sum;
     return ret;
-}
\ No newline at end of file
+}
+
+void NNFunctions::relu(NNMatrix& z, NNBitMask* mask, const NNBitMask* keep, float keepScale) {
+    const size_t count = static_cast<size_t>(z.getRowSize()) * z.getColSize();
+    NNPerfScope scope("relu", static_cast<double>(count));
+    float* data = z.data();
+    if (keep != nullptr) {
+        assert(keep->size() == count);
+        // One select per element, a word of the mask at a time, so it vectorizes like the plain
+        // ReLU.
+        constexpr size_t WORD_BITS = NNBitMask::WORD_BITS;
+        const uint32_t* words = keep->words();
+        const size_t fullWords = count / WORD_BITS;
+        for (size_t w = 0; w < fullWords; w++) {
+            const uint32_t word = words[w];
+            float* block = data + w * WORD_BITS;
+            for (size_t b = 0; b < WORD_BITS; b++) {
+                block[b] = ((word >> b) & 1u) ? std::max(block[b], 0.0f) * keepScale : 0.0f;
+            }
+        }
+        for (size_t i = fullWords * WORD_BITS; i < count; i++) {
+            data[i] = keep->test(i) ? std::max(data[i], 0.0f) * keepScale : 0.0f;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            data[i] = std::max(data[i], 0.0f);
+        }
+    }
+    if (mask != nullptr) {
+        mask->record(z);
+    }
+}
+
+float NNFunctions::softmaxCrossEntropy(const NNMatrix& logits, const std::vector<int>& labels,
+                                       NNMatrix& dlogits, std::vector<int>& predictions) {
+    const int classes = logits.getRowSize();
+    const int batch = logits.getColSize();
+    assert(static_cast<int>(labels.size()) == batch);
+    if (classes <= 0 || batch <= 0) {
+        LOG << "Invalid logits, row size " << classes << ", col size " << batch << std::endl;
+        return 0.0f;
+    }
+    NNPerfScope scope("softmax_loss");
+
+    if (dlogits.getRowSize() != classes || dlogits.getColSize() != batch) {
+        dlogits = NNMatrix(classes, batch);
+    }
+    predictions.resize(static_cast<size_t>(batch));
+
+    // Per-sample running max and exp-sum. Samples are contiguous within a row, so every sweep
+    // below walks memory linearly and vectorizes across the batch.
+    static thread_local std::vector<float> colMax;
+    static thread_local std::vector<float> colSum;
+    colMax.assign(static_cast<size_t>(batch), 0.0f);
+    colSum.assign(static_cast<size_t>(batch), 0.0f);
+
+    const float* z = logits.data();
+    float* dz = dlogits.data();
+
+    std::copy_n(z, batch, colMax.data());
+    std::fill(predictions.begin(), predictions.end(), 0);
+    for (int c = 1; c < classes; c++) {
+        const float* row = z + static_cast<size_t>(c) * batch;
+        for (int j = 0; j < batch; j++) {
+            if (row[j] > colMax[j]) {
+                colMax[j] = row[j];
+                predictions[j] = c;
+            }
+        }
+    }
+
+    for (int c = 0; c < classes; c++) {
+        const float* row = z + static_cast<size_t>(c) * batch;
+        float* dRow = dz + static_cast<size_t>(c) * batch;
+        for (int j = 0; j < batch; j++) {
+            const float e = NNVectorMath::exp(row[j] - colMax[j]);
+            dRow[j] = e;
+            colSum[j] += e;
+        }
+    }
+
+    // loss_j = log(sum_c exp(z_cj - max_j)) - (z_label,j - max_j). The logs go first, in one
+    // vectorized sweep, because the label gather keeps the loop below scalar.
+    static thread_local std::vector<float> logSum;
+    logSum.resize(static_cast<size_t>(batch));
+    NNVectorMath::log(colSum.data(), logSum.data(), static_cast<size_t>(batch));
+    const float invBatch = 1.0f / static_cast<float>(batch);
+    float loss = 0.0f;
+    for (int j = 0; j < batch; j++) {
+        const int label = labels[j];
+        assert(label >= 0 && label < classes);
+        loss += logSum[j] - (z[static_cast<size_t>(label) * batch + j] - colMax[j]);
+        colSum[j] = invBatch / colSum[j];
+    }
+
+    // dL/dz = (softmax - onehot) / batch
+    for (int c = 0; c < classes; c++) {
+        float* dRow = dz + static_cast<size_t>(c) * batch;
+        for (int j = 0; j < batch; j++) {
+            dRow[j] *= colSum[j];
+        }
+    }
+    for (int j = 0; j < batch; j++) {
+        dz[static_cast<size_t>(labels[j]) * batch + j] -= invBatch;
+    }
+
+    return loss * invBatch;
+}
@@ -0,0 +1,1070 @@
+#include "NNGraph.h"
+
+#include "NNFunctions.h"
+#include "NNPerfCounters.h"
+#include "NNUtils.h"
+#include "NNVectorMath.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+const std::string NNGraph::TAG = "NNGraph";
+
+NNGraph::Value NNGraph::addNode(Op op, int rows, std::vector<Value> inputs, float factor) {
+    assert(!compiled_);
+    for (Value v : inputs) {
+        assert(v >= 0 && v < static_cast<Value>(nodes_.size()));
+        (void) v;
+    }
+    Node node;
+    node.op = op;
+    node.rows = rows;
+    node.inputs = std::move(inputs);
+    node.factor = factor;
+    nodes_.push_back(std::move(node));
+    return static_cast<Value>(nodes_.size()) - 1;
+}
+
+NNGraph::Value NNGraph::input(int rows) { return addNode(Op::Input, rows, {}); }
+
+NNGraph::Value NNGraph::parameter(int rows, int cols, float* param, float* grad) {
+    const Value v = addNode(Op::Parameter, rows, {});
+    Node& node = nodes_[v];
+    node.cols = cols;
+    node.needsGrad = grad != nullptr;
+    node.param = param;
+    node.grad = grad;
+    return v;
+}
+
+NNGraph::Value NNGraph::matmul(Value weight, Value x) {
+    assert(nodes_[weight].op == Op::Parameter && nodes_[weight].cols == nodes_[x].rows);
+    return addNode(Op::MatMul, nodes_[weight].rows, {weight, x});
+}
+
+NNGraph::Value NNGraph::addBias(Value x, Value bias) {
+    assert(nodes_[bias].op == Op::Parameter && nodes_[bias].cols == 1 &&
+           nodes_[x].rows % nodes_[bias].rows == 0);
+    return addNode(Op::AddBias, nodes_[x].rows, {x, bias});
+}
+
+NNGraph::Value NNGraph::conv2d(Value weight, Value x, const Window& window) {
+    const Node& w = nodes_[weight];
+    assert(w.op == Op::Parameter && w.cols == window.channels * window.kernel * window.kernel);
+    assert(nodes_[x].rows == window.channels * window.height * window.width);
+    const Value v =
+        addNode(Op::Conv2D, w.rows * window.outHeight() * window.outWidth(), {weight, x});
+    nodes_[v].window = window;
+    return v;
+}
+
+NNGraph::Value NNGraph::maxPool(Value x, const Window& window) {
+    assert(nodes_[x].rows == window.channels * window.height * window.width);
+    const Value v =
+        addNode(Op::MaxPool, window.channels * window.outHeight() * window.outWidth(), {x});
+    nodes_[v].window = window;
+    return v;
+}
+
+NNGraph::Value NNGraph::batchNorm(Value x, Value gamma, Value beta, float* runningMean,
+                                  float* runningVar) {
+    const int rows = nodes_[x].rows;
+    assert(nodes_[gamma].op == Op::Parameter && nodes_[gamma].rows == rows &&
+           nodes_[gamma].cols == 1);
+    assert(nodes_[beta].op == Op::Parameter && nodes_[beta].rows == rows &&
+           nodes_[beta].cols == 1);
+    const Value v = addNode(Op::BatchNorm, rows, {x, gamma, beta});
+    Node& node = nodes_[v];
+    node.runningMean = runningMean;
+    node.runningVar = runningVar;
+    node.batchStats.resize(2 * static_cast<size_t>(rows));
+    return v;
+}
+
+NNGraph::Value NNGraph::relu(Value x) { return addNode(Op::Relu, nodes_[x].rows, {x}); }
+
+NNGraph::Value NNGraph::sigmoid(Value x) { return addNode(Op::Sigmoid, nodes_[x].rows, {x}); }
+
+NNGraph::Value NNGraph::tanh(Value x) { return addNode(Op::Tanh, nodes_[x].rows, {x}); }
+
+NNGraph::Value NNGraph::scale(Value x, float factor) {
+    return addNode(Op::Scale, nodes_[x].rows, {x}, factor);
+}
+
+NNGraph::Value NNGraph::dropout(Value x, const NNBitMask* mask, float keepScale) {
+    const Value v = addNode(Op::Dropout, nodes_[x].rows, {x}, keepScale);
+    nodes_[v].mask = mask;
+    return v;
+}
+
+NNGraph::Value NNGraph::add(Value a, Value b) {
+    assert(nodes_[a].rows == nodes_[b].rows);
+    return addNode(Op::Add, nodes_[a].rows, {a, b});
+}
+
+NNGraph::Value NNGraph::mul(Value a, Value b) {
+    assert(nodes_[a].rows == nodes_[b].rows);
+    return addNode(Op::Mul, nodes_[a].rows, {a, b});
+}
+
+NNGraph::Value NNGraph::softmax(Value x) { return addNode(Op::Softmax, nodes_[x].rows, {x}); }
+
+NNGraph::Value NNGraph::crossEntropy(Value probabilities) {
+    return addNode(Op::CrossEntropy, 1, {probabilities});
+}
+
+std::vector<int> NNGraph::countUses(const std::vector<Value>& roots) const {
+    // Uses by nodes reachable from the roots, plus one for being a root. Inputs always have
+    // lower ids than their consumers, so one backwards sweep sees every consumer first.
+    const int count = static_cast<int>(nodes_.size());
+    std::vector<char> reachable(count, 0);
+    std::vector<int> uses(count, 0);
+    for (Value root : roots) {
+        reachable[root] = 1;
+        uses[root]++;
+    }
+    for (int v = count - 1; v >= 0; v--) {
+        if (!reachable[v]) {
+            continue;
+        }
+        for (Value in : nodes_[v].inputs) {
+            reachable[in] = 1;
+            uses[in]++;
+        }
+    }
+    for (int v = 0; v < count; v++) {
+        if (!reachable[v]) {
+            uses[v] = -1;
+        }
+    }
+    return uses;
+}
+
+void NNGraph::fuse(const std::vector<Value>& roots) {
+    const std::vector<int> uses = countUses(roots);
+    auto isUnary = [](Op op) {
+        return op == Op::Relu || op == Op::Sigmoid || op == Op::Tanh || op == Op::Scale ||
+               op == Op::Dropout;
+    };
+    for (Value v = 0; v < static_cast<Value>(nodes_.size()); v++) {
+        Node& node = nodes_[v];
+        if (uses[v] < 0) {
+            continue;
+        }
+        if (node.op == Op::CrossEntropy) {
+            // softmax + cross-entropy: one max-shifted log-sum-exp, no probabilities kept.
+            const Value probabilities = node.inputs[0];
+            if (nodes_[probabilities].op == Op::Softmax && uses[probabilities] == 1) {
+                node.op = Op::SoftmaxCrossEntropy;
+                node.inputs = nodes_[probabilities].inputs;
+                nodes_[probabilities].removed = true;
+                fusedCount_++;
+            }
+        } else if (node.op == Op::AddBias) {
+            node.op = Op::Elementwise;
+        } else if (isUnary(node.op)) {
+            // Extends the chain of its input when nothing else reads that value, so bias +
+            // activation and longer element-wise runs each become one pass over the batch.
+            const Value in = node.inputs[0];
+            Node& producer = nodes_[in];
+            node.chain = {{node.op, node.factor}};
+            node.op = Op::Elementwise;
+            // A chain has room for one dropout mask.
+            if (producer.op == Op::Elementwise && uses[in] == 1 &&
+                static_cast<int>(producer.chain.size()) < MAX_CHAIN &&
+                (producer.mask == nullptr || node.mask == nullptr)) {
+                node.chain.insert(node.chain.begin(), producer.chain.begin(),
+                                  producer.chain.end());
+                node.inputs = producer.inputs;
+                if (producer.mask != nullptr) {
+                    node.mask = producer.mask;
+                }
+                producer.removed = true;
+                fusedCount_++;
+            }
+        }
+    }
+}
+
+bool NNGraph::readsInputs(const Node& node) const {
+    switch (node.op) {
+    case Op::MatMul:
+    case Op::Conv2D:
+        // x, for the weight gradient.
+        return nodes_[node.inputs[0]].differentiate;
+    case Op::MaxPool:
+        // To find where each maximum came from.
+    case Op::BatchNorm:
+        // To normalize it again.
+    case Op::Mul:
+    case Op::CrossEntropy:
+        return true;
+    case Op::Elementwise:
+        // Longer chains recompute their intermediate values from the input.
+        return node.chain.size() > 1;
+    default:
+        return false;
+    }
+}
+
+bool NNGraph::readsOutput(const Node& node) const {
+    switch (node.op) {
+    case Op::Relu:
+    case Op::Sigmoid:
+    case Op::Tanh:
+    case Op::Softmax:
+        return true;
+    case Op::Elementwise:
+        // Scale and dropout gradients do not depend on the values.
+        return node.chain.size() == 1 && node.chain[0].op != Op::Scale &&
+               node.chain[0].op != Op::Dropout;
+    default:
+        return false;
+    }
+}
+
+void NNGraph::compile(Value loss, const std::vector<Value>& outputs, bool fuse) {
+    assert(!compiled_);
+    assert(loss < 0 || nodes_[loss].op == Op::CrossEntropy);
+    loss_ = loss;
+    std::vector<Value> roots = outputs;
+    if (loss >= 0) {
+        roots.push_back(loss);
+    }
+    if (fuse) {
+        this->fuse(roots);
+    }
+
+    // Construction order is topological, so the reachable nodes in id order form a valid
+    // schedule. The loss is a sink and goes last, after everything forward() runs.
+    const std::vector<int> uses = countUses(roots);
+    schedule_.clear();
+    for (Value v = 0; v < static_cast<Value>(nodes_.size()); v++) {
+        Node& node = nodes_[v];
+        if (uses[v] < 0 || node.removed || v == loss) {
+            continue;
+        }
+        if (node.op != Op::Parameter) {
+            node.needsGrad = false;
+            for (Value in : node.inputs) {
+                node.needsGrad = node.needsGrad || nodes_[in].needsGrad;
+            }
+        }
+        if (node.op != Op::Input && node.op != Op::Parameter) {
+            schedule_.push_back(v);
+        }
+    }
+    if (loss >= 0) {
+        Node& node = nodes_[loss];
+        node.needsGrad = nodes_[node.inputs[0]].needsGrad;
+        schedule_.push_back(loss);
+        // Reverse mode: a node is back-propagated when it needs a gradient and some consumer
+        // on the way to the loss passes one down.
+        node.differentiate = node.needsGrad;
+        for (auto it = schedule_.rbegin(); it != schedule_.rend(); ++it) {
+            const Node& consumer = nodes_[*it];
+            if (!consumer.differentiate) {
+                continue;
+            }
+            for (Value in : consumer.inputs) {
+                nodes_[in].differentiate = nodes_[in].needsGrad;
+            }
+        }
+    }
+    for (size_t i = 0; i < schedule_.size(); i++) {
+        nodes_[schedule_[i]].step = static_cast<int>(i) + 1;
+    }
+    // nodes_ no longer grows, so the views stay put.
+    for (Node& node : nodes_) {
+        if (node.op == Op::Parameter) {
+            node.out.setView(node.param, node.rows, node.cols);
+            if (node.grad != nullptr) {
+                node.dOut.setView(node.grad, node.rows, node.cols);
+            }
+        }
+    }
+    planBuffers(outputs);
+    gradWritten_.assign(nodes_.size(), 0);
+    compiled_ = true;
+
+    LOG << "Graph: " << schedule_.size() << " nodes scheduled, " << fusedCount_
+        << " fused away" << std::endl;
+}
+
+void NNGraph::planBuffers(const std::vector<Value>& outputs) {
+    // Inputs are written at step 0, scheduled node i runs forward at step i + 1 and backward
+    // at 2S + 1 - (i + 1), and outputs stay live until the end, step 2S + 1.
+    const int size = static_cast<int>(schedule_.size());
+    const int end = 2 * size + 1;
+    auto backwardStep = [size](const Node& node) { return 2 * size + 1 - node.step; };
+
+    std::vector<int> lastUse(nodes_.size(), 0);
+    std::vector<int> firstGrad(nodes_.size(), end);
+    for (Value v : schedule_) {
+        const Node& node = nodes_[v];
+        lastUse[v] = std::max(lastUse[v], node.step);
+        if (node.differentiate && readsOutput(node)) {
+            lastUse[v] = std::max(lastUse[v], backwardStep(node));
+        }
+        for (Value in : node.inputs) {
+            lastUse[in] = std::max(lastUse[in], node.step);
+            if (node.differentiate && readsInputs(node)) {
+                lastUse[in] = std::max(lastUse[in], backwardStep(node));
+            }
+            if (node.differentiate) {
+                // The loss writes its input's gradient as it is evaluated.
+                const int first = v == loss_ ? node.step : backwardStep(node);
+                firstGrad[in] = std::min(firstGrad[in], first);
+            }
+        }
+    }
+    for (Value v : outputs) {
+        lastUse[v] = end;
+    }
+
+    workspace_.clear();
+    for (Value v = 0; v < static_cast<Value>(nodes_.size()); v++) {
+        Node& node = nodes_[v];
+        node.buffer = node.gradBuffer = node.scratchBuffer = node.forwardScratchBuffer = -1;
+        const bool scheduled = node.op == Op::Input || node.step > 0;
+        if (!scheduled || node.removed || node.op == Op::Parameter || v == loss_) {
+            continue;
+        }
+        if (node.op == Op::Input && lastUse[v] == 0) {
+            continue;
+        }
+        node.buffer = workspace_.add(node.rows, node.op == Op::Input ? 0 : node.step, lastUse[v]);
+        if (node.differentiate) {
+            node.gradBuffer = workspace_.add(node.rows, firstGrad[v], backwardStep(node));
+        }
+        if (node.op == Op::MatMul && readsInputs(node) && node.differentiate) {
+            node.scratchBuffer = workspace_.add(nodes_[node.inputs[1]].rows, backwardStep(node),
+                                                backwardStep(node));
+        }
+        if (node.op == Op::Conv2D) {
+            // The columns are rebuilt for backward rather than kept alive in between.
+            const int columns = nodes_[node.inputs[0]].cols * node.window.outHeight() *
+                                node.window.outWidth();
+            node.forwardScratchBuffer = workspace_.add(columns, node.step, node.step);
+            if (node.differentiate) {
+                node.scratchBuffer =
+                    workspace_.add(columns, backwardStep(node), backwardStep(node));
+            }
+        }
+    }
+    workspace_.plan();
+}
+
+void NNGraph::setBatch(int batch) {
+    assert(compiled_);
+    workspace_.reserve(batch);
+    for (Node& node : nodes_) {
+        if (node.buffer >= 0) {
+            node.out.setView(workspace_.data(node.buffer, batch), node.rows, batch);
+        }
+        if (node.gradBuffer >= 0) {
+            node.dOut.setView(workspace_.data(node.gradBuffer, batch), node.rows, batch);
+        }
+        if (node.op == Op::Conv2D) {
+            const int rows = nodes_[node.inputs[0]].cols;
+            const int cols = node.window.outHeight() * node.window.outWidth() * batch;
+            node.forwardScratch.setView(workspace_.data(node.forwardScratchBuffer, batch), rows,
+                                        cols);
+            if (node.scratchBuffer >= 0) {
+                node.scratch.setView(workspace_.data(node.scratchBuffer, batch), rows, cols);
+            }
+        } else if (node.scratchBuffer >= 0) {
+            node.scratch.setView(workspace_.data(node.scratchBuffer, batch), batch,
+                                 nodes_[node.inputs[1]].rows);
+        }
+    }
+    size_t chainRows = 0;
+    for (Value v : schedule_) {
+        if (nodes_[v].op == Op::Elementwise && nodes_[v].chain.size() > 1) {
+            chainRows = std::max(chainRows, nodes_[v].chain.size() + 2);
+        }
+    }
+    colMax_.resize(batch);
+    colSum_.resize(batch);
+    argMax_.resize(batch);
+    chainValues_.resize(chainRows * batch);
+    batch_ = batch;
+}
+
+void NNGraph::forward() {
+    NNPerfScope scope("graph.forward");
+    const size_t count = schedule_.size() - (loss_ >= 0 ? 1 : 0);
+    for (size_t i = 0; i < count; i++) {
+        runForward(nodes_[schedule_[i]]);
+    }
+}
+
+float NNGraph::loss(const std::vector<int>& labels) {
+    assert(loss_ >= 0 && static_cast<int>(labels.size()) == batch_);
+    Node& node = nodes_[loss_];
+    Node& in = nodes_[node.inputs[0]];
+    labels_ = labels;
+    if (node.op == Op::SoftmaxCrossEntropy) {
+        NNMatrix& dlogits = in.gradBuffer >= 0 ? in.dOut : lossGrad_;
+        return NNFunctions::softmaxCrossEntropy(in.out, labels_, dlogits, predictions_);
+    }
+
+    // Unfused: the probabilities are already normalized.
+    const int classes = in.rows;
+    const float* p = in.out.data();
+    float total = 0.0f;
+    predictions_.assign(batch_, 0);
+    for (int j = 0; j < batch_; j++) {
+        for (int c = 1; c < classes; c++) {
+            if (p[static_cast<size_t>(c) * batch_ + j] >
+                p[static_cast<size_t>(predictions_[j]) * batch_ + j]) {
+                predictions_[j] = c;
+            }
+        }
+        assert(labels_[j] >= 0 && labels_[j] < classes);
+        const float probability = p[static_cast<size_t>(labels_[j]) * batch_ + j];
+        total -= NNVectorMath::log(std::max(probability, 1e-30f));
+    }
+    return total / static_cast<float>(batch_);
+}
+
+void NNGraph::backward(float scale) {
+    assert(loss_ >= 0);
+    NNPerfScope scope("graph.backward");
+    std::fill(gradWritten_.begin(), gradWritten_.end(), 0);
+    for (auto it = schedule_.rbegin(); it != schedule_.rend(); ++it) {
+        Node& node = nodes_[*it];
+        if (node.differentiate) {
+            runBackward(node, scale);
+        }
+    }
+}
+
+float* NNGraph::gradFor(Value v, bool& add) {
+    add = gradWritten_[v] != 0;
+    gradWritten_[v] = 1;
+    return nodes_[v].dOut.data();
+}
+
+void NNGraph::applyUnary(Op op, float factor, const float* in, float* out, int count) {
+    switch (op) {
+    case Op::Relu:
+        for (int i = 0; i < count; i++) {
+            out[i] = std::max(in[i], 0.0f);
+        }
+        break;
+    case Op::Sigmoid:
+        NNVectorMath::sigmoid(in, out, static_cast<size_t>(count));
+        break;
+    case Op::Tanh:
+        NNVectorMath::tanh(in, out, static_cast<size_t>(count));
+        break;
+    default:
+        for (int i = 0; i < count; i++) {
+            out[i] = in[i] * factor;
+        }
+        break;
+    }
+}
+
+float NNGraph::derivative(Op op, float factor, float y) {
+    switch (op) {
+    case Op::Relu:
+        return y > 0.0f ? 1.0f : 0.0f;
+    case Op::Sigmoid:
+        return y * (1.0f - y);
+    case Op::Tanh:
+        return 1.0f - y * y;
+    default:
+        return factor;
+    }
+}
+
+void NNGraph::applyChainOp(const Node& node, const ChainOp& op, size_t offset, const float* in,
+                           float* out, int count) const {
+    if (op.op != Op::Dropout) {
+        applyUnary(op.op, op.factor, in, out, count);
+    } else if (training_) {
+        assert(node.mask->size() >= offset + count);
+        for (int i = 0; i < count; i++) {
+            out[i] = node.mask->test(offset + i) ? in[i] * op.factor : 0.0f;
+        }
+    } else if (out != in) {
+        std::copy_n(in, count, out);
+    }
+}
+
+void NNGraph::chainGradient(const Node& node, const ChainOp& op, size_t offset, const float* y,
+                            float* g, int count) const {
+    if (op.op == Op::Dropout) {
+        for (int i = 0; i < count; i++) {
+            g[i] = node.mask->test(offset + i) ? g[i] * op.factor : 0.0f;
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        g[i] *= derivative(op.op, op.factor, y[i]);
+    }
+}
+
+void NNGraph::runForward(Node& node) {
+    const int count = node.rows * batch_;
+    float* out = node.out.data();
+    switch (node.op) {
+    case Op::MatMul:
+        node.out.fill(0.0f);
+        node.out.addDotProduct(nodes_[node.inputs[0]].out, nodes_[node.inputs[1]].out);
+        break;
+    case Op::Conv2D: {
+        const Node& weight = nodes_[node.inputs[0]];
+        im2col(node.window, nodes_[node.inputs[1]].out.data(), node.forwardScratch.data());
+        // (outChannels x positions * batch) is exactly the (rows x batch) layout of the output.
+        NNMatrix outFlat(nullptr, out, weight.rows, node.forwardScratch.getColSize());
+        outFlat.fill(0.0f);
+        outFlat.addDotProduct(weight.out, node.forwardScratch);
+        break;
+    }
+    case Op::BatchNorm: {
+        NNPerfScope scope("batch_norm");
+        const float* x = nodes_[node.inputs[0]].out.data();
+        const float* gamma = nodes_[node.inputs[1]].out.data();
+        const float* beta = nodes_[node.inputs[2]].out.data();
+        const float n = static_cast<float>(batch_);
+        for (int r = 0; r < node.rows; r++) {
+            const float* xRow = x + static_cast<size_t>(r) * batch_;
+            float* row = out + static_cast<size_t>(r) * batch_;
+            float mean = node.runningMean[r];
+            float invStd = 1.0f / std::sqrt(node.runningVar[r] + BATCH_NORM_EPSILON);
+            if (training_) {
+                // The row stays in L1 across its three sweeps.
+                float sum = 0.0f;
+                for (int j = 0; j < batch_; j++) {
+                    sum += xRow[j];
+                }
+                mean = sum / n;
+                float squares = 0.0f;
+                for (int j = 0; j < batch_; j++) {
+                    const float d = xRow[j] - mean;
+                    squares += d * d;
+                }
+                const float var = squares / n;
+                invStd = 1.0f / std::sqrt(var + BATCH_NORM_EPSILON);
+                node.batchStats[2 * r] = mean;
+                node.batchStats[2 * r + 1] = invStd;
+                // The running variance is the unbiased estimate.
+                const float unbiased = batch_ > 1 ? squares / (n - 1.0f) : var;
+                node.runningMean[r] += BATCH_NORM_MOMENTUM * (mean - node.runningMean[r]);
+                node.runningVar[r] += BATCH_NORM_MOMENTUM * (unbiased - node.runningVar[r]);
+            }
+            const float scale = gamma[r] * invStd;
+            const float shift = beta[r] - mean * scale;
+            for (int j = 0; j < batch_; j++) {
+                row[j] = xRow[j] * scale + shift;
+            }
+        }
+        break;
+    }
+    case Op::MaxPool: {
+        NNPerfScope scope("max_pool");
+        const Window& w = node.window;
+        const float* x = nodes_[node.inputs[0]].out.data();
+        float* outRow = out;
+        for (int c = 0; c < w.channels; c++) {
+            for (int oh = 0; oh < w.outHeight(); oh++) {
+                for (int ow = 0; ow < w.outWidth(); ow++, outRow += batch_) {
+                    bool first = true;
+                    for (int kh = 0; kh < w.kernel; kh++) {
+                        const int ih = oh * w.stride + kh - w.padding;
+                        for (int kw = 0; kw < w.kernel; kw++) {
+                            const int iw = ow * w.stride + kw - w.padding;
+                            if (ih < 0 || ih >= w.height || iw < 0 || iw >= w.width) {
+                                continue;
+                            }
+                            const float* src =
+                                x + ((static_cast<size_t>(c) * w.height + ih) * w.width + iw) *
+                                        batch_;
+                            for (int j = 0; j < batch_; j++) {
+                                outRow[j] = first ? src[j] : std::max(outRow[j], src[j]);
+                            }
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+        break;
+    }
+    case Op::AddBias:
+    case Op::Elementwise: {
+        const float* x = nodes_[node.inputs[0]].out.data();
+        const float* bias = node.inputs.size() > 1 ? nodes_[node.inputs[1]].out.data() : nullptr;
+        const int repeat = bias != nullptr ? node.rows / nodes_[node.inputs[1]].rows : 1;
+        // Row by row, so every op of the chain finds the row still in L1.
+        for (int r = 0; r < node.rows; r++) {
+            const float* xRow = x + static_cast<size_t>(r) * batch_;
+            float* row = out + static_cast<size_t>(r) * batch_;
+            const float b = bias != nullptr ? bias[r / repeat] : 0.0f;
+            for (int j = 0; j < batch_; j++) {
+                row[j] = xRow[j] + b;
+            }
+            for (const ChainOp& op : node.chain) {
+                applyChainOp(node, op, static_cast<size_t>(r) * batch_, row, row, batch_);
+            }
+        }
+        break;
+    }
+    case Op::Relu:
+    case Op::Sigmoid:
+    case Op::Tanh:
+    case Op::Scale:
+        applyUnary(node.op, node.factor, nodes_[node.inputs[0]].out.data(), out, count);
+        break;
+    case Op::Dropout:
+        applyChainOp(node, {node.op, node.factor}, 0, nodes_[node.inputs[0]].out.data(), out,
+                     count);
+        break;
+    case Op::Add:
+    case Op::Mul: {
+        const float* a = nodes_[node.inputs[0]].out.data();
+        const float* b = nodes_[node.inputs[1]].out.data();
+        for (int i = 0; i < count; i++) {
+            out[i] = node.op == Op::Add ? a[i] + b[i] : a[i] * b[i];
+        }
+        break;
+    }
+    case Op::Softmax: {
+        const float* x = nodes_[node.inputs[0]].out.data();
+        std::copy_n(x, batch_, colMax_.data());
+        for (int r = 1; r < node.rows; r++) {
+            const float* row = x + static_cast<size_t>(r) * batch_;
+            for (int j = 0; j < batch_; j++) {
+                colMax_[j] = std::max(colMax_[j], row[j]);
+            }
+        }
+        std::fill(colSum_.begin(), colSum_.end(), 0.0f);
+        for (int r = 0; r < node.rows; r++) {
+            const float* row = x + static_cast<size_t>(r) * batch_;
+            float* outRow = out + static_cast<size_t>(r) * batch_;
+            for (int j = 0; j < batch_; j++) {
+                outRow[j] = NNVectorMath::exp(row[j] - colMax_[j]);
+                colSum_[j] += outRow[j];
+            }
+        }
+        for (int r = 0; r < node.rows; r++) {
+            float* outRow = out + static_cast<size_t>(r) * batch_;
+            for (int j = 0; j < batch_; j++) {
+                outRow[j] /= colSum_[j];
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void NNGraph::runBackward(Node& node, float scale) {
+    const int count = node.rows * batch_;
+    const float* dy = node.dOut.data();
+    bool add = false;
+    switch (node.op) {
+    case Op::SoftmaxCrossEntropy: {
+        // loss() already wrote (softmax - onehot) / batch into the logits gradient.
+        Node& logits = nodes_[node.inputs[0]];
+        gradFor(node.inputs[0], add);
+        if (scale != 1.0f) {
+            logits.dOut *= scale;
+        }
+        break;
+    }
+    case Op::CrossEntropy: {
+        const Node& probabilities = nodes_[node.inputs[0]];
+        const float* p = probabilities.out.data();
+        float* dp = gradFor(node.inputs[0], add);
+        if (!add) {
+            std::fill_n(dp, static_cast<size_t>(probabilities.rows) * batch_, 0.0f);
+        }
+        const float unit = -scale / static_cast<float>(batch_);
+        for (int j = 0; j < batch_; j++) {
+            const size_t at = static_cast<size_t>(labels_[j]) * batch_ + j;
+            dp[at] += unit / std::max(p[at], 1e-30f);
+        }
+        break;
+    }
+    case Op::MatMul: {
+        Node& weight = nodes_[node.inputs[0]];
+        Node& x = nodes_[node.inputs[1]];
+        if (weight.differentiate) {
+            x.out.transposeInto(node.scratch);
+            weight.dOut.addDotProduct(node.dOut, node.scratch);
+        }
+        if (x.differentiate) {
+            gradFor(node.inputs[1], add);
+            if (!add) {
+                x.dOut.fill(0.0f);
+            }
+            x.dOut.addDotProduct(weight.out, node.dOut, true);
+        }
+        break;
+    }
+    case Op::Conv2D: {
+        Node& weight = nodes_[node.inputs[0]];
+        Node& x = nodes_[node.inputs[1]];
+        NNMatrix dyFlat(nullptr, node.dOut.data(), weight.rows, node.scratch.getColSize());
+        if (weight.differentiate) {
+            im2col(node.window, x.out.data(), node.scratch.data());
+            weight.dOut.addDotProductTransposed(dyFlat, node.scratch);
+        }
+        if (x.differentiate) {
+            node.scratch.fill(0.0f);
+            node.scratch.addDotProduct(weight.out, dyFlat, true);
+            float* dx = gradFor(node.inputs[1], add);
+            if (!add) {
+                std::fill_n(dx, static_cast<size_t>(x.rows) * batch_, 0.0f);
+            }
+            col2im(node.window, node.scratch.data(), dx);
+        }
+        break;
+    }
+    case Op::BatchNorm: {
+        assert(training_);
+        NNPerfScope scope("batch_norm");
+        const float* x = nodes_[node.inputs[0]].out.data();
+        const float* gamma = nodes_[node.inputs[1]].out.data();
+        Node& gammaNode = nodes_[node.inputs[1]];
+        Node& betaNode = nodes_[node.inputs[2]];
+        float* dx = nodes_[node.inputs[0]].differentiate ? gradFor(node.inputs[0], add) : nullptr;
+        const float n = static_cast<float>(batch_);
+        for (int r = 0; r < node.rows; r++) {
+            const size_t offset = static_cast<size_t>(r) * batch_;
+            const float mean = node.batchStats[2 * r];
+            const float invStd = node.batchStats[2 * r + 1];
+            float sumDy = 0.0f;
+            float sumDyXhat = 0.0f;
+            for (int j = 0; j < batch_; j++) {
+                sumDy += dy[offset + j];
+                sumDyXhat += dy[offset + j] * (x[offset + j] - mean) * invStd;
+            }
+            if (gammaNode.differentiate) {
+                gammaNode.dOut.data()[r] += sumDyXhat;
+            }
+            if (betaNode.differentiate) {
+                betaNode.dOut.data()[r] += sumDy;
+            }
+            if (dx == nullptr) {
+                continue;
+            }
+            // dx = gamma / sigma * (dy - mean(dy) - xhat * mean(dy * xhat)).
+            const float k = gamma[r] * invStd;
+            const float meanDy = sumDy / n;
+            const float meanDyXhat = sumDyXhat / n;
+            float* dxRow = dx + offset;
+            for (int j = 0; j < batch_; j++) {
+                const float xhat = (x[offset + j] - mean) * invStd;
+                const float g = k * (dy[offset + j] - meanDy - xhat * meanDyXhat);
+                dxRow[j] = add ? dxRow[j] + g : g;
+            }
+        }
+        break;
+    }
+    case Op::MaxPool: {
+        if (!nodes_[node.inputs[0]].differentiate) {
+            break;
+        }
+        // Each output's gradient goes to the first input of its window holding the maximum.
+        const Window& w = node.window;
+        const float* x = nodes_[node.inputs[0]].out.data();
+        float* dx = gradFor(node.inputs[0], add);
+        if (!add) {
+            std::fill_n(dx, static_cast<size_t>(nodes_[node.inputs[0]].rows) * batch_, 0.0f);
+        }
+        const float* dyRow = dy;
+        for (int c = 0; c < w.channels; c++) {
+            for (int oh = 0; oh < w.outHeight(); oh++) {
+                for (int ow = 0; ow < w.outWidth(); ow++, dyRow += batch_) {
+                    bool first = true;
+                    for (int kh = 0; kh < w.kernel; kh++) {
+                        const int ih = oh * w.stride + kh - w.padding;
+                        for (int kw = 0; kw < w.kernel; kw++) {
+                            const int iw = ow * w.stride + kw - w.padding;
+                            if (ih < 0 || ih >= w.height || iw < 0 || iw >= w.width) {
+                                continue;
+                            }
+                            const int row = (c * w.height + ih) * w.width + iw;
+                            const float* src = x + static_cast<size_t>(row) * batch_;
+                            for (int j = 0; j < batch_; j++) {
+                                if (first || src[j] > colMax_[j]) {
+                                    colMax_[j] = src[j];
+                                    argMax_[j] = row;
+                                }
+                            }
+                            first = false;
+                        }
+                    }
+                    for (int j = 0; j < batch_; j++) {
+                        dx[static_cast<size_t>(argMax_[j]) * batch_ + j] += dyRow[j];
+                    }
+                }
+            }
+        }
+        break;
+    }
+    case Op::AddBias:
+    case Op::Elementwise: {
+        const Node& x = nodes_[node.inputs[0]];
+        Node* bias = node.inputs.size() > 1 && nodes_[node.inputs[1]].differentiate
+                         ? &nodes_[node.inputs[1]]
+                         : nullptr;
+        float* dx = x.differentiate ? gradFor(node.inputs[0], add) : nullptr;
+        const float* xData = x.out.data();
+        const float* biasData =
+            node.inputs.size() > 1 ? nodes_[node.inputs[1]].out.data() : nullptr;
+        const int repeat = biasData != nullptr ? node.rows / nodes_[node.inputs[1]].rows : 1;
+        const int steps = static_cast<int>(node.chain.size());
+        for (int r = 0; r < node.rows; r++) {
+            const size_t offset = static_cast<size_t>(r) * batch_;
+            // g is the row's gradient, pushed back through the chain into chainValues_.
+            float* g = steps > 1 ? chainValues_.data() + (steps + 1) * batch_ : colSum_.data();
+            std::copy_n(dy + offset, batch_, g);
+            if (steps == 1) {
+                chainGradient(node, node.chain[0], offset, node.out.data() + offset, g, batch_);
+            } else if (steps > 1) {
+                // Recompute t_0 = x + b, t_{k+1} = op_k(t_k) for the row, then apply the
+                // derivatives in reverse, each from its op's output t_{k+1}.
+                float* t = chainValues_.data();
+                const float b = biasData != nullptr ? biasData[r / repeat] : 0.0f;
+                for (int j = 0; j < batch_; j++) {
+                    t[j] = xData[offset + j] + b;
+                }
+                for (int k = 0; k < steps; k++) {
+                    applyChainOp(node, node.chain[k], offset, t + k * batch_,
+                                 t + (k + 1) * batch_, batch_);
+                }
+                for (int k = steps - 1; k >= 0; k--) {
+                    chainGradient(node, node.chain[k], offset, t + (k + 1) * batch_, g, batch_);
+                }
+            }
+            if (dx != nullptr) {
+                float* dxRow = dx + offset;
+                for (int j = 0; j < batch_; j++) {
+                    dxRow[j] = add ? dxRow[j] + g[j] : g[j];
+                }
+            }
+            if (bias != nullptr) {
+                float sum = 0.0f;
+                for (int j = 0; j < batch_; j++) {
+                    sum += g[j];
+                }
+                bias->dOut.data()[r / repeat] += sum;
+            }
+        }
+        break;
+    }
+    case Op::Relu:
+    case Op::Sigmoid:
+    case Op::Tanh:
+    case Op::Scale: {
+        if (!nodes_[node.inputs[0]].differentiate) {
+            break;
+        }
+        const float* y = node.out.data();
+        float* dx = gradFor(node.inputs[0], add);
+        for (int i = 0; i < count; i++) {
+            const float g = dy[i] * derivative(node.op, node.factor, y[i]);
+            dx[i] = add ? dx[i] + g : g;
+        }
+        break;
+    }
+    case Op::Dropout: {
+        if (!nodes_[node.inputs[0]].differentiate) {
+            break;
+        }
+        float* dx = gradFor(node.inputs[0], add);
+        for (int i = 0; i < count; i++) {
+            const float g = node.mask->test(i) ? dy[i] * node.factor : 0.0f;
+            dx[i] = add ? dx[i] + g : g;
+        }
+        break;
+    }
+    case Op::Add:
+    case Op::Mul:
+        for (int side = 0; side < 2; side++) {
+            if (!nodes_[node.inputs[side]].differentiate) {
+                continue;
+            }
+            const float* other = nodes_[node.inputs[1 - side]].out.data();
+            float* dx = gradFor(node.inputs[side], add);
+            for (int i = 0; i < count; i++) {
+                const float g = node.op == Op::Add ? dy[i] : dy[i] * other[i];
+                dx[i] = add ? dx[i] + g : g;
+            }
+        }
+        break;
+    case Op::Softmax: {
+        if (!nodes_[node.inputs[0]].differentiate) {
+            break;
+        }
+        // dx = y * (dy - sum_r dy * y), per column.
+        const float* y = node.out.data();
+        float* dx = gradFor(node.inputs[0], add);
+        std::fill(colSum_.begin(), colSum_.end(), 0.0f);
+        for (int i = 0; i < count; i++) {
+            colSum_[i % batch_] += dy[i] * y[i];
+        }
+        for (int i = 0; i < count; i++) {
+            const float g = y[i] * (dy[i] - colSum_[i % batch_]);
+            dx[i] = add ? dx[i] + g : g;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void NNGraph::im2col(const Window& w, const float* x, float* columns) const {
+    NNPerfScope scope("im2col");
+    // Samples are the innermost dimension of both layouts, so every (position, sample range)
+    // is a contiguous copy, and with stride 1 a whole output row is one copy.
+    const int outH = w.outHeight();
+    const int outW = w.outWidth();
+    const size_t n = batch_;
+    float* col = columns;
+    for (int c = 0; c < w.channels; c++) {
+        for (int kh = 0; kh < w.kernel; kh++) {
+            for (int kw = 0; kw < w.kernel; kw++) {
+                for (int oh = 0; oh < outH; oh++, col += outW * n) {
+                    const int ih = oh * w.stride + kh - w.padding;
+                    if (ih < 0 || ih >= w.height) {
+                        std::fill_n(col, outW * n, 0.0f);
+                        continue;
+                    }
+                    const float* src = x + (static_cast<size_t>(c) * w.height + ih) * w.width * n;
+                    int ow = 0;
+                    for (; ow < outW && ow * w.stride + kw - w.padding < 0; ow++) {
+                        std::fill_n(col + ow * n, n, 0.0f);
+                    }
+                    if (w.stride == 1) {
+                        const int last = std::min(outW, w.width + w.padding - kw);
+                        if (last > ow) {
+                            std::copy_n(src + (ow + kw - w.padding) * n, (last - ow) * n,
+                                        col + ow * n);
+                            ow = last;
+                        }
+                    }
+                    for (; ow < outW; ow++) {
+                        const int iw = ow * w.stride + kw - w.padding;
+                        if (iw < w.width) {
+                            std::copy_n(src + iw * n, n, col + ow * n);
+                        } else {
+                            std::fill_n(col + ow * n, n, 0.0f);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void NNGraph::col2im(const Window& w, const float* columns, float* dx) const {
+    NNPerfScope scope("col2im");
+    const int outH = w.outHeight();
+    const int outW = w.outWidth();
+    const size_t n = batch_;
+    const float* col = columns;
+    for (int c = 0; c < w.channels; c++) {
+        for (int kh = 0; kh < w.kernel; kh++) {
+            for (int kw = 0; kw < w.kernel; kw++) {
+                for (int oh = 0; oh < outH; oh++, col += outW * n) {
+                    const int ih = oh * w.stride + kh - w.padding;
+                    if (ih < 0 || ih >= w.height) {
+                        continue;
+                    }
+                    float* dst = dx + (static_cast<size_t>(c) * w.height + ih) * w.width * n;
+                    for (int ow = 0; ow < outW; ow++) {
+                        const int iw = ow * w.stride + kw - w.padding;
+                        if (iw < 0 || iw >= w.width) {
+                            continue;
+                        }
+                        float* dstRow = dst + iw * n;
+                        const float* srcRow = col + ow * n;
+                        for (size_t j = 0; j < n; j++) {
+                            dstRow[j] += srcRow[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+const char* NNGraph::opName(Op op) {
+    switch (op) {
+    case Op::Input:
+        return "input";
+    case Op::Parameter:
+        return "parameter";
+    case Op::MatMul:
+        return "matmul";
+    case Op::AddBias:
+        return "bias";
+    case Op::Relu:
+        return "relu";
+    case Op::Sigmoid:
+        return "sigmoid";
+    case Op::Tanh:
+        return "tanh";
+    case Op::Scale:
+        return "scale";
+    case Op::Dropout:
+        return "dropout";
+    case Op::Add:
+        return "add";
+    case Op::Mul:
+        return "mul";
+    case Op::Conv2D:
+        return "conv2d";
+    case Op::BatchNorm:
+        return "batch_norm";
+    case Op::MaxPool:
+        return "max_pool";
+    case Op::Softmax:
+        return "softmax";
+    case Op::CrossEntropy:
+        return "cross_entropy";
+    case Op::Elementwise:
+        return "elementwise";
+    case Op::SoftmaxCrossEntropy:
+        return "softmax_cross_entropy";
+    }
+    return "?";
+}
+
+std::string NNGraph::describe() const {
+    std::ostringstream text;
+    for (Value v : schedule_) {
+        const Node& node = nodes_[v];
+        text << v << " " << opName(node.op);
+        if (node.op == Op::Elementwise) {
+            text << "(";
+            const char* separator = "";
+            if (node.inputs.size() > 1) {
+                text << "bias";
+                separator = ",";
+            }
+            for (const ChainOp& op : node.chain) {
+                text << separator << opName(op.op);
+                separator = ",";
+            }
+            text << ")";
+        }
+        text << " " << node.rows << " <-";
+        for (Value in : node.inputs) {
+            text << " " << in;
+        }
+        text << "\n";
+    }
+    return text.str();
+}
@@ -0,0 +1,347 @@
+#include "NNInferenceServer.h"
+
+#include "NNUtils.h"
+#include "NNVectorMath.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+constexpr size_t READ_CHUNK = 64 * 1024;
+// A client that stops reading its replies for this long is disconnected rather than
+// stalling every other client's batch.
+constexpr int SEND_TIMEOUT_MS = 1000;
+
+void setNonBlocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK); }
+
+bool sendAll(int fd, const char* buf, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t sent = send(fd, buf, bytes, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        buf += sent;
+        bytes -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+} // namespace
+
+struct NNInferenceServer::Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+    int fd;
+    // Bytes of a request that has not fully arrived yet.
+    std::vector<uint8_t> partial;
+    // Set by the batching thread when a reply could not be sent.
+    std::atomic<bool> broken{false};
+};
+
+NNInferenceServer::NNInferenceServer(NeuralNetwork& network, int inputSize, Options options)
+    : network_(network), inputSize_(inputSize), options_(std::move(options)) {
+    options_.maxBatch = std::max(1, options_.maxBatch);
+    options_.maxDelayUs = std::max(0, options_.maxDelayUs);
+}
+
+NNInferenceServer::~NNInferenceServer() { stop(); }
+
+void NNInferenceServer::start() {
+    const bool unixSocket = !options_.socketPath.empty();
+    listenFd_ = socket(unixSocket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) {
+        throw std::runtime_error("Unable to create server socket");
+    }
+    int bound = -1;
+    if (unixSocket) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (options_.socketPath.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + options_.socketPath);
+        }
+        std::strcpy(addr.sun_path, options_.socketPath.c_str());
+        unlink(addr.sun_path);
+        bound = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } else {
+        int one = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(options_.port));
+        bound = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+    }
+    if (bound < 0 || listen(listenFd_, SOMAXCONN) < 0) {
+        const std::string error = std::strerror(errno);
+        close(listenFd_);
+        listenFd_ = -1;
+        throw std::runtime_error("Unable to listen for clients: " + error);
+    }
+    setNonBlocking(listenFd_);
+    if (pipe(wakeFds_) < 0) {
+        throw std::runtime_error("Unable to create wake-up pipe");
+    }
+
+    stop_ = false;
+    resetStats();
+    ioThread_ = std::thread(&NNInferenceServer::runIo, this);
+    batchThread_ = std::thread(&NNInferenceServer::runBatches, this);
+    LOG << "Serving on "
+        << (unixSocket ? options_.socketPath : "127.0.0.1:" + std::to_string(port_))
+        << ", max batch " << options_.maxBatch << ", max delay " << options_.maxDelayUs << "us"
+        << std::endl;
+}
+
+void NNInferenceServer::stop() {
+    if (listenFd_ < 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stop_ = true;
+    }
+    queueCv_.notify_all();
+    const char wake = 0;
+    (void) !write(wakeFds_[1], &wake, 1);
+    ioThread_.join();
+    batchThread_.join();
+
+    queue_.clear();
+    connections_.clear();
+    close(listenFd_);
+    close(wakeFds_[0]);
+    close(wakeFds_[1]);
+    listenFd_ = -1;
+    wakeFds_[0] = wakeFds_[1] = -1;
+    if (!options_.socketPath.empty()) {
+        unlink(options_.socketPath.c_str());
+    }
+}
+
+void NNInferenceServer::runIo() {
+    std::vector<pollfd> fds;
+    while (!stop_) {
+        fds.clear();
+        fds.push_back({wakeFds_[0], POLLIN, 0});
+        fds.push_back({listenFd_, POLLIN, 0});
+        for (const auto& connection : connections_) {
+            fds.push_back({connection->fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG << "poll failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            acceptConnections();
+        }
+        // fds[i + 2] belongs to the i-th connection that existed before accepting.
+        size_t kept = 0;
+        const size_t polled = fds.size() - 2;
+        for (size_t i = 0; i < connections_.size(); i++) {
+            const bool ready = i < polled && fds[i + 2].revents != 0;
+            if ((!ready || readRequests(connections_[i])) && !connections_[i]->broken) {
+                connections_[kept++] = std::move(connections_[i]);
+            }
+        }
+        connections_.resize(kept);
+    }
+}
+
+void NNInferenceServer::acceptConnections() {
+    while (true) {
+        const int fd = accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        // Replies are sent blocking from the batching thread, reads never block (MSG_DONTWAIT).
+        timeval timeout{SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+        connections_.push_back(std::make_shared<Connection>(fd));
+    }
+}
+
+bool NNInferenceServer::readRequests(const std::shared_ptr<Connection>& connection) {
+    std::vector<Request> arrived;
+    uint8_t chunk[READ_CHUNK];
+    bool open = true;
+    while (true) {
+        const ssize_t got = recv(connection->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            open = got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+        const auto now = Clock::now();
+        const uint8_t* src = chunk;
+        size_t left = static_cast<size_t>(got);
+        while (left > 0) {
+            std::vector<uint8_t>& partial = connection->partial;
+            const size_t take = std::min(left, inputSize_ - partial.size());
+            partial.insert(partial.end(), src, src + take);
+            src += take;
+            left -= take;
+            if (partial.size() == static_cast<size_t>(inputSize_)) {
+                arrived.push_back({connection, std::move(partial), now});
+                partial = {};
+                partial.reserve(inputSize_);
+            }
+        }
+        if (got < static_cast<ssize_t>(sizeof(chunk))) {
+            break;
+        }
+    }
+
+    if (!arrived.empty()) {
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            const size_t before = queue_.size();
+            for (auto& request : arrived) {
+                queue_.push_back(std::move(request));
+            }
+            // The batching thread only needs waking to start a deadline or to fill a batch.
+            wake = before == 0 || (before < static_cast<size_t>(options_.maxBatch) &&
+                                   queue_.size() >= static_cast<size_t>(options_.maxBatch));
+        }
+        if (wake) {
+            queueCv_.notify_one();
+        }
+    }
+    return open;
+}
+
+void NNInferenceServer::runBatches() {
+    const auto maxDelay = std::chrono::microseconds(options_.maxDelayUs);
+    const size_t maxBatch = options_.maxBatch;
+    std::vector<Request> batch;
+    batch.reserve(maxBatch);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            queueCv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            // Wait for a full batch, but no longer than the oldest request's deadline.
+            const auto deadline = queue_.empty() ? Clock::now() : queue_.front().arrival + maxDelay;
+            queueCv_.wait_until(lock, deadline,
+                                [this, maxBatch] { return stop_ || queue_.size() >= maxBatch; });
+            if (stop_) {
+                return;
+            }
+            const size_t n = std::min(queue_.size(), maxBatch);
+            std::move(queue_.begin(), queue_.begin() + n, std::back_inserter(batch));
+            queue_.erase(queue_.begin(), queue_.begin() + n);
+        }
+        runBatch(batch);
+        batch.clear();
+    }
+}
+
+void NNInferenceServer::runBatch(std::vector<Request>& batch) {
+    const int n = static_cast<int>(batch.size());
+    NNMatrix& input = network_.beginInference(n);
+    float* x = input.data();
+    for (int j = 0; j < n; j++) {
+        const uint8_t* pixels = batch[j].pixels.data();
+        for (int i = 0; i < inputSize_; i++) {
+            x[static_cast<size_t>(i) * n + j] = pixels[i] / 255.0f;
+        }
+    }
+    const NNMatrix& logits = network_.runInference();
+
+    const int classes = logits.getRowSize();
+    const float* z = logits.data();
+    for (int j = 0; j < n; j++) {
+        const int label = logits.getIndexOfColMax(j);
+        const float zMax = z[static_cast<size_t>(label) * n + j];
+        float sum = 0.0f;
+        for (int k = 0; k < classes; k++) {
+            sum += NNVectorMath::exp(z[static_cast<size_t>(k) * n + j] - zMax);
+        }
+        char reply[REPLY_BYTES];
+        const int32_t label32 = label;
+        const float probability = 1.0f / sum;
+        std::memcpy(reply, &label32, sizeof(label32));
+        std::memcpy(reply + sizeof(label32), &probability, sizeof(probability));
+        Connection& connection = *batch[j].connection;
+        if (!connection.broken && !sendAll(connection.fd, reply, sizeof(reply))) {
+            connection.broken = true;
+            shutdown(connection.fd, SHUT_RDWR);
+        }
+    }
+
+    const auto done = Clock::now();
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    batches_++;
+    requests_ += n;
+    for (const Request& request : batch) {
+        const float us = std::chrono::duration<float, std::micro>(done - request.arrival).count();
+        if (latencies_.size() < MAX_LATENCY_SAMPLES) {
+            latencies_.push_back(us);
+        } else {
+            latencies_[latencyNext_] = us;
+            latencyNext_ = (latencyNext_ + 1) % MAX_LATENCY_SAMPLES;
+        }
+    }
+}
+
+NNServeStats NNInferenceServer::getStats() const {
+    NNServeStats stats;
+    std::vector<float> latencies;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        stats.requests = requests_;
+        stats.batches = batches_;
+        stats.seconds = std::chrono::duration<double>(Clock::now() - statsStart_).count();
+        latencies = latencies_;
+    }
+    if (stats.seconds > 0.0) {
+        stats.requestsPerSecond = stats.requests / stats.seconds;
+    }
+    if (stats.batches > 0) {
+        stats.meanBatch = static_cast<double>(stats.requests) / stats.batches;
+    }
+    stats.p50Us = NNUtils::percentile(latencies, 0.5);
+    stats.p99Us = NNUtils::percentile(latencies, 0.99);
+    stats.p999Us = NNUtils::percentile(latencies, 0.999);
+    return stats;
+}
+
+void NNInferenceServer::resetStats() {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    statsStart_ = Clock::now();
+    batches_ = 0;
+    requests_ = 0;
+    latencies_.clear();
+    latencyNext_ = 0;
+}
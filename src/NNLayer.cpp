@@ -3,16 +3,13 @@
 #include <iomanip>
 #include <sstream>
 
-NNLayer::NNLayer(int inputSize, int outputSize)
-    : weight(outputSize, inputSize), vWeight(outputSize, inputSize), bias(outputSize, 1),
-      vBias(outputSize, 1), dz_(outputSize, 1) {
-    for (int i = 0; i < outputSize; i++) {
-        for (int j = 0; j < inputSize; j++) {
-            weight.set(i, j, NNUtils::xavierInit(inputSize, outputSize));
-        }
-
-        bias.set(i, 0, NNUtils::xavierInit(inputSize, outputSize));
-    }
+NNLayer::NNLayer(int inputSize, int outputSize, const NNRandom& random)
+    : weight(outputSize, inputSize), bias(outputSize, 1), dWeight(outputSize, inputSize),
+      dBias(outputSize, 1), dz_(outputSize, 1) {
+    const float limit = NNUtils::xavierLimit(inputSize, outputSize);
+    const size_t weightCount = static_cast<size_t>(outputSize) * inputSize;
+    random.fillUniform(weight.data(), weightCount, -limit, limit);
+    random.fillUniform(bias.data(), outputSize, -limit, limit, weightCount);
 }
 
 NNMatrix NNLayer::forward(const NNMatrix& input, MatrixFunc activateFunc, bool debug) {
@@ -25,7 +22,7 @@ NNMatrix NNLayer::forward(const NNMatrix& input, MatrixFunc activateFunc, bool d
         LOG << "weight dotProduct input: " << std::endl;
         ret.dump();
     }
-    ret += bias;
+    ret.addToColumns(bias);
     if (debug) {
         LOG << "weight x input + bias: " << std::endl;
         ret.dump();
@@ -41,33 +38,90 @@ NNMatrix NNLayer::forward(const NNMatrix& input, MatrixFunc activateFunc, bool d
     return ret;
 }
 
-NNMatrix NNLayer::calculatePrevLayerDA(const NNMatrix& dz) {
-    NNMatrix da(weight.getColSize(), 1);
-    for (int i = 0; i < da.getRowSize(); i++) {
-        float daElemValue = 0.0f;
-        for (int j = 0; j < weight.getRowSize(); j++) {
-            daElemValue += dz.get(j, 0) * weight.get(j, i);
-        }
-        da.set(i, 0, daElemValue);
-    }
+void NNLayer::forward(const NNMatrix& input, NNMatrix& out) {
+    out.fill(0.0f);
+    out.addDotProduct(weight, input);
+    out.addToColumns(bias);
+}
+
+void NNLayer::forward(const NNSparseColumns& input, NNMatrix& out) {
+    out.fill(0.0f);
+    out.addDotProduct(weight, input);
+    out.addToColumns(bias);
+}
 
+NNMatrix NNLayer::calculatePrevLayerDA(const NNMatrix& dz) {
+    NNMatrix da(weight.getColSize(), dz.getColSize());
+    da.addDotProduct(weight, dz, true);
     return da;
 }
 
-void NNLayer::update(const NNMatrix& dw, const NNMatrix& db, float alpha, float momentum) {
-    for (int i = 0; i < weight.getRowSize(); i++) {
-        for (int j = 0; j < weight.getColSize(); j++) {
-            auto delta = momentum * vWeight.get(i, j) + alpha * dw.get(i, j);
-            vWeight.set(i, j, delta);
-            weight.set(i, j, weight.get(i, j) - delta);
+void NNLayer::calculatePrevLayerDA(const NNMatrix& dz, NNMatrix& da) {
+    da.fill(0.0f);
+    da.addDotProduct(weight, dz, true);
+}
+
+void NNLayer::accumulateGradients(const NNMatrix& input, const NNMatrix& dz) {
+    assert(input.getRowSize() == weight.getColSize());
+    assert(dz.getRowSize() == weight.getRowSize());
+    assert(input.getColSize() == dz.getColSize());
+
+    // dW += dz * input^T, with input transposed once so the GEMM streams contiguous rows.
+    dWeight.addDotProduct(dz, input.transpose());
+    accumulateBiasGradient(dz);
+}
+
+void NNLayer::accumulateGradients(const NNMatrix& input, const NNMatrix& dz, NNMatrix& inputT) {
+    assert(input.getRowSize() == weight.getColSize());
+    assert(dz.getRowSize() == weight.getRowSize());
+    assert(input.getColSize() == dz.getColSize());
+
+    input.transposeInto(inputT);
+    dWeight.addDotProduct(dz, inputT);
+    accumulateBiasGradient(dz);
+}
+
+void NNLayer::accumulateGradients(const NNSparseColumns& input, const NNMatrix& dz) {
+    assert(input.rows == weight.getColSize());
+    assert(dz.getRowSize() == weight.getRowSize());
+    assert(input.getColSize() == dz.getColSize());
+
+    // dW += dz * input^T, scattering only into the columns of dW the batch actually touches.
+    dWeight.addDotProductTransposed(dz, input);
+    accumulateBiasGradient(dz);
+}
+
+void NNLayer::accumulateBiasGradient(const NNMatrix& dz) {
+    const int rows = dz.getRowSize();
+    const int batch = dz.getColSize();
+    const float* d = dz.data();
+    float* db = dBias.data();
+    for (int i = 0; i < rows; i++) {
+        const float* dRow = d + static_cast<size_t>(i) * batch;
+        float sum = 0.0f;
+        for (int j = 0; j < batch; j++) {
+            sum += dRow[j];
         }
+        db[i] += sum;
     }
+}
 
-    for (int i = 0; i < bias.getRowSize(); i++) {
-        auto delta = momentum * vBias.get(i, 0) + alpha * db.get(i, 0);
-        vBias.set(i, 0, delta);
-        bias.set(i, 0, bias.get(i, 0) - delta);
+NNGraph::Value NNLayer::addToGraph(NNGraph& graph, NNGraph::Value input, bool withBias) {
+    const NNGraph::Value w = graph.parameter(weight.getRowSize(), weight.getColSize(),
+                                             weight.data(), dWeight.data());
+    if (!withBias) {
+        return graph.matmul(w, input);
     }
+    const NNGraph::Value b = graph.parameter(bias.getRowSize(), 1, bias.data(), dBias.data());
+    return graph.addBias(graph.matmul(w, input), b);
+}
+
+void NNLayer::bindParameters(float* weightMem, float* biasMem, float* dWeightMem,
+                             float* dBiasMem) {
+    weight.rebind(weightMem);
+    bias.rebind(biasMem);
+    dWeight.rebind(dWeightMem);
+    dBias.rebind(dBiasMem);
 }
 
 void NNLayer::dump() {
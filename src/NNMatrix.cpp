@@ -1,7 +1,11 @@
 #include "NNMatrix.h"
 
+#include "NNAllocator.h"
+#include "NNPerfCounters.h"
 #include "NNUtils.h"
 
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
@@ -15,7 +19,7 @@ NNMatrix::NNMatrix(int row, int col, float defaultValue) {
     row_ = row;
     col_ = col;
     auto elemCount = static_cast<size_t>(row) * static_cast<size_t>(col);
-    mem_ = new float[elemCount];
+    mem_ = NNAllocator::allocate(elemCount);
     std::fill_n(mem_, elemCount, defaultValue);
 }
 
@@ -23,17 +27,55 @@ NNMatrix::NNMatrix(const NNMatrix& other) : std::enable_shared_from_this<NNMatri
     row_ = other.row_;
     col_ = other.col_;
     auto elemCount = static_cast<size_t>(row_) * static_cast<size_t>(col_);
-    mem_ = new float[elemCount];
+    mem_ = NNAllocator::allocate(elemCount);
     memcpy(mem_, other.mem_, elemCount * sizeof(float));
+    hasNonZeroIndex_ = other.hasNonZeroIndex_;
+    nonZero_ = other.nonZero_;
+}
+
+NNMatrix::NNMatrix(std::shared_ptr<float> storage, float* mem, int row, int col)
+    : mem_(mem), row_(row), col_(col), owned_(false), storage_(std::move(storage)) {
+    assert(mem != nullptr && row > 0 && col > 0);
 }
 
 NNMatrix::~NNMatrix() {
-    if (mem_ != nullptr) {
-        row_ = 0;
-        col_ = 0;
-        delete[] mem_;
-        mem_ = nullptr;
+    release();
+    mem_ = nullptr;
+    row_ = 0;
+    col_ = 0;
+}
+
+void NNMatrix::release() {
+    if (owned_ && mem_ != nullptr) {
+        NNAllocator::deallocate(mem_, static_cast<size_t>(row_) * col_);
+    }
+    storage_.reset();
+}
+
+void NNMatrix::rebind(float* mem) {
+    assert(mem != nullptr);
+    auto elemCount = static_cast<size_t>(row_) * static_cast<size_t>(col_);
+    if (mem_ != nullptr && mem_ != mem) {
+        memcpy(mem, mem_, elemCount * sizeof(float));
     }
+    release();
+    mem_ = mem;
+    owned_ = false;
+}
+
+void NNMatrix::setView(float* mem, int row, int col) {
+    assert(mem != nullptr && row > 0 && col > 0);
+    dropNonZeroIndex();
+    release();
+    mem_ = mem;
+    row_ = row;
+    col_ = col;
+    owned_ = false;
+}
+
+void NNMatrix::fill(float value) {
+    dropNonZeroIndex();
+    std::fill_n(mem_, static_cast<size_t>(row_) * col_, value);
 }
 
 NNMatrix& NNMatrix::operator=(const NNMatrix& other) {
@@ -41,18 +83,29 @@ NNMatrix& NNMatrix::operator=(const NNMatrix& other) {
         return *this;
     }
 
-    if (mem_ != nullptr) {
-        delete[] mem_;
-        mem_ = nullptr;
+    if (!owned_) {
+        if (row_ != other.row_ || col_ != other.col_) {
+            LOG << "mismatched matrix size" << std::endl;
+            return *this;
+        }
+        memcpy(mem_, other.mem_, static_cast<size_t>(row_) * col_ * sizeof(float));
+        hasNonZeroIndex_ = other.hasNonZeroIndex_;
+        nonZero_ = other.nonZero_;
+        return *this;
     }
 
+    release();
+    mem_ = nullptr;
+
     row_ = other.row_;
     col_ = other.col_;
     if (row_ > 0 && col_ > 0) {
         auto elemCount = static_cast<size_t>(row_) * static_cast<size_t>(col_);
-        mem_ = new float[elemCount];
+        mem_ = NNAllocator::allocate(elemCount);
         memcpy(mem_, other.mem_, elemCount * sizeof(float));
     }
+    hasNonZeroIndex_ = other.hasNonZeroIndex_;
+    nonZero_ = other.nonZero_;
 
     return *this;
 }
@@ -62,17 +115,21 @@ NNMatrix& NNMatrix::operator=(NNMatrix&& other) noexcept {
         return *this;
     }
 
-    if (mem_ != nullptr) {
-        delete[] mem_;
-        mem_ = nullptr;
+    // Views never give up their storage and nobody takes ownership of a view's storage.
+    if (!owned_ || !other.owned_) {
+        return *this = static_cast<const NNMatrix&>(other);
     }
 
+    release();
     mem_ = other.mem_;
     row_ = other.row_;
     col_ = other.col_;
+    hasNonZeroIndex_ = other.hasNonZeroIndex_;
+    nonZero_ = std::move(other.nonZero_);
     other.mem_ = nullptr;
     other.row_ = 0;
     other.col_ = 0;
+    other.hasNonZeroIndex_ = false;
 
     return *this;
 }
@@ -106,6 +163,7 @@ NNVector NNMatrix::getCol(int col) const {
 void NNMatrix::set(int i, int j, float elemValue) {
     assert(i >= 0 && j >= 0);
     assert(i < row_ && j < col_);
+    dropNonZeroIndex();
     mem_[i * col_ + j] = elemValue;
 }
 
@@ -124,34 +182,254 @@ NNMatrix NNMatrix::dotProduct(const NNMatrix& other) {
         return ret;
     }
 
-    const int m = row_;
-    const int n = other.col_;
-    const int kDim = col_;
-
-    // Compute C = A(m x kDim) * B(kDim x n). Matrices are stored row-major.
-    // We use loop order i -> j -> k so B is accessed row-wise (contiguous) in the inner loop.
     // ret is constructed with defaultValue=0, so we can accumulate directly into its buffer.
+    ret.addDotProduct(*this, other);
+    return ret;
+}
 
-    float* out = ret.mem_;
-    const float* a = mem_;
-    const float* b = other.mem_;
+void NNMatrix::addDotProduct(const NNMatrix& a, const NNMatrix& b, bool transposeA) {
+    const int m = transposeA ? a.col_ : a.row_;
+    const int kDim = transposeA ? a.row_ : a.col_;
+    const int n = b.col_;
+    assert(b.row_ == kDim);
+    assert(row_ == m && col_ == n);
+    if (mem_ == nullptr || a.mem_ == nullptr || b.mem_ == nullptr) {
+        return;
+    }
+    NNPerfScope scope(transposeA ? "gemm_tn" : "gemm", 2.0 * m * kDim * n);
+    dropNonZeroIndex();
+
+    float* out = mem_;
+    const float* aMem = a.mem_;
+    const float* bMem = b.mem_;
+
+    if (!transposeA) {
+        // Compute C += A(m x kDim) * B(kDim x n). Matrices are stored row-major.
+        // We use loop order i -> j -> k so B is accessed row-wise (contiguous) in the inner loop,
+        // folding four rows of B into each pass so row i of C is loaded and stored a quarter as
+        // often.
+        for (int i = 0; i < m; i++) {
+            float* outRow = out + static_cast<size_t>(i) * n;
+            const float* aRow = aMem + static_cast<size_t>(i) * kDim;
+            int j = 0;
+            for (; j + 4 <= kDim; j += 4) {
+                const float a0 = aRow[j];
+                const float a1 = aRow[j + 1];
+                const float a2 = aRow[j + 2];
+                const float a3 = aRow[j + 3];
+                const float* b0 = bMem + static_cast<size_t>(j) * n;
+                const float* b1 = b0 + n;
+                const float* b2 = b1 + n;
+                const float* b3 = b2 + n;
+                for (int kk = 0; kk < n; kk++) {
+                    outRow[kk] += a0 * b0[kk] + a1 * b1[kk] + a2 * b2[kk] + a3 * b3[kk];
+                }
+            }
+            for (; j < kDim; j++) {
+                const float aVal = aRow[j];
+                const float* bRow = bMem + static_cast<size_t>(j) * n;
+                // outRow[kk] += A(i, j) * B(j, kk)
+                for (int kk = 0; kk < n; kk++) {
+                    outRow[kk] += aVal * bRow[kk];
+                }
+            }
+        }
+        return;
+    }
 
-    for (int i = 0; i < m; i++) {
-        float* outRow = out + i * n;
-        const float* aRow = a + i * kDim;
-        for (int j = 0; j < kDim; j++) {
-            const float aVal = aRow[j];
-            const float* bRow = b + j * n;
-            // outRow[kk] += A(i, j) * B(j, kk)
+    // Compute C += A^T * B with A stored (kDim x m). Walking A row by row keeps both A and B
+    // contiguous: C(i, :) += A(j, i) * B(j, :). Four rows of A and B go into each sweep over C,
+    // which otherwise streams all of C (e.g. a 784 x batch backward da) once per row of A.
+    int j = 0;
+    for (; j + 4 <= kDim; j += 4) {
+        const float* a0 = aMem + static_cast<size_t>(j) * m;
+        const float* a1 = a0 + m;
+        const float* a2 = a1 + m;
+        const float* a3 = a2 + m;
+        const float* b0 = bMem + static_cast<size_t>(j) * n;
+        const float* b1 = b0 + n;
+        const float* b2 = b1 + n;
+        const float* b3 = b2 + n;
+        for (int i = 0; i < m; i++) {
+            const float v0 = a0[i];
+            const float v1 = a1[i];
+            const float v2 = a2[i];
+            const float v3 = a3[i];
+            float* outRow = out + static_cast<size_t>(i) * n;
+            for (int kk = 0; kk < n; kk++) {
+                outRow[kk] += v0 * b0[kk] + v1 * b1[kk] + v2 * b2[kk] + v3 * b3[kk];
+            }
+        }
+    }
+    for (; j < kDim; j++) {
+        const float* aRow = aMem + static_cast<size_t>(j) * m;
+        const float* bRow = bMem + static_cast<size_t>(j) * n;
+        for (int i = 0; i < m; i++) {
+            const float aVal = aRow[i];
+            float* outRow = out + static_cast<size_t>(i) * n;
             for (int kk = 0; kk < n; kk++) {
                 outRow[kk] += aVal * bRow[kk];
             }
         }
     }
+}
+
+void NNMatrix::addDotProductTransposed(const NNMatrix& a, const NNMatrix& b) {
+    const int m = a.row_;
+    const int kDim = a.col_;
+    const int n = b.row_;
+    assert(b.col_ == kDim);
+    assert(row_ == m && col_ == n);
+    if (mem_ == nullptr || a.mem_ == nullptr || b.mem_ == nullptr) {
+        return;
+    }
+    NNPerfScope scope("gemm_nt", 2.0 * m * kDim * n);
+    dropNonZeroIndex();
 
+    // C(i, j) += A(i, :) . B(j, :): both rows are contiguous. Four rows of B share each pass
+    // over the row of A, and each dot product keeps LANES partial sums so the loop vectorizes
+    // without reassociating float adds.
+    constexpr int LANES = 8;
+    for (int i = 0; i < m; i++) {
+        const float* aRow = a.mem_ + static_cast<size_t>(i) * kDim;
+        float* outRow = mem_ + static_cast<size_t>(i) * n;
+        int j = 0;
+        for (; j + 4 <= n; j += 4) {
+            const float* b0 = b.mem_ + static_cast<size_t>(j) * kDim;
+            const float* b1 = b0 + kDim;
+            const float* b2 = b1 + kDim;
+            const float* b3 = b2 + kDim;
+            float s0[LANES] = {};
+            float s1[LANES] = {};
+            float s2[LANES] = {};
+            float s3[LANES] = {};
+            int kk = 0;
+            for (; kk + LANES <= kDim; kk += LANES) {
+                for (int l = 0; l < LANES; l++) {
+                    const float aVal = aRow[kk + l];
+                    s0[l] += aVal * b0[kk + l];
+                    s1[l] += aVal * b1[kk + l];
+                    s2[l] += aVal * b2[kk + l];
+                    s3[l] += aVal * b3[kk + l];
+                }
+            }
+            for (; kk < kDim; kk++) {
+                const float aVal = aRow[kk];
+                s0[0] += aVal * b0[kk];
+                s1[0] += aVal * b1[kk];
+                s2[0] += aVal * b2[kk];
+                s3[0] += aVal * b3[kk];
+            }
+            for (int l = 0; l < LANES; l++) {
+                outRow[j] += s0[l];
+                outRow[j + 1] += s1[l];
+                outRow[j + 2] += s2[l];
+                outRow[j + 3] += s3[l];
+            }
+        }
+        for (; j < n; j++) {
+            const float* bRow = b.mem_ + static_cast<size_t>(j) * kDim;
+            float sum = 0.0f;
+            for (int kk = 0; kk < kDim; kk++) {
+                sum += aRow[kk] * bRow[kk];
+            }
+            outRow[j] += sum;
+        }
+    }
+}
+
+void NNMatrix::addDotProduct(const NNMatrix& a, const NNSparseColumns& b) {
+    const int m = a.row_;
+    const int kDim = a.col_;
+    const int n = b.getColSize();
+    assert(b.rows == kDim);
+    assert(row_ == m && col_ == n);
+    NNPerfScope scope("sparse_gemm", 2.0 * m * b.index.size());
+    dropNonZeroIndex();
+
+    // C(i, j) += sum over non-zeros p of column j: A(i, index[p]) * value[p]. Row i of A stays
+    // in L1 while every column of B gathers from it.
+    const int* index = b.index.data();
+    const float* value = b.value.data();
+    for (int i = 0; i < m; i++) {
+        const float* aRow = a.mem_ + static_cast<size_t>(i) * kDim;
+        float* outRow = mem_ + static_cast<size_t>(i) * n;
+        for (int j = 0; j < n; j++) {
+            float sum = 0.0f;
+            for (int p = b.colStart[j]; p < b.colStart[j + 1]; p++) {
+                sum += aRow[index[p]] * value[p];
+            }
+            outRow[j] += sum;
+        }
+    }
+}
+
+void NNMatrix::addDotProductTransposed(const NNMatrix& a, const NNSparseColumns& b) {
+    const int m = a.row_;
+    const int n = b.getColSize();
+    assert(a.col_ == n);
+    assert(row_ == m && col_ == b.rows);
+    NNPerfScope scope("sparse_gemm_nt", 2.0 * m * b.index.size());
+    dropNonZeroIndex();
+
+    // C(i, index[p]) += A(i, j) * value[p] for every non-zero p of column j: a scatter into
+    // row i of C, which stays in L1.
+    const int* index = b.index.data();
+    const float* value = b.value.data();
+    for (int i = 0; i < m; i++) {
+        const float* aRow = a.mem_ + static_cast<size_t>(i) * n;
+        float* outRow = mem_ + static_cast<size_t>(i) * col_;
+        for (int j = 0; j < n; j++) {
+            const float aVal = aRow[j];
+            if (aVal == 0.0f) {
+                continue;
+            }
+            for (int p = b.colStart[j]; p < b.colStart[j + 1]; p++) {
+                outRow[index[p]] += aVal * value[p];
+            }
+        }
+    }
+}
+
+NNMatrix NNMatrix::transpose() const {
+    NNMatrix ret(col_, row_);
+    transposeInto(ret);
     return ret;
 }
 
+void NNMatrix::transposeInto(NNMatrix& out) const {
+    assert(out.row_ == col_ && out.col_ == row_);
+    if (mem_ == nullptr || out.mem_ == nullptr) {
+        return;
+    }
+    NNPerfScope scope("transpose");
+    out.dropNonZeroIndex();
+
+    for (int i = 0; i < row_; i++) {
+        const float* src = mem_ + static_cast<size_t>(i) * col_;
+        for (int j = 0; j < col_; j++) {
+            out.mem_[static_cast<size_t>(j) * row_ + i] = src[j];
+        }
+    }
+}
+
+NNMatrix& NNMatrix::addToColumns(const NNMatrix& column) {
+    dropNonZeroIndex();
+    if (column.row_ != row_ || column.col_ != 1) {
+        LOG << "mismatched matrix size" << std::endl;
+        return *this;
+    }
+
+    for (int i = 0; i < row_; i++) {
+        const float v = column.mem_[i];
+        float* dst = mem_ + static_cast<size_t>(i) * col_;
+        for (int j = 0; j < col_; j++) {
+            dst[j] += v;
+        }
+    }
+    return *this;
+}
+
 NNMatrix NNMatrix::elementProduct(const NNMatrix& other) {
     assert(row_ == other.row_);
     assert(col_ == other.col_);
@@ -169,6 +447,7 @@ NNMatrix NNMatrix::elementProduct(const NNMatrix& other) {
 }
 
 NNMatrix& NNMatrix::operator+=(const NNMatrix& other) {
+    dropNonZeroIndex();
     if (row_ != other.row_ || col_ != other.col_) {
         LOG << "mismatched matrix size" << std::endl;
         return *this;
@@ -202,6 +481,7 @@ NNMatrix NNMatrix::operator-(const NNMatrix& other) {
 }
 
 NNMatrix& NNMatrix::operator-=(const NNMatrix& other) {
+    dropNonZeroIndex();
     if (row_ != other.row_ || col_ != other.col_) {
         LOG << "mismatched matrix size" << std::endl;
         return *this;
@@ -217,6 +497,7 @@ NNMatrix& NNMatrix::operator-=(const NNMatrix& other) {
 }
 
 NNMatrix& NNMatrix::operator*=(float ratio) {
+    dropNonZeroIndex();
     const int total = row_ * col_;
     for (int idx = 0; idx < total; idx++) {
         mem_[idx] *= ratio;
@@ -225,6 +506,7 @@ NNMatrix& NNMatrix::operator*=(float ratio) {
 }
 
 NNMatrix& NNMatrix::operator/=(float ratio) {
+    dropNonZeroIndex();
     if (fabs(ratio) < 1e-6) {
         LOG << "cannot divide by 0" << std::endl;
         return *this;
@@ -253,6 +535,7 @@ NNMatrix NNMatrix::applyFunction(const MatrixFunc& func) {
 }
 
 void NNMatrix::toOneHot() {
+    dropNonZeroIndex();
     if (mem_ == nullptr || row_ <= 0 || col_ <= 0) {
         return;
     }
@@ -264,6 +547,17 @@ void NNMatrix::toOneHot() {
     }
 }
 
+void NNMatrix::buildNonZeroIndex() {
+    nonZero_.clear();
+    const int total = row_ * col_;
+    for (int idx = 0; idx < total; idx++) {
+        if (mem_[idx] != 0.0f) {
+            nonZero_.push_back(idx);
+        }
+    }
+    hasNonZeroIndex_ = true;
+}
+
 void NNMatrix::dump(bool showFullLine, int lineSize, bool dumpToFile) const {
     int numToDump = col_ * row_;
     std::stringstream ss;
@@ -335,3 +629,11 @@ int NNMatrix::getIndexOfColMax(int col) const {
 
     return ret;
 }
+
+float NNSparseColumns::density() const {
+    const int cols = getColSize();
+    if (rows <= 0 || cols <= 0) {
+        return 1.0f;
+    }
+    return static_cast<float>(index.size()) / (static_cast<float>(rows) * cols);
+}
@@ -0,0 +1,286 @@
+#include "NNNuma.h"
+
+#include "NNAllocator.h"
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+constexpr const char* NODE_DIR = "/sys/devices/system/node";
+
+std::vector<std::vector<int>> readTopology() {
+    std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+    if (DIR* dir = opendir(NODE_DIR)) {
+        while (dirent* entry = readdir(dir)) {
+            int node = -1;
+            if (std::sscanf(entry->d_name, "node%d", &node) != 1 || node < 0) {
+                continue;
+            }
+            std::ifstream file(std::string(NODE_DIR) + "/" + entry->d_name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            if (static_cast<int>(nodes.size()) <= node) {
+                nodes.resize(node + 1);
+            }
+            nodes[node] = NNNuma::parseCpuList(list);
+        }
+        closedir(dir);
+    }
+#endif
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        const int cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < cpus; cpu++) {
+            nodes[0].push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+#ifdef __linux__
+// set_mempolicy(2) over a mask of nodeIds, no mask at all when it is empty.
+bool setMemoryPolicy(int mode, const std::vector<int>& nodeIds) {
+    constexpr int BITS = 8 * sizeof(unsigned long);
+    int maxNode = 0;
+    for (int node : nodeIds) {
+        maxNode = std::max(maxNode, node + 1);
+    }
+    std::vector<unsigned long> mask(std::max(1, (maxNode + BITS - 1) / BITS), 0);
+    for (int node : nodeIds) {
+        mask[node / BITS] |= 1ul << (node % BITS);
+    }
+    const unsigned long* maskData = nodeIds.empty() ? nullptr : mask.data();
+    const unsigned long maskBits = nodeIds.empty() ? 0 : mask.size() * BITS + 1;
+    return syscall(SYS_set_mempolicy, mode, maskData, maskBits) == 0;
+}
+#endif
+} // namespace
+
+NNNuma::NNNuma(std::vector<std::vector<int>> nodeCpus) : nodeCpus_(std::move(nodeCpus)) {
+    if (nodeCpus_.empty()) {
+        nodeCpus_.emplace_back();
+    }
+}
+
+const NNNuma& NNNuma::system() {
+    static const NNNuma topology(readTopology());
+    return topology;
+}
+
+int NNNuma::nodeOfCpu(int cpu) const {
+    for (int node = 0; node < getNodeCount(); node++) {
+        const auto& cpus = nodeCpus_[node];
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+int NNNuma::cpuFor(int worker, NNPinPolicy policy) const {
+    std::vector<const std::vector<int>*> nodes;
+    size_t total = 0;
+    for (const auto& cpus : nodeCpus_) {
+        if (!cpus.empty()) {
+            nodes.push_back(&cpus);
+            total += cpus.size();
+        }
+    }
+    if (policy == NNPinPolicy::None || nodes.empty() || worker < 0) {
+        return -1;
+    }
+    if (policy == NNPinPolicy::Compact) {
+        size_t index = static_cast<size_t>(worker) % total;
+        for (const auto* cpus : nodes) {
+            if (index < cpus->size()) {
+                return (*cpus)[index];
+            }
+            index -= cpus->size();
+        }
+    }
+    // Scatter: worker w goes to node w % nodes, taking that node's CPUs in order.
+    const auto& cpus = *nodes[worker % nodes.size()];
+    return cpus[(worker / nodes.size()) % cpus.size()];
+}
+
+int NNNuma::placeWorker(int worker, NNPinPolicy policy) const {
+    const int cpu = cpuFor(worker, policy);
+    if (cpu < 0 || !pinThread(cpu)) {
+        return -1;
+    }
+    const int node = nodeOfCpu(cpu);
+    // Only worth a policy when there is another node to avoid, first touch does the rest.
+    if (getNodeCount() > 1) {
+        preferNode(node);
+    }
+    return node;
+}
+
+bool NNNuma::interleaveMemory() const {
+#ifdef __linux__
+    std::vector<int> nodes;
+    for (int node = 0; node < getNodeCount(); node++) {
+        nodes.push_back(node);
+    }
+    return getNodeCount() > 1 && setMemoryPolicy(MPOL_INTERLEAVE, nodes);
+#else
+    return false;
+#endif
+}
+
+bool NNNuma::pinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+bool NNNuma::preferNode(int node) {
+#ifdef __linux__
+    return setMemoryPolicy(MPOL_PREFERRED, {node});
+#else
+    (void) node;
+    return false;
+#endif
+}
+
+bool NNNuma::resetMemoryPolicy() {
+#ifdef __linux__
+    return setMemoryPolicy(MPOL_DEFAULT, {});
+#else
+    return false;
+#endif
+}
+
+std::vector<NNMatrixPtr> NNNuma::localCopy(const std::vector<NNMatrixPtr>& samples) {
+    // One block for all of them, like read_mnist_data, so the replica can use huge pages too.
+    size_t total = 0;
+    for (const auto& sample : samples) {
+        total += static_cast<size_t>(sample->getRowSize()) * sample->getColSize();
+    }
+    auto block = NNAllocator::allocateShared(total);
+    std::vector<NNMatrixPtr> copies;
+    copies.reserve(samples.size());
+    float* next = block.get();
+    for (const auto& sample : samples) {
+        const NNMatrix& source = *sample;
+        const size_t count = static_cast<size_t>(source.getRowSize()) * source.getColSize();
+        std::copy_n(source.data(), count, next);
+        auto copy = std::make_shared<NNMatrix>(block, next, source.getRowSize(),
+                                               source.getColSize());
+        if (source.getNonZeroIndex() != nullptr) {
+            copy->buildNonZeroIndex();
+        }
+        copies.push_back(std::move(copy));
+        next += count;
+    }
+    return copies;
+}
+
+std::vector<NNNuma::NodeStats> NNNuma::readNodeStats() const {
+    std::vector<NodeStats> stats(getNodeCount());
+    for (int node = 0; node < getNodeCount(); node++) {
+        std::ifstream file(std::string(NODE_DIR) + "/node" + std::to_string(node) + "/numastat");
+        std::string key;
+        uint64_t value = 0;
+        while (file >> key >> value) {
+            if (key == "numa_hit") {
+                stats[node].numaHit = value;
+            } else if (key == "numa_miss") {
+                stats[node].numaMiss = value;
+            } else if (key == "interleave_hit") {
+                stats[node].interleaveHit = value;
+            } else if (key == "local_node") {
+                stats[node].localNode = value;
+            } else if (key == "other_node") {
+                stats[node].otherNode = value;
+            }
+        }
+    }
+    return stats;
+}
+
+void NNNuma::logNodeStats(const std::vector<NodeStats>& before,
+                          const std::vector<NodeStats>& after, double seconds) const {
+    const size_t nodes = std::min(before.size(), after.size());
+    const double pageMB = sysconf(_SC_PAGESIZE) / 1e6;
+    const double time = std::max(seconds, 1e-9);
+    for (size_t node = 0; node < nodes; node++) {
+        const uint64_t local = after[node].localNode - before[node].localNode;
+        const uint64_t remote = after[node].otherNode - before[node].otherNode;
+        const uint64_t miss = after[node].numaMiss - before[node].numaMiss;
+        const double remoteShare = local + remote > 0 ? 100.0 * remote / (local + remote) : 0.0;
+        LOG << "Node " << node << ": local allocations " << local * pageMB / time
+            << " MB/s, remote " << remote * pageMB / time << " MB/s (" << remoteShare
+            << "%), misses " << miss << std::endl;
+    }
+}
+
+std::map<int, uint64_t> NNNuma::residentPages() {
+    std::map<int, uint64_t> pages;
+    std::ifstream maps("/proc/self/numa_maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::istringstream fields(line);
+        std::string field;
+        while (fields >> field) {
+            int node = -1;
+            unsigned long long count = 0;
+            if (std::sscanf(field.c_str(), "N%d=%llu", &node, &count) == 2) {
+                pages[node] += count;
+            }
+        }
+    }
+    return pages;
+}
+
+std::vector<int> NNNuma::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first = 0;
+        int last = 0;
+        const int parsed = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (parsed == 1) {
+            last = first;
+        } else if (parsed != 2) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool NNNuma::parsePinPolicy(const std::string& name, NNPinPolicy& policy) {
+    if (name == "none") {
+        policy = NNPinPolicy::None;
+    } else if (name == "compact") {
+        policy = NNPinPolicy::Compact;
+    } else if (name == "scatter") {
+        policy = NNPinPolicy::Scatter;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,182 @@
+#include "NNOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+NNSGDOptimizer::NNSGDOptimizer(float momentum, bool nesterov, float weightDecay)
+    : momentum_(momentum), nesterov_(nesterov), weightDecay_(weightDecay) {}
+
+void NNSGDOptimizer::update(float* param, const float* grad, float* const* state, size_t n,
+                            float lr, bool decay) {
+    const float wd = decay ? weightDecay_ : 0.0f;
+    const float m = momentum_;
+    if (stateSize() == 0) {
+        for (size_t i = 0; i < n; i++) {
+            param[i] -= lr * (grad[i] + wd * param[i]);
+        }
+        return;
+    }
+
+    float* v = state[0];
+    if (nesterov_) {
+        for (size_t i = 0; i < n; i++) {
+            const float g = lr * (grad[i] + wd * param[i]);
+            const float vNew = m * v[i] + g;
+            v[i] = vNew;
+            param[i] -= m * vNew + g;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const float vNew = m * v[i] + lr * (grad[i] + wd * param[i]);
+        v[i] = vNew;
+        param[i] -= vNew;
+    }
+}
+
+NNAdamOptimizer::NNAdamOptimizer(float beta1, float beta2, float epsilon, float weightDecay,
+                                 bool decoupled)
+    : beta1_(beta1), beta2_(beta2), epsilon_(epsilon), weightDecay_(weightDecay),
+      decoupled_(decoupled) {}
+
+void NNAdamOptimizer::update(float* param, const float* grad, float* const* state, size_t n,
+                             float lr, bool decay) {
+    float* m = state[0];
+    float* v = state[1];
+    const int t = std::max(step_, 1);
+    const float b1 = beta1_;
+    const float b2 = beta2_;
+    const float eps = epsilon_;
+    // Fold bias correction into two scalars so the loop is a single multiply-add chain.
+    const float stepSize = lr / (1.0f - std::pow(b1, static_cast<float>(t)));
+    const float invCorrection2 = 1.0f / (1.0f - std::pow(b2, static_cast<float>(t)));
+    const float l2 = (decay && !decoupled_) ? weightDecay_ : 0.0f;
+    const float shrink = (decay && decoupled_) ? 1.0f - lr * weightDecay_ : 1.0f;
+
+    for (size_t i = 0; i < n; i++) {
+        const float g = grad[i] + l2 * param[i];
+        const float mNew = b1 * m[i] + (1.0f - b1) * g;
+        const float vNew = b2 * v[i] + (1.0f - b2) * g * g;
+        m[i] = mNew;
+        v[i] = vNew;
+        param[i] = shrink * param[i] - stepSize * mNew / (std::sqrt(vNew * invCorrection2) + eps);
+    }
+}
+
+NNRMSPropOptimizer::NNRMSPropOptimizer(float rho, float epsilon, float weightDecay)
+    : rho_(rho), epsilon_(epsilon), weightDecay_(weightDecay) {}
+
+void NNRMSPropOptimizer::update(float* param, const float* grad, float* const* state, size_t n,
+                                float lr, bool decay) {
+    float* s = state[0];
+    const float rho = rho_;
+    const float eps = epsilon_;
+    const float wd = decay ? weightDecay_ : 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        const float g = grad[i] + wd * param[i];
+        const float sNew = rho * s[i] + (1.0f - rho) * g * g;
+        s[i] = sNew;
+        param[i] -= lr * g / (std::sqrt(sNew) + eps);
+    }
+}
+
+NNLARSOptimizer::NNLARSOptimizer(float momentum, float weightDecay, float trust)
+    : momentum_(momentum), weightDecay_(weightDecay), trust_(trust) {}
+
+void NNLARSOptimizer::update(float* param, const float* grad, float* const* state, size_t n,
+                             float lr, bool decay) {
+    float* v = state[0];
+    const float wd = decay ? weightDecay_ : 0.0f;
+    float localLr = lr;
+    if (decay) {
+        float weightNorm = 0.0f;
+        float gradNorm = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            weightNorm += param[i] * param[i];
+            gradNorm += grad[i] * grad[i];
+        }
+        weightNorm = std::sqrt(weightNorm);
+        gradNorm = std::sqrt(gradNorm);
+        if (weightNorm > 0.0f && gradNorm > 0.0f) {
+            localLr *= trust_ * weightNorm / (gradNorm + wd * weightNorm);
+        }
+    }
+
+    const float m = momentum_;
+    for (size_t i = 0; i < n; i++) {
+        const float vNew = m * v[i] + localLr * (grad[i] + wd * param[i]);
+        v[i] = vNew;
+        param[i] -= vNew;
+    }
+}
+
+NNLAMBOptimizer::NNLAMBOptimizer(float beta1, float beta2, float epsilon, float weightDecay)
+    : beta1_(beta1), beta2_(beta2), epsilon_(epsilon), weightDecay_(weightDecay) {}
+
+void NNLAMBOptimizer::update(float* param, const float* grad, float* const* state, size_t n,
+                             float lr, bool decay) {
+    float* m = state[0];
+    float* v = state[1];
+    const int t = std::max(step_, 1);
+    const float b1 = beta1_;
+    const float b2 = beta2_;
+    const float eps = epsilon_;
+    const float invCorrection1 = 1.0f / (1.0f - std::pow(b1, static_cast<float>(t)));
+    const float invCorrection2 = 1.0f / (1.0f - std::pow(b2, static_cast<float>(t)));
+    const float wd = decay ? weightDecay_ : 0.0f;
+
+    // Pass 1 updates the moments and measures ||w|| and ||u||, pass 2 applies the scaled step.
+    float weightNorm = 0.0f;
+    float updateNorm = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        const float g = grad[i];
+        const float mNew = b1 * m[i] + (1.0f - b1) * g;
+        const float vNew = b2 * v[i] + (1.0f - b2) * g * g;
+        m[i] = mNew;
+        v[i] = vNew;
+        const float u =
+            mNew * invCorrection1 / (std::sqrt(vNew * invCorrection2) + eps) + wd * param[i];
+        weightNorm += param[i] * param[i];
+        updateNorm += u * u;
+    }
+
+    float ratio = 1.0f;
+    if (decay && weightNorm > 0.0f && updateNorm > 0.0f) {
+        ratio = std::sqrt(weightNorm) / std::sqrt(updateNorm);
+    }
+
+    const float stepSize = lr * ratio;
+    for (size_t i = 0; i < n; i++) {
+        const float u =
+            m[i] * invCorrection1 / (std::sqrt(v[i] * invCorrection2) + eps) + wd * param[i];
+        param[i] -= stepSize * u;
+    }
+}
+
+NNStepSchedule::NNStepSchedule(float lr, int stepSize, float gamma)
+    : lr_(lr), stepSize_(std::max(stepSize, 1)), gamma_(gamma) {}
+
+float NNStepSchedule::rate(int step) const {
+    return lr_ * std::pow(gamma_, static_cast<float>(step / stepSize_));
+}
+
+NNCosineSchedule::NNCosineSchedule(float lr, int totalSteps, float minLr)
+    : lr_(lr), totalSteps_(std::max(totalSteps, 1)), minLr_(minLr) {}
+
+float NNCosineSchedule::rate(int step) const {
+    const float progress =
+        static_cast<float>(std::min(step, totalSteps_)) / static_cast<float>(totalSteps_);
+    return minLr_ + 0.5f * (lr_ - minLr_) * (1.0f + std::cos(static_cast<float>(M_PI) * progress));
+}
+
+NNWarmupSchedule::NNWarmupSchedule(int warmupSteps, std::shared_ptr<NNLearningRateSchedule> after)
+    : warmupSteps_(std::max(warmupSteps, 0)), after_(std::move(after)) {}
+
+float NNWarmupSchedule::rate(int step) const {
+    if (step < warmupSteps_) {
+        return after_->rate(0) * static_cast<float>(step + 1) / static_cast<float>(warmupSteps_);
+    }
+    return after_->rate(step - warmupSteps_);
+}
@@ -0,0 +1,89 @@
+#include "NNParameterArena.h"
+
+#include "NNPerfCounters.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+constexpr size_t FLOATS_PER_LINE = NNParameterArena::ALIGNMENT / sizeof(float);
+
+size_t alignUp(size_t count) {
+    return (count + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+}
+} // namespace
+
+int NNParameterArena::reserve(size_t count, bool decay) {
+    assert(!params_);
+    Segment segment;
+    segment.count = count;
+    segment.decay = decay;
+    segments_.push_back(segment);
+    return static_cast<int>(segments_.size()) - 1;
+}
+
+void NNParameterArena::allocate() {
+    // Decayed segments go first so the optimizer can sweep each group in one pass. Every
+    // segment starts on a cache line, the padding stays zero and is never touched by gradients.
+    size_t offset = 0;
+    for (bool decay : {true, false}) {
+        for (auto& segment : segments_) {
+            if (segment.decay == decay) {
+                segment.offset = offset;
+                offset += alignUp(segment.count);
+            }
+        }
+        if (decay) {
+            decaySize_ = offset;
+        }
+    }
+
+    size_ = offset;
+    params_ = NNAllocator::allocateBuffer(size_);
+    grads_ = NNAllocator::allocateBuffer(size_);
+    state_.reset();
+    stateSize_ = 0;
+}
+
+size_t NNParameterArena::segmentSpan(int segment) const {
+    return alignUp(segments_[segment].count);
+}
+
+void NNParameterArena::zeroGrad() { std::memset(grads_.get(), 0, size_ * sizeof(float)); }
+
+void NNParameterArena::reserveState(int stateSize) {
+    if (stateSize != stateSize_) {
+        state_ = NNAllocator::allocateBuffer(static_cast<size_t>(stateSize) * size_);
+        stateSize_ = stateSize;
+    }
+}
+
+void NNParameterArena::step(NNOptimizer& optimizer, float learningRate) {
+    const int stateSize = optimizer.stateSize();
+    reserveState(stateSize);
+    NNPerfScope scope("optimizer");
+
+    if (optimizer.isLayerwise()) {
+        float* segmentState[NNOptimizer::MAX_STATE_SIZE] = {};
+        for (const auto& segment : segments_) {
+            for (int s = 0; s < stateSize; s++) {
+                segmentState[s] = state(s) + segment.offset;
+            }
+            optimizer.update(params_.get() + segment.offset, grads_.get() + segment.offset,
+                             segmentState, segment.count, learningRate, segment.decay);
+        }
+        return;
+    }
+
+    float* decayState[NNOptimizer::MAX_STATE_SIZE] = {};
+    float* plainState[NNOptimizer::MAX_STATE_SIZE] = {};
+    for (int s = 0; s < stateSize; s++) {
+        decayState[s] = state(s);
+        plainState[s] = state(s) + decaySize_;
+    }
+
+    optimizer.update(params_.get(), grads_.get(), decayState, decaySize_, learningRate, true);
+    optimizer.update(params_.get() + decaySize_, grads_.get() + decaySize_, plainState,
+                     size_ - decaySize_, learningRate, false);
+}
@@ -0,0 +1,222 @@
+#include "NNPerfCounters.h"
+
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+thread_local NNPerfCounters* currentCounters = nullptr;
+
+#ifdef __linux__
+int openCounter(uint32_t type, uint64_t config, int groupFd) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+} // namespace
+
+NNPerfCounters::NNPerfCounters() {
+    slot_.fill(-1);
+#ifdef __linux__
+    struct Event {
+        Counter counter;
+        uint32_t type;
+        uint64_t config;
+    };
+    const Event events[] = {
+        {CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {L1D_MISSES, PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {LLC_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    // Cycles lead the group, members the PMU cannot schedule are left out.
+    for (const Event& event : events) {
+        const int fd = openCounter(event.type, event.config, leaderFd_);
+        if (fd < 0) {
+            if (leaderFd_ < 0) {
+                LOG << "perf_event_open unavailable, reporting time and GFLOP/s only"
+                    << std::endl;
+                return;
+            }
+            continue;
+        }
+        if (leaderFd_ < 0) {
+            leaderFd_ = fd;
+        }
+        slot_[event.counter] = static_cast<int>(fds_.size());
+        fds_.push_back(fd);
+    }
+    ioctl(leaderFd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leaderFd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+NNPerfCounters::~NNPerfCounters() {
+    for (int fd : fds_) {
+        close(fd);
+    }
+}
+
+NNPerfCounters::Values NNPerfCounters::read() const {
+    Values values{};
+    if (leaderFd_ < 0) {
+        return values;
+    }
+    // PERF_FORMAT_GROUP: the number of counters, then their values in open order.
+    uint64_t buffer[1 + COUNTER_COUNT] = {};
+    if (::read(leaderFd_, buffer, sizeof(buffer)) <= 0) {
+        return values;
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (slot_[c] >= 0 && static_cast<uint64_t>(slot_[c]) < buffer[0]) {
+            values[c] = buffer[1 + slot_[c]];
+        }
+    }
+    return values;
+}
+
+int NNPerfCounters::begin(const char* name, double flops) {
+    auto it = ids_.find(name);
+    if (it == ids_.end()) {
+        it = ids_.emplace(name, static_cast<int>(regions_.size())).first;
+        regions_.push_back({name});
+    }
+    stack_.push_back({it->second, flops, Clock::now(), read()});
+    return it->second;
+}
+
+void NNPerfCounters::end(int id) {
+    const Values now = read();
+    const auto time = Clock::now();
+    if (stack_.empty() || stack_.back().id != id) {
+        return;
+    }
+    const Open& open = stack_.back();
+    Region& region = regions_[id];
+    region.calls++;
+    region.seconds += std::chrono::duration<double>(time - open.start).count();
+    region.flops += open.flops;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        region.counts[c] += now[c] - open.counts[c];
+    }
+    stack_.pop_back();
+}
+
+uint64_t NNPerfCounters::getCalls(const std::string& name) const {
+    auto it = ids_.find(name);
+    return it == ids_.end() ? 0 : regions_[it->second].calls;
+}
+
+double NNPerfCounters::getFlops(const std::string& name) const {
+    auto it = ids_.find(name);
+    return it == ids_.end() ? 0.0 : regions_[it->second].flops;
+}
+
+double NNPerfCounters::getPeakGflops() {
+    if (peakGflops_ > 0.0) {
+        return peakGflops_;
+    }
+    // 64 independent multiply-add chains keep every vector lane and port busy.
+    float acc[64];
+    std::fill(std::begin(acc), std::end(acc), 1.0f);
+    volatile float scaleSource = 0.999f;
+    volatile float offsetSource = 0.001f;
+    const float scale = scaleSource;
+    const float offset = offsetSource;
+    const int iterations = 200000;
+    const auto start = Clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (float& a : acc) {
+            a = a * scale + offset;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    volatile float sink = acc[0];
+    (void) sink;
+    peakGflops_ = 2.0 * 64 * iterations / seconds / 1e9;
+    return peakGflops_;
+}
+
+void NNPerfCounters::report(const std::string& title) {
+    const double peak = getPeakGflops();
+    LOG << title << " (peak " << peak << " GFLOP/s per core)" << std::endl;
+    char line[200];
+    std::snprintf(line, sizeof(line), "%-22s %8s %10s %8s %6s %6s %9s %9s %9s %7s", "region",
+                  "calls", "ms", "GFLOP/s", "%peak", "IPC", "L1m/kI", "LLCm/kI", "LLC MB/s",
+                  "brm/kI");
+    LOG << line << std::endl;
+
+    std::vector<const Region*> order;
+    for (const Region& region : regions_) {
+        if (region.calls > 0) {
+            order.push_back(&region);
+        }
+    }
+    std::sort(order.begin(), order.end(),
+              [](const Region* a, const Region* b) { return a->seconds > b->seconds; });
+    auto field = [](char* out, size_t size, bool available, double value) {
+        if (available) {
+            std::snprintf(out, size, "%.2f", value);
+        } else {
+            std::snprintf(out, size, "n/a");
+        }
+    };
+    for (const Region* region : order) {
+        const double gflops = region->seconds > 0.0 ? region->flops / region->seconds / 1e9 : 0.0;
+        const double kiloInstructions = region->counts[INSTRUCTIONS] / 1e3;
+        const bool perInstruction = isAvailable(INSTRUCTIONS) && kiloInstructions > 0.0;
+        char ipc[16], l1[16], llc[16], bandwidth[16], branch[16];
+        field(ipc, sizeof(ipc), perInstruction && isAvailable(CYCLES),
+              perInstruction ? region->counts[INSTRUCTIONS] /
+                                   std::max<double>(1.0, region->counts[CYCLES])
+                             : 0.0);
+        field(l1, sizeof(l1), perInstruction && isAvailable(L1D_MISSES),
+              perInstruction ? region->counts[L1D_MISSES] / kiloInstructions : 0.0);
+        field(llc, sizeof(llc), perInstruction && isAvailable(LLC_MISSES),
+              perInstruction ? region->counts[LLC_MISSES] / kiloInstructions : 0.0);
+        // Every LLC miss moves one 64-byte line from memory, an estimate of DRAM traffic.
+        field(bandwidth, sizeof(bandwidth), isAvailable(LLC_MISSES) && region->seconds > 0.0,
+              region->counts[LLC_MISSES] * 64.0 / 1e6 / std::max(region->seconds, 1e-12));
+        field(branch, sizeof(branch), perInstruction && isAvailable(BRANCH_MISSES),
+              perInstruction ? region->counts[BRANCH_MISSES] / kiloInstructions : 0.0);
+        std::snprintf(line, sizeof(line), "%-22s %8llu %10.2f %8.2f %6.1f %6s %9s %9s %9s %7s",
+                      region->name.c_str(), static_cast<unsigned long long>(region->calls),
+                      region->seconds * 1e3, gflops, peak > 0.0 ? 100.0 * gflops / peak : 0.0,
+                      ipc, l1, llc, bandwidth, branch);
+        LOG << line << std::endl;
+    }
+    reset();
+}
+
+void NNPerfCounters::reset() {
+    for (Region& region : regions_) {
+        region = Region{region.name};
+    }
+}
+
+NNPerfCounters* NNPerfCounters::current() { return currentCounters; }
+
+NNPerfCounters::Activation::Activation(NNPerfCounters* counters) : previous_(currentCounters) {
+    currentCounters = counters;
+}
+
+NNPerfCounters::Activation::~Activation() { currentCounters = previous_; }
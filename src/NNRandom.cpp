@@ -0,0 +1,164 @@
+#include "NNRandom.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace {
+constexpr uint32_t PHILOX_M0 = 0xD2511F53u;
+constexpr uint32_t PHILOX_M1 = 0xCD9E8D57u;
+constexpr uint32_t PHILOX_W0 = 0x9E3779B9u;
+constexpr uint32_t PHILOX_W1 = 0xBB67AE85u;
+constexpr int PHILOX_ROUNDS = 10;
+// Blocks generated together so the rounds vectorize across lanes.
+constexpr size_t LANES = 8;
+// Below this many blocks the threads cost more than they save.
+constexpr size_t MIN_BLOCKS_PER_THREAD = 1 << 14;
+
+std::atomic<uint64_t> globalSeedValue{NNRandom::DEFAULT_SEED};
+
+inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t& hi) {
+    const uint64_t product = static_cast<uint64_t>(a) * b;
+    hi = static_cast<uint32_t>(product >> 32);
+    return static_cast<uint32_t>(product);
+}
+} // namespace
+
+void NNRandom::setGlobalSeed(uint64_t seed) { globalSeedValue.store(seed); }
+
+uint64_t NNRandom::globalSeed() { return globalSeedValue.load(); }
+
+std::array<uint32_t, 4> NNRandom::philox(std::array<uint32_t, 4> counter,
+                                         std::array<uint32_t, 2> key) {
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        uint32_t hi0, hi1;
+        const uint32_t lo0 = mulhilo(PHILOX_M0, counter[0], hi0);
+        const uint32_t lo1 = mulhilo(PHILOX_M1, counter[2], hi1);
+        counter = {hi1 ^ counter[1] ^ key[0], lo1, hi0 ^ counter[3] ^ key[1], lo0};
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+    return counter;
+}
+
+uint32_t NNRandom::bitsAt(uint64_t index) const {
+    const uint64_t block = index / 4;
+    const auto out = philox({static_cast<uint32_t>(block), static_cast<uint32_t>(block >> 32),
+                             static_cast<uint32_t>(stream_), static_cast<uint32_t>(stream_ >> 32)},
+                            {static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32)});
+    return out[index % 4];
+}
+
+void NNRandom::fillBlocks(uint32_t* out, uint64_t firstBlock, size_t blockCount) const {
+    const uint32_t stream0 = static_cast<uint32_t>(stream_);
+    const uint32_t stream1 = static_cast<uint32_t>(stream_ >> 32);
+    size_t b = 0;
+    // Same rounds as philox(), on LANES counters at once in structure-of-arrays form.
+    for (; b + LANES <= blockCount; b += LANES) {
+        uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+        for (size_t j = 0; j < LANES; j++) {
+            const uint64_t block = firstBlock + b + j;
+            c0[j] = static_cast<uint32_t>(block);
+            c1[j] = static_cast<uint32_t>(block >> 32);
+            c2[j] = stream0;
+            c3[j] = stream1;
+        }
+        uint32_t k0 = static_cast<uint32_t>(seed_);
+        uint32_t k1 = static_cast<uint32_t>(seed_ >> 32);
+        for (int round = 0; round < PHILOX_ROUNDS; round++) {
+            for (size_t j = 0; j < LANES; j++) {
+                const uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0[j];
+                const uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * c2[j];
+                const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[j] ^ k0;
+                const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[j] ^ k1;
+                c1[j] = static_cast<uint32_t>(p1);
+                c3[j] = static_cast<uint32_t>(p0);
+                c0[j] = n0;
+                c2[j] = n2;
+            }
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        for (size_t j = 0; j < LANES; j++) {
+            uint32_t* dst = out + (b + j) * 4;
+            dst[0] = c0[j];
+            dst[1] = c1[j];
+            dst[2] = c2[j];
+            dst[3] = c3[j];
+        }
+    }
+    for (; b < blockCount; b++) {
+        const uint64_t block = firstBlock + b;
+        const auto words =
+            philox({static_cast<uint32_t>(block), static_cast<uint32_t>(block >> 32), stream0,
+                    stream1},
+                   {static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32)});
+        std::copy(words.begin(), words.end(), out + b * 4);
+    }
+}
+
+void NNRandom::fillBits(uint32_t* out, size_t count, uint64_t offset, int threads) const {
+    if (count == 0) {
+        return;
+    }
+    // Elements before the first whole block and after the last one go through bitsAt.
+    size_t head = std::min<size_t>(count, (4 - offset % 4) % 4);
+    for (size_t i = 0; i < head; i++) {
+        out[i] = bitsAt(offset + i);
+    }
+    const uint64_t firstBlock = (offset + head) / 4;
+    const size_t blockCount = (count - head) / 4;
+    uint32_t* blockOut = out + head;
+
+    size_t workers = threads > 0 ? static_cast<size_t>(threads)
+                                 : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max<size_t>(1, std::min(workers, blockCount / MIN_BLOCKS_PER_THREAD));
+    if (workers == 1) {
+        fillBlocks(blockOut, firstBlock, blockCount);
+    } else {
+        std::vector<std::thread> pool;
+        const size_t perWorker = (blockCount + workers - 1) / workers;
+        for (size_t w = 0; w < workers; w++) {
+            const size_t begin = w * perWorker;
+            const size_t end = std::min(blockCount, begin + perWorker);
+            if (begin >= end) {
+                break;
+            }
+            pool.emplace_back([this, blockOut, firstBlock, begin, end] {
+                fillBlocks(blockOut + begin * 4, firstBlock + begin, end - begin);
+            });
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    }
+
+    for (size_t i = head + blockCount * 4; i < count; i++) {
+        out[i] = bitsAt(offset + i);
+    }
+}
+
+void NNRandom::fillUniform(float* out, size_t count, float a, float b, uint64_t offset,
+                           int threads) const {
+    std::vector<uint32_t> bits(count);
+    fillBits(bits.data(), count, offset, threads);
+    const float scale = b - a;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = a + scale * toUnitFloat(bits[i]);
+    }
+}
+
+std::vector<uint32_t> NNRandom::permutation(size_t n, int threads) const {
+    std::vector<uint32_t> perm(n);
+    for (size_t i = 0; i < n; i++) {
+        perm[i] = static_cast<uint32_t>(i);
+    }
+    std::vector<uint32_t> draws(n);
+    fillBits(draws.data(), n, 0, threads);
+    for (size_t i = n; i > 1; i--) {
+        // Multiply-shift maps a 32-bit draw onto [0, i).
+        const size_t j = static_cast<size_t>((static_cast<uint64_t>(draws[i - 1]) * i) >> 32);
+        std::swap(perm[i - 1], perm[j]);
+    }
+    return perm;
+}
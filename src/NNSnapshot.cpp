@@ -0,0 +1,243 @@
+#include "NNSnapshot.h"
+
+#include "NNUtils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+constexpr uint32_t SNAPSHOT_MAGIC = 0x4b434e4e; // "NNCK"
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+// FNV-1a over the payload, detects torn or corrupted files.
+uint64_t checksum(const std::string& bytes) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : bytes) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+void append(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void appendVector(std::string& out, const std::vector<T>& values) {
+    append(out, static_cast<uint64_t>(values.size()));
+    out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T>
+bool take(const std::string& in, size_t& pos, T& value) {
+    if (pos + sizeof(T) > in.size()) {
+        return false;
+    }
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+template <typename T>
+bool takeVector(const std::string& in, size_t& pos, std::vector<T>& values) {
+    uint64_t count = 0;
+    if (!take(in, pos, count) || count > (in.size() - pos) / sizeof(T)) {
+        return false;
+    }
+    values.resize(count);
+    std::memcpy(values.data(), in.data() + pos, count * sizeof(T));
+    pos += count * sizeof(T);
+    return true;
+}
+
+void writeAll(int fd, const char* data, size_t size, const std::string& path) {
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            throw std::runtime_error("Unable to write " + path + ": " + std::strerror(errno));
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+} // namespace
+
+void NNSnapshot::write(const std::string& path) const {
+    std::string payload;
+    payload.reserve((params.size() + state.size()) * sizeof(float) + 128);
+    appendVector(payload, config);
+    appendVector(payload, inputShape);
+    appendVector(payload, convSpecs);
+    append(payload, batchNorm);
+    append(payload, seed);
+    append(payload, shuffleCount);
+    append(payload, epoch);
+    append(payload, nextBatch);
+    append(payload, optimizerStep);
+    append(payload, epochLoss);
+    append(payload, stateSize);
+    appendVector(payload, params);
+    appendVector(payload, state);
+
+    std::string header;
+    append(header, SNAPSHOT_MAGIC);
+    append(header, SNAPSHOT_VERSION);
+    append(header, checksum(payload));
+
+    const std::string tmpPath = path + ".tmp";
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open " + tmpPath + ": " + std::strerror(errno));
+    }
+    writeAll(fd, header.data(), header.size(), tmpPath);
+    writeAll(fd, payload.data(), payload.size(), tmpPath);
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Unable to fsync " + tmpPath + ": " + std::strerror(errno));
+    }
+    ::close(fd);
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Unable to rename " + tmpPath + ": " + std::strerror(errno));
+    }
+
+    // Persist the rename itself.
+    const size_t slash = path.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    const int dirFd = ::open(dir.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+bool NNSnapshot::read(const std::string& path, NNSnapshot& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint64_t hash = 0;
+    if (!take(bytes, pos, magic) || !take(bytes, pos, version) || !take(bytes, pos, hash) ||
+        magic != SNAPSHOT_MAGIC || version < 1 || version > SNAPSHOT_VERSION) {
+        return false;
+    }
+    const std::string payload = bytes.substr(pos);
+    if (checksum(payload) != hash) {
+        return false;
+    }
+
+    pos = 0;
+    NNSnapshot snapshot;
+    if (!takeVector(payload, pos, snapshot.config)) {
+        return false;
+    }
+    if (version >= 2 && (!takeVector(payload, pos, snapshot.inputShape) ||
+                         !takeVector(payload, pos, snapshot.convSpecs) ||
+                         !take(payload, pos, snapshot.batchNorm))) {
+        return false;
+    }
+    if (!take(payload, pos, snapshot.seed) || !take(payload, pos, snapshot.shuffleCount) ||
+        !take(payload, pos, snapshot.epoch) || !take(payload, pos, snapshot.nextBatch) ||
+        !take(payload, pos, snapshot.optimizerStep) || !take(payload, pos, snapshot.epochLoss) ||
+        !take(payload, pos, snapshot.stateSize) || !takeVector(payload, pos, snapshot.params) ||
+        !takeVector(payload, pos, snapshot.state)) {
+        return false;
+    }
+    if (snapshot.state.size() != static_cast<size_t>(snapshot.stateSize) * snapshot.params.size()) {
+        return false;
+    }
+    out = std::move(snapshot);
+    return true;
+}
+
+NNSnapshotWriter::NNSnapshotWriter(std::string path) : path_(std::move(path)) {
+    for (auto& buffer : buffers_) {
+        free_.push_back(&buffer);
+    }
+    worker_ = std::thread(&NNSnapshotWriter::run, this);
+}
+
+NNSnapshotWriter::~NNSnapshotWriter() {
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queueCv_.notify_all();
+    worker_.join();
+}
+
+NNSnapshot* NNSnapshotWriter::acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+        skipped_++;
+        return nullptr;
+    }
+    NNSnapshot* snapshot = free_.back();
+    free_.pop_back();
+    return snapshot;
+}
+
+void NNSnapshotWriter::submit(NNSnapshot* snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(snapshot);
+    }
+    queueCv_.notify_one();
+}
+
+void NNSnapshotWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCv_.wait(lock, [this] { return queue_.empty() && writing_ == 0; });
+}
+
+int NNSnapshotWriter::getWritten() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+int NNSnapshotWriter::getSkipped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return skipped_;
+}
+
+void NNSnapshotWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        queueCv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        NNSnapshot* snapshot = queue_.front();
+        queue_.pop_front();
+        writing_++;
+        lock.unlock();
+
+        bool ok = true;
+        try {
+            snapshot->write(path_);
+        } catch (const std::exception& e) {
+            LOG << e.what() << std::endl;
+            ok = false;
+        }
+
+        lock.lock();
+        writing_--;
+        written_ += ok ? 1 : 0;
+        free_.push_back(snapshot);
+        doneCv_.notify_all();
+    }
+}
@@ -0,0 +1,194 @@
+#include "NNSweep.h"
+
+#include "NNNuma.h"
+#include "NNOptimizer.h"
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+namespace {
+// Seeds of the trials come from this stream of the sweep seed, two words per trial.
+constexpr uint64_t TRIAL_SEED_STREAM = 1ull << 40;
+} // namespace
+
+std::string NNTrialConfig::describe() const {
+    std::ostringstream out;
+    out << "hidden ";
+    for (size_t i = 0; i < hidden.size(); i++) {
+        out << (i > 0 ? "x" : "") << hidden[i];
+    }
+    out << ", lr " << learningRate << ", momentum " << momentum << ", batch " << batchSize;
+    return out.str();
+}
+
+struct NNSweep::Trial {
+    NNTrialResult result;
+    std::unique_ptr<NeuralNetwork> network;
+    // Kept across rungs so momentum carries over when training continues.
+    NNOptimizerPtr optimizer;
+    // This trial's order of the shared samples.
+    std::vector<NNMatrixPtr> X;
+    std::vector<NNMatrixPtr> Y;
+};
+
+NNSweep::NNSweep(std::vector<NNMatrixPtr> X, std::vector<NNMatrixPtr> Y,
+                 std::vector<NNMatrixPtr> validationX, std::vector<NNMatrixPtr> validationY,
+                 Options options)
+    : X_(std::move(X)), Y_(std::move(Y)), validationX_(std::move(validationX)),
+      validationY_(std::move(validationY)), options_(options) {
+    if (options_.threads <= 0) {
+        options_.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    options_.eta = std::max(2, options_.eta);
+    options_.minEpochs = std::max(1, options_.minEpochs);
+    options_.maxEpochs = std::max(options_.minEpochs, options_.maxEpochs);
+}
+
+NNSweep::~NNSweep() = default;
+
+std::vector<NNTrialConfig> NNSweep::grid(const std::vector<std::vector<int>>& hidden,
+                                         const std::vector<float>& learningRates,
+                                         const std::vector<float>& momenta,
+                                         const std::vector<int>& batchSizes) {
+    std::vector<NNTrialConfig> trials;
+    for (const auto& layers : hidden) {
+        for (float learningRate : learningRates) {
+            for (float momentum : momenta) {
+                for (int batchSize : batchSizes) {
+                    trials.push_back({layers, learningRate, momentum, batchSize});
+                }
+            }
+        }
+    }
+    return trials;
+}
+
+std::vector<NNTrialResult> NNSweep::run(const std::vector<NNTrialConfig>& configs) {
+    best_.reset();
+    if (configs.empty() || X_.empty()) {
+        return {};
+    }
+    const NNRandom seeds(options_.seed, TRIAL_SEED_STREAM);
+
+    std::vector<std::unique_ptr<Trial>> trials;
+    for (size_t t = 0; t < configs.size(); t++) {
+        auto trial = std::make_unique<Trial>();
+        trial->result.config = configs[t];
+        trial->result.seed = (uint64_t(seeds.bitsAt(2 * t)) << 32) | seeds.bitsAt(2 * t + 1);
+        trials.push_back(std::move(trial));
+    }
+
+    std::vector<Trial*> alive;
+    for (auto& trial : trials) {
+        alive.push_back(trial.get());
+    }
+    int budget = options_.minEpochs;
+    for (int rung = 0;; rung++) {
+        LOG << "Rung " << rung << ": " << alive.size() << " trials to " << budget << " epochs"
+            << std::endl;
+        trainRung(alive, budget);
+
+        std::stable_sort(alive.begin(), alive.end(), [](const Trial* a, const Trial* b) {
+            return a->result.accuracy > b->result.accuracy;
+        });
+        for (const Trial* trial : alive) {
+            LOG << "  " << trial->result.config.describe() << ": acc " << trial->result.accuracy
+                << ", loss " << trial->result.loss << std::endl;
+        }
+        if (alive.size() == 1 || budget >= options_.maxEpochs) {
+            break;
+        }
+        // Keep the best 1/eta, the others stop here and release their networks.
+        const size_t keep = std::max<size_t>(1, alive.size() / options_.eta);
+        for (size_t i = keep; i < alive.size(); i++) {
+            alive[i]->network.reset();
+            alive[i]->optimizer.reset();
+            alive[i]->X = {};
+            alive[i]->Y = {};
+        }
+        alive.resize(keep);
+        budget = std::min(options_.maxEpochs, budget * options_.eta);
+    }
+
+    for (Trial* trial : alive) {
+        trial->result.finished = budget >= options_.maxEpochs;
+    }
+    best_ = std::move(alive.front()->network);
+
+    std::vector<NNTrialResult> results;
+    for (const auto& trial : trials) {
+        results.push_back(trial->result);
+    }
+    // Trials that went further rank above those stopped earlier, then by accuracy.
+    std::stable_sort(results.begin(), results.end(),
+                     [](const NNTrialResult& a, const NNTrialResult& b) {
+                         if (a.epochs != b.epochs) {
+                             return a.epochs > b.epochs;
+                         }
+                         return a.accuracy > b.accuracy;
+                     });
+    return results;
+}
+
+void NNSweep::buildTrial(Trial& trial) const {
+    std::vector<int> config{X_[0]->getRowSize()};
+    config.insert(config.end(), trial.result.config.hidden.begin(),
+                  trial.result.config.hidden.end());
+    config.push_back(Y_[0]->getRowSize());
+    trial.network = std::make_unique<NeuralNetwork>(config, trial.result.seed);
+    trial.optimizer = std::make_shared<NNSGDOptimizer>(trial.result.config.momentum);
+    trial.network->setOptimizer(trial.optimizer);
+    trial.X = X_;
+    trial.Y = Y_;
+}
+
+void NNSweep::trainRung(std::vector<Trial*>& trials, int targetEpochs) {
+    const nnlog::Level level = nnlog::config().minLevel;
+    if (options_.quietTrials) {
+        nnlog::config().minLevel = std::max(level, nnlog::Level::Warn);
+    }
+
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i = next++; i < trials.size(); i = next++) {
+            Trial& trial = *trials[i];
+            const int epochs = targetEpochs - trial.result.epochs;
+            if (epochs <= 0) {
+                continue;
+            }
+            // Networks are built lazily so only the trials of the current rung hold memory.
+            if (!trial.network) {
+                buildTrial(trial);
+            }
+            const NNTrialConfig& config = trial.result.config;
+            trial.network->train(trial.X, trial.Y, validationX_, validationY_, epochs,
+                                 config.batchSize, config.learningRate, config.momentum,
+                                 [&trial](int, int, float loss, float accuracy) {
+                                     trial.result.epochs++;
+                                     trial.result.loss = loss;
+                                     trial.result.accuracy = accuracy;
+                                 });
+        }
+    };
+    const int threads = std::min<int>(options_.threads, trials.size());
+    std::vector<std::thread> pool;
+    // Pinned runs keep every trial on the pool, so the caller's own affinity is left alone.
+    const bool pinned = options_.pin != NNPinPolicy::None;
+    for (int t = pinned ? 0 : 1; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            NNNuma::system().placeWorker(t, options_.pin);
+            work();
+        });
+    }
+    if (!pinned) {
+        work();
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    nnlog::config().minLevel = level;
+}
@@ -1,11 +1,23 @@
 #include "NNUtils.h"
 
+#include "NNAllocator.h"
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <chrono>
 #include <cmath>
 #include <fstream>
-#include <random>
+
+namespace {
+// Streams from here on are reserved for the per-thread generators below.
+constexpr uint64_t THREAD_STREAM_BASE = 1ull << 62;
+
+NNRandom& threadRandom() {
+    static std::atomic<uint64_t> threadCount{0};
+    thread_local NNRandom random(NNRandom::globalSeed(), THREAD_STREAM_BASE + threadCount++);
+    return random;
+}
+} // namespace
 
 const std::string NNUtils::TAG = "NNUtils";
 uint32_t NNUtils::swap_endian(uint32_t val) {
@@ -15,14 +27,20 @@ uint32_t NNUtils::swap_endian(uint32_t val) {
 }
 
 float NNUtils::xavierInit(int inputSize, int outputSize) {
-    float limit = std::sqrt(6.0f / float((inputSize + outputSize)));
+    float limit = xavierLimit(inputSize, outputSize);
     return NNUtils::random(-limit, limit);
 }
 
+float NNUtils::xavierLimit(int inputSize, int outputSize) {
+    return std::sqrt(6.0f / float((inputSize + outputSize)));
+}
+
 void NNUtils::normalizeMnistData(std::vector<NNMatrixPtr>& data) {
     for (auto& inputPtr : data) {
         auto& input = *inputPtr;
         input /= 255.0f;
+        // MNIST digits are ~80% background, record the strokes once for the sparse first layer.
+        input.buildNonZeroIndex();
     }
 }
 
@@ -33,6 +51,56 @@ void NNUtils::normalizeMnistLabel(std::vector<NNMatrixPtr>& labels) {
     }
 }
 
+std::vector<int> NNUtils::toLabelIndices(const std::vector<NNMatrixPtr>& labels) {
+    std::vector<int> ret;
+    ret.reserve(labels.size());
+    for (const auto& labelPtr : labels) {
+        ret.push_back(labelPtr->getIndexOfColMax(0));
+    }
+    return ret;
+}
+
+void NNUtils::packColumns(const std::vector<NNMatrixPtr>& samples, NNMatrix& out) {
+    const int batch = static_cast<int>(samples.size());
+    if (batch == 0) {
+        return;
+    }
+
+    const int rows = samples[0]->getRowSize();
+    if (out.getRowSize() != rows || out.getColSize() != batch) {
+        out = NNMatrix(rows, batch);
+    }
+
+    float* dst = out.data();
+    for (int j = 0; j < batch; j++) {
+        const float* src = static_cast<const NNMatrix&>(*samples[j]).data();
+        for (int i = 0; i < rows; i++) {
+            dst[static_cast<size_t>(i) * batch + j] = src[i];
+        }
+    }
+}
+
+bool NNUtils::packSparseColumns(const std::vector<NNMatrixPtr>& samples, NNSparseColumns& out) {
+    out.rows = samples.empty() ? 0 : samples[0]->getRowSize();
+    out.colStart.assign(1, 0);
+    out.index.clear();
+    out.value.clear();
+    for (const auto& samplePtr : samples) {
+        const NNMatrix& sample = *samplePtr;
+        const std::vector<int>* nonZero = sample.getNonZeroIndex();
+        if (nonZero == nullptr) {
+            return false;
+        }
+        const float* src = sample.data();
+        for (int idx : *nonZero) {
+            out.index.push_back(idx);
+            out.value.push_back(src[idx]);
+        }
+        out.colStart.push_back(static_cast<int>(out.index.size()));
+    }
+    return true;
+}
+
 std::vector<NNMatrixPtr> NNUtils::read_mnist_data(const std::string& filePath) {
     std::ifstream file(filePath, std::ios::binary);
     if (!file.is_open()) {
@@ -57,17 +125,19 @@ std::vector<NNMatrixPtr> NNUtils::read_mnist_data(const std::string& filePath) {
     col = swap_endian(col);
 
     LOG << "Totally, " << numImages << " images, width " << col << ", height " << row;
+    // Every image is a view into one block, so a large dataset is a single huge-page candidate
+    // instead of thousands of small heap allocations.
+    const int imgSize = row * col;
+    auto block = NNAllocator::allocateShared(static_cast<size_t>(numImages) * imgSize);
     std::vector<NNMatrixPtr> result(numImages);
+    std::vector<unsigned char> buffer(imgSize, 0);
     for (int i = 0; i < numImages; i++) {
-        auto imgSize = row * col;
-        auto imgData = std::make_shared<NNMatrix>(imgSize, 1);
-        std::vector<unsigned char> buffer(imgSize, 0);
+        float* pixels = block.get() + static_cast<size_t>(i) * imgSize;
         file.read(reinterpret_cast<char*>(buffer.data()), imgSize);
         for (int j = 0; j < imgSize; j++) {
-            imgData->set(j, 0, static_cast<float>(buffer[j]));
+            pixels[j] = static_cast<float>(buffer[j]);
         }
-
-        result[i] = imgData;
+        result[i] = std::make_shared<NNMatrix>(block, pixels, imgSize, 1);
     }
 
     return result;
@@ -107,34 +177,57 @@ std::vector<NNMatrixPtr> NNUtils::read_mnist_labels(const std::string& filePath)
     return result;
 }
 
-float NNUtils::random(float a, float b) {
-    static std::random_device rd;                     // Non-deterministic random seed
-    static std::mt19937 gen(rd());                    // Mersenne Twister engine
-    std::uniform_real_distribution<float> dist(a, b); // Range [a, b]
-    return dist(gen);
+std::vector<NNMatrixPtr> NNUtils::shard(const std::vector<NNMatrixPtr>& input, int rank,
+                                        int worldSize) {
+    std::vector<NNMatrixPtr> ret;
+    if (worldSize <= 0 || rank < 0 || rank >= worldSize) {
+        return ret;
+    }
+
+    const size_t perRank = input.size() / static_cast<size_t>(worldSize);
+    ret.reserve(perRank);
+    for (size_t i = 0; i < perRank; i++) {
+        ret.push_back(input[i * worldSize + rank]);
+    }
+    return ret;
 }
 
+float NNUtils::random(float a, float b) { return threadRandom().uniform(a, b); }
+
 void NNUtils::shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label) {
-    assert(input.size() == label.size());
+    NNRandom& random = threadRandom();
+    const uint64_t stream = (static_cast<uint64_t>(random.next()) << 32) | random.next();
+    shuffle(input, label, random.substream(stream));
+}
 
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::mt19937 gen(seed); // Mersenne Twister engine
+void NNUtils::shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label,
+                      const NNRandom& random) {
+    std::vector<int> labelIndices;
+    shuffle(input, label, labelIndices, random);
+}
 
-    std::vector<std::pair<NNMatrixPtr, NNMatrixPtr>> combinedData;
-    for (int i = 0; i < input.size(); i++) {
-        combinedData.push_back(std::make_pair(input[i], label[i]));
-    }
-    std::shuffle(combinedData.begin(), combinedData.end(), gen);
+void NNUtils::shuffle(std::vector<NNMatrixPtr>& input, std::vector<NNMatrixPtr>& label,
+                      std::vector<int>& labelIndices, const NNRandom& random) {
+    assert(input.size() == label.size());
+    assert(labelIndices.empty() || labelIndices.size() == label.size());
 
-    input.clear();
-    label.clear();
-    for (auto& data : combinedData) {
-        input.push_back(data.first);
-        label.push_back(data.second);
+    const auto perm = random.permutation(input.size());
+    std::vector<NNMatrixPtr> shuffledInput(input.size());
+    std::vector<NNMatrixPtr> shuffledLabel(label.size());
+    std::vector<int> shuffledIndices(labelIndices.size());
+    for (size_t i = 0; i < perm.size(); i++) {
+        shuffledInput[i] = std::move(input[perm[i]]);
+        shuffledLabel[i] = std::move(label[perm[i]]);
+        if (!labelIndices.empty()) {
+            shuffledIndices[i] = labelIndices[perm[i]];
+        }
     }
+    input.swap(shuffledInput);
+    label.swap(shuffledLabel);
+    labelIndices.swap(shuffledIndices);
 }
 
-std::vector<NNMatrixPtr> NNUtils::getBatch(std::vector<NNMatrixPtr>& input, int batchNo,
+std::vector<NNMatrixPtr> NNUtils::getBatch(const std::vector<NNMatrixPtr>& input, int batchNo,
                                            int batchSize) {
     std::vector<NNMatrixPtr> ret;
 
@@ -154,3 +247,13 @@ std::vector<NNMatrixPtr> NNUtils::getBatch(std::vector<NNMatrixPtr>& input, int
 
     return ret;
 }
+
+float NNUtils::percentile(std::vector<float>& values, double q) {
+    if (values.empty()) {
+        return 0.0f;
+    }
+    const double rank = std::ceil(std::clamp(q, 0.0, 1.0) * values.size());
+    const size_t k = std::max<size_t>(1, static_cast<size_t>(rank)) - 1;
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
@@ -0,0 +1,27 @@
+#include "NNVectorMath.h"
+
+// Kept out of line so callers without a loop of their own get one vectorized body, and so the
+// element loops here are the ones the benchmark measures.
+void NNVectorMath::exp(const float* in, float* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = exp(in[i]);
+    }
+}
+
+void NNVectorMath::log(const float* in, float* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = log(in[i]);
+    }
+}
+
+void NNVectorMath::sigmoid(const float* in, float* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = sigmoid(in[i]);
+    }
+}
+
+void NNVectorMath::tanh(const float* in, float* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = tanh(in[i]);
+    }
+}
@@ -1,26 +1,421 @@
 #include "NeuralNetwork.h"
 
 #include "NNFunctions.h"
+#include "NNPerfCounters.h"
 #include "NNUtils.h"
 
 #include <iomanip>
 #include <iostream>
 #include <math.h>
 
-NeuralNetwork::NeuralNetwork(const std::vector<int>& config) {
+namespace {
+// NNConvSpec fields as stored in snapshots, five ints per stage.
+constexpr int CONV_SPEC_FIELDS = 5;
+
+std::vector<int> flattenConvSpecs(const std::vector<NNConvSpec>& convs) {
+    std::vector<int> flat;
+    for (const auto& spec : convs) {
+        flat.insert(flat.end(),
+                    {spec.outChannels, spec.kernel, spec.stride, spec.padding, spec.pool});
+    }
+    return flat;
+}
+} // namespace
+
+NeuralNetwork::NeuralNetwork(const std::vector<int>& config, uint64_t seed)
+    : NeuralNetwork({}, {}, config, seed) {}
+
+NeuralNetwork NeuralNetwork::fromSnapshot(const NNSnapshot& snapshot) {
+    std::vector<NNConvSpec> convs;
+    for (size_t i = 0; i + CONV_SPEC_FIELDS <= snapshot.convSpecs.size();
+         i += CONV_SPEC_FIELDS) {
+        const int* field = snapshot.convSpecs.data() + i;
+        convs.push_back({field[0], field[1], field[2], field[3], field[4]});
+    }
+    return NeuralNetwork(snapshot.inputShape, convs, snapshot.config, snapshot.seed,
+                         snapshot.batchNorm != 0);
+}
+
+NeuralNetwork::NeuralNetwork(const std::vector<int>& inputShape,
+                             const std::vector<NNConvSpec>& convs, const std::vector<int>& config,
+                             uint64_t seed, bool batchNorm)
+    : batchNorm_(batchNorm), seed_(seed), config_(config), inputShape_(inputShape),
+      convSpecs_(convs) {
     int configSize = config.size();
-    if (configSize < 3) {
+    if (configSize < (convs.empty() ? 3 : 2)) {
         LOG << "Invalid NeuralNetwork config " << configSize << std::endl;
         return;
     }
+    if (!convs.empty() && (inputShape.size() != 3 ||
+                           inputShape[0] * inputShape[1] * inputShape[2] != config[0])) {
+        LOG << "Invalid NeuralNetwork input shape for " << config[0] << " inputs" << std::endl;
+        return;
+    }
+
+    int denseInput = config[0];
+    if (!convs.empty()) {
+        int channels = inputShape[0];
+        int height = inputShape[1];
+        int width = inputShape[2];
+        for (size_t s = 0; s < convs.size(); s++) {
+            convLayers.emplace_back(channels, height, width, convs[s],
+                                    NNRandom(seed, CONV_STREAM + s));
+            channels = convLayers.back().getOutChannels();
+            height = convLayers.back().getOutHeight();
+            width = convLayers.back().getOutWidth();
+        }
+        denseInput = convLayers.back().getOutputSize();
+    }
 
     for (int l = 1; l < configSize; l++) {
-        auto layer = NNLayer(config[l - 1], config[l]);
+        auto layer = NNLayer(l == 1 ? denseInput : config[l - 1], config[l], NNRandom(seed, l - 1));
         // layer.dump();
         layers.push_back(layer);
     }
 
-    layerOutputs = std::vector<std::vector<NNMatrix>>(configSize - 1, std::vector<NNMatrix>());
+    layerOutputs = std::vector<NNMatrix>(configSize - 1, NNMatrix(1, 1));
+    dzs_ = std::vector<NNMatrix>(configSize - 1, NNMatrix(1, 1));
+    inputTs_ = std::vector<NNMatrix>(configSize - 1, NNMatrix(1, 1));
+    reluMasks_.resize(configSize - 1);
+    keepOutput_.assign(configSize - 1, true);
+    for (int l = 0; l < configSize - 1; l++) {
+        perfForwardNames_.push_back("layer" + std::to_string(l) + ".forward");
+        perfBackwardNames_.push_back("layer" + std::to_string(l) + ".backward");
+    }
+
+    for (auto& layer : layers) {
+        const auto outputSize = static_cast<size_t>(layer.getOutputSize());
+        weightSegments_.push_back(
+            parameters_.reserve(outputSize * static_cast<size_t>(layer.getInputSize()), true));
+        biasSegments_.push_back(parameters_.reserve(outputSize, false));
+    }
+    for (auto& conv : convLayers) {
+        const auto outChannels = static_cast<size_t>(conv.getOutChannels());
+        convWeightSegments_.push_back(
+            parameters_.reserve(outChannels * conv.getWeight().getColSize(), true));
+        convBiasSegments_.push_back(parameters_.reserve(outChannels, false));
+    }
+    for (int l = 0; batchNorm_ && l < static_cast<int>(layers.size()) - 1; l++) {
+        normSegments_.push_back(parameters_.reserve(4 * layers[l].getOutputSize(), false));
+    }
+    parameters_.allocate();
+    for (size_t l = 0; l < normSegments_.size(); l++) {
+        // Identity scale and unit running variance; the shift and running mean start at zero.
+        const int outputSize = layers[l].getOutputSize();
+        float* norm = parameters_.param(normSegments_[l]);
+        std::fill_n(norm, outputSize, 1.0f);
+        std::fill_n(norm + 3 * outputSize, outputSize, 1.0f);
+    }
+    for (size_t s = 0; s < convLayers.size(); s++) {
+        const int w = convWeightSegments_[s];
+        const int b = convBiasSegments_[s];
+        convLayers[s].bindParameters(parameters_.param(w), parameters_.param(b),
+                                     parameters_.grad(w), parameters_.grad(b));
+    }
+    for (int l = 0; l < static_cast<int>(layers.size()); l++) {
+        const int w = weightSegments_[l];
+        const int b = biasSegments_[l];
+        layers[l].bindParameters(parameters_.param(w), parameters_.param(b), parameters_.grad(w),
+                                 parameters_.grad(b));
+    }
+}
+
+void NeuralNetwork::setReluMasks(bool enabled) {
+    if (enabled != useReluMasks_) {
+        useReluMasks_ = enabled;
+        // Without masks, backward needs each hidden output one step longer.
+        activations_.clear();
+    }
+}
+
+size_t NeuralNetwork::getPeakActivationBytes(int batchSize) {
+    if (graphMode()) {
+        ensureGraph();
+        return graph_->peakBytes(batchSize);
+    }
+    if (!activations_.isPlanned()) {
+        planActivations();
+    }
+    return activations_.peakBytes(batchSize);
+}
+
+NeuralNetwork NeuralNetwork::foldBatchNorm() const {
+    NeuralNetwork folded(inputShape_, convSpecs_, config_, seed_);
+    // Same layout without the batch norm segments, so everything else copies over as is.
+    for (size_t s = 0; s < convLayers.size(); s++) {
+        for (int segment : {convWeightSegments_[s], convBiasSegments_[s]}) {
+            std::copy_n(parameters_.param(segment), parameters_.segmentSize(segment),
+                        folded.parameters_.param(segment));
+        }
+    }
+    for (size_t l = 0; l < layers.size(); l++) {
+        const int rows = layers[l].getOutputSize();
+        const int cols = layers[l].getInputSize();
+        const float* weight = parameters_.param(weightSegments_[l]);
+        const float* bias = parameters_.param(biasSegments_[l]);
+        float* foldedWeight = folded.parameters_.param(folded.weightSegments_[l]);
+        float* foldedBias = folded.parameters_.param(folded.biasSegments_[l]);
+        if (l >= normSegments_.size()) {
+            std::copy_n(weight, static_cast<size_t>(rows) * cols, foldedWeight);
+            std::copy_n(bias, rows, foldedBias);
+            continue;
+        }
+        // gamma * (w.x - mean) / sqrt(var + eps) + beta: row r of the weight scales by
+        // gamma / sqrt(var + eps), and the bias becomes beta - mean * that scale.
+        const float* norm = parameters_.param(normSegments_[l]);
+        for (int r = 0; r < rows; r++) {
+            const float scale =
+                norm[r] / std::sqrt(norm[3 * rows + r] + NNGraph::BATCH_NORM_EPSILON);
+            const size_t offset = static_cast<size_t>(r) * cols;
+            for (int c = 0; c < cols; c++) {
+                foldedWeight[offset + c] = weight[offset + c] * scale;
+            }
+            foldedBias[r] = norm[rows + r] - norm[2 * rows + r] * scale;
+        }
+    }
+    return folded;
+}
+
+void NeuralNetwork::exportModel(const std::string& path) const {
+    if (batchNorm_) {
+        foldBatchNorm().exportModel(path);
+        return;
+    }
+    NNSnapshot snapshot;
+    describeArchitecture(snapshot);
+    snapshot.seed = seed_;
+    snapshot.params.assign(parameters_.params(), parameters_.params() + parameters_.size());
+    snapshot.write(path);
+}
+
+void NeuralNetwork::describeArchitecture(NNSnapshot& snapshot) const {
+    snapshot.config = config_;
+    snapshot.inputShape = convSpecs_.empty() ? std::vector<int>() : inputShape_;
+    snapshot.convSpecs = flattenConvSpecs(convSpecs_);
+    snapshot.batchNorm = batchNorm_ ? 1 : 0;
+}
+
+void NeuralNetwork::setSnapshots(const std::string& path, int everySteps) {
+    snapshotWriter_.reset();
+    snapshotEvery_ = 0;
+    if (!path.empty() && everySteps > 0) {
+        snapshotWriter_ = std::make_unique<NNSnapshotWriter>(path);
+        snapshotEvery_ = everySteps;
+    }
+}
+
+void NeuralNetwork::takeSnapshot(const NNOptimizer& optimizer, int epoch, int nextBatch,
+                                 float epochLoss) {
+    NNSnapshot* snapshot = snapshotWriter_->acquire();
+    if (snapshot == nullptr) {
+        LOG << "Snapshot writer busy, skipping snapshot at step " << optimizer.getStep()
+            << std::endl;
+        return;
+    }
+    // Only copies into the recycled buffer here, serialization and fsync happen on the writer
+    // thread.
+    const size_t count = parameters_.size();
+    describeArchitecture(*snapshot);
+    snapshot->seed = seed_;
+    snapshot->shuffleCount = shuffleCount_;
+    snapshot->epoch = epoch;
+    snapshot->nextBatch = nextBatch;
+    snapshot->optimizerStep = optimizer.getStep();
+    snapshot->epochLoss = epochLoss;
+    snapshot->stateSize = parameters_.stateSize();
+    snapshot->params.assign(parameters_.params(), parameters_.params() + count);
+    snapshot->state.resize(count * static_cast<size_t>(snapshot->stateSize));
+    for (int s = 0; s < snapshot->stateSize; s++) {
+        std::copy_n(parameters_.state(s), count, snapshot->state.data() + s * count);
+    }
+    snapshotWriter_->submit(snapshot);
+}
+
+bool NeuralNetwork::resumeFromSnapshot(const std::string& path) {
+    NNSnapshot snapshot;
+    if (!NNSnapshot::read(path, snapshot)) {
+        LOG << "No usable snapshot at " << path << std::endl;
+        return false;
+    }
+    NNSnapshot architecture;
+    describeArchitecture(architecture);
+    if (snapshot.config != config_ || snapshot.inputShape != architecture.inputShape ||
+        snapshot.convSpecs != architecture.convSpecs ||
+        snapshot.batchNorm != architecture.batchNorm ||
+        snapshot.params.size() != parameters_.size()) {
+        LOG << "Snapshot " << path << " was taken from a different network" << std::endl;
+        return false;
+    }
+
+    std::copy(snapshot.params.begin(), snapshot.params.end(), parameters_.params());
+    parameters_.reserveState(snapshot.stateSize);
+    const size_t count = parameters_.size();
+    for (int s = 0; s < snapshot.stateSize; s++) {
+        std::copy_n(snapshot.state.data() + s * count, count, parameters_.state(s));
+    }
+    seed_ = snapshot.seed;
+    resume_.pending = true;
+    resume_.shuffleCount = snapshot.shuffleCount;
+    resume_.epoch = snapshot.epoch;
+    resume_.nextBatch = snapshot.nextBatch;
+    resume_.optimizerStep = snapshot.optimizerStep;
+    resume_.stateSize = snapshot.stateSize;
+    resume_.epochLoss = snapshot.epochLoss;
+    return true;
+}
+
+void NeuralNetwork::setCheckpoints(const std::vector<int>& hiddenLayers) {
+    const int layerSize = layers.size();
+    keepOutput_.assign(layerSize, hiddenLayers.empty());
+    for (int l : hiddenLayers) {
+        if (l >= 0 && l < layerSize - 1) {
+            keepOutput_[l] = true;
+        } else {
+            LOG << "Invalid checkpoint layer " << l << std::endl;
+        }
+    }
+    // The logits are consumed by the loss right after forward.
+    keepOutput_[layerSize - 1] = true;
+    activations_.clear();
+}
+
+void NeuralNetwork::setCheckpointInterval(int interval) {
+    std::vector<int> checkpoints;
+    if (interval > 1) {
+        for (int l = interval - 1; l < static_cast<int>(layers.size()) - 1; l += interval) {
+            checkpoints.push_back(l);
+        }
+    }
+    setCheckpoints(checkpoints);
+}
+
+void NeuralNetwork::planActivations() {
+    // Schedule: forward of layer l is step l and the loss is step L. Backward of layer l is step
+    // 3L - 2l, preceded by a step for recomputing the dropped outputs it needs. A buffer is live
+    // from the step that writes it to the last step that reads it.
+    const int layerSize = layers.size();
+    auto backwardStep = [layerSize](int l) { return 3 * layerSize - 2 * l; };
+
+    activations_.clear();
+    outputBuffers_.assign(layerSize, -1);
+    recomputeBuffers_.assign(layerSize, -1);
+    dzBuffers_.assign(layerSize, -1);
+    inputTBuffers_.assign(layerSize, -1);
+    inputBuffer_ = activations_.add(layers[0].getInputSize(), 0, backwardStep(0));
+    for (int l = 0; l < layerSize; l++) {
+        const int outputSize = layers[l].getOutputSize();
+        if (l == layerSize - 1) {
+            outputBuffers_[l] = activations_.add(outputSize, l, layerSize);
+        } else {
+            // Read by the next layer's weight gradient, and by this layer's own backward when
+            // the ReLU derivative is re-derived from it.
+            const int lastUse = useReluMasks_ ? backwardStep(l + 1) : backwardStep(l);
+            if (keepOutput_[l]) {
+                outputBuffers_[l] = activations_.add(outputSize, l, lastUse);
+            } else {
+                // Dropped right after the next layer's forward and recomputed before the
+                // backward of the first kept layer above it.
+                int top = l + 1;
+                while (!keepOutput_[top]) {
+                    top++;
+                }
+                outputBuffers_[l] = activations_.add(outputSize, l, l + 1);
+                recomputeBuffers_[l] =
+                    activations_.add(outputSize, backwardStep(top) - 1, lastUse);
+            }
+        }
+        // dz of the output layer is written by the loss; every dz is read again by the
+        // backward step of the layer below.
+        const int dzFirst = l == layerSize - 1 ? layerSize : backwardStep(l);
+        dzBuffers_[l] = activations_.add(outputSize, dzFirst, backwardStep(std::max(l - 1, 0)));
+        inputTBuffers_[l] =
+            activations_.add(layers[l].getInputSize(), backwardStep(l), backwardStep(l));
+    }
+    activations_.plan();
+}
+
+void NeuralNetwork::bindActivations(int batch) {
+    if (!activations_.isPlanned()) {
+        planActivations();
+    }
+    activations_.reserve(batch);
+    batchInput_.setView(activations_.data(inputBuffer_, batch), layers[0].getInputSize(), batch);
+    for (int l = 0; l < static_cast<int>(layers.size()); l++) {
+        const int outputSize = layers[l].getOutputSize();
+        layerOutputs[l].setView(activations_.data(outputBuffers_[l], batch), outputSize, batch);
+        dzs_[l].setView(activations_.data(dzBuffers_[l], batch), outputSize, batch);
+        inputTs_[l].setView(activations_.data(inputTBuffers_[l], batch), batch,
+                            layers[l].getInputSize());
+    }
+    batch_ = batch;
+}
+
+void NeuralNetwork::forwardLayer(int l, bool training) {
+    NNPerfScope scope(perfForwardNames_[l].c_str(),
+                      2.0 * layers[l].getInputSize() * layers[l].getOutputSize() * batch_);
+    if (l == 0 && useSparseInput_) {
+        layers[l].forward(batchSparse_, layerOutputs[l]);
+    } else {
+        layers[l].forward(l > 0 ? layerOutputs[l - 1] : batchInput_, layerOutputs[l]);
+    }
+    // Keep raw logits on the output layer, softmax is fused into the loss kernel.
+    if (l < static_cast<int>(layers.size()) - 1) {
+        NNBitMask* reluMask = training && useReluMasks_ ? &reluMasks_[l] : nullptr;
+        if (training && dropoutRate_ > 0.0f) {
+            // Recomputing the layer for a checkpoint draws the same mask again.
+            const size_t outputSize = layers[l].getOutputSize();
+            dropoutMask_.sample(NNRandom(seed_, DROPOUT_STREAM + l), batchSample_ * outputSize,
+                                outputSize * batch_, 1.0f - dropoutRate_);
+            NNFunctions::relu(layerOutputs[l], reluMask, &dropoutMask_,
+                              1.0f / (1.0f - dropoutRate_));
+        } else {
+            NNFunctions::relu(layerOutputs[l], reluMask);
+        }
+    }
+}
+
+void NeuralNetwork::recomputeSegment(int top) {
+    int first = top;
+    while (first > 0 && !keepOutput_[first - 1]) {
+        first--;
+    }
+    for (int l = first; l < top; l++) {
+        layerOutputs[l].setView(activations_.data(recomputeBuffers_[l], batch_),
+                                layers[l].getOutputSize(), batch_);
+        forwardLayer(l);
+    }
+}
+
+NNMatrix& NeuralNetwork::beginInference(int batch) {
+    if (graphMode()) {
+        ensureGraph();
+        graph_->setTraining(false);
+        graph_->setBatch(batch);
+        return graph_->value(graphInput_);
+    }
+    bindActivations(batch);
+    useSparseInput_ = false;
+    return batchInput_;
+}
+
+const NNMatrix& NeuralNetwork::runInference() {
+    if (graphMode()) {
+        graph_->forward();
+        return graph_->value(graphLogits_);
+    }
+    const int layerSize = layers.size();
+    for (int l = 0; l < layerSize; l++) {
+        forwardLayer(l, false);
+    }
+    return layerOutputs.back();
+}
+
+void NeuralNetwork::setCommunicator(NNCommunicatorPtr communicator, size_t bucketBytes) {
+    communicator_ = std::move(communicator);
+    bucketer_.reset();
+    if (communicator_) {
+        bucketer_ = std::make_unique<NNGradientBucketer>(*communicator_, bucketBytes);
+    }
 }
 
 void NeuralNetwork::train(std::vector<NNMatrixPtr>& X, std::vector<NNMatrixPtr>& Y,
@@ -29,16 +424,74 @@ void NeuralNetwork::train(std::vector<NNMatrixPtr>& X, std::vector<NNMatrixPtr>&
                           TrainCallback callback, LayerCallback layerCallback,
                           BatchCallback batchCallback, StopCallback stopCallback,
                           BatchStatsCallback batchStatsCallback) {
+    NNOptimizerPtr optimizer = optimizer_;
+    if (!optimizer) {
+        optimizer = std::make_shared<NNSGDOptimizer>(momentum);
+    }
+    // Kernels and layers report to perf_ on this thread until train() returns.
+    NNPerfCounters::Activation perfActivation(perf_.get());
+    LOG << "Optimizer " << optimizer->name() << std::endl;
+    if (communicator_) {
+        LOG << "Data parallel rank " << communicator_->getRank() << "/"
+            << communicator_->getWorldSize() << std::endl;
+        communicator_->broadcast(parameters_.params(), parameters_.size());
+    }
+
+    const int accumulation = accumulationSteps_;
+    if (accumulation > 1) {
+        LOG << "Accumulating " << accumulation << " micro-batches of " << batchSize
+            << ", effective batch " << accumulation * batchSize << std::endl;
+    }
+
+    // One workspace serves training and evaluation batches alike.
+    const size_t peakBytes = getPeakActivationBytes(batchSize);
+    LOG << "Activation workspace " << peakBytes << " bytes for batch " << batchSize << ", "
+        << (graphMode() ? graph_->unplannedBytes(batchSize)
+                        : activations_.unplannedBytes(batchSize))
+        << " without reuse" << std::endl;
+    if (!graphMode()) {
+        activations_.reserve(std::max(batchSize, EVAL_BATCH_SIZE));
+    }
+
+    // Class indices are taken once and permuted with the samples, so batches only slice them.
+    std::vector<int> labels = NNUtils::toLabelIndices(Y);
+
     int e = 0;
+    int firstBatch = 0;
+    float resumedLoss = 0.0f;
+    if (resume_.pending) {
+        resume_.pending = false;
+        if (optimizer->stateSize() == resume_.stateSize) {
+            optimizer->setStep(resume_.optimizerStep);
+        } else {
+            LOG << "Snapshot optimizer state does not match " << optimizer->name()
+                << ", starting it fresh" << std::endl;
+            parameters_.reserveState(0);
+        }
+        // Replay the shuffles of the finished epochs so the interrupted one sees the same order.
+        shuffleCount_ = 0;
+        while (shuffleCount_ + 1 < resume_.shuffleCount) {
+            NNUtils::shuffle(X, Y, labels, NNRandom(seed_, SHUFFLE_STREAM + shuffleCount_++));
+        }
+        e = resume_.epoch;
+        firstBatch = resume_.nextBatch;
+        resumedLoss = resume_.epochLoss;
+        LOG << "Resuming at epoch " << e << ", batch " << firstBatch << std::endl;
+    }
+
     while (e < epochNum) {
         if (stopCallback && stopCallback()) {
             return;
         }
         LOG << "Epic " << e << std::endl;
-        NNUtils::shuffle(X, Y);
+        NNUtils::shuffle(X, Y, labels, NNRandom(seed_, SHUFFLE_STREAM + shuffleCount_++));
         int numBatches = (X.size() + 1) / batchSize;
-        float epochLoss = 0.0f;
-        for (int b = 0; b < numBatches; b++) {
+        numBatches = std::min<int>(numBatches, (X.size() + batchSize - 1) / batchSize);
+        float epochLoss = resumedLoss;
+        const int startBatch = firstBatch;
+        firstBatch = 0;
+        resumedLoss = 0.0f;
+        for (int b = startBatch; b < numBatches; b++) {
             if (stopCallback && stopCallback()) {
                 return;
             }
@@ -46,22 +499,29 @@ void NeuralNetwork::train(std::vector<NNMatrixPtr>& X, std::vector<NNMatrixPtr>&
                 LOG << "Epic " << e << ", batch " << b << " starts" << std::endl;
             }
             std::vector<NNMatrixPtr> batchX = NNUtils::getBatch(X, b, batchSize);
-            std::vector<NNMatrixPtr> batchY = NNUtils::getBatch(Y, b, batchSize);
-            forward(e, b, batchX, layerCallback);
-            if (batchCallback && !batchX.empty() && !layerOutputs.empty() &&
-                !layerOutputs.back().empty()) {
-                batchCallback(e, b, *batchX[0], layerOutputs.back()[0]);
+            const auto firstLabel = labels.begin() + static_cast<size_t>(b) * batchSize;
+            batchLabels_.assign(firstLabel, firstLabel + batchX.size());
+            batchSample_ = static_cast<int64_t>((shuffleCount_ - 1) * X.size() + b * batchSize);
+            const int64_t augmentSample = augmenter_ ? batchSample_ : -1;
+            const NNMatrix& logits =
+                graphMode() ? forwardGraph(batchX, augmentSample, true)
+                            : forward(e, b, batchX, layerCallback, true, augmentSample);
+            if (batchCallback && !batchX.empty()) {
+                NNMatrix firstLogits(logits.getRowSize(), 1);
+                for (int c = 0; c < logits.getRowSize(); c++) {
+                    firstLogits.set(c, 0, logits.get(c, 0));
+                }
+                batchCallback(e, b, *batchX[0], NNFunctions::softmax(firstLogits));
             }
 
-            float batchLoss = loss(batchY);
+            float batchLoss = loss();
             epochLoss += batchLoss;
 
             if (batchStatsCallback) {
                 int correct = 0;
-                const auto& predOutputs = layerOutputs[layers.size() - 1];
-                const int batchCount = static_cast<int>(batchY.size());
+                const int batchCount = static_cast<int>(batchLabels_.size());
                 for (int i = 0; i < batchCount; ++i) {
-                    if (argmax(predOutputs[i]) == argmax(*batchY[i])) {
+                    if (batchPredictions_[i] == batchLabels_[i]) {
                         correct += 1;
                     }
                 }
@@ -75,166 +535,254 @@ void NeuralNetwork::train(std::vector<NNMatrixPtr>& X, std::vector<NNMatrixPtr>&
                                    batchAcc);
             }
 
-            backward(batchX, batchY, learningRate, momentum, e, b, layerCallback);
+            // Micro-batches are grouped into windows of `accumulation`; the last window of an
+            // epoch may be shorter. Each micro-batch contributes 1/windowSize of the gradient.
+            const int windowStart = b - b % accumulation;
+            const int windowSize = std::min(accumulation, numBatches - windowStart);
+            const bool lastInWindow = b == windowStart + windowSize - 1;
+            if (b == windowStart) {
+                parameters_.zeroGrad();
+            }
+            backward(1.0f / static_cast<float>(windowSize), lastInWindow, e, b, layerCallback);
+            if (lastInWindow) {
+                optimizer->nextStep();
+                const float lr =
+                    schedule_ ? schedule_->rate(optimizer->getStep() - 1) : learningRate;
+                parameters_.step(*optimizer, lr);
+                if (snapshotWriter_ && optimizer->getStep() % snapshotEvery_ == 0) {
+                    takeSnapshot(*optimizer, e, b + 1, epochLoss);
+                }
+            }
             if (layerCallback) {
                 layerCallback(e, b, -1, LayerPhase::Idle);
             }
         }
 
+        averageBatchNormStatistics();
         float avgLoss = epochLoss / numBatches;
-        float acc = accuracy(e, testX, testY);
+        float acc = 0.0f;
+        {
+            NNPerfScope scope("evaluate");
+            // Once per epoch: the test set may be the training set, reshuffled every epoch.
+            acc = accuracy(e, testX, NNUtils::toLabelIndices(testY));
+        }
         LOG << "Epic " << e + 1 << "/" << epochNum << ", loss " << avgLoss << ", acc "
             << std::setprecision(3) << acc * 100;
+        if (perf_) {
+            perf_->report("Epoch " + std::to_string(e + 1) + " counters");
+        }
         if (callback) {
             callback(e + 1, epochNum, avgLoss, acc);
         }
         e++;
     }
+    if (snapshotWriter_) {
+        snapshotWriter_->flush();
+    }
 }
 
-NNMatrix NeuralNetwork::forward(int epic, int batchNo, const std::vector<NNMatrixPtr>& X,
-                                LayerCallback layerCallback) {
-    for (auto& batchOutpus : layerOutputs) {
-        batchOutpus.clear();
+void NeuralNetwork::averageBatchNormStatistics() {
+    if (!communicator_) {
+        return;
+    }
+    for (size_t l = 0; l < normSegments_.size(); l++) {
+        // The running mean and variance follow gamma and beta in the segment.
+        const size_t rows = layers[l].getOutputSize();
+        communicator_->allReduce(parameters_.param(normSegments_[l]) + 2 * rows, 2 * rows);
     }
+}
 
-    for (auto x : X) {
-        NNMatrix input(*x);
-        for (int i = 0; i < layers.size(); i++) {
-            if (layerCallback) {
-                layerCallback(epic, batchNo, i, LayerPhase::Forward);
-            }
+const NNMatrix& NeuralNetwork::forward(int epic, int batchNo, const std::vector<NNMatrixPtr>& X,
+                                       LayerCallback layerCallback, bool training,
+                                       int64_t augmentSample) {
+    bindActivations(static_cast<int>(X.size()));
+    const bool augment = augmentSample >= 0 && augmenter_;
+    useSparseInput_ = !augment && sparseInputThreshold_ > 0.0f &&
+                      NNUtils::packSparseColumns(X, batchSparse_) &&
+                      batchSparse_.density() < sparseInputThreshold_;
+    if (!useSparseInput_) {
+        NNUtils::packColumns(X, batchInput_);
+    }
+    if (augment) {
+        augmenter_->applyColumns(batchInput_, augmentSample, augmentThreads_);
+    }
 
-            if (i < layers.size() - 1) {
-                input = layers[i].forward(input, NNFunctions::ReLUFunc, false);
-            } else {
-                input = layers[i].forward(input, nullptr);
-                input = NNFunctions::softmax(input);
-            }
-            layerOutputs[i].push_back(input);
+    const int layerSize = layers.size();
+    for (int i = 0; i < layerSize; i++) {
+        if (layerCallback) {
+            layerCallback(epic, batchNo, i, LayerPhase::Forward);
         }
+        forwardLayer(i, training);
     }
 
-    return layerOutputs[layers.size() - 1][X.size() - 1];
+    return layerOutputs.back();
 }
 
-void NeuralNetwork::backward(const std::vector<NNMatrixPtr>& X, const std::vector<NNMatrixPtr>& Y,
-                             float learningRate, float momentum, int epic, int batchNo,
-                             LayerCallback layerCallback) {
-    int batchSize = X.size();
-    std::vector<NNMatrix> dws;
-    std::vector<NNMatrix> dbs;
-    std::vector<NNMatrix> dzs;
-    for (int i = 0; i < layers.size(); i++) {
-        int layerOuputSize = layers[i].getOutputSize();
-        int layerInputSize = layers[i].getInputSize();
-        dws.push_back(NNMatrix(layerOuputSize, layerInputSize));
-        dbs.push_back(NNMatrix(layerOuputSize, 1));
-        dzs.push_back(NNMatrix(layerOuputSize, 1));
-    }
-
-    for (int i = 0; i < batchSize; i++) {
-        auto& x = *(X[i]);
-        auto& y = *(Y[i]);
-
-        // output layer derivatives
-        int layerSize = layers.size();
-        int outputLayerId = layerSize - 1;
-        if (layerCallback) {
-            layerCallback(epic, batchNo, outputLayerId, LayerPhase::Backward);
+void NeuralNetwork::ensureGraph() {
+    if (graph_) {
+        return;
+    }
+    graph_ = std::make_unique<NNGraph>();
+    graphDropoutMasks_.assign(dropoutRate_ > 0.0f ? layers.size() - 1 : 0, NNBitMask());
+    graphInput_ = graph_->input(config_[0]);
+    NNGraph::Value x = graphInput_;
+    for (auto& conv : convLayers) {
+        x = conv.addToGraph(*graph_, x);
+    }
+    for (int l = 0; l < static_cast<int>(layers.size()); l++) {
+        const bool norm = l < static_cast<int>(normSegments_.size());
+        x = layers[l].addToGraph(*graph_, x, !norm);
+        if (norm) {
+            const int rows = layers[l].getOutputSize();
+            float* param = parameters_.param(normSegments_[l]);
+            float* grad = parameters_.grad(normSegments_[l]);
+            const NNGraph::Value gamma = graph_->parameter(rows, 1, param, grad);
+            const NNGraph::Value beta = graph_->parameter(rows, 1, param + rows, grad + rows);
+            x = graph_->batchNorm(x, gamma, beta, param + 2 * rows, param + 3 * rows);
         }
-        dzs[outputLayerId] = layerOutputs[outputLayerId][i] - y;
-        dws[outputLayerId] += calculateDW(layerOutputs[outputLayerId - 1][i], dzs[outputLayerId]);
-        dbs[outputLayerId] += dzs[outputLayerId];
-
-        // hidden layers derivatives
-        for (int l = layerSize - 2; l > 0; l--) {
-            if (layerCallback) {
-                layerCallback(epic, batchNo, l, LayerPhase::Backward);
+        if (l < static_cast<int>(layers.size()) - 1) {
+            x = graph_->relu(x);
+            if (dropoutRate_ > 0.0f) {
+                // Fused into the bias + ReLU pass.
+                x = graph_->dropout(x, &graphDropoutMasks_[l], 1.0f / (1.0f - dropoutRate_));
             }
-            auto da = layers[l + 1].calculatePrevLayerDA(dzs[l + 1]);
-            dzs[l] =
-                da.elementProduct(layerOutputs[l][i].applyFunction(NNFunctions::ReLUDrevative));
-            dws[l] += calculateDW(layerOutputs[l - 1][i], dzs[l]);
-            dbs[l] += dzs[l];
-        }
-
-        // 1st hidden layer derivative
-        if (layerCallback) {
-            layerCallback(epic, batchNo, 0, LayerPhase::Backward);
         }
-        auto da = layers[1].calculatePrevLayerDA(dzs[1]);
-        auto activeLayerOutput = layerOutputs[0][i].applyFunction(NNFunctions::ReLUDrevative);
-        dzs[0] = da.elementProduct(activeLayerOutput);
-        auto curDW = calculateDW(x, dzs[0]);
-        dws[0] += curDW;
-        dbs[0] += dzs[0];
     }
+    graphLogits_ = x;
+    graph_->compile(graph_->crossEntropy(graph_->softmax(x)), {graphLogits_});
+}
 
-    for (auto& dw : dws) {
-        dw /= (float) batchSize;
-    }
-    for (auto& db : dbs) {
-        db /= (float) batchSize;
+const NNMatrix& NeuralNetwork::forwardGraph(const std::vector<NNMatrixPtr>& X,
+                                            int64_t augmentSample, bool training) {
+    ensureGraph();
+    graph_->setTraining(training);
+    graph_->setBatch(static_cast<int>(X.size()));
+    if (training) {
+        // The same draws as forwardLayer, so both paths drop the same units.
+        for (size_t l = 0; l < graphDropoutMasks_.size(); l++) {
+            const size_t outputSize = layers[l].getOutputSize();
+            graphDropoutMasks_[l].sample(NNRandom(seed_, DROPOUT_STREAM + l),
+                                         batchSample_ * outputSize, outputSize * X.size(),
+                                         1.0f - dropoutRate_);
+        }
     }
-
-    for (int l = 0; l < layers.size(); l++) {
-        layers[l].update(dws[l], dbs[l], learningRate, momentum);
+    NNMatrix& input = graph_->value(graphInput_);
+    NNUtils::packColumns(X, input);
+    if (augmentSample >= 0 && augmenter_) {
+        augmenter_->applyColumns(input, augmentSample, augmentThreads_);
     }
+    graph_->forward();
+    return graph_->value(graphLogits_);
 }
 
-NNMatrix NeuralNetwork::calculateDW(const NNMatrix& input, const NNMatrix& dz) {
-    assert(input.getColSize() == 1);
-    assert(dz.getColSize() == 1);
-
-    NNMatrix dw(dz.getRowSize(), input.getRowSize());
-    for (int i = 0; i < dw.getRowSize(); i++) {
-        for (int j = 0; j < dw.getColSize(); j++) {
-            dw.set(i, j, input.get(j, 0) * dz.get(i, 0));
+void NeuralNetwork::backward(float gradScale, bool reduceGradients, int epic, int batchNo,
+                             LayerCallback layerCallback) {
+    const bool reduce = bucketer_ && reduceGradients;
+    if (graphMode()) {
+        // The graph back-propagates all layers in one go, so their gradients are reduced after.
+        graph_->backward(gradScale);
+        for (int l = static_cast<int>(layers.size()) - 1; reduce && l >= 0; l--) {
+            reduceLayerGradient(l);
+        }
+        for (int s = static_cast<int>(convLayers.size()) - 1; reduce && s >= 0; s--) {
+            const int segment = convWeightSegments_[s];
+            bucketer_->add(parameters_.grad(segment), parameters_.segmentSpan(segment));
         }
+    } else {
+        backwardLayers(gradScale, reduce, epic, batchNo, layerCallback);
     }
 
-    return dw;
+    if (reduce) {
+        // Biases are tiny and share one contiguous region, reduce them as a single bucket.
+        bucketer_->add(parameters_.grads() + parameters_.decaySize(),
+                       parameters_.size() - parameters_.decaySize());
+        bucketer_->finish();
+    }
 }
 
-float NeuralNetwork::loss(std::vector<NNMatrixPtr>& Y) {
-    float totalLoss = 0.0f;
-    for (int i = 0; i < Y.size(); i++) {
-        auto& actual = layerOutputs[layers.size() - 1][i];
-        auto& expect = *(Y[i]);
-        totalLoss += calculateCrossEntropyLoss(actual, expect);
+void NeuralNetwork::backwardLayers(float gradScale, bool reduce, int epic, int batchNo,
+                                   LayerCallback layerCallback) {
+    const int layerSize = layers.size();
+    const int outputLayerId = layerSize - 1;
+
+    // The output dz already holds (softmax - onehot) / batchSize from the fused loss kernel, so
+    // every gradient below comes out batch-averaged. gradScale averages over accumulated
+    // micro-batches.
+    if (gradScale != 1.0f) {
+        dzs_[outputLayerId] *= gradScale;
     }
 
-    return totalLoss / Y.size();
+    for (int l = outputLayerId; l >= 0; l--) {
+        if (layerCallback) {
+            layerCallback(epic, batchNo, l, LayerPhase::Backward);
+        }
+        if (l > 0 && !keepOutput_[l - 1] && keepOutput_[l]) {
+            recomputeSegment(l);
+        }
+        // The weight gradient, plus the previous layer's dz for every layer but the output.
+        const double layerFlops =
+            2.0 * layers[l].getInputSize() * layers[l].getOutputSize() * batch_;
+        NNPerfScope scope(perfBackwardNames_[l].c_str(),
+                          l < outputLayerId ? 2.0 * layerFlops : layerFlops);
+        if (l < outputLayerId) {
+            layers[l + 1].calculatePrevLayerDA(dzs_[l + 1], dzs_[l]);
+            // Dropped units are zero in the output, so the ReLU gate covers them too.
+            const float keepScale = dropoutRate_ > 0.0f ? 1.0f / (1.0f - dropoutRate_) : 1.0f;
+            if (useReluMasks_) {
+                reluMasks_[l].apply(dzs_[l], keepScale);
+            } else {
+                dzs_[l] = dzs_[l].elementProduct(
+                    layerOutputs[l].applyFunction(NNFunctions::ReLUDrevative));
+                if (keepScale != 1.0f) {
+                    dzs_[l] *= keepScale;
+                }
+            }
+        }
+        if (l == 0 && useSparseInput_) {
+            layers[l].accumulateGradients(batchSparse_, dzs_[l]);
+        } else {
+            layers[l].accumulateGradients(l > 0 ? layerOutputs[l - 1] : batchInput_, dzs_[l],
+                                          inputTs_[l]);
+        }
+        // The layer's gradient is final now and can be reduced while the earlier layers are
+        // still back-propagating.
+        if (reduce) {
+            reduceLayerGradient(l);
+        }
+    }
 }
 
-float NeuralNetwork::calculateCrossEntropyLoss(const NNMatrix& actual, const NNMatrix& expect) {
-    assert(actual.getRowSize() == expect.getRowSize());
-    assert(actual.getColSize() == 1);
-    assert(expect.getColSize() == 1);
+void NeuralNetwork::reduceLayerGradient(int layerIndex) {
+    const int segment = weightSegments_[layerIndex];
+    bucketer_->add(parameters_.grad(segment), parameters_.segmentSpan(segment));
+}
 
-    float eps = 1e-15f;
-    float loss = 0.0f;
-    for (int i = 0; i < actual.getRowSize(); i++) {
-        float expectElem = expect.get(i, 0);
-        float actualElem = actual.get(i, 0);
-        float actualElemClipped = std::max(eps, std::min(1.0f - eps, actualElem));
-        loss -= expectElem * std::log(actualElemClipped);
+float NeuralNetwork::loss() {
+    if (graphMode()) {
+        const float batchLoss = graph_->loss(batchLabels_);
+        batchPredictions_ = graph_->getPredictions();
+        return batchLoss;
     }
-
-    return loss;
+    return NNFunctions::softmaxCrossEntropy(layerOutputs.back(), batchLabels_, dzs_.back(),
+                                            batchPredictions_);
 }
 
 float NeuralNetwork::accuracy(int epic, const std::vector<NNMatrixPtr>& x_test,
-                              const std::vector<NNMatrixPtr>& y_test) {
-    assert(x_test.size() == y_test.size());
+                              const std::vector<int>& labels) {
+    assert(x_test.size() == labels.size());
     int correct = 0;
-    for (int i = 0; i < x_test.size(); i++) {
-        auto x = x_test[i];
-        auto& y_true = *(y_test[i]);
-        auto pred = predict(epic, x);
-        if (argmax(pred) == argmax(y_true)) {
-            correct += 1;
+    for (int b = 0;; b++) {
+        auto batchX = NNUtils::getBatch(x_test, b, EVAL_BATCH_SIZE);
+        if (batchX.empty()) {
+            break;
+        }
+        const NNMatrix& logits = graphMode() ? forwardGraph(batchX, -1, false)
+                                             : forward(epic, b, batchX, nullptr, false);
+        const int first = b * EVAL_BATCH_SIZE;
+        for (int j = 0; j < static_cast<int>(batchX.size()); j++) {
+            if (logits.getIndexOfColMax(j) == labels[first + j]) {
+                correct += 1;
+            }
         }
     }
     return (float) correct / x_test.size();
@@ -242,7 +790,8 @@ float NeuralNetwork::accuracy(int epic, const std::vector<NNMatrixPtr>& x_test,
 
 NNMatrix NeuralNetwork::predict(int epic, NNMatrixPtr x) {
     std::vector<NNMatrixPtr> input = {x};
-    return forward(epic, 0, input, nullptr);
+    return graphMode() ? forwardGraph(input, -1, false)
+                       : forward(epic, 0, input, nullptr, false);
 }
 
 int NeuralNetwork::argmax(const NNMatrix& x) {
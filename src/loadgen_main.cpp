@@ -0,0 +1,200 @@
+#include "NNInferenceServer.h"
+#include "NNRandom.h"
+#include "NNUtils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// ./nn_loadgen [--socket PATH | --port P] [--clients N] [--requests PER_CLIENT]
+//              [--pipeline DEPTH] [--images IDX_FILE]
+// Closed-loop load for nn_serve: every client keeps DEPTH requests in flight on its own
+// connection and sends the next image as soon as a reply arrives. Images come from an MNIST
+// IDX file, or are random 784-byte images when --images is not given.
+struct Options {
+    std::string socketPath;
+    int port = 5555;
+    int clients = 8;
+    int requests = 2000;
+    int pipeline = 1;
+    std::string imagesPath;
+};
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--socket") == 0) {
+            options.socketPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--port") == 0) {
+            options.port = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--clients") == 0) {
+            options.clients = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--requests") == 0) {
+            options.requests = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--pipeline") == 0) {
+            options.pipeline = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--images") == 0) {
+            options.imagesPath = argv[i + 1];
+        }
+    }
+    return options;
+}
+
+static int connectToServer(const Options& options) {
+    if (!options.socketPath.empty()) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, options.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool sendAll(int fd, const uint8_t* buf, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t done = send(fd, buf, bytes, 0);
+        if (done <= 0) {
+            return false;
+        }
+        buf += done;
+        bytes -= static_cast<size_t>(done);
+    }
+    return true;
+}
+
+static bool recvAll(int fd, char* buf, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t done = recv(fd, buf, bytes, 0);
+        if (done <= 0) {
+            return false;
+        }
+        buf += done;
+        bytes -= static_cast<size_t>(done);
+    }
+    return true;
+}
+
+static std::vector<std::vector<uint8_t>> loadImages(const Options& options) {
+    std::vector<std::vector<uint8_t>> images;
+    if (!options.imagesPath.empty()) {
+        for (const auto& sample : NNUtils::read_mnist_data(options.imagesPath)) {
+            std::vector<uint8_t> pixels(sample->getRowSize());
+            for (int i = 0; i < sample->getRowSize(); i++) {
+                pixels[i] = static_cast<uint8_t>(sample->get(i, 0));
+            }
+            images.push_back(std::move(pixels));
+        }
+        return images;
+    }
+    // Roughly MNIST-like: most pixels dark, a fifth of them lit.
+    const NNRandom random;
+    images.assign(256, std::vector<uint8_t>(784));
+    for (size_t n = 0; n < images.size(); n++) {
+        for (size_t i = 0; i < 784; i++) {
+            const uint32_t bits = random.bitsAt(n * 784 + i);
+            images[n][i] = bits % 5 == 0 ? static_cast<uint8_t>(bits >> 8) : 0;
+        }
+    }
+    return images;
+}
+
+// Runs one client, appending its request latencies in microseconds. Returns false on a
+// connection error.
+static bool runClient(const Options& options, int client,
+                      const std::vector<std::vector<uint8_t>>& images,
+                      std::vector<float>& latencies) {
+    using Clock = std::chrono::steady_clock;
+    const int fd = connectToServer(options);
+    if (fd < 0) {
+        return false;
+    }
+    std::deque<Clock::time_point> inFlight;
+    char reply[NNInferenceServer::REPLY_BYTES];
+    int sent = 0;
+    bool ok = true;
+    for (int received = 0; ok && received < options.requests; received++) {
+        while (sent < options.requests && static_cast<int>(inFlight.size()) < options.pipeline) {
+            const auto& image = images[(client * 7919 + sent) % images.size()];
+            inFlight.push_back(Clock::now());
+            ok = sendAll(fd, image.data(), image.size());
+            sent++;
+        }
+        ok = ok && recvAll(fd, reply, sizeof(reply));
+        if (ok) {
+            latencies.push_back(
+                std::chrono::duration<float, std::micro>(Clock::now() - inFlight.front())
+                    .count());
+            inFlight.pop_front();
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+    const auto images = loadImages(options);
+    if (images.empty()) {
+        NNLOG_ERROR("nn_loadgen") << "No images to send";
+        return 1;
+    }
+
+    std::vector<std::vector<float>> latencies(options.clients);
+    std::vector<char> ok(options.clients, 0);
+    std::vector<std::thread> clients;
+    const auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < options.clients; c++) {
+        latencies[c].reserve(options.requests);
+        clients.emplace_back([&, c] { ok[c] = runClient(options, c, images, latencies[c]); });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<float> all;
+    for (const auto& clientLatencies : latencies) {
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    const int failed = static_cast<int>(std::count(ok.begin(), ok.end(), 0));
+    NNLOG_INFO("nn_loadgen") << all.size() << " requests from " << options.clients
+                             << " clients (pipeline " << options.pipeline << ") in " << seconds
+                             << "s: " << all.size() / seconds << " req/s, latency p50 "
+                             << NNUtils::percentile(all, 0.5) << "us p99 "
+                             << NNUtils::percentile(all, 0.99) << "us p999 "
+                             << NNUtils::percentile(all, 0.999) << "us";
+    if (failed > 0) {
+        NNLOG_ERROR("nn_loadgen") << failed << " clients lost their connection";
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,20 @@
+#include "NNAllocator.h"
+#include "NNCommunicator.h"
+#include "NNNuma.h"
+#include "NNRandom.h"
 #include "NNUtils.h"
 #include "NeuralNetwork.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
 const char* MNIST_TRAIN_DATA_FILE = "mnist/train-images-idx3-ubyte";
 const char* MNIST_TRAIN_LABEL_FILE = "mnist/train-labels-idx1-ubyte";
 const char* MNISt_TEST_DATA_FILE = "mnist/t10k-images-idx3-ubyte";
@@ -15,7 +29,110 @@ const int BATCH_SIZE = 16;
 const float LEARNING_RATE = 0.005f;
 const float MOMENTUM = 0.9f;
 
+// ./main [--workers N] [--transport shm|tcp] [--port P] [--seed S]
+//        [--snapshot PATH] [--snapshot-every STEPS] [--resume PATH] [--perf 0|1]
+//        [--pin none|compact|scatter] [--numa-data shared|replicate|interleave]
+//        [--huge-pages off|transparent|explicit] [--graph 0|1] [--conv 0|1]
+//        [--batch-norm 0|1] [--export PATH] [--dropout RATE]
+// The first three configure data-parallel training, the seed makes a run reproducible.
+// Snapshots are written by rank 0 in the background; --resume continues a pre-empted run.
+// --perf 1 logs hardware counters per kernel and per layer after every epoch.
+// --pin binds each rank to a CPU; its network and buffers are then allocated on that CPU's node.
+// --numa-data replicate gives every rank a node-local copy of its shard and the test set,
+// interleave spreads the loaded dataset over all nodes.
+// --huge-pages picks the backing of buffers of 2 MB and more (the dataset, large weights).
+// --graph 1 trains through the compiled, fused computation graph instead of the layer loops.
+// --conv 1 trains a small convolutional network (always through the graph) instead of the MLP.
+// --batch-norm 1 normalizes every hidden layer's output before its ReLU during training.
+// --export writes the trained model for nn_score/nn_serve, with batch norms folded away.
+// --dropout drops that fraction of the hidden dense units in every training batch.
+struct Options {
+    int workers = 1;
+    std::string transport = "shm";
+    int port = 29500;
+    uint64_t seed = NNRandom::DEFAULT_SEED;
+    std::string snapshotPath;
+    int snapshotEvery = 500;
+    std::string resumePath;
+    bool perf = false;
+    NNPinPolicy pin = NNPinPolicy::None;
+    std::string numaData = "shared";
+    NNAllocator::HugePages hugePages = NNAllocator::HugePages::Transparent;
+    bool graph = false;
+    bool conv = false;
+    bool batchNorm = false;
+    std::string exportPath;
+    float dropout = 0.0f;
+};
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--workers") == 0) {
+            options.workers = std::max(1, std::atoi(argv[i + 1]));
+        } else if (std::strcmp(argv[i], "--transport") == 0) {
+            options.transport = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--port") == 0) {
+            options.port = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            options.seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--snapshot") == 0) {
+            options.snapshotPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--snapshot-every") == 0) {
+            options.snapshotEvery = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--resume") == 0) {
+            options.resumePath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--perf") == 0) {
+            options.perf = std::atoi(argv[i + 1]) != 0;
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            if (!NNNuma::parsePinPolicy(argv[i + 1], options.pin)) {
+                NNLOG_WARN("main") << "Unknown pin policy " << argv[i + 1] << ", not pinning";
+            }
+        } else if (std::strcmp(argv[i], "--numa-data") == 0) {
+            options.numaData = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--huge-pages") == 0) {
+            const std::string mode = argv[i + 1];
+            options.hugePages = mode == "off"        ? NNAllocator::HugePages::Off
+                                : mode == "explicit" ? NNAllocator::HugePages::Explicit
+                                                     : NNAllocator::HugePages::Transparent;
+        } else if (std::strcmp(argv[i], "--graph") == 0) {
+            options.graph = std::atoi(argv[i + 1]) != 0;
+        } else if (std::strcmp(argv[i], "--conv") == 0) {
+            options.conv = std::atoi(argv[i + 1]) != 0;
+        } else if (std::strcmp(argv[i], "--batch-norm") == 0) {
+            options.batchNorm = std::atoi(argv[i + 1]) != 0;
+        } else if (std::strcmp(argv[i], "--export") == 0) {
+            options.exportPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--dropout") == 0) {
+            options.dropout = std::strtof(argv[i + 1], nullptr);
+        }
+    }
+    return options;
+}
+
+// Forks workers - 1 children after the dataset is loaded so they share its pages copy-on-write.
+// Returns this process's rank.
+static int spawnWorkers(int workers, std::vector<pid_t>& children) {
+    for (int rank = 1; rank < workers; rank++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            return rank;
+        }
+        children.push_back(pid);
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+    NNRandom::setGlobalSeed(options.seed);
+    NNAllocator::Policy allocation;
+    allocation.hugePages = options.hugePages;
+    NNAllocator::setPolicy(allocation);
+    const NNNuma& numa = NNNuma::system();
+    NNLOG_INFO("main") << numa.getNodeCount() << " NUMA node(s)";
+    const bool interleave = options.numaData == "interleave" && numa.interleaveMemory();
+
     NNLOG_INFO("main") << "Read train data from " << MNIST_TRAIN_DATA_FILE;
     auto inputs = NNUtils::read_mnist_data(MNIST_TRAIN_DATA_FILE);
     NNUtils::normalizeMnistData(inputs);
@@ -31,11 +148,101 @@ int main(int argc, char** argv) {
     NNLOG_INFO("main") << "Read test label from " << MNIST_TEST_LABEL_FILE;
     auto testLabels = NNUtils::read_mnist_labels(MNIST_TEST_LABEL_FILE);
     NNUtils::normalizeMnistLabel(testLabels);
+    if (interleave) {
+        NNNuma::resetMemoryPolicy();
+    }
+    NNAllocator::logStats();
+
+    std::vector<pid_t> children;
+    int rank = 0;
+    const std::string shmName = "/nn_ring_" + std::to_string(getpid());
+    if (options.workers > 1) {
+        rank = spawnWorkers(options.workers, children);
+        if (rank != 0) {
+            nnlog::config().minLevel = nnlog::Level::Warn;
+        }
+    }
+    // Pin before the network exists, so its parameters, gradients and activation workspace are
+    // first touched on this rank's node.
+    const int node = numa.placeWorker(rank, options.pin);
+    if (node >= 0) {
+        NNLOG_INFO("main") << "Rank " << rank << " pinned to node " << node;
+    }
 
     std::vector<int> cfg{INPUT_SIZE, HIDDEN1_SIZE, HIDDEN2_SIZE, OUTPUT_SIZE};
-    auto nn = NeuralNetwork(cfg);
+    std::vector<int> inputShape;
+    std::vector<NNConvSpec> convs;
+    if (options.conv) {
+        // 28x28 -> 8 maps of 12x12 -> 16 maps of 4x4, then one hidden layer.
+        inputShape = {1, 28, 28};
+        convs = {{8, 5, 1, 0, 2}, {16, 5, 1, 0, 2}};
+        cfg = {INPUT_SIZE, HIDDEN2_SIZE, OUTPUT_SIZE};
+    }
+    NeuralNetwork nn(inputShape, convs, cfg, NNRandom::globalSeed(), options.batchNorm);
+
+    if (options.workers > 1) {
+        std::unique_ptr<NNTransport> transport;
+        if (options.transport == "tcp") {
+            transport = std::make_unique<NNTcpTransport>(rank, options.workers, "127.0.0.1",
+                                                         options.port);
+        } else {
+            transport = std::make_unique<NNShmTransport>(rank, options.workers, shmName);
+        }
+        nn.setCommunicator(std::make_shared<NNCommunicator>(std::move(transport)));
+        inputs = NNUtils::shard(inputs, rank, options.workers);
+        labels = NNUtils::shard(labels, rank, options.workers);
+    }
+    if (options.numaData == "replicate") {
+        inputs = NNNuma::localCopy(inputs);
+        labels = NNNuma::localCopy(labels);
+        testInputs = NNNuma::localCopy(testInputs);
+        testLabels = NNNuma::localCopy(testLabels);
+    }
+
+    if (!options.resumePath.empty()) {
+        nn.resumeFromSnapshot(options.resumePath);
+    }
+    // Every rank holds the same parameters, one writer is enough. Batch norm running statistics
+    // only agree at epoch ends; in between, snapshots carry rank 0's.
+    if (!options.snapshotPath.empty() && rank == 0) {
+        nn.setSnapshots(options.snapshotPath, options.snapshotEvery);
+    }
+    if (options.perf) {
+        nn.setPerfCounters(std::make_shared<NNPerfCounters>());
+    }
+    nn.setGraphExecution(options.graph);
+    nn.setDropout(options.dropout);
+
+    const auto nodeStats = numa.readNodeStats();
+    const auto start = std::chrono::steady_clock::now();
     nn.train(inputs, labels, testInputs, testLabels, EPOCHS, BATCH_SIZE, LEARNING_RATE, MOMENTUM,
              nullptr, nullptr, nullptr, nullptr);
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Remote allocations and where each rank's pages ended up, to check the placement.
+    if (options.pin != NNPinPolicy::None || options.numaData != "shared") {
+        if (rank == 0) {
+            numa.logNodeStats(nodeStats, numa.readNodeStats(), seconds);
+        }
+        for (const auto& [pageNode, pages] : NNNuma::residentPages()) {
+            NNLOG_WARN("main") << "Rank " << rank << ": " << pages << " pages on node "
+                               << pageNode;
+        }
+    }
+
+    if (rank == 0) {
+        NNAllocator::logStats();
+        if (!options.exportPath.empty()) {
+            try {
+                nn.exportModel(options.exportPath);
+            } catch (const std::exception& e) {
+                NNLOG_ERROR("main") << "Export failed: " << e.what();
+            }
+        }
+    }
 
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
     return 0;
 }
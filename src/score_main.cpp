@@ -0,0 +1,89 @@
+#include "NNBatchScorer.h"
+#include "NNSnapshot.h"
+#include "NNUtils.h"
+#include "NeuralNetwork.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// ./nn_score --model SNAPSHOT --input IMAGES [--output PATH|-] [--packed] [--csv] [--top-k K]
+//            [--threads N] [--batch B] [--chunk IMAGES] [--pin none|compact|scatter]
+// Scores an IDX image file (or, with --packed, a file of raw images) with the network from a
+// training snapshot. Output is CSV or binary records of top-k (int32 class, float probability)
+// pairs, in input order.
+struct Options {
+    std::string modelPath;
+    std::string inputPath;
+    std::string outputPath = "-";
+    bool packed = false;
+    NNBatchScorer::Options scorer;
+};
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--packed") == 0) {
+            options.packed = true;
+        } else if (std::strcmp(argv[i], "--csv") == 0) {
+            options.scorer.csv = true;
+        } else if (!hasValue) {
+            break;
+        } else if (std::strcmp(argv[i], "--model") == 0) {
+            options.modelPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--input") == 0) {
+            options.inputPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--output") == 0) {
+            options.outputPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--top-k") == 0) {
+            options.scorer.topK = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            options.scorer.threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--batch") == 0) {
+            options.scorer.batchSize = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--chunk") == 0) {
+            options.scorer.chunkImages = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            NNNuma::parsePinPolicy(argv[++i], options.scorer.pin);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+    if (options.modelPath.empty() || options.inputPath.empty()) {
+        NNLOG_ERROR("nn_score")
+            << "Usage: nn_score --model SNAPSHOT --input IMAGES [--output PATH]";
+        return 1;
+    }
+
+    NNSnapshot snapshot;
+    if (!NNSnapshot::read(options.modelPath, snapshot)) {
+        NNLOG_ERROR("nn_score") << "Unable to read model " << options.modelPath;
+        return 1;
+    }
+    NeuralNetwork nn = NeuralNetwork::fromSnapshot(snapshot);
+    if (!nn.resumeFromSnapshot(options.modelPath)) {
+        return 1;
+    }
+
+    try {
+        NNImageStream input(options.inputPath, options.packed ? snapshot.config.front() : 0);
+        NNBatchScorer scorer(nn, options.scorer);
+        const auto start = std::chrono::steady_clock::now();
+        const int64_t scored = scorer.score(input, options.outputPath);
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double megabytes = static_cast<double>(scored) * input.getImageSize() / 1e6;
+        NNLOG_INFO("nn_score") << scored << " images in " << seconds << "s ("
+                               << scored / seconds << " images/s, " << megabytes / seconds
+                               << " MB/s of input)";
+    } catch (const std::exception& e) {
+        NNLOG_ERROR("nn_score") << e.what();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "NNInferenceServer.h"
+#include "NNSnapshot.h"
+#include "NNUtils.h"
+#include "NeuralNetwork.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// ./nn_serve [--model SNAPSHOT] [--socket PATH | --port P] [--max-batch N] [--max-delay-us U]
+//            [--report-every SECONDS]
+// Serves the network stored in a training snapshot (see ./main --snapshot); without --model a
+// randomly initialized 784-128-64-10 network is served, which is enough for benchmarking.
+// Stats since the previous report are printed every --report-every seconds and on exit.
+struct Options {
+    std::string modelPath;
+    NNInferenceServer::Options server;
+    int reportEvery = 5;
+};
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    options.server.port = 5555;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--model") == 0) {
+            options.modelPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--socket") == 0) {
+            options.server.socketPath = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--port") == 0) {
+            options.server.port = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--max-batch") == 0) {
+            options.server.maxBatch = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--max-delay-us") == 0) {
+            options.server.maxDelayUs = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--report-every") == 0) {
+            options.reportEvery = std::max(1, std::atoi(argv[i + 1]));
+        }
+    }
+    return options;
+}
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) { stopRequested = 1; }
+
+static void report(const NNServeStats& stats) {
+    NNLOG_INFO("nn_serve") << stats.requests << " requests in " << stats.seconds << "s ("
+                           << stats.requestsPerSecond << " req/s), mean batch "
+                           << stats.meanBatch << ", latency p50 " << stats.p50Us << "us p99 "
+                           << stats.p99Us << "us p999 " << stats.p999Us << "us";
+}
+
+int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+
+    NNSnapshot snapshot;
+    if (!options.modelPath.empty() && !NNSnapshot::read(options.modelPath, snapshot)) {
+        NNLOG_ERROR("nn_serve") << "Unable to read model " << options.modelPath;
+        return 1;
+    }
+    NeuralNetwork nn = options.modelPath.empty() ? NeuralNetwork({784, 128, 64, 10})
+                                                 : NeuralNetwork::fromSnapshot(snapshot);
+    if (!options.modelPath.empty() && !nn.resumeFromSnapshot(options.modelPath)) {
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    NNInferenceServer server(nn, nn.getConfig().front(), options.server);
+    try {
+        server.start();
+    } catch (const std::exception& e) {
+        NNLOG_ERROR("nn_serve") << e.what();
+        return 1;
+    }
+
+    auto lastReport = std::chrono::steady_clock::now();
+    while (!stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (std::chrono::steady_clock::now() - lastReport >=
+            std::chrono::seconds(options.reportEvery)) {
+            const NNServeStats stats = server.getStats();
+            if (stats.requests > 0) {
+                report(stats);
+            }
+            server.resetStats();
+            lastReport = std::chrono::steady_clock::now();
+        }
+    }
+    report(server.getStats());
+    server.stop();
+    return 0;
+}
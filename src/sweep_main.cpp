@@ -0,0 +1,166 @@
+#include "NNRandom.h"
+#include "NNSweep.h"
+#include "NNUtils.h"
+#include "NeuralNetwork.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char* MNIST_TRAIN_DATA_FILE = "mnist/train-images-idx3-ubyte";
+const char* MNIST_TRAIN_LABEL_FILE = "mnist/train-labels-idx1-ubyte";
+const char* MNIST_TEST_DATA_FILE = "mnist/t10k-images-idx3-ubyte";
+const char* MNIST_TEST_LABEL_FILE = "mnist/t10k-labels-idx1-ubyte";
+
+// ./nn_sweep [--hidden 128x64,256x128] [--lr 0.001,0.005,0.01] [--momentum 0.9]
+//            [--batch 16,64] [--trials N] [--min-epochs E] [--max-epochs E] [--eta K]
+//            [--threads N] [--validation SAMPLES] [--seed S] [--pin none|compact|scatter]
+// Loads MNIST once and runs a successive-halving sweep over the grid of the listed values (or
+// over --trials random points of it). The last --validation training samples are held out to
+// rank trials; the winner is scored on the test set at the end.
+struct Options {
+    std::vector<std::vector<int>> hidden{{128, 64}};
+    std::vector<float> learningRates{0.001f, 0.005f, 0.01f};
+    std::vector<float> momenta{0.9f};
+    std::vector<int> batchSizes{16, 64};
+    int trials = 0;
+    int validation = 10000;
+    NNSweep::Options sweep;
+};
+
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+template <typename T> static std::vector<T> parseList(const char* text) {
+    std::vector<T> values;
+    for (const auto& part : split(text, ',')) {
+        values.push_back(static_cast<T>(std::atof(part.c_str())));
+    }
+    return values;
+}
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--hidden") == 0) {
+            options.hidden.clear();
+            for (const auto& layers : split(argv[i + 1], ',')) {
+                std::vector<int> sizes;
+                for (const auto& size : split(layers, 'x')) {
+                    sizes.push_back(std::atoi(size.c_str()));
+                }
+                options.hidden.push_back(sizes);
+            }
+        } else if (std::strcmp(argv[i], "--lr") == 0) {
+            options.learningRates = parseList<float>(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--momentum") == 0) {
+            options.momenta = parseList<float>(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--batch") == 0) {
+            options.batchSizes = parseList<int>(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--trials") == 0) {
+            options.trials = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--min-epochs") == 0) {
+            options.sweep.minEpochs = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--max-epochs") == 0) {
+            options.sweep.maxEpochs = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--eta") == 0) {
+            options.sweep.eta = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            options.sweep.threads = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--validation") == 0) {
+            options.validation = std::atoi(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            options.sweep.seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            NNNuma::parsePinPolicy(argv[i + 1], options.sweep.pin);
+        }
+    }
+    return options;
+}
+
+static float testAccuracy(NeuralNetwork& nn, const std::vector<NNMatrixPtr>& X,
+                          const std::vector<NNMatrixPtr>& Y) {
+    const int batchSize = 256;
+    int correct = 0;
+    for (int b = 0;; b++) {
+        auto batchX = NNUtils::getBatch(X, b, batchSize);
+        if (batchX.empty()) {
+            break;
+        }
+        auto labels = NNUtils::toLabelIndices(NNUtils::getBatch(Y, b, batchSize));
+        NNUtils::packColumns(batchX, nn.beginInference(static_cast<int>(batchX.size())));
+        const NNMatrix& logits = nn.runInference();
+        for (size_t j = 0; j < labels.size(); j++) {
+            correct += logits.getIndexOfColMax(static_cast<int>(j)) == labels[j];
+        }
+    }
+    return static_cast<float>(correct) / X.size();
+}
+
+int main(int argc, char** argv) {
+    const Options options = parseOptions(argc, argv);
+
+    // Loaded and normalized once, every trial shares these samples read-only.
+    auto inputs = NNUtils::read_mnist_data(MNIST_TRAIN_DATA_FILE);
+    NNUtils::normalizeMnistData(inputs);
+    auto labels = NNUtils::read_mnist_labels(MNIST_TRAIN_LABEL_FILE);
+    NNUtils::normalizeMnistLabel(labels);
+    auto testInputs = NNUtils::read_mnist_data(MNIST_TEST_DATA_FILE);
+    NNUtils::normalizeMnistData(testInputs);
+    auto testLabels = NNUtils::read_mnist_labels(MNIST_TEST_LABEL_FILE);
+    NNUtils::normalizeMnistLabel(testLabels);
+
+    const size_t holdOut = std::min<size_t>(std::max(options.validation, 1), inputs.size() / 2);
+    const size_t trainSize = inputs.size() - holdOut;
+    std::vector<NNMatrixPtr> validationX(inputs.begin() + trainSize, inputs.end());
+    std::vector<NNMatrixPtr> validationY(labels.begin() + trainSize, labels.end());
+    inputs.resize(trainSize);
+    labels.resize(trainSize);
+
+    auto trials = NNSweep::grid(options.hidden, options.learningRates, options.momenta,
+                                options.batchSizes);
+    if (options.trials > 0 && options.trials < static_cast<int>(trials.size())) {
+        const auto order = NNRandom(options.sweep.seed).permutation(trials.size());
+        std::vector<NNTrialConfig> sampled;
+        for (int t = 0; t < options.trials; t++) {
+            sampled.push_back(trials[order[t]]);
+        }
+        trials = std::move(sampled);
+    }
+
+    NNSweep sweep(std::move(inputs), std::move(labels), std::move(validationX),
+                  std::move(validationY), options.sweep);
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = sweep.run(trials);
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int epochs = 0;
+    for (const auto& result : results) {
+        epochs += result.epochs;
+        NNLOG_INFO("nn_sweep") << (result.finished ? "finished " : "stopped  ") << result.epochs
+                               << " epochs, val acc " << result.accuracy << ", loss "
+                               << result.loss << " | " << result.config.describe();
+    }
+    NNLOG_INFO("nn_sweep") << trials.size() << " trials in " << seconds << "s, " << epochs
+                           << " epochs trained instead of "
+                           << trials.size() * options.sweep.maxEpochs << " without halving";
+    if (sweep.getBest()) {
+        NNLOG_INFO("nn_sweep") << "Best: " << results.front().config.describe() << ", test acc "
+                               << testAccuracy(*sweep.getBest(), testInputs, testLabels);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "NNUtils.h"
+#include "NNVectorMath.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ./nn_vecmath_bench [--count N]
+// Single-core throughput in elements/s of the NNVectorMath array kernels next to the same loops
+// over libm, on inputs spread across the range activations and logits actually take.
+template <typename Fn> static double elementsPerSecond(size_t count, Fn fn) {
+    fn();
+    const auto start = std::chrono::steady_clock::now();
+    int rounds = 0;
+    double seconds = 0.0;
+    while (seconds < 0.5) {
+        fn();
+        rounds++;
+        seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return rounds * static_cast<double>(count) / seconds;
+}
+
+static void report(const std::string& what, double fast, double libm) {
+    NNLOG_WARN("nn_vecmath_bench") << what << ": " << fast / 1e6 << " M/s, libm " << libm / 1e6
+                                   << " M/s (" << fast / libm << "x)";
+}
+
+int main(int argc, char** argv) {
+    size_t count = 4096;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--count") == 0) {
+            count = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        }
+    }
+    nnlog::config().minLevel = nnlog::Level::Warn;
+
+    std::vector<float> x(count);
+    std::vector<float> positive(count);
+    std::vector<float> out(count);
+    for (size_t i = 0; i < count; i++) {
+        x[i] = -20.0f + 40.0f * static_cast<float>(i) / static_cast<float>(count);
+        positive[i] = std::exp(x[i]);
+    }
+    const float* in = x.data();
+    float* y = out.data();
+
+    report("exp",
+           elementsPerSecond(count, [&] { NNVectorMath::exp(in, y, count); }),
+           elementsPerSecond(count, [&] {
+               for (size_t i = 0; i < count; i++) {
+                   y[i] = std::exp(in[i]);
+               }
+           }));
+    report("log",
+           elementsPerSecond(count, [&] { NNVectorMath::log(positive.data(), y, count); }),
+           elementsPerSecond(count, [&] {
+               for (size_t i = 0; i < count; i++) {
+                   y[i] = std::log(positive[i]);
+               }
+           }));
+    report("sigmoid",
+           elementsPerSecond(count, [&] { NNVectorMath::sigmoid(in, y, count); }),
+           elementsPerSecond(count, [&] {
+               for (size_t i = 0; i < count; i++) {
+                   y[i] = 1.0f / (1.0f + std::exp(-in[i]));
+               }
+           }));
+    report("tanh",
+           elementsPerSecond(count, [&] { NNVectorMath::tanh(in, y, count); }),
+           elementsPerSecond(count, [&] {
+               for (size_t i = 0; i < count; i++) {
+                   y[i] = std::tanh(in[i]);
+               }
+           }));
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../include/NNActivationPlanner.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+
+TEST(NNActivationPlannerTest, DisjointLifetimesShareMemory) {
+    NNActivationPlanner planner;
+    int a = planner.add(10, 0, 1);
+    int b = planner.add(6, 1, 2);
+    int c = planner.add(8, 2, 3);
+    planner.plan();
+
+    // a and c are never live together, b overlaps both.
+    const int batch = 5;
+    planner.reserve(batch);
+    ASSERT_EQ(planner.data(a, batch), planner.data(c, batch));
+    ASSERT_EQ(planner.data(a, batch) + 10 * NNActivationPlanner::stride(batch),
+              planner.data(b, batch));
+    ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(planner.data(b, batch)) %
+                      NNActivationPlanner::ALIGNMENT);
+    ASSERT_EQ(16u, NNActivationPlanner::stride(batch));
+    ASSERT_EQ(16u * 16u * sizeof(float), planner.peakBytes(batch));
+    ASSERT_EQ(24u * 16u * sizeof(float), planner.unplannedBytes(batch));
+}
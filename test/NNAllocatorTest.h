@@ -0,0 +1,86 @@
+#pragma once
+
+#include "../include/NNAllocator.h"
+#include "../include/NNMatrix.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+
+namespace {
+// Restores the allocation policy when a test ends.
+struct PolicyGuard {
+    NNAllocator::Policy saved = NNAllocator::getPolicy();
+    ~PolicyGuard() { NNAllocator::setPolicy(saved); }
+};
+
+bool isAligned(const float* ptr, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+} // namespace
+
+TEST(NNAllocatorTest, SmallBuffersAreCacheLineAligned) {
+    const size_t before = NNAllocator::getStats().liveBytes;
+    for (size_t count : {0, 1, 3, 17, 1000}) {
+        float* ptr = NNAllocator::allocate(count);
+        ASSERT_NE(ptr, nullptr);
+        EXPECT_TRUE(isAligned(ptr, NNAllocator::ALIGNMENT));
+        EXPECT_EQ(NNAllocator::getStats().liveBytes, before + count * sizeof(float));
+        NNAllocator::deallocate(ptr, count);
+    }
+    EXPECT_EQ(NNAllocator::getStats().liveBytes, before);
+
+    NNMatrix matrix(3, 5);
+    EXPECT_TRUE(isAligned(matrix.data(), NNAllocator::ALIGNMENT));
+}
+
+TEST(NNAllocatorTest, LargeBuffersGetTheirOwnMapping) {
+    PolicyGuard guard;
+    const size_t count = 3 * NNAllocator::HUGE_PAGE / sizeof(float) + 5;
+    const auto before = NNAllocator::getStats();
+
+    NNAllocator::setPolicy({NNAllocator::HugePages::Off, NNAllocator::HUGE_PAGE});
+    auto heap = NNAllocator::allocateBuffer(count);
+    EXPECT_TRUE(isAligned(heap.get(), NNAllocator::ALIGNMENT));
+    EXPECT_EQ(NNAllocator::getStats().mappedBytes, before.mappedBytes);
+
+    for (auto mode : {NNAllocator::HugePages::Transparent, NNAllocator::HugePages::Explicit}) {
+        NNAllocator::setPolicy({mode, NNAllocator::HUGE_PAGE});
+        auto buffer = NNAllocator::allocateBuffer(count);
+        EXPECT_EQ(buffer[count - 1], 0.0f);
+        const auto stats = NNAllocator::getStats();
+#ifdef __linux__
+        EXPECT_TRUE(isAligned(buffer.get(), NNAllocator::HUGE_PAGE));
+        EXPECT_EQ(stats.mappedBytes, before.mappedBytes + count * sizeof(float));
+        // Explicit pages fall back to advised ones when none are reserved.
+        EXPECT_EQ(stats.explicitHugeBytes + stats.advisedBytes, stats.mappedBytes);
+        EXPECT_LE(stats.hugeBackedBytes, stats.mappedBytes);
+#endif
+        buffer.reset();
+        EXPECT_EQ(NNAllocator::getStats().mappedBytes, before.mappedBytes);
+    }
+}
+
+TEST(NNAllocatorTest, ThresholdKeepsMidSizedBuffersOnTheHeap) {
+    PolicyGuard guard;
+    NNAllocator::setPolicy({NNAllocator::HugePages::Transparent, 8 * NNAllocator::HUGE_PAGE});
+    const size_t before = NNAllocator::getStats().mappedBytes;
+    auto buffer = NNAllocator::allocateBuffer(4 * NNAllocator::HUGE_PAGE / sizeof(float));
+    EXPECT_EQ(NNAllocator::getStats().mappedBytes, before);
+
+    // The threshold never goes below one huge page.
+    NNAllocator::setPolicy({NNAllocator::HugePages::Transparent, 4096});
+    EXPECT_EQ(NNAllocator::getPolicy().hugeThreshold, NNAllocator::HUGE_PAGE);
+}
+
+TEST(NNAllocatorTest, ViewsKeepSharedStorageAlive) {
+    std::shared_ptr<float> block = NNAllocator::allocateShared(8);
+    block.get()[5] = 2.5f;
+    NNMatrix view(block, block.get() + 4, 4, 1);
+    block.reset();
+    EXPECT_TRUE(view.isView());
+    EXPECT_FLOAT_EQ(view.get(1, 0), 2.5f);
+
+    NNMatrix copy(view);
+    EXPECT_FALSE(copy.isView());
+    EXPECT_FLOAT_EQ(copy.get(1, 0), 2.5f);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "../include/NNAugment.h"
+#include "NeuralNetworkTest.h"
+
+#include "gtest/gtest.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+static std::vector<float> makeAugmentImages(int count) {
+    std::vector<float> images(static_cast<size_t>(count) * 784);
+    for (size_t i = 0; i < images.size(); i++) {
+        images[i] = static_cast<float>((i * 37) % 101) / 100.0f;
+    }
+    return images;
+}
+
+TEST(NNAugmentTest, IdentityOptionsCopyTheImage) {
+    NNAugmenter::Options options;
+    options.maxShift = 0.0f;
+    options.maxRotation = 0.0f;
+    options.minScale = options.maxScale = 1.0f;
+    const NNAugmenter augmenter(options);
+    const auto images = makeAugmentImages(2);
+    std::vector<float> out(images.size());
+    augmenter.apply(images.data(), out.data(), 2, 0);
+    EXPECT_EQ(images, out);
+}
+
+TEST(NNAugmentTest, DeterministicPerSampleAcrossBatchingAndThreads) {
+    NNAugmenter::Options options;
+    options.elasticAlpha = 1.5f;
+    options.noiseStddev = 0.05f;
+    const NNAugmenter augmenter(options, 28, 28, 17);
+    const int count = 6;
+    const auto images = makeAugmentImages(count);
+
+    std::vector<float> whole(images.size());
+    augmenter.apply(images.data(), whole.data(), count, 100, 3);
+    std::vector<float> split(images.size());
+    augmenter.apply(images.data(), split.data(), 2, 100);
+    augmenter.apply(images.data() + 2 * 784, split.data() + 2 * 784, 4, 102);
+    EXPECT_EQ(whole, split);
+    EXPECT_NE(images, whole);
+    for (float v : whole) {
+        ASSERT_GE(v, 0.0f);
+        ASSERT_LE(v, 1.0f);
+    }
+
+    // Another seed gives other images.
+    std::vector<float> reseeded(images.size());
+    NNAugmenter(options, 28, 28, 18).apply(images.data(), reseeded.data(), count, 100);
+    EXPECT_NE(whole, reseeded);
+
+    // Packed columns get the same augmentation as contiguous images.
+    NNMatrix batch(784, count);
+    for (int j = 0; j < count; j++) {
+        for (int i = 0; i < 784; i++) {
+            batch.set(i, j, images[j * 784 + i]);
+        }
+    }
+    augmenter.applyColumns(batch, 100);
+    for (int j = 0; j < count; j++) {
+        for (int i = 0; i < 784; i++) {
+            ASSERT_EQ(whole[j * 784 + i], batch.get(i, j));
+        }
+    }
+}
+
+TEST(NNAugmentTest, BytesFollowFloats) {
+    NNAugmenter::Options options;
+    options.elasticAlpha = 1.0f;
+    const NNAugmenter augmenter(options);
+    std::vector<float> images(784);
+    std::vector<uint8_t> bytes(784);
+    for (int i = 0; i < 784; i++) {
+        bytes[i] = static_cast<uint8_t>((i * 13) % 256);
+        images[i] = bytes[i] / 255.0f;
+    }
+    std::vector<float> out(784);
+    std::vector<uint8_t> bytesOut(784);
+    augmenter.apply(images.data(), out.data(), 1, 7);
+    augmenter.apply(bytes.data(), bytesOut.data(), 1, 7);
+    for (int i = 0; i < 784; i++) {
+        ASSERT_NEAR(out[i] * 255.0f, bytesOut[i], 0.51f);
+    }
+}
+
+TEST(NNAugmentTest, AugmentedTrainingIsReproducible) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(12, X, Y);
+    std::vector<NNMatrixPtr> X2 = X, Y2 = Y, X3 = X, Y3 = Y;
+    NNAugmenter::Options options;
+    options.maxShift = 0.5f;
+    auto augmenter = std::make_shared<NNAugmenter>(options, 2, 2, 5);
+
+    NeuralNetwork first({4, 6, 3}, 3);
+    NeuralNetwork second({4, 6, 3}, 3);
+    NeuralNetwork plain({4, 6, 3}, 3);
+    first.setAugmentation(augmenter);
+    second.setAugmentation(augmenter);
+    first.train(X, Y, X, Y, 2, 4, 0.1f, 0.9f);
+    second.train(X2, Y2, X2, Y2, 2, 4, 0.1f, 0.9f);
+    plain.train(X3, Y3, X3, Y3, 2, 4, 0.1f, 0.9f);
+
+    const auto& a = first.getParameters();
+    const auto& b = second.getParameters();
+    const auto& c = plain.getParameters();
+    bool differsFromPlain = false;
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_EQ(a.params()[i], b.params()[i]);
+        differsFromPlain = differsFromPlain || a.params()[i] != c.params()[i];
+    }
+    EXPECT_TRUE(differsFromPlain);
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "../include/NNBatchScorer.h"
+#include "../include/NNSnapshot.h"
+#include "../include/NeuralNetwork.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+void writeIdxImages(const std::string& path, const std::vector<std::vector<uint8_t>>& images,
+                    int rows, int cols) {
+    std::ofstream file(path, std::ios::binary);
+    auto writeBigEndian = [&file](uint32_t value) {
+        const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8),
+                               char(value)};
+        file.write(bytes, 4);
+    };
+    writeBigEndian(2051);
+    writeBigEndian(static_cast<uint32_t>(images.size()));
+    writeBigEndian(rows);
+    writeBigEndian(cols);
+    for (const auto& image : images) {
+        file.write(reinterpret_cast<const char*>(image.data()), image.size());
+    }
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+} // namespace
+
+TEST(NNBatchScorerTest, StreamsChunksInOrderAndMatchesInference) {
+    const int inputSize = 6;
+    const int count = 11;
+    NeuralNetwork nn({inputSize, 5, 3}, 8);
+    std::vector<std::vector<uint8_t>> images(count, std::vector<uint8_t>(inputSize));
+    std::vector<int> expected;
+    for (int n = 0; n < count; n++) {
+        NNMatrix& input = nn.beginInference(1);
+        for (int i = 0; i < inputSize; i++) {
+            images[n][i] = static_cast<uint8_t>((n * 53 + i * 29) % 256);
+            input.set(i, 0, images[n][i] / 255.0f);
+        }
+        expected.push_back(nn.runInference().getIndexOfColMax(0));
+    }
+    const std::string imagesPath = "nn_score_test.idx";
+    writeIdxImages(imagesPath, images, 2, 3);
+
+    // Chunks of 4 split into batches of 3 and 1, scored by two workers.
+    NNBatchScorer::Options options;
+    options.threads = 2;
+    options.batchSize = 3;
+    options.chunkImages = 4;
+    options.topK = 2;
+    NNImageStream binaryInput(imagesPath);
+    ASSERT_EQ(count, binaryInput.getCount());
+    ASSERT_EQ(count, NNBatchScorer(nn, options).score(binaryInput, "nn_score_test.bin"));
+    const std::string binary = readFile("nn_score_test.bin");
+    ASSERT_EQ(static_cast<size_t>(count) * 2 * 8, binary.size());
+
+    options.csv = true;
+    NNImageStream csvInput(imagesPath);
+    NNBatchScorer(nn, options).score(csvInput, "nn_score_test.csv");
+    std::istringstream csv(readFile("nn_score_test.csv"));
+
+    for (int n = 0; n < count; n++) {
+        int32_t top[2];
+        float probability[2];
+        for (int k = 0; k < 2; k++) {
+            std::memcpy(&top[k], binary.data() + (n * 2 + k) * 8, 4);
+            std::memcpy(&probability[k], binary.data() + (n * 2 + k) * 8 + 4, 4);
+        }
+        EXPECT_EQ(expected[n], top[0]);
+        EXPECT_NE(top[0], top[1]);
+        EXPECT_GE(probability[0], probability[1]);
+
+        std::string line;
+        ASSERT_TRUE(std::getline(csv, line));
+        char prefix[32];
+        std::snprintf(prefix, sizeof(prefix), "%d,%d,", n, top[0]);
+        EXPECT_EQ(0u, line.find(prefix)) << line;
+    }
+
+    std::remove(imagesPath.c_str());
+    std::remove("nn_score_test.bin");
+    std::remove("nn_score_test.csv");
+}
+
+TEST(NNBatchScorerTest, ScoresExportedConvNetwork) {
+    const int inputSize = 16;
+    const int count = 7;
+    std::vector<std::vector<uint8_t>> images(count, std::vector<uint8_t>(inputSize));
+    std::vector<NNMatrixPtr> X, Y;
+    for (int n = 0; n < count; n++) {
+        auto x = std::make_shared<NNMatrix>(inputSize, 1);
+        for (int i = 0; i < inputSize; i++) {
+            images[n][i] = static_cast<uint8_t>((n * 71 + i * 37) % 256);
+            x->set(i, 0, images[n][i] / 255.0f);
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(n % 3, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+    NeuralNetwork nn({1, 4, 4}, {{2, 3, 1, 1, 2}}, {inputSize, 5, 3}, 8, true);
+    nn.train(X, Y, X, Y, 1, 4, 0.05f, 0.9f);
+    const std::string modelPath = "nn_score_conv.bin";
+    nn.exportModel(modelPath);
+
+    // Loaded the way nn_score loads it, then checked against the trained network.
+    NNSnapshot snapshot;
+    ASSERT_TRUE(NNSnapshot::read(modelPath, snapshot));
+    NeuralNetwork loaded = NeuralNetwork::fromSnapshot(snapshot);
+    ASSERT_TRUE(loaded.resumeFromSnapshot(modelPath));
+    std::vector<int> expected;
+    for (int n = 0; n < count; n++) {
+        NNMatrix& input = nn.beginInference(1);
+        for (int i = 0; i < inputSize; i++) {
+            input.set(i, 0, images[n][i] / 255.0f);
+        }
+        expected.push_back(nn.runInference().getIndexOfColMax(0));
+    }
+    const std::string imagesPath = "nn_score_conv.idx";
+    writeIdxImages(imagesPath, images, 4, 4);
+
+    NNBatchScorer::Options options;
+    options.threads = 2;
+    options.batchSize = 3;
+    options.chunkImages = 4;
+    NNImageStream input(imagesPath);
+    ASSERT_EQ(count, NNBatchScorer(loaded, options).score(input, "nn_score_conv.out"));
+    const std::string binary = readFile("nn_score_conv.out");
+    ASSERT_EQ(static_cast<size_t>(count) * 8, binary.size());
+    for (int n = 0; n < count; n++) {
+        int32_t top;
+        std::memcpy(&top, binary.data() + n * 8, 4);
+        EXPECT_EQ(expected[n], top);
+    }
+
+    std::remove(modelPath.c_str());
+    std::remove(imagesPath.c_str());
+    std::remove("nn_score_conv.out");
+}
+
+TEST(NNBatchScorerTest, RejectsMismatchedImages) {
+    const std::string imagesPath = "nn_score_mismatch.idx";
+    writeIdxImages(imagesPath, {std::vector<uint8_t>(4)}, 2, 2);
+    NeuralNetwork nn({6, 3});
+    NNImageStream input(imagesPath);
+    EXPECT_THROW(NNBatchScorer(nn, NNBatchScorer::Options()).score(input, "-"),
+                 std::runtime_error);
+    EXPECT_THROW(NNImageStream("nn_score_missing.idx"), std::runtime_error);
+    std::remove(imagesPath.c_str());
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../include/NNCommunicator.h"
+
+#include "gtest/gtest.h"
+#include <functional>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Runs body(rank) for every rank of a ring on its own thread.
+static void runRing(int worldSize, const std::function<void(int)>& body) {
+    std::vector<std::thread> threads;
+    for (int rank = 0; rank < worldSize; rank++) {
+        threads.emplace_back(body, rank);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+static void checkAllReduce(int rank, int worldSize, NNCommunicator& communicator) {
+    // Odd length so the chunks are uneven.
+    std::vector<float> data(1001);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<float>(rank + 1) * static_cast<float>(i);
+    }
+    communicator.allReduce(data.data(), data.size(), false);
+
+    const float rankSum = static_cast<float>(worldSize * (worldSize + 1) / 2);
+    for (size_t i = 0; i < data.size(); i++) {
+        ASSERT_FLOAT_EQ(rankSum * static_cast<float>(i), data[i]);
+    }
+}
+
+TEST(NNCommunicatorTest, TcpRingAllReduce) {
+    const int worldSize = 3;
+    const int basePort = 40000 + static_cast<int>(getpid() % 2000) * 8;
+    runRing(worldSize, [&](int rank) {
+        NNCommunicator communicator(
+            std::make_unique<NNTcpTransport>(rank, worldSize, "127.0.0.1", basePort));
+        checkAllReduce(rank, worldSize, communicator);
+    });
+}
+
+TEST(NNCommunicatorTest, ShmRingAllReduceAndBroadcast) {
+    const int worldSize = 4;
+    const std::string name = "/nn_test_" + std::to_string(getpid());
+    runRing(worldSize, [&](int rank) {
+        NNCommunicator communicator(std::make_unique<NNShmTransport>(rank, worldSize, name));
+        checkAllReduce(rank, worldSize, communicator);
+
+        // Larger than the shared memory channel to exercise wrap-around.
+        std::vector<float> params(600000, static_cast<float>(rank));
+        communicator.broadcast(params.data(), params.size(), 0);
+        ASSERT_FLOAT_EQ(0.0f, params.front());
+        ASSERT_FLOAT_EQ(0.0f, params.back());
+    });
+}
+
+TEST(NNCommunicatorTest, BucketerAveragesAdjacentRanges) {
+    const int worldSize = 2;
+    const std::string name = "/nn_bucket_" + std::to_string(getpid());
+    runRing(worldSize, [&](int rank) {
+        NNCommunicator communicator(std::make_unique<NNShmTransport>(rank, worldSize, name));
+        NNGradientBucketer bucketer(communicator, 64 * sizeof(float));
+        std::vector<float> grads(256, rank == 0 ? 1.0f : 3.0f);
+
+        // Ranges arrive back to front, as layers do during backward.
+        bucketer.add(grads.data() + 128, 128);
+        bucketer.add(grads.data() + 32, 96);
+        bucketer.add(grads.data(), 32);
+        bucketer.finish();
+
+        for (float g : grads) {
+            ASSERT_FLOAT_EQ(2.0f, g);
+        }
+    });
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../include/NNFunctions.h"
+
+#include "gtest/gtest.h"
+#include <cmath>
+#include <vector>
+
+TEST(NNFunctionsTest, SoftmaxCrossEntropyMatchesReference) {
+    // 3 classes x 2 samples, one sample per column.
+    NNMatrix logits(3, 2);
+    const float values[3][2] = {{1.0f, -2.0f}, {2.0f, 0.5f}, {0.5f, 3.0f}};
+    for (int c = 0; c < 3; c++) {
+        for (int j = 0; j < 2; j++) {
+            logits.set(c, j, values[c][j]);
+        }
+    }
+    std::vector<int> labels{1, 0};
+
+    NNMatrix dlogits(1, 1);
+    std::vector<int> predictions;
+    float loss = NNFunctions::softmaxCrossEntropy(logits, labels, dlogits, predictions);
+
+    float expectedLoss = 0.0f;
+    for (int j = 0; j < 2; j++) {
+        NNMatrix column(3, 1);
+        for (int c = 0; c < 3; c++) {
+            column.set(c, 0, values[c][j]);
+        }
+        auto probs = NNFunctions::softmax(column);
+        expectedLoss -= std::log(probs.get(labels[j], 0));
+        for (int c = 0; c < 3; c++) {
+            float onehot = c == labels[j] ? 1.0f : 0.0f;
+            EXPECT_NEAR((probs.get(c, 0) - onehot) / 2.0f, dlogits.get(c, j), 1e-6f);
+        }
+    }
+
+    EXPECT_NEAR(expectedLoss / 2.0f, loss, 1e-5f);
+    ASSERT_EQ(2u, predictions.size());
+    EXPECT_EQ(1, predictions[0]);
+    EXPECT_EQ(2, predictions[1]);
+}
+
+TEST(NNFunctionsTest, SoftmaxCrossEntropyIsStableForLargeLogits) {
+    NNMatrix logits(2, 1);
+    logits.set(0, 0, 1000.0f);
+    logits.set(1, 0, -1000.0f);
+    std::vector<int> labels{1};
+
+    NNMatrix dlogits(2, 1);
+    std::vector<int> predictions;
+    float loss = NNFunctions::softmaxCrossEntropy(logits, labels, dlogits, predictions);
+
+    EXPECT_TRUE(std::isfinite(loss));
+    EXPECT_NEAR(2000.0f, loss, 1e-2f);
+    EXPECT_NEAR(1.0f, dlogits.get(0, 0), 1e-6f);
+    EXPECT_NEAR(-1.0f, dlogits.get(1, 0), 1e-6f);
+    EXPECT_EQ(0, predictions[0]);
+}
+
+TEST(NNFunctionsTest, ReluMaskGatesGradient) {
+    // 5 x 8 = 40 elements spans a full mask word and a partial one.
+    NNMatrix z(5, 8);
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 8; j++) {
+            z.set(i, j, static_cast<float>((i * 8 + j) % 3) - 1.0f);
+        }
+    }
+    NNMatrix expected = z.applyFunction(NNFunctions::ReLUDrevative);
+    NNBitMask mask;
+    NNFunctions::relu(z, &mask);
+    ASSERT_EQ(40u, mask.size());
+    ASSERT_EQ(8u, mask.byteSize());
+
+    NNMatrix dz(5, 8, 2.0f);
+    mask.apply(dz);
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 8; j++) {
+            ASSERT_FLOAT_EQ(std::max(z.get(i, j), 0.0f), z.get(i, j));
+            ASSERT_FLOAT_EQ(2.0f * expected.get(i, j), dz.get(i, j));
+        }
+    }
+}
+
+TEST(NNFunctionsTest, DropoutFusesIntoRelu) {
+    // 37 x 29 = 1073 elements: a whole chunk of draws, then a partial word.
+    const int rows = 37;
+    const int cols = 29;
+    const size_t count = rows * cols;
+    NNBitMask keep;
+    keep.sample(NNRandom(9, 4), 1000, count, 0.75f);
+    ASSERT_EQ(count, keep.size());
+    ASSERT_EQ(136u, keep.byteSize());
+    NNBitMask again;
+    again.sample(NNRandom(9, 4), 1000, count, 0.75f);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(keep.test(i), again.test(i));
+        kept += keep.test(i);
+    }
+    EXPECT_NEAR(0.75, static_cast<double>(kept) / count, 0.05);
+
+    NNMatrix z(rows, cols);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            z.set(i, j, static_cast<float>((i * cols + j) % 5) - 2.0f);
+        }
+    }
+    const NNMatrix input = z;
+    NNBitMask mask;
+    NNFunctions::relu(z, &mask, &keep, 4.0f / 3.0f);
+    NNMatrix dz(rows, cols, 3.0f);
+    mask.apply(dz, 4.0f / 3.0f);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            const bool on = keep.test(static_cast<size_t>(i) * cols + j) && input.get(i, j) > 0;
+            ASSERT_FLOAT_EQ(on ? input.get(i, j) * 4.0f / 3.0f : 0.0f, z.get(i, j));
+            ASSERT_FLOAT_EQ(on ? 4.0f : 0.0f, dz.get(i, j));
+        }
+    }
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "../include/NNBitMask.h"
+#include "../include/NNGraph.h"
+#include "../include/NNRandom.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// A graph using every op: tanh(0.5 * (W1 x + b1)) feeds z = W2 h + b2, which is gated by
+// sigmoid(W3 x) into relu(z * gate + z) and a softmax cross-entropy. 56 parameters.
+static NNGraph::Value buildGraphTestNet(NNGraph& graph, std::vector<float>& params,
+                                        std::vector<float>& grads, NNGraph::Value& input) {
+    float* p = params.data();
+    float* g = grads.data();
+    input = graph.input(3);
+    const NNGraph::Value w1 = graph.parameter(5, 3, p, g);
+    const NNGraph::Value b1 = graph.parameter(5, 1, p + 15, g + 15);
+    const NNGraph::Value w2 = graph.parameter(4, 5, p + 20, g + 20);
+    const NNGraph::Value b2 = graph.parameter(4, 1, p + 40, g + 40);
+    const NNGraph::Value w3 = graph.parameter(4, 3, p + 44, g + 44);
+    const NNGraph::Value h =
+        graph.tanh(graph.scale(graph.addBias(graph.matmul(w1, input), b1), 0.5f));
+    const NNGraph::Value gate = graph.sigmoid(graph.matmul(w3, input));
+    const NNGraph::Value z = graph.addBias(graph.matmul(w2, h), b2);
+    const NNGraph::Value u = graph.relu(graph.add(graph.mul(z, gate), z));
+    // Nothing depends on this one, so it is never scheduled.
+    graph.sigmoid(graph.matmul(w1, input));
+    return graph.crossEntropy(graph.softmax(u));
+}
+
+static float runGraphLoss(NNGraph& graph, NNGraph::Value input, const std::vector<float>& x,
+                          const std::vector<int>& labels) {
+    graph.setBatch(static_cast<int>(labels.size()));
+    std::copy(x.begin(), x.end(), graph.value(input).data());
+    graph.forward();
+    return graph.loss(labels);
+}
+
+TEST(NNGraphTest, GradientsMatchFiniteDifferences) {
+    const std::vector<int> labels = {0, 3, 1, 2};
+    std::vector<float> x(3 * labels.size());
+    NNRandom(7, 0).fillUniform(x.data(), x.size(), -1.0f, 1.0f);
+
+    for (bool fuse : {false, true}) {
+        std::vector<float> params(56);
+        std::vector<float> grads(56, 0.0f);
+        NNRandom(7, 1).fillUniform(params.data(), params.size(), -1.0f, 1.0f);
+        NNGraph graph;
+        NNGraph::Value input = -1;
+        graph.compile(buildGraphTestNet(graph, params, grads, input), {}, fuse);
+        // Fused: bias + scale + tanh is one pass, and softmax joins the cross-entropy.
+        EXPECT_EQ(fuse ? 3 : 0, graph.getFusedCount());
+        EXPECT_EQ(fuse ? 10 : 13, graph.getScheduleSize());
+
+        runGraphLoss(graph, input, x, labels);
+        graph.backward();
+        const float eps = 1e-3f;
+        for (size_t i = 0; i < params.size(); i++) {
+            const float saved = params[i];
+            params[i] = saved + eps;
+            const float up = runGraphLoss(graph, input, x, labels);
+            params[i] = saved - eps;
+            const float down = runGraphLoss(graph, input, x, labels);
+            params[i] = saved;
+            ASSERT_NEAR((up - down) / (2.0f * eps), grads[i], 2e-3f) << "parameter " << i;
+        }
+    }
+}
+
+TEST(NNGraphTest, FusesAndPlansAnMlp) {
+    const std::vector<int> sizes = {20, 16, 16, 4};
+    std::vector<float> params;
+    for (size_t l = 1; l < sizes.size(); l++) {
+        params.resize(params.size() + sizes[l] * (sizes[l - 1] + 1));
+    }
+    std::vector<float> grads(params.size(), 0.0f);
+    NNRandom(3, 0).fillUniform(params.data(), params.size(), -0.5f, 0.5f);
+
+    auto build = [&](NNGraph& graph, NNGraph::Value& input) {
+        input = graph.input(sizes[0]);
+        NNGraph::Value x = input;
+        size_t offset = 0;
+        for (size_t l = 1; l < sizes.size(); l++) {
+            const NNGraph::Value w = graph.parameter(sizes[l], sizes[l - 1],
+                                                     params.data() + offset, grads.data() + offset);
+            offset += sizes[l] * sizes[l - 1];
+            const NNGraph::Value b =
+                graph.parameter(sizes[l], 1, params.data() + offset, grads.data() + offset);
+            offset += sizes[l];
+            x = graph.addBias(graph.matmul(w, x), b);
+            if (l + 1 < sizes.size()) {
+                x = graph.relu(x);
+            }
+        }
+        return x;
+    };
+
+    NNGraph training;
+    NNGraph::Value trainingInput = -1;
+    const NNGraph::Value logits = build(training, trainingInput);
+    training.compile(training.crossEntropy(training.softmax(logits)), {logits});
+    const std::string schedule = training.describe();
+    EXPECT_NE(std::string::npos, schedule.find("elementwise(bias,relu)"));
+    EXPECT_NE(std::string::npos, schedule.find("softmax_cross_entropy"));
+    EXPECT_EQ(7, training.getScheduleSize());
+    EXPECT_LT(training.peakBytes(32), training.unplannedBytes(32));
+
+    // Inference keeps nothing for backward, so it needs less.
+    NNGraph inference;
+    NNGraph::Value inferenceInput = -1;
+    const NNGraph::Value inferenceLogits = build(inference, inferenceInput);
+    inference.compile(-1, {inferenceLogits});
+    EXPECT_LT(inference.peakBytes(32), training.peakBytes(32));
+
+    std::vector<float> x(sizes[0] * 8);
+    NNRandom(3, 1).fillUniform(x.data(), x.size(), 0.0f, 1.0f);
+    for (NNGraph* graph : {&training, &inference}) {
+        graph->setBatch(8);
+        const NNGraph::Value input = graph == &training ? trainingInput : inferenceInput;
+        std::copy(x.begin(), x.end(), graph->value(input).data());
+        graph->forward();
+    }
+    const NNMatrix& a = training.value(logits);
+    const NNMatrix& b = inference.value(inferenceLogits);
+    for (int i = 0; i < sizes.back(); i++) {
+        for (int j = 0; j < 8; j++) {
+            ASSERT_FLOAT_EQ(a.get(i, j), b.get(i, j));
+        }
+    }
+}
+
+TEST(NNGraphTest, ConvolutionGradientsMatchFiniteDifferences) {
+    // 2x6x5 samples through a padded 3x3 convolution with a channel bias, ReLU and 2x2 max
+    // pooling, then a strided, padded 2x2 convolution and a dense layer. 113 parameters.
+    const NNGraph::Window conv1{2, 6, 5, 3, 1, 1};
+    const NNGraph::Window pool{3, 6, 5, 2, 2, 0};
+    const NNGraph::Window conv2{3, 3, 2, 2, 2, 1};
+    const std::vector<int> labels = {1, 0, 3};
+    std::vector<float> x(60 * labels.size());
+    NNRandom(11, 0).fillUniform(x.data(), x.size(), -1.0f, 1.0f);
+    std::vector<float> params(113);
+    std::vector<float> grads(params.size(), 0.0f);
+    NNRandom(11, 1).fillUniform(params.data(), params.size(), -0.5f, 0.5f);
+    float* p = params.data();
+    float* g = grads.data();
+
+    NNGraph graph;
+    const NNGraph::Value input = graph.input(60);
+    const NNGraph::Value w1 = graph.parameter(3, 18, p, g);
+    const NNGraph::Value b1 = graph.parameter(3, 1, p + 54, g + 54);
+    const NNGraph::Value w2 = graph.parameter(2, 12, p + 57, g + 57);
+    const NNGraph::Value w3 = graph.parameter(4, 8, p + 81, g + 81);
+    NNGraph::Value h = graph.relu(graph.addBias(graph.conv2d(w1, input, conv1), b1));
+    h = graph.conv2d(w2, graph.maxPool(h, pool), conv2);
+    graph.compile(graph.crossEntropy(graph.softmax(graph.matmul(w3, h))));
+    EXPECT_NE(std::string::npos, graph.describe().find("elementwise(bias,relu)"));
+
+    runGraphLoss(graph, input, x, labels);
+    graph.backward();
+    const float eps = 1e-3f;
+    for (size_t i = 0; i < params.size(); i++) {
+        const float saved = params[i];
+        params[i] = saved + eps;
+        const float up = runGraphLoss(graph, input, x, labels);
+        params[i] = saved - eps;
+        const float down = runGraphLoss(graph, input, x, labels);
+        params[i] = saved;
+        ASSERT_NEAR((up - down) / (2.0f * eps), grads[i], 2e-3f) << "parameter " << i;
+    }
+}
+
+TEST(NNGraphTest, BatchNormGradientsMatchFiniteDifferences) {
+    // tanh(batchNorm(W1 x)) into a dense layer and softmax cross-entropy. 40 parameters.
+    const std::vector<int> labels = {2, 0, 1, 3, 0};
+    std::vector<float> x(3 * labels.size());
+    NNRandom(5, 0).fillUniform(x.data(), x.size(), -1.0f, 1.0f);
+    std::vector<float> params(40);
+    std::vector<float> grads(params.size(), 0.0f);
+    NNRandom(5, 1).fillUniform(params.data(), params.size(), -1.0f, 1.0f);
+    std::vector<float> runningMean(4, 0.0f);
+    std::vector<float> runningVar(4, 1.0f);
+    float* p = params.data();
+    float* g = grads.data();
+
+    NNGraph graph;
+    const NNGraph::Value input = graph.input(3);
+    const NNGraph::Value w1 = graph.parameter(4, 3, p, g);
+    const NNGraph::Value gamma = graph.parameter(4, 1, p + 12, g + 12);
+    const NNGraph::Value beta = graph.parameter(4, 1, p + 16, g + 16);
+    const NNGraph::Value w2 = graph.parameter(4, 4, p + 20, g + 20);
+    const NNGraph::Value b2 = graph.parameter(4, 1, p + 36, g + 36);
+    const NNGraph::Value h = graph.tanh(graph.batchNorm(graph.matmul(w1, input), gamma, beta,
+                                                        runningMean.data(), runningVar.data()));
+    graph.compile(graph.crossEntropy(graph.softmax(graph.addBias(graph.matmul(w2, h), b2))));
+
+    runGraphLoss(graph, input, x, labels);
+    graph.backward();
+    const float eps = 1e-3f;
+    for (size_t i = 0; i < params.size(); i++) {
+        const float saved = params[i];
+        params[i] = saved + eps;
+        const float up = runGraphLoss(graph, input, x, labels);
+        params[i] = saved - eps;
+        const float down = runGraphLoss(graph, input, x, labels);
+        params[i] = saved;
+        ASSERT_NEAR((up - down) / (2.0f * eps), grads[i], 2e-3f) << "parameter " << i;
+    }
+
+    // Outside training the running statistics normalize instead: with a zero mean and unit
+    // variance, the batch norm only scales by gamma / sqrt(1 + eps) and shifts by beta.
+    std::fill(runningMean.begin(), runningMean.end(), 0.0f);
+    std::fill(runningVar.begin(), runningVar.end(), 1.0f);
+    graph.setTraining(false);
+    const float evalLoss = runGraphLoss(graph, input, x, labels);
+    EXPECT_EQ(0.0f, runningMean[0]);
+    EXPECT_EQ(1.0f, runningVar[0]);
+    std::vector<float> folded = params;
+    for (int r = 0; r < 4; r++) {
+        const float scale = params[12 + r] / std::sqrt(1.0f + NNGraph::BATCH_NORM_EPSILON);
+        for (int c = 0; c < 3; c++) {
+            folded[r * 3 + c] = params[r * 3 + c] * scale;
+        }
+    }
+    NNGraph plain;
+    const NNGraph::Value plainInput = plain.input(3);
+    const NNGraph::Value pw1 = plain.parameter(4, 3, folded.data(), nullptr);
+    const NNGraph::Value pb1 = plain.parameter(4, 1, folded.data() + 16, nullptr);
+    const NNGraph::Value pw2 = plain.parameter(4, 4, folded.data() + 20, nullptr);
+    const NNGraph::Value pb2 = plain.parameter(4, 1, folded.data() + 36, nullptr);
+    const NNGraph::Value ph = plain.tanh(plain.addBias(plain.matmul(pw1, plainInput), pb1));
+    plain.compile(plain.crossEntropy(plain.softmax(plain.addBias(plain.matmul(pw2, ph), pb2))));
+    EXPECT_NEAR(evalLoss, runGraphLoss(plain, plainInput, x, labels), 1e-5f);
+}
+
+TEST(NNGraphTest, DropoutGradientsMatchFiniteDifferences) {
+    // dropout(relu(W1 x + b1)) into a dense layer and softmax cross-entropy. 44 parameters.
+    const std::vector<int> labels = {1, 3, 0, 2, 2, 1};
+    const int batch = static_cast<int>(labels.size());
+    std::vector<float> x(3 * labels.size());
+    NNRandom(9, 0).fillUniform(x.data(), x.size(), -1.0f, 1.0f);
+    NNBitMask mask;
+    mask.sample(NNRandom(9, 2), 0, 5 * labels.size(), 0.5f);
+
+    for (bool fuse : {false, true}) {
+        std::vector<float> params(44);
+        std::vector<float> grads(params.size(), 0.0f);
+        NNRandom(9, 1).fillUniform(params.data(), params.size(), -1.0f, 1.0f);
+        float* p = params.data();
+        float* g = grads.data();
+        NNGraph graph;
+        const NNGraph::Value input = graph.input(3);
+        const NNGraph::Value w1 = graph.parameter(5, 3, p, g);
+        const NNGraph::Value b1 = graph.parameter(5, 1, p + 15, g + 15);
+        const NNGraph::Value w2 = graph.parameter(4, 5, p + 20, g + 20);
+        const NNGraph::Value b2 = graph.parameter(4, 1, p + 40, g + 40);
+        const NNGraph::Value h =
+            graph.dropout(graph.relu(graph.addBias(graph.matmul(w1, input), b1)), &mask, 2.0f);
+        graph.compile(graph.crossEntropy(graph.softmax(graph.addBias(graph.matmul(w2, h), b2))),
+                      {h}, fuse);
+        EXPECT_EQ(fuse, graph.describe().find("elementwise(bias,relu,dropout)") !=
+                            std::string::npos);
+
+        runGraphLoss(graph, input, x, labels);
+        const std::vector<float> dropped(graph.value(h).data(),
+                                         graph.value(h).data() + 5 * batch);
+        graph.backward();
+        const float eps = 1e-3f;
+        for (size_t i = 0; i < params.size(); i++) {
+            const float saved = params[i];
+            params[i] = saved + eps;
+            const float up = runGraphLoss(graph, input, x, labels);
+            params[i] = saved - eps;
+            const float down = runGraphLoss(graph, input, x, labels);
+            params[i] = saved;
+            ASSERT_NEAR((up - down) / (2.0f * eps), grads[i], 2e-3f) << "parameter " << i;
+        }
+
+        // Evaluation keeps every unit unscaled.
+        graph.setTraining(false);
+        runGraphLoss(graph, input, x, labels);
+        for (int i = 0; i < 5 * batch; i++) {
+            ASSERT_FLOAT_EQ(mask.test(i) ? 2.0f * graph.value(h).data()[i] : 0.0f, dropped[i]);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../include/NNInferenceServer.h"
+#include "../include/NeuralNetwork.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+int connectUnix(const std::string& path) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool readFully(int fd, char* buf, size_t bytes) {
+    while (bytes > 0) {
+        const ssize_t got = recv(fd, buf, bytes, 0);
+        if (got <= 0) {
+            return false;
+        }
+        buf += got;
+        bytes -= static_cast<size_t>(got);
+    }
+    return true;
+}
+} // namespace
+
+TEST(NNInferenceServerTest, BatchedRepliesMatchSingleSampleInference) {
+    const int inputSize = 6;
+    const int requests = 10;
+    NeuralNetwork nn({inputSize, 5, 3}, 21);
+    std::vector<std::vector<uint8_t>> images(requests, std::vector<uint8_t>(inputSize));
+    for (int n = 0; n < requests; n++) {
+        for (int i = 0; i < inputSize; i++) {
+            images[n][i] = static_cast<uint8_t>((n * 37 + i * 91) % 256);
+        }
+    }
+
+    // Expected classes from one-sample batches, before the server owns the network.
+    std::vector<int> expected;
+    for (const auto& image : images) {
+        NNMatrix& input = nn.beginInference(1);
+        for (int i = 0; i < inputSize; i++) {
+            input.set(i, 0, image[i] / 255.0f);
+        }
+        expected.push_back(nn.runInference().getIndexOfColMax(0));
+    }
+
+    NNInferenceServer::Options options;
+    options.socketPath = "nn_serve_test.sock";
+    options.maxBatch = 4;
+    options.maxDelayUs = 2000;
+    NNInferenceServer server(nn, inputSize, options);
+    server.start();
+
+    // Two connections, the first request split across writes to exercise partial reads.
+    const int fds[2] = {connectUnix(options.socketPath), connectUnix(options.socketPath)};
+    ASSERT_GE(fds[0], 0);
+    ASSERT_GE(fds[1], 0);
+    for (int n = 0; n < requests; n++) {
+        const int fd = fds[n % 2];
+        if (n == 0) {
+            ASSERT_EQ(2, send(fd, images[n].data(), 2, 0));
+            ASSERT_EQ(inputSize - 2, send(fd, images[n].data() + 2, inputSize - 2, 0));
+        } else {
+            ASSERT_EQ(inputSize, send(fd, images[n].data(), inputSize, 0));
+        }
+    }
+    for (int n = 0; n < requests; n++) {
+        char reply[NNInferenceServer::REPLY_BYTES];
+        ASSERT_TRUE(readFully(fds[n % 2], reply, sizeof(reply)));
+        int32_t label = 0;
+        float probability = 0.0f;
+        std::memcpy(&label, reply, sizeof(label));
+        std::memcpy(&probability, reply + sizeof(label), sizeof(probability));
+        EXPECT_EQ(expected[n], label);
+        EXPECT_GT(probability, 1.0f / 3.0f - 1e-6f);
+        EXPECT_LE(probability, 1.0f);
+    }
+
+    // Stats are recorded just after the last reply went out.
+    NNServeStats stats = server.getStats();
+    for (int wait = 0; wait < 1000 && stats.requests < requests; wait++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        stats = server.getStats();
+    }
+    EXPECT_EQ(static_cast<uint64_t>(requests), stats.requests);
+    EXPECT_LE(stats.meanBatch, 4.0);
+    EXPECT_GT(stats.p50Us, 0.0f);
+    EXPECT_LE(stats.p50Us, stats.p999Us);
+    close(fds[0]);
+    close(fds[1]);
+    server.stop();
+}
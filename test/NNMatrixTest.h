@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../include/NNMatrix.h"
+#include "../include/NNUtils.h"
 
 #include "gtest/gtest.h"
 #include <functional>
@@ -84,3 +85,141 @@ TEST(NNMatrixTest, MaxElementTest) {
     ASSERT_EQ(2, matrix.getIndexOfColMax(0));
     ASSERT_FLOAT_EQ(100.0f, matrix.getColMax(0));
 }
+
+TEST(NNMatrixTest, RebindWritesThrough) {
+    std::vector<float> storage(4, 0.0f);
+    NNMatrix matrix(2, 2, 3.0f);
+    matrix.rebind(storage.data());
+    ASSERT_TRUE(matrix.isView());
+    ASSERT_FLOAT_EQ(3.0f, storage[3]);
+
+    matrix.set(0, 1, 5.0f);
+    ASSERT_FLOAT_EQ(5.0f, storage[1]);
+
+    // Assigning to a view keeps the view and copies into its storage.
+    matrix = NNMatrix(2, 2, 7.0f);
+    ASSERT_TRUE(matrix.isView());
+    ASSERT_FLOAT_EQ(7.0f, storage[0]);
+
+    // Copies of a view own their memory.
+    NNMatrix copy(matrix);
+    ASSERT_FALSE(copy.isView());
+    copy.set(0, 0, 1.0f);
+    ASSERT_FLOAT_EQ(7.0f, storage[0]);
+}
+
+TEST(NNMatrixTest, SparseDotProductMatchesDense) {
+    // Two (4 x 1) samples with a few non-zeros, packed densely and sparsely.
+    std::vector<NNMatrixPtr> samples = {std::make_shared<NNMatrix>(4, 1, 0.0f),
+                                        std::make_shared<NNMatrix>(4, 1, 0.0f)};
+    samples[0]->set(1, 0, 2.0f);
+    samples[1]->set(0, 0, -1.0f);
+    samples[1]->set(3, 0, 0.5f);
+    for (auto& sample : samples) {
+        sample->buildNonZeroIndex();
+        ASSERT_NE(nullptr, sample->getNonZeroIndex());
+    }
+    NNMatrix dense(1, 1);
+    NNUtils::packColumns(samples, dense);
+    NNSparseColumns sparse;
+    ASSERT_TRUE(NNUtils::packSparseColumns(samples, sparse));
+    ASSERT_FLOAT_EQ(3.0f / 8.0f, sparse.density());
+
+    NNMatrix weight(3, 4);
+    NNMatrix dz(3, 2);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            weight.set(i, j, static_cast<float>(i * 4 + j) - 5.0f);
+        }
+        dz.set(i, 0, static_cast<float>(i) + 1.0f);
+        dz.set(i, 1, i == 1 ? 0.0f : -2.0f);
+    }
+
+    NNMatrix expectedOut(3, 2, 0.0f);
+    expectedOut.addDotProduct(weight, dense);
+    NNMatrix out(3, 2, 0.0f);
+    out.addDotProduct(weight, sparse);
+    NNMatrix expectedGrad(3, 4, 0.0f);
+    expectedGrad.addDotProduct(dz, dense.transpose());
+    NNMatrix grad(3, 4, 0.0f);
+    grad.addDotProductTransposed(dz, sparse);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 2; j++) {
+            ASSERT_FLOAT_EQ(expectedOut.get(i, j), out.get(i, j));
+        }
+        for (int j = 0; j < 4; j++) {
+            ASSERT_FLOAT_EQ(expectedGrad.get(i, j), grad.get(i, j));
+        }
+    }
+
+    // Any write invalidates the index.
+    samples[0]->set(0, 0, 1.0f);
+    ASSERT_EQ(nullptr, samples[0]->getNonZeroIndex());
+    ASSERT_FALSE(NNUtils::packSparseColumns(samples, sparse));
+}
+
+TEST(NNMatrixTest, DotProductMatchesNaive) {
+    // Both kernels block over the inner dimension: kDim = 7 gives one four-row block of B (and
+    // of aT in the transposed case) plus three remainder rows.
+    const int m = 5;
+    const int kDim = 7;
+    const int n = 3;
+    NNMatrix a(m, kDim);
+    NNMatrix aT(kDim, m);
+    NNMatrix b(kDim, n);
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < kDim; j++) {
+            a.set(i, j, static_cast<float>((i * 7 + j * 3) % 11) - 5.0f);
+            aT.set(j, i, a.get(i, j));
+        }
+    }
+    for (int j = 0; j < kDim; j++) {
+        for (int kk = 0; kk < n; kk++) {
+            b.set(j, kk, 0.25f * static_cast<float>((j * 5 + kk) % 9) - 1.0f);
+        }
+    }
+
+    NNMatrix out(m, n, 1.0f);
+    out.addDotProduct(a, b);
+    NNMatrix outT(m, n, 1.0f);
+    outT.addDotProduct(aT, b, true);
+    for (int i = 0; i < m; i++) {
+        for (int kk = 0; kk < n; kk++) {
+            float expected = 1.0f;
+            for (int j = 0; j < kDim; j++) {
+                expected += a.get(i, j) * b.get(j, kk);
+            }
+            ASSERT_NEAR(expected, out.get(i, kk), 1e-4f);
+            ASSERT_NEAR(expected, outT.get(i, kk), 1e-4f);
+        }
+    }
+}
+
+TEST(NNMatrixTest, DotProductTransposedMatchesNaive) {
+    // 19 columns cover the eight-wide partial sums and their tail, 6 rows of b the remainder.
+    const int m = 3;
+    const int n = 6;
+    const int kDim = 19;
+    NNMatrix a(m, kDim);
+    NNMatrix b(n, kDim);
+    for (int j = 0; j < kDim; j++) {
+        for (int i = 0; i < m; i++) {
+            a.set(i, j, static_cast<float>((i * 5 + j * 3) % 7) - 3.0f);
+        }
+        for (int i = 0; i < n; i++) {
+            b.set(i, j, 0.5f * static_cast<float>((i * 3 + j) % 5) - 1.0f);
+        }
+    }
+
+    NNMatrix out(m, n, 2.0f);
+    out.addDotProductTransposed(a, b);
+    for (int i = 0; i < m; i++) {
+        for (int r = 0; r < n; r++) {
+            float expected = 2.0f;
+            for (int j = 0; j < kDim; j++) {
+                expected += a.get(i, j) * b.get(r, j);
+            }
+            ASSERT_NEAR(expected, out.get(i, r), 1e-4f);
+        }
+    }
+}
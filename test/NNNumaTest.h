@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../include/NNNuma.h"
+
+#include "gtest/gtest.h"
+#include <thread>
+
+TEST(NNNumaTest, ParsesCpuLists) {
+    EXPECT_EQ(NNNuma::parseCpuList("0-3,8,10-11"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(NNNuma::parseCpuList("5"), (std::vector<int>{5}));
+    EXPECT_TRUE(NNNuma::parseCpuList("").empty());
+
+    NNPinPolicy policy = NNPinPolicy::None;
+    EXPECT_TRUE(NNNuma::parsePinPolicy("scatter", policy));
+    EXPECT_EQ(policy, NNPinPolicy::Scatter);
+    EXPECT_FALSE(NNNuma::parsePinPolicy("everywhere", policy));
+    EXPECT_EQ(policy, NNPinPolicy::Scatter);
+}
+
+TEST(NNNumaTest, PinPoliciesSpreadWorkers) {
+    // Two nodes of four CPUs, plus a memory-only node without CPUs.
+    const NNNuma numa({{0, 1, 2, 3}, {4, 5, 6, 7}, {}});
+    EXPECT_EQ(numa.getNodeCount(), 3);
+    EXPECT_EQ(numa.nodeOfCpu(6), 1);
+    EXPECT_EQ(numa.cpuFor(0, NNPinPolicy::None), -1);
+
+    std::vector<int> compact;
+    std::vector<int> scatter;
+    for (int worker = 0; worker < 10; worker++) {
+        compact.push_back(numa.cpuFor(worker, NNPinPolicy::Compact));
+        scatter.push_back(numa.cpuFor(worker, NNPinPolicy::Scatter));
+    }
+    EXPECT_EQ(compact, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 0, 1}));
+    EXPECT_EQ(scatter, (std::vector<int>{0, 4, 1, 5, 2, 6, 3, 7, 0, 4}));
+}
+
+TEST(NNNumaTest, PlacesWorkersOnThisHost) {
+    const NNNuma& numa = NNNuma::system();
+    ASSERT_GE(numa.getNodeCount(), 1);
+    EXPECT_EQ(numa.readNodeStats().size(), static_cast<size_t>(numa.getNodeCount()));
+
+    // Pin a separate thread so the test runner's own affinity is untouched.
+    int node = -2;
+    std::thread worker([&] { node = numa.placeWorker(0, NNPinPolicy::Compact); });
+    worker.join();
+#ifdef __linux__
+    EXPECT_EQ(node, numa.nodeOfCpu(numa.cpuFor(0, NNPinPolicy::Compact)));
+#else
+    EXPECT_EQ(node, -1);
+#endif
+}
+
+TEST(NNNumaTest, LocalCopyIsDeep) {
+    auto sample = std::make_shared<NNMatrix>(4, 1);
+    sample->set(2, 0, 0.5f);
+    sample->buildNonZeroIndex();
+    const auto copies = NNNuma::localCopy({sample});
+    ASSERT_EQ(copies.size(), 1u);
+    const NNMatrix& copy = *copies[0];
+    EXPECT_NE(copy.data(), static_cast<const NNMatrix&>(*sample).data());
+    EXPECT_FLOAT_EQ(copy.get(2, 0), 0.5f);
+    ASSERT_NE(copy.getNonZeroIndex(), nullptr);
+    EXPECT_EQ(*copy.getNonZeroIndex(), std::vector<int>{2});
+}
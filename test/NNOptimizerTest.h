@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../include/NNOptimizer.h"
+
+#include "gtest/gtest.h"
+#include <cmath>
+#include <vector>
+
+TEST(NNOptimizerTest, SGDMomentumMatchesReference) {
+    NNSGDOptimizer optimizer(0.9f);
+    std::vector<float> param{1.0f, -2.0f};
+    std::vector<float> grad{0.5f, 1.0f};
+    std::vector<float> velocity{0.1f, 0.0f};
+    float* state[] = {velocity.data()};
+
+    optimizer.nextStep();
+    optimizer.update(param.data(), grad.data(), state, param.size(), 0.1f, true);
+
+    // v = 0.9 * v + lr * g; w -= v
+    EXPECT_FLOAT_EQ(0.14f, velocity[0]);
+    EXPECT_FLOAT_EQ(0.86f, param[0]);
+    EXPECT_FLOAT_EQ(0.1f, velocity[1]);
+    EXPECT_FLOAT_EQ(-2.1f, param[1]);
+}
+
+TEST(NNOptimizerTest, AdamFirstStepMovesByLearningRate) {
+    NNAdamOptimizer optimizer;
+    std::vector<float> param{1.0f, 1.0f};
+    std::vector<float> grad{0.25f, -4.0f};
+    std::vector<float> m(2, 0.0f);
+    std::vector<float> v(2, 0.0f);
+    float* state[] = {m.data(), v.data()};
+
+    optimizer.nextStep();
+    optimizer.update(param.data(), grad.data(), state, param.size(), 0.01f, true);
+
+    // With bias correction the first step is lr * sign(g), independent of |g|.
+    EXPECT_NEAR(0.99f, param[0], 1e-5f);
+    EXPECT_NEAR(1.01f, param[1], 1e-5f);
+}
+
+TEST(NNOptimizerTest, AdamWDecaysWeightsButNotBiases) {
+    NNAdamOptimizer optimizer(0.9f, 0.999f, 1e-8f, 0.1f, true);
+    std::vector<float> weight{2.0f};
+    std::vector<float> bias{2.0f};
+    std::vector<float> zeroGrad{0.0f};
+    std::vector<float> wm(1, 0.0f), wv(1, 0.0f), bm(1, 0.0f), bv(1, 0.0f);
+    float* weightState[] = {wm.data(), wv.data()};
+    float* biasState[] = {bm.data(), bv.data()};
+
+    optimizer.nextStep();
+    optimizer.update(weight.data(), zeroGrad.data(), weightState, 1, 0.5f, true);
+    optimizer.update(bias.data(), zeroGrad.data(), biasState, 1, 0.5f, false);
+
+    EXPECT_FLOAT_EQ(2.0f * (1.0f - 0.5f * 0.1f), weight[0]);
+    EXPECT_FLOAT_EQ(2.0f, bias[0]);
+}
+
+TEST(NNOptimizerTest, RMSPropNormalizesGradient) {
+    NNRMSPropOptimizer optimizer(0.0f, 0.0f);
+    std::vector<float> param{0.0f};
+    std::vector<float> grad{-8.0f};
+    std::vector<float> s(1, 0.0f);
+    float* state[] = {s.data()};
+
+    optimizer.nextStep();
+    optimizer.update(param.data(), grad.data(), state, 1, 0.1f, true);
+
+    EXPECT_FLOAT_EQ(64.0f, s[0]);
+    EXPECT_FLOAT_EQ(0.1f, param[0]);
+}
+
+TEST(NNOptimizerTest, LearningRateSchedules) {
+    NNStepSchedule step(1.0f, 10, 0.5f);
+    EXPECT_FLOAT_EQ(1.0f, step.rate(9));
+    EXPECT_FLOAT_EQ(0.5f, step.rate(10));
+    EXPECT_FLOAT_EQ(0.25f, step.rate(25));
+
+    NNCosineSchedule cosine(1.0f, 100, 0.1f);
+    EXPECT_FLOAT_EQ(1.0f, cosine.rate(0));
+    EXPECT_NEAR(0.55f, cosine.rate(50), 1e-6f);
+    EXPECT_FLOAT_EQ(0.1f, cosine.rate(100));
+    EXPECT_FLOAT_EQ(0.1f, cosine.rate(1000));
+
+    NNWarmupSchedule warmup(4, std::make_shared<NNConstantSchedule>(2.0f));
+    EXPECT_FLOAT_EQ(0.5f, warmup.rate(0));
+    EXPECT_FLOAT_EQ(2.0f, warmup.rate(3));
+    EXPECT_FLOAT_EQ(2.0f, warmup.rate(4));
+}
+
+TEST(NNOptimizerTest, LARSScalesByTrustRatio) {
+    NNLARSOptimizer optimizer(0.0f, 0.0f, 0.5f);
+    std::vector<float> param{3.0f, 4.0f};
+    std::vector<float> grad{0.0f, 10.0f};
+    std::vector<float> velocity(2, 0.0f);
+    float* state[] = {velocity.data()};
+
+    optimizer.nextStep();
+    optimizer.update(param.data(), grad.data(), state, param.size(), 1.0f, true);
+
+    // ||w|| = 5, ||g|| = 10, local lr = 0.5 * 5 / 10 = 0.25
+    EXPECT_FLOAT_EQ(3.0f, param[0]);
+    EXPECT_FLOAT_EQ(1.5f, param[1]);
+}
+
+TEST(NNOptimizerTest, LAMBStepIsProportionalToWeightNorm) {
+    NNLAMBOptimizer optimizer(0.9f, 0.999f, 0.0f);
+    std::vector<float> param{6.0f, 8.0f};
+    std::vector<float> grad{1.0f, -1.0f};
+    std::vector<float> m(2, 0.0f), v(2, 0.0f);
+    float* state[] = {m.data(), v.data()};
+
+    optimizer.nextStep();
+    optimizer.update(param.data(), grad.data(), state, param.size(), 0.1f, true);
+
+    // First Adam direction is sign(g) with norm sqrt(2); trust ratio 10 / sqrt(2), so each
+    // element moves by lr * 10 / sqrt(2).
+    const float delta = 0.1f * 10.0f / std::sqrt(2.0f);
+    EXPECT_NEAR(6.0f - delta, param[0], 1e-5f);
+    EXPECT_NEAR(8.0f + delta, param[1], 1e-5f);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../include/NNParameterArena.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+
+TEST(NNParameterArenaTest, SegmentsAreAlignedAndDecayedFirst) {
+    NNParameterArena arena;
+    int bias = arena.reserve(3, false);
+    int weight = arena.reserve(10, true);
+    arena.allocate();
+
+    ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(arena.param(weight)) %
+                      NNParameterArena::ALIGNMENT);
+    ASSERT_EQ(0u,
+              reinterpret_cast<std::uintptr_t>(arena.grad(bias)) % NNParameterArena::ALIGNMENT);
+    ASSERT_EQ(arena.params(), arena.param(weight));
+    ASSERT_EQ(32u, arena.size());
+    ASSERT_FLOAT_EQ(0.0f, arena.param(bias)[2]);
+}
+
+TEST(NNParameterArenaTest, StepUpdatesAllSegments) {
+    NNParameterArena arena;
+    int weight = arena.reserve(4, true);
+    int bias = arena.reserve(2, false);
+    arena.allocate();
+
+    for (int i = 0; i < 4; i++) {
+        arena.param(weight)[i] = 1.0f;
+        arena.grad(weight)[i] = 1.0f;
+    }
+    arena.param(bias)[0] = 1.0f;
+    arena.grad(bias)[0] = 2.0f;
+
+    NNSGDOptimizer optimizer(0.5f, false, 1.0f);
+    optimizer.nextStep();
+    arena.step(optimizer, 0.1f);
+
+    ASSERT_EQ(1, arena.stateSize());
+    // weight: lr * (g + wd * w) = 0.2, bias has no decay: lr * g = 0.2
+    ASSERT_FLOAT_EQ(0.8f, arena.param(weight)[3]);
+    ASSERT_FLOAT_EQ(0.8f, arena.param(bias)[0]);
+    ASSERT_FLOAT_EQ(0.0f, arena.param(bias)[1]);
+
+    arena.zeroGrad();
+    ASSERT_FLOAT_EQ(0.0f, arena.grad(weight)[0]);
+    ASSERT_FLOAT_EQ(0.0f, arena.grad(bias)[0]);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../include/NNPerfCounters.h"
+#include "NeuralNetworkTest.h"
+
+#include "gtest/gtest.h"
+
+TEST(NNPerfCountersTest, KernelsReportToActiveCounters) {
+    NNPerfCounters counters;
+    NNMatrix a(3, 4, 1.0f);
+    NNMatrix b(4, 5, 1.0f);
+    NNMatrix c(3, 5);
+    c.addDotProduct(a, b);
+    EXPECT_EQ(counters.getCalls("gemm"), 0u);
+    {
+        NNPerfCounters::Activation activation(&counters);
+        NNPerfScope outer("outer", 1.0);
+        c.addDotProduct(a, b);
+        c.addDotProduct(a, b);
+    }
+    EXPECT_EQ(counters.getCalls("gemm"), 2u);
+    EXPECT_DOUBLE_EQ(counters.getFlops("gemm"), 2 * 2.0 * 3 * 4 * 5);
+    EXPECT_EQ(counters.getCalls("outer"), 1u);
+    EXPECT_DOUBLE_EQ(counters.getFlops("outer"), 1.0);
+    EXPECT_EQ(NNPerfCounters::current(), nullptr);
+
+    // Scopes outside the activation are not counted.
+    c.addDotProduct(a, b);
+    EXPECT_EQ(counters.getCalls("gemm"), 2u);
+    counters.setPeakGflops(1.0);
+    counters.report("test");
+    EXPECT_EQ(counters.getCalls("gemm"), 0u);
+}
+
+TEST(NNPerfCountersTest, TrainingWithCountersIsUnchanged) {
+    // train() shuffles its data in place, so each network gets its own copy.
+    std::vector<NNMatrixPtr> X, Y, plainX, plainY;
+    makeToyDataset(16, X, Y);
+    makeToyDataset(16, plainX, plainY);
+    NeuralNetwork plain({4, 6, 5, 3}, 7);
+    NeuralNetwork counted({4, 6, 5, 3}, 7);
+    auto counters = std::make_shared<NNPerfCounters>();
+    counters->setPeakGflops(1.0);
+    counted.setPerfCounters(counters);
+    plain.train(plainX, plainY, plainX, plainY, 2, 4, 0.1f, 0.9f);
+    uint64_t forwards = 0;
+    uint64_t backwards = 0;
+    counted.train(X, Y, X, Y, 2, 4, 0.1f, 0.9f, nullptr,
+                  [&](int, int, int layer, NeuralNetwork::LayerPhase phase) {
+                      if (layer < 0 && phase == NeuralNetwork::LayerPhase::Idle) {
+                          forwards = counters->getCalls("layer2.forward");
+                          backwards = counters->getCalls("layer0.backward");
+                      }
+                  });
+    // Four batches per epoch, counted until the end-of-epoch report.
+    EXPECT_EQ(forwards, 4u);
+    EXPECT_EQ(backwards, 4u);
+
+    auto& a = plain.getParameters();
+    auto& b = counted.getParameters();
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_EQ(a.params()[i], b.params()[i]);
+    }
+    // Every epoch's totals were reported and cleared.
+    EXPECT_EQ(counters->getCalls("layer0.forward"), 0u);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../include/NNRandom.h"
+#include "../include/NeuralNetwork.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <vector>
+
+TEST(NNRandomTest, PhiloxKnownAnswers) {
+    // Reference vectors of Philox4x32-10 from the Random123 distribution.
+    auto zero = NNRandom::philox({0, 0, 0, 0}, {0, 0});
+    EXPECT_EQ(0x6627e8d5u, zero[0]);
+    EXPECT_EQ(0x9b00dbd8u, zero[3]);
+    auto pi = NNRandom::philox({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                               {0xa4093822, 0x299f31d0});
+    EXPECT_EQ(0xd16cfe09u, pi[0]);
+    EXPECT_EQ(0x94fdccebu, pi[1]);
+    EXPECT_EQ(0x5001e420u, pi[2]);
+    EXPECT_EQ(0x24126ea1u, pi[3]);
+}
+
+TEST(NNRandomTest, BulkFillIndependentOfThreads) {
+    NNRandom random(42, 7);
+    // Unaligned offset and count exercise the partial blocks at both ends.
+    const size_t count = (1 << 17) + 3;
+    std::vector<uint32_t> single(count), parallel(count);
+    random.fillBits(single.data(), count, 5, 1);
+    random.fillBits(parallel.data(), count, 5, 4);
+    ASSERT_EQ(single, parallel);
+    for (size_t i : {size_t(0), size_t(1), count / 2, count - 1}) {
+        ASSERT_EQ(random.bitsAt(5 + i), single[i]);
+    }
+
+    std::vector<float> uniform(1000);
+    random.fillUniform(uniform.data(), uniform.size(), -2.0f, 3.0f);
+    for (float v : uniform) {
+        ASSERT_GE(v, -2.0f);
+        ASSERT_LT(v, 3.0f);
+    }
+    EXPECT_NE(random.bitsAt(0), random.substream(8).bitsAt(0));
+}
+
+TEST(NNRandomTest, PermutationIsReproducible) {
+    NNRandom random(1, 2);
+    auto perm = random.permutation(1000);
+    ASSERT_EQ(perm, random.permutation(1000));
+    ASSERT_NE(perm, random.substream(3).permutation(1000));
+    std::sort(perm.begin(), perm.end());
+    for (uint32_t i = 0; i < perm.size(); i++) {
+        ASSERT_EQ(i, perm[i]);
+    }
+}
+
+TEST(NNRandomTest, NetworkInitializationFollowsSeed) {
+    NeuralNetwork a({6, 5, 4, 3}, 123);
+    NeuralNetwork b({6, 5, 4, 3}, 123);
+    NeuralNetwork c({6, 5, 4, 3}, 124);
+    auto& pa = a.getParameters();
+    auto& pb = b.getParameters();
+    auto& pc = c.getParameters();
+    ASSERT_TRUE(std::equal(pa.params(), pa.params() + pa.size(), pb.params()));
+    ASSERT_FALSE(std::equal(pa.params(), pa.params() + pa.size(), pc.params()));
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../include/NNSnapshot.h"
+#include "../include/NeuralNetwork.h"
+
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+TEST(NNSnapshotTest, RoundTripAndCorruption) {
+    const std::string path = "nn_snapshot_test.bin";
+    NNSnapshot snapshot;
+    snapshot.config = {3, 2};
+    snapshot.inputShape = {1, 1, 3};
+    snapshot.convSpecs = {2, 1, 1, 0, 1};
+    snapshot.batchNorm = 1;
+    snapshot.seed = 9;
+    snapshot.shuffleCount = 4;
+    snapshot.epoch = 2;
+    snapshot.nextBatch = 17;
+    snapshot.optimizerStep = 51;
+    snapshot.epochLoss = 1.5f;
+    snapshot.stateSize = 1;
+    snapshot.params = {1.0f, -2.0f, 3.0f};
+    snapshot.state = {0.5f, 0.25f, 0.125f};
+    snapshot.write(path);
+
+    NNSnapshot loaded;
+    ASSERT_TRUE(NNSnapshot::read(path, loaded));
+    EXPECT_EQ(snapshot.config, loaded.config);
+    EXPECT_EQ(snapshot.inputShape, loaded.inputShape);
+    EXPECT_EQ(snapshot.convSpecs, loaded.convSpecs);
+    EXPECT_EQ(1, loaded.batchNorm);
+    EXPECT_EQ(4u, loaded.shuffleCount);
+    EXPECT_EQ(17, loaded.nextBatch);
+    EXPECT_EQ(51, loaded.optimizerStep);
+    EXPECT_EQ(snapshot.params, loaded.params);
+    EXPECT_EQ(snapshot.state, loaded.state);
+
+    // Flip one byte of the payload.
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-2, std::ios::end);
+        file.put('\x7f');
+    }
+    EXPECT_FALSE(NNSnapshot::read(path, loaded));
+    EXPECT_FALSE(NNSnapshot::read("missing_snapshot.bin", loaded));
+    std::remove(path.c_str());
+}
+
+TEST(NNSnapshotTest, ResumeMatchesUninterruptedRun) {
+    const std::string path = "nn_resume_test.bin";
+    std::vector<NNMatrixPtr> X, Y;
+    for (int i = 0; i < 24; i++) {
+        auto x = std::make_shared<NNMatrix>(4, 1);
+        for (int k = 0; k < 4; k++) {
+            x->set(k, 0, static_cast<float>((i * 5 + k * 3) % 7) / 7.0f);
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(i % 3, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+    const std::vector<int> config = {4, 8, 6, 3};
+
+    // Uninterrupted: 3 epochs of 6 batches.
+    NeuralNetwork full(config, 5);
+    full.setOptimizer(std::make_shared<NNAdamOptimizer>());
+    auto fullX = X, fullY = Y;
+    full.train(fullX, fullY, X, Y, 3, 4, 0.01f, 0.0f);
+
+    // Pre-empted after 8 batches, i.e. in the middle of the second epoch.
+    {
+        NeuralNetwork interrupted(config, 5);
+        interrupted.setOptimizer(std::make_shared<NNAdamOptimizer>());
+        interrupted.setSnapshots(path, 1);
+        int batches = 0;
+        auto runX = X, runY = Y;
+        interrupted.train(
+            runX, runY, X, Y, 3, 4, 0.01f, 0.0f, nullptr, nullptr, nullptr,
+            [&] { return batches == 8; },
+            [&](int, int, int, int, float, float, float) { batches++; });
+    }
+
+    NeuralNetwork resumed(config, 77);
+    resumed.setOptimizer(std::make_shared<NNAdamOptimizer>());
+    ASSERT_TRUE(resumed.resumeFromSnapshot(path));
+    auto resumedX = X, resumedY = Y;
+    resumed.train(resumedX, resumedY, X, Y, 3, 4, 0.01f, 0.0f);
+
+    auto& a = full.getParameters();
+    auto& b = resumed.getParameters();
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_FLOAT_EQ(a.params()[i], b.params()[i]);
+    }
+    NeuralNetwork other({4, 8, 3});
+    EXPECT_FALSE(other.resumeFromSnapshot(path));
+    std::remove(path.c_str());
+}
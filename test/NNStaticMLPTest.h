@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../include/NNStaticMLP.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+TEST(NNStaticMLPTest, MatchesNetworkForward) {
+    NeuralNetwork network({5, 7, 6, 3});
+    auto model = std::make_unique<NNStaticMLP<5, 7, 6, 3>>(network);
+    ASSERT_EQ(5, model->INPUT_SIZE);
+    ASSERT_EQ(3, model->OUTPUT_SIZE);
+
+    NNMatrix input(5, 1);
+    for (int k = 0; k < 5; k++) {
+        // One zero input exercises the skipped-column path.
+        input.set(k, 0, k == 2 ? 0.0f : 0.3f * static_cast<float>(k) - 0.4f);
+    }
+    NNMatrix expected = input;
+    for (size_t l = 0; l < network.layers.size(); l++) {
+        const bool hidden = l + 1 < network.layers.size();
+        expected = network.layers[l].forward(expected, hidden ? NNFunctions::ReLUFunc : nullptr);
+    }
+
+    const auto logits = model->forward(input.data());
+    int best = 0;
+    for (int c = 0; c < 3; c++) {
+        ASSERT_NEAR(expected.get(c, 0), logits[c], 1e-5f);
+        if (logits[c] > logits[best]) {
+            best = c;
+        }
+    }
+    ASSERT_EQ(best, model->predict(input.data()));
+}
+
+TEST(NNStaticMLPTest, RejectsMismatchedTopology) {
+    NeuralNetwork network({5, 7, 6, 3});
+    using Wrong = NNStaticMLP<5, 8, 6, 3>;
+    using Shallow = NNStaticMLP<5, 7, 3>;
+    EXPECT_THROW(std::make_unique<Wrong>(network), std::runtime_error);
+    EXPECT_THROW(std::make_unique<Shallow>(network), std::runtime_error);
+}
+
+TEST(NNStaticMLPTest, FoldsBatchNormAndRejectsConvStages) {
+    std::vector<NNMatrixPtr> X, Y;
+    for (int i = 0; i < 12; i++) {
+        auto x = std::make_shared<NNMatrix>(5, 1);
+        for (int k = 0; k < 5; k++) {
+            x->set(k, 0, static_cast<float>((i * 7 + k * 3) % 5) / 5.0f);
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(i % 3, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+    // Training moves the running statistics away from zero mean and unit variance.
+    NeuralNetwork network({}, {}, {5, 7, 6, 3}, NNRandom::globalSeed(), true);
+    network.train(X, Y, X, Y, 3, 4, 0.05f, 0.9f);
+    auto model = std::make_unique<NNStaticMLP<5, 7, 6, 3>>(network);
+    for (const NNMatrixPtr& x : X) {
+        std::copy_n(x->data(), 5, network.beginInference(1).data());
+        const NNMatrix& expected = network.runInference();
+        const auto logits = model->forward(x->data());
+        for (int c = 0; c < 3; c++) {
+            ASSERT_NEAR(expected.get(c, 0), logits[c], 1e-4f);
+        }
+    }
+
+    // Its dense layers alone would fit: 2 channels of 3x3 into 6 units, then 3.
+    NeuralNetwork conv({1, 3, 3}, {{2, 3, 1, 1, 1}}, {9, 6, 3});
+    using Dense = NNStaticMLP<18, 6, 3>;
+    EXPECT_THROW(std::make_unique<Dense>(conv), std::runtime_error);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../include/NNSweep.h"
+
+#include "gtest/gtest.h"
+#include <vector>
+
+// Three classes, the label is the largest of the first three features.
+static void makeArgmaxDataset(int count, std::vector<NNMatrixPtr>& X,
+                              std::vector<NNMatrixPtr>& Y) {
+    for (int i = 0; i < count; i++) {
+        auto x = std::make_shared<NNMatrix>(4, 1);
+        for (int k = 0; k < 4; k++) {
+            x->set(k, 0, static_cast<float>((i * 37 + k * 11 + i * k * 5) % 17) / 17.0f);
+        }
+        int label = 0;
+        for (int k = 1; k < 3; k++) {
+            label = x->get(k, 0) > x->get(label, 0) ? k : label;
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(label, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+}
+
+TEST(NNSweepTest, SuccessiveHalvingStopsWeakTrials) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeArgmaxDataset(120, X, Y);
+    const std::vector<NNMatrixPtr> originalOrder = X;
+
+    NNSweep::Options options;
+    options.threads = 2;
+    options.minEpochs = 2;
+    options.maxEpochs = 8;
+    // A learning rate of 0 never improves on the initialization, so it must not survive.
+    auto trials = NNSweep::grid({{16}, {8}}, {0.0f, 0.1f}, {0.9f}, {8});
+    NNSweep sweep(X, Y, X, Y, options);
+    const auto results = sweep.run(trials);
+
+    ASSERT_EQ(4u, results.size());
+    // 4 trials for 2 epochs, 2 to 4 epochs, 1 to 8 epochs.
+    EXPECT_EQ(8, results[0].epochs);
+    EXPECT_TRUE(results[0].finished);
+    EXPECT_EQ(4, results[1].epochs);
+    EXPECT_EQ(2, results[2].epochs);
+    EXPECT_EQ(2, results[3].epochs);
+    EXPECT_FALSE(results[3].finished);
+    EXPECT_GT(results[0].config.learningRate, 0.0f);
+    EXPECT_GT(results[1].config.learningRate, 0.0f);
+    EXPECT_GT(results[0].accuracy, 0.6f);
+    EXPECT_NE(results[0].seed, results[1].seed);
+    ASSERT_NE(nullptr, sweep.getBest());
+    // Trials shuffle their own copies of the sample order.
+    EXPECT_EQ(originalOrder, X);
+}
@@ -1,5 +1,23 @@
+#include "NNActivationPlannerTest.h"
+#include "NNAllocatorTest.h"
+#include "NNAugmentTest.h"
+#include "NNBatchScorerTest.h"
+#include "NNCommunicatorTest.h"
+#include "NNFunctionsTest.h"
+#include "NNGraphTest.h"
+#include "NNInferenceServerTest.h"
 #include "NNMatrixTest.h"
+#include "NNNumaTest.h"
+#include "NNOptimizerTest.h"
+#include "NNParameterArenaTest.h"
+#include "NNPerfCountersTest.h"
+#include "NNRandomTest.h"
+#include "NNSnapshotTest.h"
+#include "NNStaticMLPTest.h"
+#include "NNSweepTest.h"
 #include "NNUtilsTest.h"
+#include "NNVectorMathTest.h"
+#include "NeuralNetworkTest.h"
 
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
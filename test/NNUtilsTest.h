@@ -101,6 +101,25 @@ TEST(NNUtilsTest, ShuffleKeepsPairs) {
     }
 }
 
+TEST(NNUtilsTest, ShuffleKeepsLabelIndicesWithPairs) {
+    std::vector<NNMatrixPtr> inputs;
+    std::vector<NNMatrixPtr> labels;
+    std::vector<int> indices;
+    for (int i = 0; i < 10; i++) {
+        inputs.push_back(makeScalarMatrix(static_cast<float>(i)));
+        labels.push_back(makeScalarMatrix(static_cast<float>(i)));
+        indices.push_back(i);
+    }
+
+    NNUtils::shuffle(inputs, labels, indices, NNRandom(7, 0));
+
+    ASSERT_EQ(inputs.size(), indices.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        ASSERT_FLOAT_EQ(inputs[i]->get(0, 0), labels[i]->get(0, 0));
+        ASSERT_FLOAT_EQ(inputs[i]->get(0, 0), static_cast<float>(indices[i]));
+    }
+}
+
 TEST(NNUtilsTest, ShuffleEmptyVectors) {
     std::vector<NNMatrixPtr> inputs;
     std::vector<NNMatrixPtr> labels;
@@ -247,3 +266,30 @@ TEST(NNUtilsTest, ReadMnistLabelsMissingFile) {
     std::filesystem::remove(tempPath);
     EXPECT_THROW(NNUtils::read_mnist_labels(tempPath.string()), std::runtime_error);
 }
+
+TEST(NNUtilsTest, ShardInterleavesAndEqualizes) {
+    std::vector<NNMatrixPtr> data;
+    for (int i = 0; i < 7; i++) {
+        data.push_back(makeScalarMatrix(static_cast<float>(i)));
+    }
+
+    auto shard0 = NNUtils::shard(data, 0, 3);
+    auto shard2 = NNUtils::shard(data, 2, 3);
+    ASSERT_EQ(2u, shard0.size());
+    ASSERT_EQ(2u, shard2.size());
+    ASSERT_FLOAT_EQ(3.0f, shard0[1]->get(0, 0));
+    ASSERT_FLOAT_EQ(5.0f, shard2[1]->get(0, 0));
+}
+
+TEST(NNUtilsTest, PercentileIsNearestRank) {
+    std::vector<float> values;
+    for (int i = 100; i >= 1; i--) {
+        values.push_back(static_cast<float>(i));
+    }
+    ASSERT_FLOAT_EQ(50.0f, NNUtils::percentile(values, 0.5));
+    ASSERT_FLOAT_EQ(99.0f, NNUtils::percentile(values, 0.99));
+    ASSERT_FLOAT_EQ(100.0f, NNUtils::percentile(values, 0.999));
+    ASSERT_FLOAT_EQ(1.0f, NNUtils::percentile(values, 0.0));
+    std::vector<float> empty;
+    ASSERT_FLOAT_EQ(0.0f, NNUtils::percentile(empty, 0.5));
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../include/NNVectorMath.h"
+
+#include "gtest/gtest.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace {
+// Distance of y from a double-precision reference in units of the float spacing at the
+// reference, 2^-149 for denormals. Results that round to infinity must match exactly.
+double ulpError(float y, double reference) {
+    if (std::isnan(reference)) {
+        return std::isnan(y) ? 0.0 : 1e9;
+    }
+    const float rounded = static_cast<float>(reference);
+    if (std::isinf(rounded)) {
+        return y == rounded ? 0.0 : 1e9;
+    }
+    const float magnitude = std::fabs(rounded);
+    const float inf = std::numeric_limits<float>::infinity();
+    const double spacing = magnitude < std::numeric_limits<float>::min()
+                               ? std::ldexp(1.0, -149)
+                               : std::nextafter(magnitude, inf) - magnitude;
+    return std::fabs(static_cast<double>(y) - reference) / spacing;
+}
+
+// Largest error of f against reference over every float whose bit pattern is a multiple of
+// stride, about 2^32 / stride inputs of both signs covering every exponent.
+template <typename F, typename R> double maxUlpError(F f, R reference, uint32_t stride) {
+    double worst = 0.0;
+    for (uint64_t pattern = 0; pattern <= UINT32_MAX; pattern += stride) {
+        const uint32_t u = static_cast<uint32_t>(pattern);
+        float x;
+        std::memcpy(&x, &u, sizeof(x));
+        worst = std::max(worst, ulpError(f(x), reference(static_cast<double>(x))));
+    }
+    return worst;
+}
+
+constexpr uint32_t SWEEP_STRIDE = 4099;
+} // namespace
+
+TEST(NNVectorMathTest, ExpAndLogMatchLibm) {
+    EXPECT_LE(maxUlpError([](float x) { return NNVectorMath::exp(x); },
+                          [](double x) { return std::exp(x); }, SWEEP_STRIDE),
+              1.1);
+    EXPECT_LE(maxUlpError([](float x) { return NNVectorMath::log(x); },
+                          [](double x) { return std::log(x); }, SWEEP_STRIDE),
+              1.0);
+}
+
+TEST(NNVectorMathTest, SigmoidAndTanhMatchLibm) {
+    EXPECT_LE(maxUlpError([](float x) { return NNVectorMath::sigmoid(x); },
+                          [](double x) { return 1.0 / (1.0 + std::exp(-x)); }, SWEEP_STRIDE),
+              3.0);
+    EXPECT_LE(maxUlpError([](float x) { return NNVectorMath::tanh(x); },
+                          [](double x) { return std::tanh(x); }, SWEEP_STRIDE),
+              1.5);
+}
+
+TEST(NNVectorMathTest, SpecialValuesFollowLibm) {
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    EXPECT_EQ(1.0f, NNVectorMath::exp(0.0f));
+    EXPECT_EQ(inf, NNVectorMath::exp(inf));
+    EXPECT_EQ(inf, NNVectorMath::exp(89.0f));
+    EXPECT_EQ(0.0f, NNVectorMath::exp(-inf));
+    EXPECT_EQ(0.0f, NNVectorMath::exp(-104.0f));
+    EXPECT_TRUE(std::isnan(NNVectorMath::exp(nan)));
+
+    EXPECT_EQ(0.0f, NNVectorMath::log(1.0f));
+    EXPECT_EQ(-inf, NNVectorMath::log(0.0f));
+    EXPECT_EQ(-inf, NNVectorMath::log(-0.0f));
+    EXPECT_EQ(inf, NNVectorMath::log(inf));
+    EXPECT_TRUE(std::isnan(NNVectorMath::log(-1.0f)));
+    EXPECT_TRUE(std::isnan(NNVectorMath::log(nan)));
+
+    EXPECT_EQ(0.5f, NNVectorMath::sigmoid(0.0f));
+    EXPECT_EQ(1.0f, NNVectorMath::sigmoid(inf));
+    EXPECT_EQ(0.0f, NNVectorMath::sigmoid(-inf));
+    EXPECT_EQ(1.0f, NNVectorMath::tanh(inf));
+    EXPECT_EQ(-1.0f, NNVectorMath::tanh(-inf));
+    EXPECT_TRUE(std::signbit(NNVectorMath::tanh(-0.0f)));
+    EXPECT_TRUE(std::isnan(NNVectorMath::tanh(nan)));
+}
+
+TEST(NNVectorMathTest, ArrayKernelsMatchScalar) {
+    // An odd length, so vectorized loops also run their scalar tail.
+    std::vector<float> x(1001);
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = -30.0f + 60.0f * static_cast<float>(i) / static_cast<float>(x.size());
+    }
+    std::vector<float> y(x.size());
+    NNVectorMath::exp(x.data(), y.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        EXPECT_FLOAT_EQ(NNVectorMath::exp(x[i]), y[i]);
+    }
+    NNVectorMath::sigmoid(x.data(), y.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        EXPECT_FLOAT_EQ(NNVectorMath::sigmoid(x[i]), y[i]);
+    }
+    NNVectorMath::tanh(x.data(), y.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        EXPECT_FLOAT_EQ(NNVectorMath::tanh(x[i]), y[i]);
+    }
+    // In place.
+    std::vector<float> positive(x.size());
+    NNVectorMath::exp(x.data(), positive.data(), x.size());
+    std::vector<float> logs = positive;
+    NNVectorMath::log(logs.data(), logs.data(), logs.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        EXPECT_FLOAT_EQ(NNVectorMath::log(positive[i]), logs[i]);
+    }
+}
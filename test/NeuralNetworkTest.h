@@ -0,0 +1,351 @@
+#pragma once
+
+#include "../include/NNCommunicator.h"
+#include "../include/NeuralNetwork.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static void makeToyDataset(int count, std::vector<NNMatrixPtr>& X, std::vector<NNMatrixPtr>& Y) {
+    for (int i = 0; i < count; i++) {
+        auto x = std::make_shared<NNMatrix>(4, 1);
+        for (int k = 0; k < 4; k++) {
+            x->set(k, 0, static_cast<float>((i * 7 + k * 3) % 5) / 5.0f);
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(i % 3, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+}
+
+static void copyParameters(NeuralNetwork& from, NeuralNetwork& to) {
+    auto& src = from.getParameters();
+    auto& dst = to.getParameters();
+    ASSERT_EQ(src.size(), dst.size());
+    std::copy_n(src.params(), src.size(), dst.params());
+}
+
+TEST(NeuralNetworkTest, GradientAccumulationMatchesFullBatch) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(8, X, Y);
+
+    NeuralNetwork fullBatch({4, 6, 5, 3});
+    NeuralNetwork accumulated({4, 6, 5, 3});
+    copyParameters(fullBatch, accumulated);
+    accumulated.setGradientAccumulation(2);
+
+    // One optimizer step each: a batch of 8, and two micro-batches of 4. Without momentum the
+    // result does not depend on how the epoch was shuffled.
+    fullBatch.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+    accumulated.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+    fullBatch.train(X, Y, X, Y, 1, 8, 0.5f, 0.0f);
+    accumulated.train(X, Y, X, Y, 1, 4, 0.5f, 0.0f);
+
+    auto& a = fullBatch.getParameters();
+    auto& b = accumulated.getParameters();
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_NEAR(a.params()[i], b.params()[i], 1e-5f);
+    }
+}
+
+TEST(NeuralNetworkTest, TrainingReducesLoss) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(30, X, Y);
+
+    NeuralNetwork nn({4, 16, 8, 3});
+    std::vector<float> losses;
+    nn.train(X, Y, X, Y, 30, 5, 0.05f, 0.9f,
+             [&](int, int, float loss, float) { losses.push_back(loss); });
+
+    ASSERT_EQ(30u, losses.size());
+    EXPECT_LT(losses.back(), losses.front());
+}
+
+TEST(NeuralNetworkTest, ReluMasksMatchDerivativePath) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(12, X, Y);
+
+    NeuralNetwork masked({4, 6, 5, 3});
+    NeuralNetwork derived({4, 6, 5, 3});
+    copyParameters(masked, derived);
+    derived.setReluMasks(false);
+    // Re-deriving the ReLU derivative keeps each hidden output alive one step longer.
+    EXPECT_GE(derived.getPeakActivationBytes(12), masked.getPeakActivationBytes(12));
+
+    masked.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+    derived.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+    masked.train(X, Y, X, Y, 1, 12, 0.5f, 0.0f);
+    derived.train(X, Y, X, Y, 1, 12, 0.5f, 0.0f);
+
+    auto& a = masked.getParameters();
+    auto& b = derived.getParameters();
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_NEAR(a.params()[i], b.params()[i], 1e-6f);
+    }
+}
+
+TEST(NeuralNetworkTest, CheckpointingMatchesStoredActivations) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(12, X, Y);
+    const std::vector<int> config = {4, 16, 16, 16, 16, 16, 16, 16, 3};
+
+    for (bool masks : {true, false}) {
+        NeuralNetwork stored(config);
+        NeuralNetwork checkpointed(config);
+        copyParameters(stored, checkpointed);
+        stored.setReluMasks(masks);
+        checkpointed.setReluMasks(masks);
+        checkpointed.setCheckpointInterval(3);
+        EXPECT_LT(checkpointed.getPeakActivationBytes(12), stored.getPeakActivationBytes(12));
+
+        stored.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+        checkpointed.setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+        stored.train(X, Y, X, Y, 1, 12, 0.5f, 0.0f);
+        checkpointed.train(X, Y, X, Y, 1, 12, 0.5f, 0.0f);
+
+        auto& a = stored.getParameters();
+        auto& b = checkpointed.getParameters();
+        for (size_t i = 0; i < a.size(); i++) {
+            ASSERT_NEAR(a.params()[i], b.params()[i], 1e-6f);
+        }
+    }
+}
+
+TEST(NeuralNetworkTest, DropoutMasksAreReproducible) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(12, X, Y);
+    const std::vector<int> config = {4, 16, 16, 16, 16, 3};
+
+    // The same masks come back whether backward gates dz with the ReLU masks or re-derives it,
+    // and when checkpointed layers are recomputed.
+    NeuralNetwork reference(config);
+    NeuralNetwork derived(config);
+    NeuralNetwork checkpointed(config);
+    NeuralNetwork plain(config);
+    for (NeuralNetwork* nn : {&reference, &derived, &checkpointed, &plain}) {
+        if (nn != &reference) {
+            copyParameters(reference, *nn);
+        }
+        if (nn != &plain) {
+            nn->setDropout(0.3f);
+        }
+        nn->setOptimizer(std::make_shared<NNSGDOptimizer>(0.0f));
+    }
+    derived.setReluMasks(false);
+    checkpointed.setCheckpointInterval(2);
+    std::vector<float> accuracies;
+    for (NeuralNetwork* nn : {&reference, &derived, &checkpointed, &plain}) {
+        // train() shuffles in place, every network starts from the same order.
+        std::vector<NNMatrixPtr> x = X;
+        std::vector<NNMatrixPtr> y = Y;
+        nn->train(x, y, x, y, 2, 4, 0.2f, 0.0f,
+                  [&](int, int, float, float accuracy) { accuracies.push_back(accuracy); });
+    }
+
+    auto& a = reference.getParameters();
+    for (NeuralNetwork* nn : {&derived, &checkpointed}) {
+        auto& b = nn->getParameters();
+        for (size_t i = 0; i < a.size(); i++) {
+            ASSERT_NEAR(a.params()[i], b.params()[i], 1e-5f);
+        }
+    }
+    float difference = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        difference += std::abs(a.params()[i] - plain.getParameters().params()[i]);
+    }
+    EXPECT_GT(difference, 1e-3f);
+    // Evaluation runs without dropout, so it is the same for every dropout network.
+    EXPECT_EQ(accuracies[1], accuracies[3]);
+    EXPECT_EQ(accuracies[1], accuracies[5]);
+}
+
+TEST(NeuralNetworkTest, GraphExecutionMatchesLayers) {
+    // Graph batches draw the same dropout masks as the layers.
+    for (float dropout : {0.0f, 0.3f}) {
+        std::vector<NNMatrixPtr> X, Y;
+        makeToyDataset(12, X, Y);
+
+        NeuralNetwork layered({4, 6, 5, 3});
+        NeuralNetwork graphed({4, 6, 5, 3});
+        copyParameters(layered, graphed);
+        graphed.setGraphExecution(true);
+        layered.setDropout(dropout);
+        graphed.setDropout(dropout);
+
+        // train() shuffles in place, both networks start from the same order.
+        std::vector<NNMatrixPtr> graphedX = X;
+        std::vector<NNMatrixPtr> graphedY = Y;
+        std::vector<float> layeredLosses;
+        std::vector<float> graphedLosses;
+        layered.train(X, Y, X, Y, 3, 4, 0.5f, 0.9f,
+                      [&](int, int, float loss, float) { layeredLosses.push_back(loss); });
+        graphed.train(graphedX, graphedY, graphedX, graphedY, 3, 4, 0.5f, 0.9f,
+                      [&](int, int, float loss, float) { graphedLosses.push_back(loss); });
+
+        ASSERT_EQ(layeredLosses.size(), graphedLosses.size());
+        for (size_t e = 0; e < layeredLosses.size(); e++) {
+            ASSERT_NEAR(layeredLosses[e], graphedLosses[e], 1e-5f) << "dropout " << dropout;
+        }
+        auto& a = layered.getParameters();
+        auto& b = graphed.getParameters();
+        for (size_t i = 0; i < a.size(); i++) {
+            ASSERT_NEAR(a.params()[i], b.params()[i], 1e-5f) << "dropout " << dropout;
+        }
+    }
+}
+
+TEST(NeuralNetworkTest, ConvNetworkLearnsBrightQuadrant) {
+    // 6x6 images whose brightest quadrant (of the first three) is the class.
+    std::vector<NNMatrixPtr> X, Y;
+    for (int i = 0; i < 24; i++) {
+        const int label = i % 3;
+        auto x = std::make_shared<NNMatrix>(36, 1);
+        for (int r = 0; r < 6; r++) {
+            for (int c = 0; c < 6; c++) {
+                const int quadrant = (r / 3) * 2 + c / 3;
+                const float noise = static_cast<float>((i * 5 + r * 7 + c * 3) % 4) / 10.0f;
+                x->set(r * 6 + c, 0, (quadrant == label ? 0.6f : 0.0f) + noise);
+            }
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(label, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+
+    NeuralNetwork nn({1, 6, 6}, {{4, 3, 1, 1, 2}}, {36, 8, 3});
+    ASSERT_EQ(1u, nn.convLayers.size());
+    EXPECT_EQ(36, nn.convLayers[0].getOutputSize());
+    std::vector<float> losses;
+    float finalAccuracy = 0.0f;
+    nn.train(X, Y, X, Y, 20, 24, 0.1f, 0.9f, [&](int, int, float loss, float accuracy) {
+        losses.push_back(loss);
+        finalAccuracy = accuracy;
+    });
+    ASSERT_EQ(20u, losses.size());
+    EXPECT_LT(losses.back(), 0.5f * losses.front());
+    EXPECT_GT(finalAccuracy, 0.9f);
+
+    // Inference runs through the same graph.
+    NNMatrix& input = nn.beginInference(1);
+    std::copy_n(X[0]->data(), 36, input.data());
+    EXPECT_EQ(NNUtils::toLabelIndices({Y[0]})[0], nn.runInference().getIndexOfColMax(0));
+}
+
+TEST(NeuralNetworkTest, ExportedConvNetworkRebuildsFromSnapshot) {
+    std::vector<NNMatrixPtr> X, Y;
+    for (int i = 0; i < 12; i++) {
+        auto x = std::make_shared<NNMatrix>(36, 1);
+        for (int k = 0; k < 36; k++) {
+            x->set(k, 0, static_cast<float>((i * 5 + k * 3) % 7) / 7.0f);
+        }
+        auto y = std::make_shared<NNMatrix>(3, 1);
+        y->set(i % 3, 0, 1.0f);
+        X.push_back(x);
+        Y.push_back(y);
+    }
+    NeuralNetwork nn({1, 6, 6}, {{4, 3, 1, 1, 2}}, {36, 8, 3}, NNRandom::globalSeed(), true);
+    nn.train(X, Y, X, Y, 2, 4, 0.05f, 0.9f);
+
+    const auto path = std::filesystem::temp_directory_path() / "nn_conv_export.bin";
+    nn.exportModel(path.string());
+    NNSnapshot snapshot;
+    ASSERT_TRUE(NNSnapshot::read(path.string(), snapshot));
+    EXPECT_EQ(std::vector<int>({1, 6, 6}), snapshot.inputShape);
+    EXPECT_EQ(std::vector<int>({4, 3, 1, 1, 2}), snapshot.convSpecs);
+    EXPECT_EQ(0, snapshot.batchNorm);
+    NeuralNetwork loaded = NeuralNetwork::fromSnapshot(snapshot);
+    ASSERT_TRUE(loaded.resumeFromSnapshot(path.string()));
+    EXPECT_EQ(1u, loaded.convLayers.size());
+    // An MLP of the same sizes is a different network.
+    NeuralNetwork mlp({36, 8, 3});
+    EXPECT_FALSE(mlp.resumeFromSnapshot(path.string()));
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+
+    const int batch = static_cast<int>(X.size());
+    NNUtils::packColumns(X, nn.beginInference(batch));
+    const NNMatrix& expected = nn.runInference();
+    NNUtils::packColumns(X, loaded.beginInference(batch));
+    const NNMatrix& actual = loaded.runInference();
+    for (int c = 0; c < 3; c++) {
+        for (int j = 0; j < batch; j++) {
+            ASSERT_NEAR(expected.get(c, j), actual.get(c, j), 1e-4f);
+        }
+    }
+}
+
+TEST(NeuralNetworkTest, BatchNormFoldsIntoLayers) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(30, X, Y);
+
+    NeuralNetwork nn({}, {}, {4, 16, 8, 3}, NNRandom::globalSeed(), true);
+    std::vector<float> losses;
+    nn.train(X, Y, X, Y, 30, 5, 0.05f, 0.9f,
+             [&](int, int, float loss, float) { losses.push_back(loss); });
+    ASSERT_EQ(30u, losses.size());
+    EXPECT_LT(losses.back(), losses.front());
+
+    // The folded plain layers reproduce the batch norm network's inference logits, also after
+    // a round trip through an exported model.
+    NeuralNetwork folded = nn.foldBatchNorm();
+    EXPECT_FALSE(folded.hasBatchNorm());
+    EXPECT_LT(folded.getParameters().size(), nn.getParameters().size());
+    const auto path = std::filesystem::temp_directory_path() / "nn_batch_norm_export.bin";
+    nn.exportModel(path.string());
+    NeuralNetwork loaded({4, 16, 8, 3});
+    ASSERT_TRUE(loaded.resumeFromSnapshot(path.string()));
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+
+    const int batch = static_cast<int>(X.size());
+    NNUtils::packColumns(X, nn.beginInference(batch));
+    const NNMatrix& expected = nn.runInference();
+    for (NeuralNetwork* plain : {&folded, &loaded}) {
+        NNUtils::packColumns(X, plain->beginInference(batch));
+        const NNMatrix& actual = plain->runInference();
+        for (int c = 0; c < 3; c++) {
+            for (int j = 0; j < batch; j++) {
+                ASSERT_NEAR(expected.get(c, j), actual.get(c, j), 1e-4f);
+            }
+        }
+    }
+}
+
+TEST(NeuralNetworkTest, DataParallelBatchNormAveragesRunningStatistics) {
+    std::vector<NNMatrixPtr> X, Y;
+    makeToyDataset(16, X, Y);
+    const int worldSize = 2;
+    const std::string name = "/nn_batch_norm_" + std::to_string(getpid());
+    std::vector<std::vector<float>> params(worldSize);
+    std::vector<std::thread> threads;
+    for (int rank = 0; rank < worldSize; rank++) {
+        threads.emplace_back([&, rank] {
+            NeuralNetwork nn({}, {}, {4, 8, 3}, NNRandom::globalSeed(), true);
+            nn.setCommunicator(std::make_shared<NNCommunicator>(
+                std::make_unique<NNShmTransport>(rank, worldSize, name)));
+            std::vector<NNMatrixPtr> x = NNUtils::shard(X, rank, worldSize);
+            std::vector<NNMatrixPtr> y = NNUtils::shard(Y, rank, worldSize);
+            nn.train(x, y, x, y, 2, 4, 0.05f, 0.9f);
+            const NNParameterArena& arena = nn.getParameters();
+            params[rank].assign(arena.params(), arena.params() + arena.size());
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    // Gradients keep the weights in sync; the running statistics from different shards only
+    // agree because they are averaged too.
+    ASSERT_EQ(params[0].size(), params[1].size());
+    for (size_t i = 0; i < params[0].size(); i++) {
+        ASSERT_NEAR(params[0][i], params[1][i], 1e-6f) << "parameter " << i;
+    }
+}